@@ -36,6 +36,8 @@ struct acpi_info {
 #endif /* defined(__aarch64__) */
 
     const struct acpi_pptt *pptt;
+    const struct acpi_srat *srat;
+    const struct acpi_slit *slit;
 
     const struct acpi_rsdp *rsdp;
     const struct acpi_rsdt *rsdt;
@@ -19,14 +19,21 @@ void pptt_init(const struct acpi_pptt *const pptt) {
                 struct acpi_pptt_processor_hierarchy_node *const node =
                     (struct acpi_pptt_processor_hierarchy_node *)base;
 
-                offset += sizeof(*node);
-                if (!ordinal_in_bounds(offset, pptt->sdt.length)) {
+                if (node->length < sizeof(*node)
+                 || !ordinal_in_bounds(offset + node->length,
+                                       pptt->sdt.length))
+                {
                     printk(LOGLEVEL_WARN,
                            "pptt: processor-hierarchy node goes beyond end of "
                            "node\n");
                     return;
                 }
 
+                // Nodes are followed by their private resources, so step over
+                // the entire node.
+
+                offset += node->length;
+
                 printk(LOGLEVEL_INFO,
                        "pptt: processor-hierarchy node\n"
                        "\tlength: %" PRIu32 "\n"
@@ -77,13 +84,17 @@ void pptt_init(const struct acpi_pptt *const pptt) {
                 struct acpi_pptt_cache_type_node *const node =
                     (struct acpi_pptt_cache_type_node *)base;
 
-                offset += sizeof(*node);
-                if (!ordinal_in_bounds(offset, pptt->sdt.length)) {
+                if (node->length < sizeof(*node)
+                 || !ordinal_in_bounds(offset + node->length,
+                                       pptt->sdt.length))
+                {
                     printk(LOGLEVEL_WARN,
                            "pptt: cache-type node goes beyond end of node\n");
                     return;
                 }
 
+                offset += node->length;
+
                 const enum acpi_pptt_cache_type_node_attr_alloc_kind
                     alloc_kind =
                         node->attributes &
@@ -202,4 +213,214 @@ void pptt_init(const struct acpi_pptt *const pptt) {
                 base->kind);
         return;
     }
-}
\ No newline at end of file
+}
+
+#define PPTT_MAX_DEPTH 16
+
+// Every kind of node stores its length right after its kind.
+
+__debug_optimize(3) static inline uint8_t
+get_node_length(const struct acpi_pptt_node_base *const base) {
+    return ((const struct acpi_pptt_processor_hierarchy_node *)base)->length;
+}
+
+__debug_optimize(3) static const struct acpi_pptt_processor_hierarchy_node *
+get_hierarchy_node(const struct acpi_pptt *const pptt, const uint32_t offset) {
+    if (offset < offsetof(struct acpi_pptt, buffer)
+     || !ordinal_in_bounds(
+            (uint64_t)offset +
+                sizeof(struct acpi_pptt_processor_hierarchy_node),
+            pptt->sdt.length))
+    {
+        return NULL;
+    }
+
+    const struct acpi_pptt_processor_hierarchy_node *const node =
+        reg_to_ptr(const struct acpi_pptt_processor_hierarchy_node,
+                   pptt,
+                   offset);
+
+    const uint64_t min_length =
+        sizeof(*node) +
+        (uint64_t)node->private_resource_count * sizeof(uint32_t);
+
+    if (node->base.kind != ACPI_PPTT_NODE_PROCESSOR_HIERARCHY
+     || node->length < min_length
+     || !ordinal_in_bounds((uint64_t)offset + node->length, pptt->sdt.length))
+    {
+        return NULL;
+    }
+
+    return node;
+}
+
+__debug_optimize(3) static bool
+has_cache_resource(const struct acpi_pptt *const pptt,
+                   const struct acpi_pptt_processor_hierarchy_node *const node)
+{
+    for (uint32_t i = 0; i != node->private_resource_count; i++) {
+        const uint32_t offset = node->private_resource_offsets[i];
+        if (offset < offsetof(struct acpi_pptt, buffer)
+         || !ordinal_in_bounds(
+                (uint64_t)offset + sizeof(struct acpi_pptt_cache_type_node),
+                pptt->sdt.length))
+        {
+            continue;
+        }
+
+        const struct acpi_pptt_node_base *const base =
+            reg_to_ptr(const struct acpi_pptt_node_base, pptt, offset);
+
+        if (base->kind == ACPI_PPTT_NODE_CACHE_TYPE) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Tables older than revision 2 don't mark their leaf nodes, so a node is
+// also a leaf if no other node points to it as its parent.
+
+static bool
+is_leaf_node(const struct acpi_pptt *const pptt,
+             const struct acpi_pptt_processor_hierarchy_node *const node,
+             const uint32_t node_offset)
+{
+    if (node->flags & __ACPI_PPTT_PROCESSOR_HIERARCHY_NODE_IS_LEAF) {
+        return true;
+    }
+
+    uint32_t offset = offsetof(struct acpi_pptt, buffer);
+    while (ordinal_in_bounds((uint64_t)offset + 2, pptt->sdt.length)) {
+        const struct acpi_pptt_node_base *const base =
+            reg_to_ptr(const struct acpi_pptt_node_base, pptt, offset);
+
+        const uint8_t length = get_node_length(base);
+        if (length == 0) {
+            break;
+        }
+
+        const struct acpi_pptt_processor_hierarchy_node *const child =
+            get_hierarchy_node(pptt, offset);
+
+        if (child != NULL && child->parent_offset == node_offset) {
+            return false;
+        }
+
+        offset += length;
+    }
+
+    return true;
+}
+
+static const struct acpi_pptt_processor_hierarchy_node *
+find_leaf_node(const struct acpi_pptt *const pptt,
+               const uint32_t acpi_processor_id,
+               uint32_t *const offset_out)
+{
+    uint32_t offset = offsetof(struct acpi_pptt, buffer);
+    while (ordinal_in_bounds((uint64_t)offset + 2, pptt->sdt.length)) {
+        const struct acpi_pptt_node_base *const base =
+            reg_to_ptr(const struct acpi_pptt_node_base, pptt, offset);
+
+        const uint8_t length = get_node_length(base);
+        if (length == 0) {
+            break;
+        }
+
+        const struct acpi_pptt_processor_hierarchy_node *const node =
+            get_hierarchy_node(pptt, offset);
+
+        if (node != NULL
+         && (node->flags & __ACPI_PPTT_PROCESSOR_HIERARCHY_ACPI_ID_VALID)
+         && node->acpi_processor_id == acpi_processor_id
+         && is_leaf_node(pptt, node, offset))
+        {
+            *offset_out = offset;
+            return node;
+        }
+
+        offset += length;
+    }
+
+    return NULL;
+}
+
+bool
+pptt_get_cpu_topology(const struct acpi_pptt *const pptt,
+                      const uint32_t acpi_processor_id,
+                      struct cpu_topology *const topology_out)
+{
+    uint32_t leaf_offset = 0;
+    const struct acpi_pptt_processor_hierarchy_node *const leaf =
+        find_leaf_node(pptt, acpi_processor_id, &leaf_offset);
+
+    if (leaf == NULL) {
+        return false;
+    }
+
+    // A thread's core is its parent node, otherwise the leaf is the core.
+    const struct acpi_pptt_processor_hierarchy_node *core = leaf;
+    uint32_t core_offset = leaf_offset;
+
+    if (leaf->flags & __ACPI_PPTT_PROCESSOR_HIERARCHY_PROCESSOR_IS_THREAD) {
+        const struct acpi_pptt_processor_hierarchy_node *const parent =
+            get_hierarchy_node(pptt, leaf->parent_offset);
+
+        if (parent != NULL) {
+            core = parent;
+            core_offset = leaf->parent_offset;
+        }
+    }
+
+    // The package is the closest ancestor marked as a physical package, or the
+    // root if none are. Caches listed as a node's private resources are shared
+    // by every processor below that node, so the llc belongs to the furthest
+    // node with any cache.
+
+    const struct acpi_pptt_processor_hierarchy_node *iter = leaf;
+    uint32_t iter_offset = leaf_offset;
+
+    uint32_t llc_offset = 0;
+    bool found_llc = false;
+
+    for (uint32_t depth = 0; depth != PPTT_MAX_DEPTH; depth++) {
+        if (has_cache_resource(pptt, iter)) {
+            llc_offset = iter_offset;
+            found_llc = true;
+        }
+
+        if (iter->flags & __ACPI_PPTT_PROCESSOR_HIERARCHY_NODE_PHYSICAL_PKG) {
+            break;
+        }
+
+        const uint32_t parent_offset = iter->parent_offset;
+        const struct acpi_pptt_processor_hierarchy_node *const parent =
+            get_hierarchy_node(pptt, parent_offset);
+
+        if (parent == NULL) {
+            break;
+        }
+
+        iter = parent;
+        iter_offset = parent_offset;
+    }
+
+    const uint32_t package_offset = iter_offset;
+    uint32_t cluster_offset = core_offset;
+
+    if (core_offset != package_offset
+     && get_hierarchy_node(pptt, core->parent_offset) != NULL)
+    {
+        cluster_offset = core->parent_offset;
+    }
+
+    topology_out->package_id = package_offset;
+    topology_out->cluster_id = cluster_offset;
+    topology_out->core_id = core_offset;
+    topology_out->thread_id = leaf_offset;
+    topology_out->llc_id = found_llc ? llc_offset : cluster_offset;
+
+    return true;
+}
@@ -4,6 +4,17 @@
  */
 
 #pragma once
+
+#include "cpu/topology.h"
 #include "structs.h"
 
 void pptt_init(const struct acpi_pptt *pptt);
+
+// Fill `topology_out` with the ids of the nodes the processor with
+// `acpi_processor_id` belongs to. Each id is the offset of its node in the
+// pptt.
+
+bool
+pptt_get_cpu_topology(const struct acpi_pptt *pptt,
+                      uint32_t acpi_processor_id,
+                      struct cpu_topology *topology_out);
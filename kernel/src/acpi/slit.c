@@ -0,0 +1,42 @@
+/*
+ * kernel/src/acpi/slit.c
+ * © suhas pai
+ */
+
+#include "dev/printk.h"
+#include "mm/numa.h"
+
+#include "slit.h"
+
+// Localities are proximity-domains, but only those the srat gave a node are
+// used here.
+
+void slit_init(const struct acpi_slit *const slit) {
+    const uint64_t count = slit->locality_count;
+    const uint64_t length = slit->sdt.length - sizeof(*slit);
+
+    if (count > UINT32_MAX || count * count > length) {
+        printk(LOGLEVEL_WARN,
+               "slit: locality-count of %" PRIu64 " is too large\n",
+               count);
+        return;
+    }
+
+    for (uint32_t from = 0; from != count; from++) {
+        const numa_node_t from_node = numa_node_for_domain(from);
+        if (from_node == NUMA_NO_NODE) {
+            continue;
+        }
+
+        for (uint32_t to = 0; to != count; to++) {
+            const numa_node_t to_node = numa_node_for_domain(to);
+            if (to_node == NUMA_NO_NODE) {
+                continue;
+            }
+
+            numa_set_distance(from_node,
+                              to_node,
+                              slit->entries[from * count + to]);
+        }
+    }
+}
@@ -0,0 +1,12 @@
+/*
+ * kernel/src/acpi/slit.h
+ * © suhas pai
+ */
+
+#pragma once
+#include "structs.h"
+
+// Must be called after srat_init(), as the slit is indexed by the
+// proximity-domains found in the srat.
+
+void slit_init(const struct acpi_slit *slit);
@@ -0,0 +1,146 @@
+/*
+ * kernel/src/acpi/srat.c
+ * © suhas pai
+ */
+
+#include "dev/printk.h"
+#include "mm/numa.h"
+
+#include "srat.h"
+
+static void
+parse_memory_affinity(const struct acpi_srat_memory_affinity *const entry) {
+    if ((entry->flags & __ACPI_SRAT_MEMORY_AFFINITY_ENABLED) == 0) {
+        return;
+    }
+
+    const uint64_t base = (uint64_t)entry->base_high << 32 | entry->base_low;
+    const uint64_t length =
+        (uint64_t)entry->length_high << 32 | entry->length_low;
+
+    struct range range = RANGE_EMPTY();
+    if (!range_create_and_verify(base, length, &range)) {
+        printk(LOGLEVEL_WARN,
+               "srat: memory-affinity entry has an invalid range, base: "
+               "0x%" PRIx64 ", length: 0x%" PRIx64 "\n",
+               base,
+               length);
+        return;
+    }
+
+    const numa_node_t node = numa_add_domain(entry->proximity_domain);
+    if (node == NUMA_NO_NODE) {
+        return;
+    }
+
+    numa_add_mem_range(node, range);
+}
+
+void srat_init(const struct acpi_srat *const srat) {
+    const struct acpi_srat_entry_header *iter = NULL;
+    const uint32_t length = srat->sdt.length - sizeof(*srat);
+
+    for (uint32_t offset = 0, index = 0;
+         offset + sizeof(struct acpi_srat_entry_header) <= length;
+         offset += iter->length, index++)
+    {
+        iter = (const struct acpi_srat_entry_header *)&srat->entries[offset];
+        if (iter->length < sizeof(struct acpi_srat_entry_header)
+         || offset + iter->length > length)
+        {
+            printk(LOGLEVEL_WARN,
+                   "srat: entry at index %" PRIu32 " has an invalid length\n",
+                   index);
+            return;
+        }
+
+        switch (iter->kind) {
+            case ACPI_SRAT_ENTRY_KIND_CPU_LAPIC_AFFINITY: {
+                if (iter->length
+                        != sizeof(struct acpi_srat_cpu_lapic_affinity))
+                {
+                    break;
+                }
+
+                const struct acpi_srat_cpu_lapic_affinity *const entry =
+                    (const struct acpi_srat_cpu_lapic_affinity *)iter;
+
+                if ((entry->flags & __ACPI_SRAT_CPU_AFFINITY_ENABLED) == 0) {
+                    break;
+                }
+
+                const uint32_t domain =
+                    entry->proximity_domain_low
+                  | (uint32_t)entry->proximity_domain_high[0] << 8
+                  | (uint32_t)entry->proximity_domain_high[1] << 16
+                  | (uint32_t)entry->proximity_domain_high[2] << 24;
+
+                const numa_node_t node = numa_add_domain(domain);
+                if (node != NUMA_NO_NODE) {
+                    numa_add_cpu(NUMA_CPU_ID_APIC, entry->apic_id, node);
+                }
+
+                break;
+            }
+            case ACPI_SRAT_ENTRY_KIND_MEMORY_AFFINITY:
+                if (iter->length != sizeof(struct acpi_srat_memory_affinity)) {
+                    break;
+                }
+
+                parse_memory_affinity(
+                    (const struct acpi_srat_memory_affinity *)iter);
+                break;
+            case ACPI_SRAT_ENTRY_KIND_CPU_X2APIC_AFFINITY: {
+                if (iter->length
+                        != sizeof(struct acpi_srat_cpu_x2apic_affinity))
+                {
+                    break;
+                }
+
+                const struct acpi_srat_cpu_x2apic_affinity *const entry =
+                    (const struct acpi_srat_cpu_x2apic_affinity *)iter;
+
+                if ((entry->flags & __ACPI_SRAT_CPU_AFFINITY_ENABLED) == 0) {
+                    break;
+                }
+
+                const numa_node_t node =
+                    numa_add_domain(entry->proximity_domain);
+
+                if (node != NUMA_NO_NODE) {
+                    numa_add_cpu(NUMA_CPU_ID_APIC, entry->x2apic_id, node);
+                }
+
+                break;
+            }
+            case ACPI_SRAT_ENTRY_KIND_GICC_AFFINITY: {
+                if (iter->length != sizeof(struct acpi_srat_gicc_affinity)) {
+                    break;
+                }
+
+                const struct acpi_srat_gicc_affinity *const entry =
+                    (const struct acpi_srat_gicc_affinity *)iter;
+
+                if ((entry->flags & __ACPI_SRAT_CPU_AFFINITY_ENABLED) == 0) {
+                    break;
+                }
+
+                const numa_node_t node =
+                    numa_add_domain(entry->proximity_domain);
+
+                if (node != NUMA_NO_NODE) {
+                    numa_add_cpu(NUMA_CPU_ID_ACPI_UID,
+                                 entry->acpi_proc_uid,
+                                 node);
+                }
+
+                break;
+            }
+            case ACPI_SRAT_ENTRY_KIND_GIC_ITS_AFFINITY:
+            case ACPI_SRAT_ENTRY_KIND_GENERIC_INITIATOR_AFFINITY:
+            case ACPI_SRAT_ENTRY_KIND_GENERIC_PORT_AFFINITY:
+            case ACPI_SRAT_ENTRY_KIND_RINTC_AFFINITY:
+                break;
+        }
+    }
+}
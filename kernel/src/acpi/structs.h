@@ -1040,3 +1040,97 @@ struct acpi_spcr {
 
     uint32_t uart_clock_freq;
 } __packed;
+
+enum acpi_srat_entry_kind {
+    ACPI_SRAT_ENTRY_KIND_CPU_LAPIC_AFFINITY,
+    ACPI_SRAT_ENTRY_KIND_MEMORY_AFFINITY,
+    ACPI_SRAT_ENTRY_KIND_CPU_X2APIC_AFFINITY,
+    ACPI_SRAT_ENTRY_KIND_GICC_AFFINITY,
+    ACPI_SRAT_ENTRY_KIND_GIC_ITS_AFFINITY,
+    ACPI_SRAT_ENTRY_KIND_GENERIC_INITIATOR_AFFINITY,
+    ACPI_SRAT_ENTRY_KIND_GENERIC_PORT_AFFINITY,
+    ACPI_SRAT_ENTRY_KIND_RINTC_AFFINITY,
+};
+
+struct acpi_srat_entry_header {
+    enum acpi_srat_entry_kind kind : 8;
+    uint8_t length;
+} __packed;
+
+enum acpi_srat_cpu_affinity_flags {
+    __ACPI_SRAT_CPU_AFFINITY_ENABLED = 1 << 0,
+};
+
+struct acpi_srat_cpu_lapic_affinity {
+    struct acpi_srat_entry_header header;
+
+    uint8_t proximity_domain_low;
+    uint8_t apic_id;
+    uint32_t flags;
+    uint8_t local_sapic_eid;
+
+    // Bits 8 to 31 of the proximity-domain.
+    uint8_t proximity_domain_high[3];
+    uint32_t clock_domain;
+} __packed;
+
+enum acpi_srat_memory_affinity_flags {
+    __ACPI_SRAT_MEMORY_AFFINITY_ENABLED = 1 << 0,
+    __ACPI_SRAT_MEMORY_AFFINITY_HOT_PLUGGABLE = 1 << 1,
+    __ACPI_SRAT_MEMORY_AFFINITY_NON_VOLATILE = 1 << 2,
+};
+
+struct acpi_srat_memory_affinity {
+    struct acpi_srat_entry_header header;
+
+    uint32_t proximity_domain;
+    uint16_t reserved;
+
+    uint32_t base_low;
+    uint32_t base_high;
+    uint32_t length_low;
+    uint32_t length_high;
+
+    uint32_t reserved_2;
+    uint32_t flags;
+    uint64_t reserved_3;
+} __packed;
+
+struct acpi_srat_cpu_x2apic_affinity {
+    struct acpi_srat_entry_header header;
+
+    uint16_t reserved;
+    uint32_t proximity_domain;
+    uint32_t x2apic_id;
+    uint32_t flags;
+    uint32_t clock_domain;
+    uint32_t reserved_2;
+} __packed;
+
+struct acpi_srat_gicc_affinity {
+    struct acpi_srat_entry_header header;
+
+    uint32_t proximity_domain;
+    uint32_t acpi_proc_uid;
+    uint32_t flags;
+    uint32_t clock_domain;
+} __packed;
+
+struct acpi_srat {
+    struct acpi_sdt sdt;
+
+    uint32_t reserved;
+    uint64_t reserved_2;
+
+    char entries[];
+} __packed;
+
+struct acpi_slit {
+    struct acpi_sdt sdt;
+    uint64_t locality_count;
+
+    // Matrix of locality_count * locality_count distances, where the distance
+    // from locality i to j is at [i * locality_count + j].
+
+    uint8_t entries[];
+} __packed;
@@ -0,0 +1,39 @@
+/*
+ * kernel/src/arch/aarch64/asm/static_key.c
+ * © suhas pai
+ */
+
+#include "cpu/static_key.h"
+#include "lib/assert.h"
+
+void
+arch_static_key_patch(const struct static_key_entry *const entry,
+                      const bool enabled)
+{
+    volatile uint32_t *const code = (volatile uint32_t *)entry->code;
+    uint32_t insn = STATIC_KEY_AARCH64_NOP;
+
+    if (enabled) {
+        const int64_t offset = (int64_t)(entry->target - entry->code);
+        assert_msg(offset >= -(1ll << 27) && offset < (1ll << 27),
+                   "static-key: site at %p is too far from its target",
+                   (void *)entry->code);
+
+        insn =
+            STATIC_KEY_AARCH64_B_OPCODE
+          | ((uint32_t)(offset >> 2) & STATIC_KEY_AARCH64_B_IMM_MASK);
+    }
+
+    *code = insn;
+
+    // The new instruction has to be cleaned to the point of unification before
+    // the stale copy in the instruction cache is invalidated.
+
+    asm volatile ("dc cvau, %0\n\t"
+                  "dsb ish\n\t"
+                  "ic ivau, %0\n\t"
+                  "dsb ish\n\t"
+                  "isb"
+                  :: "r"(code)
+                  : "memory");
+}
@@ -0,0 +1,33 @@
+/*
+ * kernel/src/arch/aarch64/asm/static_key.h
+ * © suhas pai
+ */
+
+#pragma once
+
+// A site starts as a nop, which is patched into a `b` to the site's l_yes label
+// once the key is enabled.
+//
+// This is a macro instead of an inline function so `key` is always a constant
+// expression, even in builds without optimizations.
+
+#define STATIC_KEY_AARCH64_NOP 0xd503201f
+#define STATIC_KEY_AARCH64_B_OPCODE 0x14000000
+#define STATIC_KEY_AARCH64_B_IMM_MASK 0x3ffffff
+
+#define arch_static_key_enabled(key) \
+    ({ \
+        __label__ l_yes, l_done; \
+        bool h_var(result) = false; \
+        asm goto ("1: nop\n\t" \
+                  ".pushsection .static_keys, \"aw\"\n\t" \
+                  ".balign 8\n\t" \
+                  ".quad 1b, %l[l_yes], %c0\n\t" \
+                  ".popsection" \
+                  :: "i"(key) :: l_yes); \
+        goto l_done; \
+    l_yes: \
+        h_var(result) = true; \
+    l_done: \
+        h_var(result); \
+    })
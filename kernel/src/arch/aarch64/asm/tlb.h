@@ -0,0 +1,52 @@
+/*
+ * kernel/src/arch/aarch64/asm/tlb.h
+ * © suhas pai
+ */
+
+#pragma once
+#include <stdint.h>
+#include "lib/macros.h"
+
+// The address operand of tlbi holds bits 55:12 of the virtual address, no
+// matter the translation granule, and the asid in its top 16 bits.
+
+#define TLBI_VA_SHIFT 12
+#define TLBI_ASID_SHIFT 48
+
+__debug_optimize(3) static inline uint64_t
+tlbi_operand(const uint64_t addr, const uint16_t asid) {
+    return (uint64_t)asid << TLBI_ASID_SHIFT
+         | (addr >> TLBI_VA_SHIFT & mask_for_n_bits(44));
+}
+
+// Invalidate the translation of `addr` for every asid, on every cpu in the
+// inner-shareable domain.
+
+__debug_optimize(3) static inline void tlbi_vaae1is(const uint64_t addr) {
+    asm volatile ("tlbi vaae1is, %0" :: "r"(tlbi_operand(addr, 0)) : "memory");
+}
+
+__debug_optimize(3) static inline void tlbi_vaae1(const uint64_t addr) {
+    asm volatile ("tlbi vaae1, %0" :: "r"(tlbi_operand(addr, 0)) : "memory");
+}
+
+// Invalidate the non-global translation of `addr` for `asid` on this cpu.
+__debug_optimize(3)
+static inline void tlbi_vae1(const uint64_t addr, const uint16_t asid) {
+    asm volatile ("tlbi vae1, %0" :: "r"(tlbi_operand(addr, asid)) : "memory");
+}
+
+// Invalidate every non-global translation of `asid` on this cpu.
+__debug_optimize(3) static inline void tlbi_aside1(const uint16_t asid) {
+    asm volatile ("tlbi aside1, %0"
+                  :: "r"((uint64_t)asid << TLBI_ASID_SHIFT)
+                  : "memory");
+}
+
+__debug_optimize(3) static inline void tlbi_vmalle1is() {
+    asm volatile ("tlbi vmalle1is" ::: "memory");
+}
+
+__debug_optimize(3) static inline void tlbi_vmalle1() {
+    asm volatile ("tlbi vmalle1" ::: "memory");
+}
@@ -6,6 +6,9 @@
 #pragma once
 #include "lib/macros.h"
 
+// The asid of the address space, used for TTBR0_EL1 unless TCR_EL1.A1 is set.
+#define TTBR_ASID_SHIFT 48
+
 __debug_optimize(3) static inline uint64_t read_ttbr0_el1() {
     uint64_t value = 0;
     asm volatile ("mrs %0, ttbr0_el1" : "=r" (value));
@@ -1398,11 +1398,14 @@ __debug_optimize(3) void cpu_early_init() {
 #define KERNEL_IRQ_STACK_ORDER 2
 
 void cpu_init_for_smp(struct cpu_info *const cpu) {
-    // cpu->mpidr is already set in cpu_add().
+    // cpu->mpidr is already set in cpu_add(), and cpu->numa_node in
+    // numa_init_cpus().
+
     cpu->irq_stack =
-        alloc_pages(PAGE_STATE_KERNEL_STACK,
-                    __ALLOC_ZERO,
-                    KERNEL_IRQ_STACK_ORDER);
+        alloc_pages_on_node(cpu->numa_node,
+                            PAGE_STATE_KERNEL_STACK,
+                            __ALLOC_ZERO,
+                            KERNEL_IRQ_STACK_ORDER);
 
     assert_msg(cpu->irq_stack != NULL, "smp: failed to alloc irq stack");
 
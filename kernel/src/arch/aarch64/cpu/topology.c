@@ -0,0 +1,45 @@
+/*
+ * kernel/src/arch/aarch64/cpu/topology.c
+ * © suhas pai
+ */
+
+#include "cpu/info.h"
+
+// The MT bit of mpidr is set when the lowest affinity level holds the threads
+// of a core, rather than the cores themselves.
+
+#define MPIDR_MT (1ull << 24)
+#define MPIDR_AFFINITY_MASK 0xFF00FFFFFFull
+
+__debug_optimize(3) bool
+cpu_get_acpi_processor_id(const struct cpu_info *const cpu,
+                          uint32_t *const id_out)
+{
+    *id_out = cpu->processor_id;
+    return true;
+}
+
+__debug_optimize(3)
+uint64_t cpu_get_dtb_reg(const struct cpu_info *const cpu) {
+    return cpu->mpidr & MPIDR_AFFINITY_MASK;
+}
+
+// Without a pptt or cpu-map, the affinity levels of mpidr are the best guess
+// we have. Clusters are assumed to share the llc.
+
+bool
+arch_get_cpu_topology(const struct cpu_info *const cpu,
+                      struct cpu_topology *const topology_out)
+{
+    // cpu->affinity holds aff3 to aff0 as one 32-bit value.
+    const uint32_t affinity = (uint32_t)cpu->affinity;
+    const uint32_t core_id = (cpu->mpidr & MPIDR_MT) ? affinity >> 8 : affinity;
+
+    topology_out->package_id = core_id >> 16;
+    topology_out->cluster_id = core_id >> 8;
+    topology_out->core_id = core_id;
+    topology_out->thread_id = affinity;
+    topology_out->llc_id = core_id >> 8;
+
+    return true;
+}
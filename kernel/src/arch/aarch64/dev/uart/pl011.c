@@ -183,6 +183,7 @@ pl011_init(const port_t base,
     info->device = device;
     info->term.emit_ch = pl011_send_char,
     info->term.emit_sv = pl011_send_sv,
+    info->term.bust_locks = NULL;
 
     printk_add_terminal(&info->term);
 }
\ No newline at end of file
@@ -15,6 +15,7 @@
 
 #include "mm/early.h"
 #include "mm/init.h"
+#include "mm/shootdown.h"
 
 #include "sched/scheduler.h"
 
@@ -66,6 +67,8 @@ __debug_optimize(3) void arch_init_for_smp(struct limine_smp_info *const info) {
     gic_init_on_this_cpu();
     arch_init_time();
 
+    tlb_shootdown_init_on_cpu();
+
     atomic_store_explicit(&boot_info->booted, true, memory_order_seq_cst);
 
     // On cpu init, we point current-thread to the idle-thread, so we have to
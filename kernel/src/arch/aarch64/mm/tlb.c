@@ -0,0 +1,81 @@
+/*
+ * kernel/src/arch/aarch64/mm/tlb.c
+ * © suhas pai
+ */
+
+#include "asm/tcr.h"
+#include "asm/tlb.h"
+#include "asm/ttbr.h"
+
+#include "mm/mm_types.h"
+#include "tlb.h"
+
+__debug_optimize(3) static inline uint16_t current_asid() {
+    uint64_t ttbr0 = 0;
+    asm volatile ("mrs %0, ttbr0_el1" : "=r"(ttbr0));
+
+    return (uint16_t)(ttbr0 >> TTBR_ASID_SHIFT);
+}
+
+__debug_optimize(3)
+void tlb_flush_local(const struct tlb_flush_batch *const batch) {
+    // Make sure the page-table updates are visible to the walker before the
+    // invalidation.
+
+    asm volatile ("dsb nshst" ::: "memory");
+    if (batch->full) {
+        if (batch->global) {
+            tlbi_vmalle1();
+        } else {
+            tlbi_aside1(current_asid());
+        }
+    } else {
+        const uint16_t asid = current_asid();
+        for (uint8_t i = 0; i != batch->range_count; i++) {
+            range_iterate(batch->range_list[i], addr, PAGE_SIZE) {
+                if (batch->global) {
+                    tlbi_vaae1(addr);
+                } else {
+                    tlbi_vae1(addr, asid);
+                }
+            }
+        }
+    }
+
+    asm volatile ("dsb nsh; isb" ::: "memory");
+}
+
+__debug_optimize(3)
+void tlb_flush_broadcast(const struct tlb_flush_batch *const batch) {
+    asm volatile ("dsb ishst" ::: "memory");
+    if (batch->full) {
+        tlbi_vmalle1is();
+    } else {
+        for (uint8_t i = 0; i != batch->range_count; i++) {
+            range_iterate(batch->range_list[i], addr, PAGE_SIZE) {
+                tlbi_vaae1is(addr);
+            }
+        }
+    }
+
+    // Wait for every cpu to finish the invalidation.
+    asm volatile ("dsb ish; isb" ::: "memory");
+}
+
+__debug_optimize(3) void tlb_flush_asid(const uint16_t asid) {
+    asm volatile ("dsb nshst" ::: "memory");
+    tlbi_aside1(asid);
+    asm volatile ("dsb nsh; isb" ::: "memory");
+}
+
+__debug_optimize(3) uint16_t tlb_get_max_asid() {
+    // The asid is taken from TTBR1_EL1 when TCR_EL1.A1 is set, which we don't
+    // support.
+
+    const uint64_t tcr = read_tcr_el1();
+    if (tcr & __TCR_ASID_DEFINED_BY_EL1) {
+        return 0;
+    }
+
+    return (tcr & __TCR_AS) ? UINT16_MAX : UINT8_MAX;
+}
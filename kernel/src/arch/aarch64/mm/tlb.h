@@ -0,0 +1,18 @@
+/*
+ * kernel/src/arch/aarch64/mm/tlb.h
+ * © suhas pai
+ */
+
+#pragma once
+#include "mm/shootdown.h"
+
+// Flushes non-global batches out of the current asid only.
+void tlb_flush_local(const struct tlb_flush_batch *batch);
+
+// Broadcast tlbi instructions reach every cpu in the inner-shareable domain, so
+// no ipis are needed. As asids are handed out per-cpu, these flush every asid.
+
+void tlb_flush_broadcast(const struct tlb_flush_batch *batch);
+
+void tlb_flush_asid(uint16_t asid);
+uint16_t tlb_get_max_asid();
@@ -40,12 +40,32 @@ __debug_optimize(3) void gicd_unmask_irq(const irq_number_t irq) {
 }
 
 __debug_optimize(3) isr_vector_t
-gicd_alloc_msi_vector(struct device *const device, const uint16_t msi_index) {
+gicd_alloc_msi_vector(struct device *const device,
+                      const uint16_t msi_index,
+                      const struct cpu_info *const cpu)
+{
     switch (g_version) {
         case 2:
             return gicdv2_alloc_msi_vector();
         case 3:
-            return gicdv3_alloc_msi_vector(device, msi_index);
+            return gicdv3_alloc_msi_vector(device, msi_index, cpu);
+    }
+
+    verify_not_reached();
+}
+
+__debug_optimize(3) bool
+gicd_move_msi_vector(struct device *const device,
+                     const uint16_t msi_index,
+                     const struct cpu_info *const cpu)
+{
+    switch (g_version) {
+        case 2:
+            // Msi vectors on gicv2 are spis from a v2m frame, which aren't
+            // moved yet.
+            return false;
+        case 3:
+            return gicdv3_move_msi_vector(device, msi_index, cpu);
     }
 
     verify_not_reached();
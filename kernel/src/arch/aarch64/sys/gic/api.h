@@ -37,7 +37,14 @@ void gicd_mask_irq(irq_number_t irq);
 void gicd_unmask_irq(irq_number_t irq);
 
 isr_vector_t
-gicd_alloc_msi_vector(struct device *device, const uint16_t msi_index);
+gicd_alloc_msi_vector(struct device *device,
+                      const uint16_t msi_index,
+                      const struct cpu_info *cpu);
+
+bool
+gicd_move_msi_vector(struct device *device,
+                     uint16_t msi_index,
+                     const struct cpu_info *cpu);
 
 void
 gicd_free_msi_vector(struct device *device,
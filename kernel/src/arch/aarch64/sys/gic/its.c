@@ -209,17 +209,16 @@ void send_command(struct gic_its_cmd_queue_entry *const command) {
 }
 
 static bool
-fill_out_collection_table(struct gic_its_info *const its, const uint16_t icid) {
+fill_out_collection_table(struct gic_its_info *const its,
+                          const struct cpu_info *const cpu)
+{
     struct gic_its_collection_table_entry *const entry =
         its->int_collection_table
-      + (its->int_collection_table_entry_count * icid);
+      + (its->int_collection_table_entry_count * cpu->icid);
 
-    with_preempt_disabled({
-        entry->flags =
-            this_cpu()->processor_id
-                << GIC_ITS_COLLECTION_TABLE_ENTRY_RDBASE_SHIFT
-          | __GIC_ITS_COLLECTION_TABLE_ENTRY_VALID;
-    });
+    entry->flags =
+        cpu->processor_id << GIC_ITS_COLLECTION_TABLE_ENTRY_RDBASE_SHIFT
+      | __GIC_ITS_COLLECTION_TABLE_ENTRY_VALID;
 
     return true;
 }
@@ -268,6 +267,35 @@ fill_out_device_table(struct gic_its_info *const its,
     return true;
 }
 
+// Point the interrupt-translation entry of msi-vector `msi_index` of `device`
+// at the collection of `cpu`.
+
+static bool
+set_msi_intr_collection(struct gic_its_info *const its,
+                        struct device *const device,
+                        const uint16_t msi_index,
+                        const struct cpu_info *const cpu)
+{
+    const uint16_t id = device_get_id(device);
+    struct gic_its_device_table_entry *const entry =
+        its->device_table + (its->device_table_entry_size * id);
+
+    if ((entry->flags & __GIC_ITS_DEVICE_TABLE_ENTRY_VALID) == 0) {
+        return false;
+    }
+
+    const uint64_t phys =
+        ((entry->flags & __GIC_ITS_DEVICE_TABLE_ENTRY_PHYS_ADDR) >> 6)
+            << GIC_ITS_DEVICE_TABLE_ENTRY_PHYS_ADDR_SHIFT;
+
+    struct gic_its_intr_table_entry *const itt = phys_to_virt(phys);
+    itt[msi_index].flags =
+        rm_mask(itt[msi_index].flags, __GIC_ITS_INTR_TABLE_ENTRY_ICID)
+      | (uint64_t)cpu->icid << GIC_ITS_INTR_TABLE_ICID_SHIFT;
+
+    return fill_out_collection_table(its, cpu);
+}
+
 static bool
 disable_msi_intr(struct gic_its_info *const its,
                  struct device *const device,
@@ -294,30 +322,31 @@ disable_msi_intr(struct gic_its_info *const its,
 __debug_optimize(3) isr_vector_t
 gic_its_alloc_msi_vector(struct gic_its_info *const its,
                          struct device *const device,
-                         const uint16_t msi_index)
+                         const uint16_t msi_index,
+                         const struct cpu_info *cpu)
 {
-    uint16_t icid = 0;
     uint64_t vector = 0;
-
     with_interrupts_disabled({
         with_spinlock_acquired(&its->bitset_lock, {
             vector =
                 bitset_find_unset(its->bitset, /*length=*/1, /*invert=*/true);
         });
 
-        icid = this_cpu()->icid;
+        if (cpu == NULL) {
+            cpu = this_cpu();
+        }
     });
 
     if (vector == BITSET_INVALID) {
         return ISR_INVALID_VECTOR;
     }
 
-    if (!fill_out_device_table(its, device, icid, vector, msi_index)) {
+    if (!fill_out_device_table(its, device, cpu->icid, vector, msi_index)) {
         bitset_unset(its->bitset, vector);
         return ISR_INVALID_VECTOR;
     }
 
-    if (!fill_out_collection_table(its, icid)) {
+    if (!fill_out_collection_table(its, cpu)) {
         bitset_unset(its->bitset, vector);
         return ISR_INVALID_VECTOR;
     }
@@ -332,6 +361,24 @@ gic_its_alloc_msi_vector(struct gic_its_info *const its,
     return vector;
 }
 
+// The lpi keeps its number, only its collection changes. The MOVI and INV
+// commands that make the its pick up the change still have to be sent once
+// send_command() is implemented.
+
+__debug_optimize(3) bool
+gic_its_move_msi_vector(struct gic_its_info *const its,
+                        struct device *const device,
+                        const uint16_t msi_index,
+                        const struct cpu_info *const cpu)
+{
+    bool result = false;
+    with_spinlock_irq_disabled(&its->bitset_lock, {
+        result = set_msi_intr_collection(its, device, msi_index, cpu);
+    });
+
+    return result;
+}
+
 __debug_optimize(3) void
 gic_its_free_msi_vector(struct gic_its_info *const its,
                         struct device *const device,
@@ -8,6 +8,7 @@
 #include "dev/dtb/node.h"
 #include "dev/dtb/tree.h"
 
+#include "cpu/info.h"
 #include "cpu/spinlock.h"
 #include "dev/device.h"
 
@@ -45,10 +46,19 @@ gic_its_init_from_dtb(const struct devicetree *tree,
 struct gic_its_info *gic_its_init_from_info(uint32_t id, uint64_t phys_addr);
 struct list *gic_its_get_list();
 
+// If `cpu` is NULL, the vector targets the current cpu.
+
 isr_vector_t
 gic_its_alloc_msi_vector(struct gic_its_info *its,
                          struct device *device,
-                         const uint16_t msi_index);
+                         const uint16_t msi_index,
+                         const struct cpu_info *cpu);
+
+bool
+gic_its_move_msi_vector(struct gic_its_info *its,
+                        struct device *device,
+                        uint16_t msi_index,
+                        const struct cpu_info *cpu);
 
 void
 gic_its_free_msi_vector(struct gic_its_info *its,
@@ -206,11 +206,14 @@ __debug_optimize(3) void gicdv3_unmask_irq(const irq_number_t irq) {
 }
 
 __debug_optimize(3) isr_vector_t
-gicdv3_alloc_msi_vector(struct device *const device, const uint16_t msi_index) {
+gicdv3_alloc_msi_vector(struct device *const device,
+                        const uint16_t msi_index,
+                        const struct cpu_info *const cpu)
+{
     struct gic_its_info *its = NULL;
     list_foreach(its, gic_its_get_list(), list) {
         const isr_vector_t vector =
-            gic_its_alloc_msi_vector(its, device, msi_index);
+            gic_its_alloc_msi_vector(its, device, msi_index, cpu);
 
         return vector;
     }
@@ -218,6 +221,19 @@ gicdv3_alloc_msi_vector(struct device *const device, const uint16_t msi_index) {
     return ISR_INVALID_VECTOR;
 }
 
+__debug_optimize(3) bool
+gicdv3_move_msi_vector(struct device *const device,
+                       const uint16_t msi_index,
+                       const struct cpu_info *const cpu)
+{
+    struct gic_its_info *its = NULL;
+    list_foreach(its, gic_its_get_list(), list) {
+        return gic_its_move_msi_vector(its, device, msi_index, cpu);
+    }
+
+    return false;
+}
+
 __debug_optimize(3) void
 gicdv3_free_msi_vector(struct device *const device,
                        const isr_vector_t vector,
@@ -24,7 +24,15 @@ void gicv3_init_on_this_cpu();
 void gicdv3_mask_irq(irq_number_t irq);
 void gicdv3_unmask_irq(irq_number_t irq);
 
-isr_vector_t gicdv3_alloc_msi_vector(struct device *device, uint16_t msi_index);
+isr_vector_t
+gicdv3_alloc_msi_vector(struct device *device,
+                        uint16_t msi_index,
+                        const struct cpu_info *cpu);
+
+bool
+gicdv3_move_msi_vector(struct device *device,
+                       uint16_t msi_index,
+                       const struct cpu_info *cpu);
 
 void
 gicdv3_free_msi_vector(struct device *device,
@@ -3,6 +3,8 @@
  * © suhas pai
  */
 
+#include <stdatomic.h>
+
 #include "lib/adt/bitset.h"
 
 #include "sys/gic/api.h"
@@ -15,6 +17,7 @@
 #include "cpu/util.h"
 
 #include "dev/printk.h"
+#include "sched/thread.h"
 
 #define ISR_IRQ_COUNT 1020
 
@@ -25,11 +28,32 @@ struct irq_info {
     bool for_msi : 1;
 };
 
+// Lpis are routed through their collection rather than their address, so a
+// move is only committed in isr_release_moved_msi_vector(), once the caller
+// is done with the device.
+
+struct lpi_info {
+    isr_func_t handler;
+
+    struct device *device;
+    const struct cpu_info *cpu;
+    const struct cpu_info *move_cpu;
+
+    _Atomic uint64_t count;
+    uint64_t last_count;
+
+    uint16_t msi_index;
+
+    bool alloced : 1;
+    bool pinned : 1;
+};
+
 extern void *const ivt_el1;
 static bitset_decl(g_bitset, ISR_IRQ_COUNT - GIC_SPI_INTERRUPT_START);
 
 static struct irq_info g_irq_info_list[ISR_IRQ_COUNT] = {0};
-static struct irq_info g_lpi_irq_info_list[GIC_ITS_MAX_LPIS_SUPPORTED] = {0};
+static struct lpi_info g_lpi_irq_info_list[GIC_ITS_MAX_LPIS_SUPPORTED] = {0};
+static struct spinlock g_lpi_lock = SPINLOCK_INIT();
 
 static struct spinlock g_sgi_lock = SPINLOCK_INIT();
 static uint16_t g_sgi_interrupt = 0;
@@ -81,8 +105,192 @@ __debug_optimize(3) isr_vector_t isr_alloc_vector() {
 }
 
 __debug_optimize(3) isr_vector_t
-isr_alloc_msi_vector(struct device *const device, const uint16_t msi_index) {
-    return gicd_alloc_msi_vector(device, msi_index);
+isr_alloc_msi_vector(struct device *const device,
+                     const uint16_t msi_index,
+                     const struct cpu_info *cpu)
+{
+    if (cpu == NULL) {
+        with_preempt_disabled({
+            cpu = this_cpu();
+        });
+    }
+
+    const isr_vector_t vector = gicd_alloc_msi_vector(device, msi_index, cpu);
+    if (vector == ISR_INVALID_VECTOR
+     || !index_in_bounds(vector, GIC_ITS_MAX_LPIS_SUPPORTED))
+    {
+        return vector;
+    }
+
+    with_spinlock_irq_disabled(&g_lpi_lock, {
+        struct lpi_info *const info = &g_lpi_irq_info_list[vector];
+
+        info->device = device;
+        info->cpu = cpu;
+        info->move_cpu = NULL;
+        info->count = 0;
+        info->last_count = 0;
+        info->msi_index = msi_index;
+        info->alloced = true;
+        info->pinned = false;
+    });
+
+    return vector;
+}
+
+__debug_optimize(3) const struct cpu_info *isr_get_cpu_for_msi() {
+    const struct cpu_info *result = NULL;
+    uint32_t result_count = UINT32_MAX;
+
+    const int flag = spin_acquire_save_irq(&g_lpi_lock);
+    const struct cpu_info *iter = NULL;
+
+    list_foreach(iter, cpus_get_list(), cpu_list) {
+        uint32_t count = 0;
+        for (uint16_t i = 0; i != GIC_ITS_MAX_LPIS_SUPPORTED; i++) {
+            const struct lpi_info *const info = &g_lpi_irq_info_list[i];
+            if (info->alloced && info->cpu == iter) {
+                count++;
+            }
+        }
+
+        if (count < result_count) {
+            result = iter;
+            result_count = count;
+        }
+    }
+
+    spin_release_restore_irq(&g_lpi_lock, flag);
+    return result;
+}
+
+// Lpis are unique across every cpu, so the vector alone identifies its owner.
+
+__debug_optimize(3) bool
+isr_get_msi_vector_owner(const isr_vector_t vector,
+                         struct device **const device_out,
+                         uint16_t *const msi_index_out)
+{
+    if (!index_in_bounds(vector, GIC_ITS_MAX_LPIS_SUPPORTED)) {
+        return false;
+    }
+
+    const struct lpi_info *const info = &g_lpi_irq_info_list[vector];
+    if (!info->alloced || info->device == NULL) {
+        return false;
+    }
+
+    *device_out = info->device;
+    *msi_index_out = info->msi_index;
+
+    return true;
+}
+
+__debug_optimize(3) void
+isr_pin_msi_vector(const struct cpu_info *const cpu, const isr_vector_t vector)
+{
+    (void)cpu;
+    if (!index_in_bounds(vector, GIC_ITS_MAX_LPIS_SUPPORTED)) {
+        return;
+    }
+
+    with_spinlock_irq_disabled(&g_lpi_lock, {
+        g_lpi_irq_info_list[vector].pinned = true;
+    });
+}
+
+__debug_optimize(3) const struct cpu_info *
+isr_start_move_msi_vector(struct device *const device,
+                          const isr_vector_t vector,
+                          const uint16_t msi_index,
+                          const struct cpu_info *const cpu)
+{
+    if (!index_in_bounds(vector, GIC_ITS_MAX_LPIS_SUPPORTED)) {
+        return NULL;
+    }
+
+    const struct cpu_info *result = NULL;
+    with_spinlock_irq_disabled(&g_lpi_lock, {
+        struct lpi_info *const info = &g_lpi_irq_info_list[vector];
+        if (info->alloced
+         && info->device == device
+         && info->msi_index == msi_index
+         && !info->pinned
+         && info->cpu != cpu
+         && info->move_cpu == NULL)
+        {
+            info->move_cpu = cpu;
+            result = info->cpu;
+        }
+    });
+
+    return result;
+}
+
+// The its only retargets the lpi once the old cpu is released, and moves any
+// pending interrupt along with it, so there's nothing in flight to wait for.
+
+__debug_optimize(3) bool
+isr_moved_msi_vector_fired(const struct cpu_info *const cpu,
+                           const isr_vector_t vector)
+{
+    (void)cpu;
+    (void)vector;
+
+    return true;
+}
+
+__debug_optimize(3) void
+isr_release_moved_msi_vector(const struct cpu_info *const cpu,
+                             const isr_vector_t vector)
+{
+    struct lpi_info *const info = &g_lpi_irq_info_list[vector];
+    const int flag = spin_acquire_save_irq(&g_lpi_lock);
+
+    // Releasing the target cancels the move, while releasing the old cpu
+    // commits it.
+
+    if (cpu == info->cpu
+     && gicd_move_msi_vector(info->device, info->msi_index, info->move_cpu))
+    {
+        info->cpu = info->move_cpu;
+    }
+
+    info->move_cpu = NULL;
+    spin_release_restore_irq(&g_lpi_lock, flag);
+}
+
+__debug_optimize(3) uint32_t
+isr_get_msi_vector_list(struct isr_msi_vector_info *const list,
+                        const uint32_t max)
+{
+    uint32_t count = 0;
+    const int flag = spin_acquire_save_irq(&g_lpi_lock);
+
+    for (uint16_t i = 0; i != GIC_ITS_MAX_LPIS_SUPPORTED && count != max; i++) {
+        struct lpi_info *const info = &g_lpi_irq_info_list[i];
+        if (!info->alloced || info->handler == NULL) {
+            continue;
+        }
+
+        const uint64_t total =
+            atomic_load_explicit(&info->count, memory_order_relaxed);
+
+        list[count] = (struct isr_msi_vector_info){
+            .device = info->device,
+            .cpu = info->cpu,
+            .vector = i,
+            .msi_index = info->msi_index,
+            .pinned = info->pinned,
+            .count = total - info->last_count
+        };
+
+        info->last_count = total;
+        count++;
+    }
+
+    spin_release_restore_irq(&g_lpi_lock, flag);
+    return count;
 }
 
 __debug_optimize(3) void isr_free_vector(const isr_vector_t vector) {
@@ -98,6 +306,18 @@ isr_free_msi_vector(struct device *const device,
                     const uint16_t msi_index)
 {
     gicd_free_msi_vector(device, vector, msi_index);
+    if (!index_in_bounds(vector, GIC_ITS_MAX_LPIS_SUPPORTED)) {
+        return;
+    }
+
+    with_spinlock_irq_disabled(&g_lpi_lock, {
+        struct lpi_info *const info = &g_lpi_irq_info_list[vector];
+
+        info->handler = NULL;
+        info->device = NULL;
+        info->cpu = NULL;
+        info->alloced = false;
+    });
 }
 
 __debug_optimize(3) void
@@ -126,11 +346,14 @@ isr_set_vector(const isr_vector_t vector,
 }
 
 __debug_optimize(3) void
-isr_set_msi_vector(const isr_vector_t vector,
+isr_set_msi_vector(const struct cpu_info *const cpu,
+                   const isr_vector_t vector,
                    const isr_func_t handler,
                    struct arch_isr_info *const info)
 {
+    (void)cpu;
     (void)info;
+
     if (!index_in_bounds(vector, GIC_ITS_MAX_LPIS_SUPPORTED)) {
         printk(LOGLEVEL_WARN,
                "isr: isr_set_vector() called on invalid lpi\n");
@@ -205,8 +428,11 @@ void handle_interrupt(struct thread_context *const context) {
             return;
         }
 
-        const isr_func_t handler = g_lpi_irq_info_list[index].handler;
+        struct lpi_info *const info = &g_lpi_irq_info_list[index];
+        const isr_func_t handler = info->handler;
+
         if (handler != NULL) {
+            atomic_fetch_add_explicit(&info->count, 1, memory_order_relaxed);
             handler((uint64_t)cpu_id << 16 | index, context);
         } else {
             printk(LOGLEVEL_WARN,
@@ -22,4 +22,3 @@ isr_vector_t isr_alloc_sgi_vector();
 uint8_t isr_get_sgi_alloced_count();
 
 void isr_install_vbar();
-void isr_eoi(uint64_t intr_info);
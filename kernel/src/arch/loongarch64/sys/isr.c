@@ -7,6 +7,7 @@
 
 #include "cpu/isr.h"
 #include "cpu/spinlock.h"
+#include "sched/thread.h"
 
 #define ISR_IRQ_COUNT 2
 #define ISR_MSI_COUNT 256
@@ -18,6 +19,13 @@ static struct spinlock g_lock = SPINLOCK_INIT();
 static isr_func_t g_funcs[ISR_IRQ_COUNT] = {0};
 static isr_func_t g_msi_funcs[ISR_MSI_COUNT] = {0};
 
+struct msi_owner {
+    struct device *device;
+    uint16_t msi_index;
+};
+
+static struct msi_owner g_msi_owner_list[ISR_MSI_COUNT] = {0};
+
 void isr_init() {
 
 }
@@ -39,14 +47,21 @@ __debug_optimize(3) isr_vector_t isr_alloc_vector() {
 }
 
 __debug_optimize(3) isr_vector_t
-isr_alloc_msi_vector(struct device *const device, const uint16_t msi_index) {
-    (void)device;
-    (void)msi_index;
+isr_alloc_msi_vector(struct device *const device,
+                     const uint16_t msi_index,
+                     const struct cpu_info *const cpu)
+{
+    (void)cpu;
 
     uint64_t result = 0;
     with_spinlock_irq_disabled(&g_lock, {
         result =
             bitset_find_unset(g_msi_bitset, ISR_MSI_COUNT, /*invert=*/true);
+
+        if (result != BITSET_INVALID) {
+            g_msi_owner_list[result].device = device;
+            g_msi_owner_list[result].msi_index = msi_index;
+        }
     });
 
     if (result == BITSET_INVALID) {
@@ -56,6 +71,26 @@ isr_alloc_msi_vector(struct device *const device, const uint16_t msi_index) {
     return (isr_vector_t)result;
 }
 
+__debug_optimize(3) bool
+isr_get_msi_vector_owner(const isr_vector_t vector,
+                         struct device **const device_out,
+                         uint16_t *const msi_index_out)
+{
+    if (!index_in_bounds(vector, ISR_MSI_COUNT)) {
+        return false;
+    }
+
+    const struct msi_owner *const owner = &g_msi_owner_list[vector];
+    if (owner->device == NULL) {
+        return false;
+    }
+
+    *device_out = owner->device;
+    *msi_index_out = owner->msi_index;
+
+    return true;
+}
+
 __debug_optimize(3) void isr_free_vector(const isr_vector_t vector) {
     assert(vector < 2);
     with_spinlock_irq_disabled(&g_lock, {
@@ -73,10 +108,75 @@ isr_free_msi_vector(struct device *const device,
 
     with_spinlock_irq_disabled(&g_lock, {
         bitset_unset(g_msi_bitset, vector);
+        g_msi_owner_list[vector].device = NULL;
         isr_set_vector(vector, /*handler=*/NULL, &ARCH_ISR_INFO_NONE());
     });
 }
 
+// Msi vectors aren't routed to specific cpus yet, so there's nothing to move.
+
+__debug_optimize(3) const struct cpu_info *isr_get_cpu_for_msi() {
+    const struct cpu_info *cpu = NULL;
+    with_preempt_disabled({
+        cpu = this_cpu();
+    });
+
+    return cpu;
+}
+
+// Msi vectors are never moved here, so there's nothing to pin them against.
+
+__debug_optimize(3) void
+isr_pin_msi_vector(const struct cpu_info *const cpu, const isr_vector_t vector)
+{
+    (void)cpu;
+    (void)vector;
+}
+
+__debug_optimize(3) const struct cpu_info *
+isr_start_move_msi_vector(struct device *const device,
+                          const isr_vector_t vector,
+                          const uint16_t msi_index,
+                          const struct cpu_info *const cpu)
+{
+    (void)device;
+    (void)vector;
+    (void)msi_index;
+    (void)cpu;
+
+    return NULL;
+}
+
+__debug_optimize(3) bool
+isr_moved_msi_vector_fired(const struct cpu_info *const cpu,
+                           const isr_vector_t vector)
+{
+    (void)cpu;
+    (void)vector;
+
+    verify_not_reached();
+}
+
+__debug_optimize(3) void
+isr_release_moved_msi_vector(const struct cpu_info *const cpu,
+                             const isr_vector_t vector)
+{
+    (void)cpu;
+    (void)vector;
+
+    verify_not_reached();
+}
+
+__debug_optimize(3) uint32_t
+isr_get_msi_vector_list(struct isr_msi_vector_info *const list,
+                        const uint32_t max)
+{
+    (void)list;
+    (void)max;
+
+    return 0;
+}
+
 void
 isr_set_vector(const isr_vector_t vector,
                const isr_func_t handler,
@@ -87,10 +187,12 @@ isr_set_vector(const isr_vector_t vector,
 }
 
 void
-isr_set_msi_vector(const isr_vector_t vector,
+isr_set_msi_vector(const struct cpu_info *const cpu,
+                   const isr_vector_t vector,
                    const isr_func_t handler,
                    struct arch_isr_info *const info)
 {
+    (void)cpu;
     (void)info;
     g_msi_funcs[vector] = handler;
 }
@@ -16,4 +16,3 @@ typedef uint16_t isr_vector_t;
 #define ISR_INVALID_VECTOR UINT16_MAX
 
 typedef void (*isr_func_t)(uint64_t intr_info, struct thread_context *frame);
-void isr_eoi(uint64_t intr_info);
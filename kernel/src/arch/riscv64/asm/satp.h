@@ -22,6 +22,6 @@ enum satp_shifts {
 
 enum satp_flags {
     __SATP_PHYS_ROOT_NUM = mask_for_n_bits(44),
-    __SATP_PHYS_ASID = 0xFFull << SATP_PHYS_ASID_SHIFT,
+    __SATP_PHYS_ASID = 0xFFFFull << SATP_PHYS_ASID_SHIFT,
     __SATP_PHYS_MODE = 0xFull << SATP_PHYS_MODE_SHIFT,
 };
@@ -0,0 +1,79 @@
+/*
+ * kernel/src/arch/riscv64/asm/sbi.h
+ * © suhas pai
+ */
+
+#pragma once
+#include <stdint.h>
+#include "lib/macros.h"
+
+enum sbi_extension_id {
+    SBI_EXTENSION_RFENCE = 0x52464E43,
+};
+
+enum sbi_rfence_function_id {
+    SBI_RFENCE_REMOTE_FENCE_I,
+    SBI_RFENCE_REMOTE_SFENCE_VMA,
+    SBI_RFENCE_REMOTE_SFENCE_VMA_ASID,
+};
+
+enum sbi_error {
+    SBI_SUCCESS,
+    SBI_ERR_FAILED = -1,
+    SBI_ERR_NOT_SUPPORTED = -2,
+    SBI_ERR_INVALID_PARAM = -3,
+    SBI_ERR_DENIED = -4,
+    SBI_ERR_INVALID_ADDRESS = -5,
+};
+
+// A hart-mask-base of this value selects every hart, ignoring the hart-mask.
+#define SBI_HART_MASK_BASE_ALL UINT64_MAX
+
+// A size of this value flushes the entire address space.
+#define SBI_RFENCE_SIZE_ALL UINT64_MAX
+
+struct sbi_result {
+    int64_t error;
+    int64_t value;
+};
+
+__debug_optimize(3) static inline struct sbi_result
+sbi_call(const uint64_t eid,
+         const uint64_t fid,
+         const uint64_t arg0,
+         const uint64_t arg1,
+         const uint64_t arg2,
+         const uint64_t arg3)
+{
+    register uint64_t a0 asm("a0") = arg0;
+    register uint64_t a1 asm("a1") = arg1;
+    register uint64_t a2 asm("a2") = arg2;
+    register uint64_t a3 asm("a3") = arg3;
+    register uint64_t a6 asm("a6") = fid;
+    register uint64_t a7 asm("a7") = eid;
+
+    asm volatile ("ecall"
+                  : "+r"(a0), "+r"(a1)
+                  : "r"(a2), "r"(a3), "r"(a6), "r"(a7)
+                  : "memory");
+
+    return (struct sbi_result){ .error = (int64_t)a0, .value = (int64_t)a1 };
+}
+
+// Run sfence.vma over [start, start + size) on every hart in the hart-mask,
+// which holds the harts starting at hart-mask-base. Returns once every hart
+// has finished the fence.
+
+__debug_optimize(3) static inline int64_t
+sbi_remote_sfence_vma(const uint64_t hart_mask,
+                      const uint64_t hart_mask_base,
+                      const uint64_t start,
+                      const uint64_t size)
+{
+    return sbi_call(SBI_EXTENSION_RFENCE,
+                    SBI_RFENCE_REMOTE_SFENCE_VMA,
+                    hart_mask,
+                    hart_mask_base,
+                    start,
+                    size).error;
+}
@@ -0,0 +1,41 @@
+/*
+ * kernel/src/arch/riscv64/asm/static_key.c
+ * © suhas pai
+ */
+
+#include "cpu/static_key.h"
+#include "lib/assert.h"
+
+__debug_optimize(3) static inline uint32_t jal_zero(const int64_t offset) {
+    const uint32_t imm = (uint32_t)offset;
+    return (imm & 0x100000) << 11
+         | (imm & 0x7fe) << 20
+         | (imm & 0x800) << 9
+         | (imm & 0xff000)
+         | STATIC_KEY_RISCV64_JAL_OPCODE;
+}
+
+void
+arch_static_key_patch(const struct static_key_entry *const entry,
+                      const bool enabled)
+{
+    uint32_t insn = STATIC_KEY_RISCV64_NOP;
+    if (enabled) {
+        const int64_t offset = (int64_t)(entry->target - entry->code);
+        assert_msg(offset >= -(1ll << 20) && offset < (1ll << 20),
+                   "static-key: site at %p is too far from its target",
+                   (void *)entry->code);
+
+        insn = jal_zero(offset);
+    }
+
+    // With compressed instructions, the site may only be 2-byte aligned, so
+    // the instruction is written as two halves.
+
+    volatile uint16_t *const code = (volatile uint16_t *)entry->code;
+
+    code[0] = (uint16_t)insn;
+    code[1] = (uint16_t)(insn >> 16);
+
+    asm volatile ("fence.i" ::: "memory");
+}
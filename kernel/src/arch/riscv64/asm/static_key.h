@@ -0,0 +1,36 @@
+/*
+ * kernel/src/arch/riscv64/asm/static_key.h
+ * © suhas pai
+ */
+
+#pragma once
+
+// A site starts as an uncompressed nop, which is patched into a `jal zero` to
+// the site's l_yes label once the key is enabled. Compressed instructions are
+// disabled for the site so the jump always fits.
+//
+// This is a macro instead of an inline function so `key` is always a constant
+// expression, even in builds without optimizations.
+
+#define STATIC_KEY_RISCV64_NOP 0x00000013
+#define STATIC_KEY_RISCV64_JAL_OPCODE 0x6f
+
+#define arch_static_key_enabled(key) \
+    ({ \
+        __label__ l_yes, l_done; \
+        bool h_var(result) = false; \
+        asm goto (".option push\n\t" \
+                  ".option norvc\n\t" \
+                  "1: nop\n\t" \
+                  ".option pop\n\t" \
+                  ".pushsection .static_keys, \"aw\"\n\t" \
+                  ".balign 8\n\t" \
+                  ".quad 1b, %l[l_yes], %c0\n\t" \
+                  ".popsection" \
+                  :: "i"(key) :: l_yes); \
+        goto l_done; \
+    l_yes: \
+        h_var(result) = true; \
+    l_done: \
+        h_var(result); \
+    })
@@ -0,0 +1,33 @@
+/*
+ * kernel/src/arch/riscv64/cpu/topology.c
+ * © suhas pai
+ */
+
+#include "cpu/info.h"
+
+// Cpus aren't matched to their acpi processor-id, so the pptt isn't used.
+
+__debug_optimize(3) bool
+cpu_get_acpi_processor_id(const struct cpu_info *const cpu,
+                          uint32_t *const id_out)
+{
+    (void)cpu;
+    (void)id_out;
+
+    return false;
+}
+
+__debug_optimize(3)
+uint64_t cpu_get_dtb_reg(const struct cpu_info *const cpu) {
+    return cpu->hart_id;
+}
+
+bool
+arch_get_cpu_topology(const struct cpu_info *const cpu,
+                      struct cpu_topology *const topology_out)
+{
+    (void)cpu;
+    (void)topology_out;
+
+    return false;
+}
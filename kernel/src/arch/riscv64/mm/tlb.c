@@ -0,0 +1,110 @@
+/*
+ * kernel/src/arch/riscv64/mm/tlb.c
+ * © suhas pai
+ */
+
+#include "asm/csr.h"
+#include "asm/satp.h"
+#include "asm/sbi.h"
+#include "dev/printk.h"
+#include "mm/mm_types.h"
+
+#include "tlb.h"
+
+__debug_optimize(3) static inline void sfence_vma_addr(const uint64_t addr) {
+    asm volatile ("sfence.vma %0, zero" :: "r"(addr) : "memory");
+}
+
+// Unlike an rs2 of zero, an asid of 0 in a register only flushes the
+// non-global entries of asid 0.
+
+__debug_optimize(3) static inline void
+sfence_vma_addr_asid(const uint64_t addr, const uint64_t asid) {
+    asm volatile ("sfence.vma %0, %1" :: "r"(addr), "r"(asid) : "memory");
+}
+
+__debug_optimize(3) static inline void sfence_vma_asid(const uint64_t asid) {
+    asm volatile ("sfence.vma zero, %0" :: "r"(asid) : "memory");
+}
+
+__debug_optimize(3) static inline uint64_t current_asid() {
+    return (csr_read(satp) & __SATP_PHYS_ASID) >> SATP_PHYS_ASID_SHIFT;
+}
+
+__debug_optimize(3)
+void tlb_flush_local(const struct tlb_flush_batch *const batch) {
+    if (batch->full) {
+        if (batch->global) {
+            asm volatile ("sfence.vma" ::: "memory");
+        } else {
+            sfence_vma_asid(current_asid());
+        }
+
+        return;
+    }
+
+    const uint64_t asid = current_asid();
+    for (uint8_t i = 0; i != batch->range_count; i++) {
+        range_iterate(batch->range_list[i], addr, PAGE_SIZE) {
+            if (batch->global) {
+                sfence_vma_addr(addr);
+            } else {
+                sfence_vma_addr_asid(addr, asid);
+            }
+        }
+    }
+}
+
+__debug_optimize(3) void tlb_flush_asid(const uint16_t asid) {
+    sfence_vma_asid(asid);
+}
+
+__debug_optimize(3) uint16_t tlb_get_max_asid() {
+    // The asid field of satp is WARL, so the number of asid bits supported is
+    // found by writing every bit and reading back the ones that stuck.
+
+    const uint64_t value = csr_read(satp);
+    csr_write(satp, value | __SATP_PHYS_ASID);
+
+    const uint64_t max_asid =
+        (csr_read(satp) & __SATP_PHYS_ASID) >> SATP_PHYS_ASID_SHIFT;
+
+    csr_write(satp, value);
+    asm volatile ("sfence.vma" ::: "memory");
+
+    return (uint16_t)max_asid;
+}
+
+__debug_optimize(3) static void
+remote_sfence_vma(const uint64_t hart_mask,
+                  const uint64_t hart_mask_base,
+                  const uint64_t start,
+                  const uint64_t size)
+{
+    const int64_t error =
+        sbi_remote_sfence_vma(hart_mask, hart_mask_base, start, size);
+
+    assert_msg(error == SBI_SUCCESS,
+               "tlb: sbi remote-sfence-vma failed with error %" PRId64,
+               error);
+}
+
+__debug_optimize(3) void
+tlb_flush_remote_harts(const uint64_t hart_mask,
+                       const uint64_t hart_mask_base,
+                       const struct tlb_flush_batch *const batch)
+{
+    if (batch->full) {
+        remote_sfence_vma(hart_mask,
+                          hart_mask_base,
+                          /*start=*/0,
+                          SBI_RFENCE_SIZE_ALL);
+        return;
+    }
+
+    // Every range is fenced in one call, instead of one call per page.
+    for (uint8_t i = 0; i != batch->range_count; i++) {
+        const struct range range = batch->range_list[i];
+        remote_sfence_vma(hart_mask, hart_mask_base, range.front, range.size);
+    }
+}
@@ -0,0 +1,23 @@
+/*
+ * kernel/src/arch/riscv64/mm/tlb.h
+ * © suhas pai
+ */
+
+#pragma once
+#include "mm/shootdown.h"
+
+// Flushes non-global batches out of the current asid only.
+void tlb_flush_local(const struct tlb_flush_batch *batch);
+
+void tlb_flush_asid(uint16_t asid);
+uint16_t tlb_get_max_asid();
+
+// Flush the batch out of the tlb of every hart in the hart-mask through the
+// sbi, which returns once every hart is done. A hart-mask-base of
+// SBI_HART_MASK_BASE_ALL flushes every hart. As asids are handed out per-cpu,
+// this flushes every asid.
+
+void
+tlb_flush_remote_harts(uint64_t hart_mask,
+                       uint64_t hart_mask_base,
+                       const struct tlb_flush_batch *batch);
@@ -16,8 +16,13 @@ ipi_handler(const uint64_t intr_no, struct thread_context *const context) {
 }
 
 void sched_init_irq() {
-    g_sched_sgi_vector = isr_alloc_msi_vector(/*device=*/NULL, /*msi_index=*/0);
-    isr_set_msi_vector(g_sched_sgi_vector, ipi_handler, &ARCH_ISR_INFO_NONE());
+    g_sched_sgi_vector =
+        isr_alloc_msi_vector(/*device=*/NULL, /*msi_index=*/0, /*cpu=*/NULL);
+
+    isr_set_msi_vector(/*cpu=*/NULL,
+                       g_sched_sgi_vector,
+                       ipi_handler,
+                       &ARCH_ISR_INFO_NONE());
 }
 
 void sched_self_ipi() {
@@ -22,6 +22,13 @@ static bitset_decl(g_bitset, ISR_IRQ_COUNT);
 static struct spinlock g_lock = SPINLOCK_INIT();
 static isr_func_t g_funcs[ISR_IRQ_COUNT] = {0};
 
+struct msi_owner {
+    struct device *device;
+    uint16_t msi_index;
+};
+
+static struct msi_owner g_msi_owner_list[UINT8_MAX] = {0};
+
 void isr_init() {
 
 }
@@ -39,12 +46,118 @@ __debug_optimize(3) isr_vector_t isr_alloc_vector() {
     return (isr_vector_t)result;
 }
 
+// imsic_alloc_msg() only enables the message in the interrupt-file of the
+// current hart, so a vector targeting any other hart would never be received.
+// Callers asking for another hart fall back to a vector they already have.
+
 __debug_optimize(3) isr_vector_t
-isr_alloc_msi_vector(struct device *const device, const uint16_t msi_index) {
+isr_alloc_msi_vector(struct device *const device,
+                     const uint16_t msi_index,
+                     const struct cpu_info *const cpu)
+{
+    uint8_t msg = UINT8_MAX;
+    with_preempt_disabled({
+        if (cpu == NULL || cpu == this_cpu()) {
+            msg = imsic_alloc_msg(RISCV64_PRIVL_SUPERVISOR);
+        }
+    });
+
+    if (msg == UINT8_MAX) {
+        return ISR_INVALID_VECTOR;
+    }
+
+    g_msi_owner_list[msg] = (struct msi_owner){
+        .device = device,
+        .msi_index = msi_index,
+    };
+
+    return msg;
+}
+
+__debug_optimize(3) bool
+isr_get_msi_vector_owner(const isr_vector_t vector,
+                         struct device **const device_out,
+                         uint16_t *const msi_index_out)
+{
+    if (!index_in_bounds(vector, UINT8_MAX)) {
+        return false;
+    }
+
+    const struct msi_owner *const owner = &g_msi_owner_list[vector];
+    if (owner->device == NULL) {
+        return false;
+    }
+
+    *device_out = owner->device;
+    *msi_index_out = owner->msi_index;
+
+    return true;
+}
+
+// Messages are only enabled in the interrupt-file of the hart that allocated
+// them, as enabling them in another hart's file requires running on that hart.
+// For the same reason, msi vectors can't be moved either.
+
+__debug_optimize(3) const struct cpu_info *isr_get_cpu_for_msi() {
+    const struct cpu_info *cpu = NULL;
+    with_preempt_disabled({
+        cpu = this_cpu();
+    });
+
+    return cpu;
+}
+
+// Msi vectors are never moved here, so there's nothing to pin them against.
+
+__debug_optimize(3) void
+isr_pin_msi_vector(const struct cpu_info *const cpu, const isr_vector_t vector)
+{
+    (void)cpu;
+    (void)vector;
+}
+
+__debug_optimize(3) const struct cpu_info *
+isr_start_move_msi_vector(struct device *const device,
+                          const isr_vector_t vector,
+                          const uint16_t msi_index,
+                          const struct cpu_info *const cpu)
+{
     (void)device;
+    (void)vector;
     (void)msi_index;
+    (void)cpu;
+
+    return NULL;
+}
+
+__debug_optimize(3) bool
+isr_moved_msi_vector_fired(const struct cpu_info *const cpu,
+                           const isr_vector_t vector)
+{
+    (void)cpu;
+    (void)vector;
 
-    return imsic_alloc_msg(RISCV64_PRIVL_SUPERVISOR);
+    verify_not_reached();
+}
+
+__debug_optimize(3) void
+isr_release_moved_msi_vector(const struct cpu_info *const cpu,
+                             const isr_vector_t vector)
+{
+    (void)cpu;
+    (void)vector;
+
+    verify_not_reached();
+}
+
+__debug_optimize(3) uint32_t
+isr_get_msi_vector_list(struct isr_msi_vector_info *const list,
+                        const uint32_t max)
+{
+    (void)list;
+    (void)max;
+
+    return 0;
 }
 
 __debug_optimize(3) void isr_free_vector(const isr_vector_t vector) {
@@ -62,7 +175,8 @@ isr_free_msi_vector(struct device *const device,
     (void)device;
     (void)msi_index;
 
-    imsic_free_msg(RISCV64_PRIVL_SUPERVISOR, vector);
+    g_msi_owner_list[vector].device = NULL;
+    imsic_free_msg(RISCV64_PRIVL_SUPERVISOR, (uint8_t)vector);
 }
 
 __debug_optimize(3) void isr_mask_irq(const isr_vector_t irq) {
@@ -153,10 +267,12 @@ isr_set_vector(const isr_vector_t vector,
 }
 
 void
-isr_set_msi_vector(const isr_vector_t vector,
+isr_set_msi_vector(const struct cpu_info *const cpu,
+                   const isr_vector_t vector,
                    const isr_func_t handler,
                    struct arch_isr_info *const info)
 {
+    (void)cpu;
     (void)info;
 
     imsic_set_msg_handler(RISCV64_PRIVL_SUPERVISOR, vector, handler);
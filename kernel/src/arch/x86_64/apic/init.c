@@ -49,6 +49,8 @@ void apic_init(const uint64_t local_apic_base) {
     if (get_cpu_capabilities()->supports_x2apic) {
         apic_msr |= __IA32_MSR_APIC_BASE_X2APIC;
         get_acpi_info_mut()->using_x2apic = true;
+
+        static_key_enable(&g_lapic_x2apic_key);
     } else {
         printk(LOGLEVEL_INFO,
                "apic: x2apic not supported. reverting to xapic instead\n");
@@ -10,6 +10,7 @@
 
 #include "cpu/info.h"
 
+#include "dev/time/tsc.h"
 #include "dev/pit.h"
 #include "dev/printk.h"
 
@@ -24,6 +25,12 @@
 static struct array g_lapic_list = ARRAY_INIT(sizeof(struct lapic_info));
 static volatile struct lapic_registers *g_lapic_regs = NULL;
 
+struct static_key g_lapic_x2apic_key = STATIC_KEY_INIT();
+
+__debug_optimize(3) static inline bool using_x2apic() {
+    return static_key_enabled(&g_lapic_x2apic_key);
+}
+
 __debug_optimize(3) static inline uint32_t
 create_timer_register(const enum lapic_timer_mode timer_mode,
                       const uint8_t vector,
@@ -32,6 +39,14 @@ create_timer_register(const enum lapic_timer_mode timer_mode,
     return (timer_mode << 17) | ((uint32_t)masked << 16) | vector;
 }
 
+// Use tsc-deadline mode when the tsc has a known and constant frequency, in
+// which case the timer doesn't need to be calibrated.
+
+__debug_optimize(3) static inline bool timer_uses_tsc_deadline() {
+    return get_cpu_capabilities()->supports_tsc_deadline
+        && tsc_get_frequency() != 0;
+}
+
 static void calibrate_timer() {
     /*
      * Calibrate the Timer:
@@ -62,7 +77,7 @@ static void calibrate_timer() {
         const uint16_t pit_init_tick_number = pit_get_current_tick();
         pit_set_reload_value(0xFFFF);
 
-        if (get_acpi_info()->using_x2apic) {
+        if (using_x2apic()) {
             x2apic_write(X2APIC_LAPIC_REG_TIMER_CURR_COUNT, 0);
             x2apic_write(X2APIC_LAPIC_REG_TIMER_DIVIDE_CONFIG,
                          LAPIC_TIMER_DIV_CONFIG_BY_2);
@@ -122,7 +137,7 @@ void lapic_enable() {
     const uint32_t spur_vector_mask =
         (uint32_t)isr_get_spur_vector() | __LAPIC_SPURVEC_ENABLE;
 
-    if (get_acpi_info()->using_x2apic) {
+    if (using_x2apic()) {
         uint64_t lint0_value = x2apic_read(X2APIC_LAPIC_REG_LVT_LINT0);
         uint64_t lint1_value = x2apic_read(X2APIC_LAPIC_REG_LVT_LINT1);
 
@@ -163,7 +178,7 @@ void lapic_enable() {
 }
 
 __debug_optimize(3) void lapic_eoi() {
-    if (get_acpi_info()->using_x2apic) {
+    if (using_x2apic()) {
         x2apic_write(X2APIC_LAPIC_REG_EOI, 0);
     } else if (__builtin_expect(g_lapic_regs != NULL, 1)) {
         mmio_write(&g_lapic_regs->eoi, /*value=*/0);
@@ -172,7 +187,7 @@ __debug_optimize(3) void lapic_eoi() {
 
 __debug_optimize(3)
 void lapic_send_ipi(const uint32_t lapic_id, const uint32_t vector) {
-    if (get_acpi_info()->using_x2apic) {
+    if (using_x2apic()) {
         x2apic_write(X2APIC_LAPIC_REG_ICR, (uint64_t)lapic_id << 32 | vector);
     } else {
         mmio_write(&g_lapic_regs->icr[1].value, lapic_id << 24);
@@ -181,7 +196,7 @@ void lapic_send_ipi(const uint32_t lapic_id, const uint32_t vector) {
 }
 
 __debug_optimize(3) void lapic_send_self_ipi(const uint32_t vector) {
-    if (get_acpi_info()->using_x2apic) {
+    if (using_x2apic()) {
         x2apic_write(X2APIC_LAPIC_REG_SELF_IPI, vector);
     } else {
         uint32_t lapic_id = 0;
@@ -194,7 +209,13 @@ __debug_optimize(3) void lapic_send_self_ipi(const uint32_t vector) {
 }
 
 __debug_optimize(3) void lapic_timer_stop() {
-    if (get_acpi_info()->using_x2apic) {
+    // Writing zero disarms the deadline, so the lvt can stay unmasked.
+    if (timer_uses_tsc_deadline()) {
+        msr_write(IA32_MSR_TSC_DEADLINE, 0);
+        return;
+    }
+
+    if (using_x2apic()) {
         x2apic_write(X2APIC_LAPIC_REG_TIMER_INIT_COUNT, 0);
         x2apic_write(X2APIC_LAPIC_REG_LVT_TIMER,
                      create_timer_register(LAPIC_TIMER_MODE_ONE_SHOT,
@@ -210,13 +231,25 @@ __debug_optimize(3) void lapic_timer_stop() {
 }
 
 __debug_optimize(3) usec_t lapic_timer_remaining() {
+    if (timer_uses_tsc_deadline()) {
+        // The deadline reads as zero once the timer fired or was stopped.
+        const uint64_t deadline = msr_read(IA32_MSR_TSC_DEADLINE);
+        const uint64_t now = rdtsc();
+
+        if (deadline <= now) {
+            return 0;
+        }
+
+        return nano_to_micro(tsc_cycles_to_nano(deadline - now));
+    }
+
     uint64_t lapic_timer_freq_in_microseconds = 0;
     with_preempt_disabled({
         lapic_timer_freq_in_microseconds =
             this_cpu()->lapic_timer_frequency / MICRO_IN_SECONDS;
     });
 
-    if (get_acpi_info()->using_x2apic) {
+    if (using_x2apic()) {
         return x2apic_read(X2APIC_LAPIC_REG_TIMER_INIT_COUNT)
              / lapic_timer_freq_in_microseconds;
     }
@@ -227,6 +260,27 @@ __debug_optimize(3) usec_t lapic_timer_remaining() {
 
 __debug_optimize(3)
 void lapic_timer_one_shot(const usec_t usec, const isr_vector_t vector) {
+    if (timer_uses_tsc_deadline()) {
+        const uint32_t timer_reg =
+            create_timer_register(LAPIC_TIMER_MODE_TSC_DEADLINE,
+                                  vector,
+                                  /*masked=*/false);
+
+        if (using_x2apic()) {
+            x2apic_write(X2APIC_LAPIC_REG_LVT_TIMER, timer_reg);
+        } else {
+            mmio_write(&g_lapic_regs->lvt_timer, timer_reg);
+        }
+
+        // The switch to tsc-deadline mode must be visible before the deadline
+        // is written, and an mmio write isn't ordered with a wrmsr.
+
+        asm volatile ("mfence" ::: "memory");
+        msr_write(IA32_MSR_TSC_DEADLINE, rdtsc() + tsc_micro_to_cycles(usec));
+
+        return;
+    }
+
     // LAPIC-Timer Frequency is in Hz, which is cycles per second, while we need
     // cycles per microseconds
 
@@ -234,7 +288,7 @@ void lapic_timer_one_shot(const usec_t usec, const isr_vector_t vector) {
         this_cpu()->lapic_timer_frequency / MICRO_IN_SECONDS;
 
     const uint64_t count = check_mul_assert(lapic_timer_freq_in_us, usec);
-    if (get_acpi_info()->using_x2apic) {
+    if (using_x2apic()) {
         x2apic_write(X2APIC_LAPIC_REG_TIMER_INIT_COUNT, count);
         x2apic_write(X2APIC_LAPIC_REG_LVT_TIMER,
                      create_timer_register(LAPIC_TIMER_MODE_ONE_SHOT,
@@ -254,8 +308,13 @@ void lapic_init() {
         lapic_enable();
         lapic_timer_stop();
 
-        calibrate_timer();
-        lapic_timer_stop();
+        // Only the count-based timer needs its frequency. The bsp calibrates
+        // before the tsc is setup, and so always does.
+
+        if (!timer_uses_tsc_deadline()) {
+            calibrate_timer();
+            lapic_timer_stop();
+        }
 
         if (this_cpu() == &g_base_cpu_info) {
             printk(LOGLEVEL_INFO,
@@ -6,6 +6,7 @@
 #pragma once
 
 #include "apic/structs.h"
+#include "cpu/static_key.h"
 #include "lib/time.h"
 #include "sys/isr.h"
 
@@ -203,6 +204,11 @@ struct lapic_info {
     bool online_capable : 1;
 };
 
+// Enabled once the bsp switches to x2apic mode, after which every lapic
+// register is accessed through msrs instead of mmio.
+
+extern struct static_key g_lapic_x2apic_key;
+
 void lapic_init();
 void lapic_add(const struct lapic_info *info);
 
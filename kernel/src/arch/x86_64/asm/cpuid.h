@@ -99,6 +99,9 @@ enum {
     // Supports POPCNT instruction
     __CPUID_FEAT_ECX_POPCNT = 1ull << 23,
 
+    // Supports one-shot lapic timer operation using a tsc deadline value
+    __CPUID_FEAT_ECX_TSC_DEADLINE = 1ull << 24,
+
     // AES = Advanced Encryption Standard
     __CPUID_FEAT_ECX_AES = 1ull << 25,
 
@@ -696,6 +699,7 @@ enum cpuid_requests {
     CPUID_GET_CPU_TOPOLOGY,
     CPUID_GET_FEATURES_XSAVE = 13,
 
+    CPUID_GET_TSC_FREQ_INFO = 0x15,
     CPUID_GET_PROC_FREQ_INFO = 0x16,
     CPUID_GET_EXTENDED_BRAND_STRING,
     CPUID_GET_EXTENDED_BRAND_STRING_MORE,
@@ -703,6 +707,8 @@ enum cpuid_requests {
 
     CPUID_GET_LARGEST_EXTENDED_FUNCTION = 0x80000000,
     CPUID_GET_FEATURES_EXTENDED,
+
+    CPUID_GET_ADVANCED_POWER_MGMT_INFO = 0x80000007,
 };
 
 void
@@ -280,4 +280,15 @@ enum {
      * interrupts will be disabled.
      */
     __CR4_BIT_TPL = 1ull << 26,
-};
\ No newline at end of file
+};
+enum {
+    // The PCID of the address space in CR3, when CR4.PCIDE is set.
+    __CR3_PCID = 0xFFFull,
+
+    /*
+     * When CR4.PCIDE is set, and this bit is set on a write to CR3, the
+     * processor isn't required to invalidate the TLB entries of the PCID being
+     * loaded. The bit is always read as 0.
+     */
+    __CR3_BIT_NOFLUSH = 1ull << 63,
+};
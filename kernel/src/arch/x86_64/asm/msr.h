@@ -25,6 +25,7 @@ enum ia32_msr {
     // at bits [47:32] and [63:48] respectively.
     IA32_MSR_STAR = 0xC0000081,
     IA32_MSR_TSC_DEADLINE = 0x6E0,
+    IA32_MSR_TSC_ADJUST = 0x3B,
 
     IA32_MSR_X2APIC_BASE = 0x800,
 
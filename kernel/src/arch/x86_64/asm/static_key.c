@@ -0,0 +1,49 @@
+/*
+ * kernel/src/arch/x86_64/asm/static_key.c
+ * © suhas pai
+ */
+
+#include "cpu/static_key.h"
+#include "lib/assert.h"
+
+static const uint8_t g_nop5[STATIC_KEY_X86_64_SITE_SIZE] = {
+    0x0f, 0x1f, 0x44, 0x00, 0x00
+};
+
+void
+arch_static_key_patch(const struct static_key_entry *const entry,
+                      const bool enabled)
+{
+    uint8_t *const code = (uint8_t *)entry->code;
+    uint8_t insn[STATIC_KEY_X86_64_SITE_SIZE];
+
+    if (enabled) {
+        const int64_t rel =
+            (int64_t)(entry->target - entry->code)
+          - STATIC_KEY_X86_64_SITE_SIZE;
+
+        assert_msg(rel >= INT32_MIN && rel <= INT32_MAX,
+                   "static-key: site at %p is too far from its target",
+                   (void *)code);
+
+        const uint32_t rel32 = (uint32_t)(int32_t)rel;
+
+        insn[0] = STATIC_KEY_X86_64_JMP32_OPCODE;
+        insn[1] = (uint8_t)rel32;
+        insn[2] = (uint8_t)(rel32 >> 8);
+        insn[3] = (uint8_t)(rel32 >> 16);
+        insn[4] = (uint8_t)(rel32 >> 24);
+    } else {
+        for (uint8_t i = 0; i != STATIC_KEY_X86_64_SITE_SIZE; i++) {
+            insn[i] = g_nop5[i];
+        }
+    }
+
+    // Written one byte at a time so this doesn't call into memcpy(), which may
+    // itself be a site that's being patched. Only this cpu is running, and x86
+    // notices writes to code that's about to run, so no flush is needed.
+
+    for (uint8_t i = 0; i != STATIC_KEY_X86_64_SITE_SIZE; i++) {
+        ((volatile uint8_t *)code)[i] = insn[i];
+    }
+}
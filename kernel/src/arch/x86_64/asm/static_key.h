@@ -0,0 +1,33 @@
+/*
+ * kernel/src/arch/x86_64/asm/static_key.h
+ * © suhas pai
+ */
+
+#pragma once
+
+// A site starts as a 5-byte nop, which is patched into a 5-byte jmp to the
+// site's l_yes label once the key is enabled.
+//
+// This is a macro instead of an inline function so `key` is always a constant
+// expression, even in builds without optimizations.
+
+#define STATIC_KEY_X86_64_NOP5 ".byte 0x0f, 0x1f, 0x44, 0x00, 0x00"
+#define STATIC_KEY_X86_64_JMP32_OPCODE 0xE9
+#define STATIC_KEY_X86_64_SITE_SIZE 5
+
+#define arch_static_key_enabled(key) \
+    ({ \
+        __label__ l_yes, l_done; \
+        bool h_var(result) = false; \
+        asm goto ("1: " STATIC_KEY_X86_64_NOP5 "\n\t" \
+                  ".pushsection .static_keys, \"aw\"\n\t" \
+                  ".balign 8\n\t" \
+                  ".quad 1b, %l[l_yes], %c0\n\t" \
+                  ".popsection" \
+                  :: "i"(key) :: l_yes); \
+        goto l_done; \
+    l_yes: \
+        h_var(result) = true; \
+    l_done: \
+        h_var(result); \
+    })
@@ -0,0 +1,29 @@
+/*
+ * kernel/src/arch/x86_64/asm/tsc.h
+ * © suhas pai
+ */
+
+#pragma once
+#include <stdint.h>
+
+#include "lib/macros.h"
+
+__debug_optimize(3) static inline uint64_t rdtsc() {
+    uint32_t low = 0;
+    uint32_t high = 0;
+
+    asm volatile ("rdtsc" : "=a"(low), "=d"(high));
+    return (uint64_t)high << 32 | low;
+}
+
+// rdtsc can be executed before earlier instructions complete. The lfence
+// keeps the read from being moved before earlier loads, which matters when
+// comparing readings across cpus.
+
+__debug_optimize(3) static inline uint64_t rdtsc_ordered() {
+    uint32_t low = 0;
+    uint32_t high = 0;
+
+    asm volatile ("lfence; rdtsc" : "=a"(low), "=d"(high) :: "memory");
+    return (uint64_t)high << 32 | low;
+}
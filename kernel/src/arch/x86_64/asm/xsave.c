@@ -49,3 +49,29 @@ __debug_optimize(3) uint16_t xsave_get_compacted_size() {
 
     return ebx;
 }
+
+__debug_optimize(3)
+uint32_t xsave_get_size_for_features(const xsave_feat_mask_t features) {
+    if (features == 0) {
+        return 0;
+    }
+
+    // x87 and sse state live in the legacy region, which is always followed by
+    // the header.
+
+    uint32_t size = sizeof(struct xsave_fx_regs) + sizeof(struct xsave_header);
+    for (enum xsave_feature feat = XSAVE_FEAT_SSE + 1;
+         feat <= XSAVE_FEAT_MAX;
+         feat++)
+    {
+        if ((features & __XSAVE_FEAT_MASK(feat)) == 0) {
+            continue;
+        }
+
+        if (g_xsave_feat_sizes[feat] > 0) {
+            size += (uint16_t)g_xsave_feat_sizes[feat];
+        }
+    }
+
+    return size;
+}
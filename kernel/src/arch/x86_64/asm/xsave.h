@@ -197,6 +197,11 @@ bool xsave_feat_has_aligned_offset(enum xsave_feature feat);
 int16_t xsave_feat_get_offset(uint64_t xcmo_bv, const enum xsave_feature feat);
 uint16_t xsave_get_compacted_size();
 
+// Returns the number of bytes taken up by the provided features in an xsave
+// buffer, including the legacy region and the header.
+
+uint32_t xsave_get_size_for_features(xsave_feat_mask_t features);
+
 __debug_optimize(3)
 static inline const char *xsave_feat_get_string(const enum xsave_feature feat) {
     switch (feat) {
@@ -254,21 +259,78 @@ static inline void xsave_set_user_features(const uint32_t features) {
     write_xcr(XCR_XSTATE_FEATURES_ENABLED, xcr | features);
 }
 
-__debug_optimize(3) static inline void xsave_user_into(void *const buffer) {
-    asm volatile ("xsave (%0)" :: "a"(buffer));
+// The xsave family of instructions take a mask of the features to save or
+// restore in edx:eax, which is and-ed with the features enabled in XCR0 (and
+// IA32_XSS for xsaves/xrstors). No feature we use is above bit 31, so edx is
+// always zero.
+
+__debug_optimize(3) static inline void
+xsave_user_into(void *const buffer, const xsave_feat_mask_t mask) {
+    asm volatile ("xsave64 (%0)"
+                  :: "r"(buffer), "a"(mask), "d"(0)
+                  : "memory");
 }
 
-__debug_optimize(3)
-static inline void xsave_supervisor_into(void *const buffer) {
-    asm volatile ("xsaves (%0)" :: "a"(buffer));
+// Like xsave, but skips features that weren't modified since the last xrstor
+// from the same buffer.
+
+__debug_optimize(3) static inline void
+xsaveopt_user_into(void *const buffer, const xsave_feat_mask_t mask) {
+    asm volatile ("xsaveopt64 (%0)"
+                  :: "r"(buffer), "a"(mask), "d"(0)
+                  : "memory");
 }
 
-__debug_optimize(3)
-static inline void xrstor_user_from(const void *const buffer) {
-    asm volatile ("xrstor (%0)" :: "a"(buffer));
+// Like xsave, but only stores features that aren't in their initial state, and
+// uses the compacted format.
+
+__debug_optimize(3) static inline void
+xsavec_user_into(void *const buffer, const xsave_feat_mask_t mask) {
+    asm volatile ("xsavec64 (%0)"
+                  :: "r"(buffer), "a"(mask), "d"(0)
+                  : "memory");
 }
 
+// Combines the optimizations of xsaveopt and xsavec, and can also save
+// supervisor features.
+
+__debug_optimize(3) static inline void
+xsave_supervisor_into(void *const buffer, const xsave_feat_mask_t mask) {
+    asm volatile ("xsaves64 (%0)"
+                  :: "r"(buffer), "a"(mask), "d"(0)
+                  : "memory");
+}
+
+__debug_optimize(3) static inline void
+xrstor_user_from(const void *const buffer, const xsave_feat_mask_t mask) {
+    asm volatile ("xrstor64 (%0)"
+                  :: "r"(buffer), "a"(mask), "d"(0)
+                  : "memory");
+}
+
+__debug_optimize(3) static inline void
+xrstor_supervisor_from(const void *const buffer, const xsave_feat_mask_t mask) {
+    asm volatile ("xrstors64 (%0)"
+                  :: "r"(buffer), "a"(mask), "d"(0)
+                  : "memory");
+}
+
+// Returns the features that aren't in their initial state. Requires
+// XGETBV with ecx=1 to be supported.
+
 __debug_optimize(3)
-static inline void xrstor_supervisor_from(const void *const buffer) {
-    asm volatile ("xrstors (%0)" :: "a"(buffer));
-}
\ No newline at end of file
+static inline xsave_feat_mask_t xsave_get_features_in_use() {
+    return (xsave_feat_mask_t)read_xcr(XCR_XSTATE_FEATURES_IN_USE);
+}
+
+#define XSAVE_MXCSR_INIT 0x1F80
+
+// XINUSE doesn't track MXCSR, which is saved and restored along with the sse
+// state, so a thread that only changed MXCSR looks like it has no state.
+
+__debug_optimize(3) static inline uint32_t xsave_read_mxcsr() {
+    uint32_t result = 0;
+    asm volatile ("stmxcsr %0" : "=m"(result));
+
+    return result;
+}
@@ -3,6 +3,7 @@
  * © suhas pai
  */
 
+#include "lib/string.h"
 #include "mm/kmalloc.h"
 #include "sched/scheduler.h"
 
@@ -15,6 +16,16 @@ static struct cpu_info g_base_cpu_info = {
     .lapic_id = 0,
     .lapic_timer_frequency = 0,
 
+    .fpu_owner = NULL,
+    .fpu_bytes_saved = 0,
+    .fpu_bytes_restored = 0,
+    .fpu_save_skip_count = 0,
+    .fpu_restore_skip_count = 0,
+
+    .isr_vector_bitset = {0},
+    .isr_vector_list = {},
+    .isr_msi_vector_count = 0,
+
     .active = true,
     .in_exception = false,
 };
@@ -60,6 +71,16 @@ struct cpu_info *cpu_add(const struct limine_smp_info *const info) {
     cpu->lapic_id = info->lapic_id;
     cpu->lapic_timer_frequency = 0;
 
+    cpu->fpu_owner = NULL;
+    cpu->fpu_bytes_saved = 0;
+    cpu->fpu_bytes_restored = 0;
+    cpu->fpu_save_skip_count = 0;
+    cpu->fpu_restore_skip_count = 0;
+
+    bzero(cpu->isr_vector_bitset, sizeof(cpu->isr_vector_bitset));
+    bzero(cpu->isr_vector_list, sizeof(cpu->isr_vector_list));
+
+    cpu->isr_msi_vector_count = 0;
     sched_init_on_cpu(cpu);
     list_add(cpus_get_list(), &cpu->cpu_list);
 
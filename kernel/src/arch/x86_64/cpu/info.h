@@ -5,21 +5,39 @@
 
 #pragma once
 #include "cpu/cpu_info.h"
+#include "cpu/static_key.h"
+#include "sys/isr.h"
 
 struct cpu_capabilities {
     bool supports_avx512 : 1;
     bool supports_x2apic : 1;
     bool supports_1gib_pages : 1;
+    bool supports_pcid : 1;
+    bool supports_invariant_tsc : 1;
+    bool supports_tsc_deadline : 1;
+    bool supports_tsc_adjust : 1;
     bool has_compacted_xsave : 1;
+    bool supports_xsaveopt : 1;
+    bool supports_xsaves : 1;
+    bool supports_xinuse : 1;
+    bool supports_xfd : 1;
+    bool supports_fsrm : 1;
 
     uint16_t xsave_user_size;
     uint16_t xsave_supervisor_size;
 
+    // Size of the buffer used to hold a thread's fpu state, which is in the
+    // compacted format when supported.
+
+    uint16_t xsave_buffer_size;
+
     uint32_t xsave_user_features;
     uint32_t xsave_supervisor_features;
 };
 
 struct pagemap;
+struct thread;
+
 struct cpu_info {
     struct cpu_info_base;
 
@@ -27,8 +45,38 @@ struct cpu_info {
     uint32_t lapic_id;
     uint32_t lapic_timer_frequency;
 
+    // The user thread whose fpu state is loaded in this cpu's registers. Kernel
+    // threads never touch the fpu, so switching to one leaves the owner's
+    // state in place.
+
+    struct thread *fpu_owner;
+
+    uint64_t fpu_bytes_saved;
+    uint64_t fpu_bytes_restored;
+
+    uint64_t fpu_save_skip_count;
+    uint64_t fpu_restore_skip_count;
+
+    // Msi vectors targeting this cpu are only reserved in this cpu's
+    // vector-table, so every cpu gets the entire vector space, except for the
+    // vectors isr_alloc_vector() reserves on every cpu.
+
+    uint64_t isr_vector_bitset[ISR_IRQ_COUNT / sizeof_bits(uint64_t)];
+    struct isr_vector_entry isr_vector_list[ISR_IRQ_COUNT];
+
+    uint32_t isr_msi_vector_count;
+
     bool active : 1;
     bool in_exception : 1;
 };
 
 const struct cpu_capabilities *get_cpu_capabilities();
+
+// Keys mirroring the capabilities above that are checked on hot paths. They're
+// enabled by cpu_init() on the bsp, once the kernel's text can be patched.
+
+extern struct static_key g_cpu_fsrm_key;
+extern struct static_key g_cpu_xsaveopt_key;
+extern struct static_key g_cpu_xsavec_key;
+extern struct static_key g_cpu_xsaves_key;
+extern struct static_key g_cpu_xinuse_key;
@@ -18,10 +18,20 @@ static struct cpu_capabilities g_cpu_capabilities = {
     .supports_avx512 = false,
     .supports_x2apic = false,
     .supports_1gib_pages = false,
+    .supports_pcid = false,
+    .supports_invariant_tsc = false,
+    .supports_tsc_deadline = false,
+    .supports_tsc_adjust = false,
     .has_compacted_xsave = false,
+    .supports_xsaveopt = false,
+    .supports_xsaves = false,
+    .supports_xinuse = false,
+    .supports_xfd = false,
+    .supports_fsrm = false,
 
     .xsave_user_size = 0,
     .xsave_supervisor_size = 0,
+    .xsave_buffer_size = 0,
 
     .xsave_user_features = 0,
     .xsave_supervisor_features = 0,
@@ -29,6 +39,12 @@ static struct cpu_capabilities g_cpu_capabilities = {
 
 static bool g_base_cpu_init = false;
 
+struct static_key g_cpu_fsrm_key = STATIC_KEY_INIT();
+struct static_key g_cpu_xsaveopt_key = STATIC_KEY_INIT();
+struct static_key g_cpu_xsavec_key = STATIC_KEY_INIT();
+struct static_key g_cpu_xsaves_key = STATIC_KEY_INIT();
+struct static_key g_cpu_xinuse_key = STATIC_KEY_INIT();
+
 int16_t g_xsave_feat_noncompacted_offsets[XSAVE_FEAT_MAX] = {
     [0 ... XSAVE_FEAT_MAX - 1] = -1
 };
@@ -79,9 +95,19 @@ static void xsave_init() {
     const xsave_feat_mask_t xsave_user_features =
         g_cpu_capabilities.xsave_user_features & __XSAVE_FEAT_USER_MASK;
 
-    msr_write(IA32_MSR_XFD, XSAVE_FEAT_XFD_MASK);
+    if (g_cpu_capabilities.supports_xfd) {
+        msr_write(IA32_MSR_XFD, XSAVE_FEAT_XFD_MASK);
+    }
+
+    // IA32_XSS only exists when xsaves is supported, and only accepts the
+    // supervisor features reported by cpuid.
+
+    if (g_cpu_capabilities.supports_xsaves) {
+        xsave_set_supervisor_features(
+            xsave_supervisor_features
+          & g_cpu_capabilities.xsave_supervisor_features);
+    }
 
-    xsave_set_supervisor_features(xsave_supervisor_features);
     xsave_set_user_features(xsave_user_features);
 
     if (initialized) {
@@ -252,6 +278,9 @@ static void init_cpuid_features() {
             assert((edx & expected_edx_features) == expected_edx_features);
 
             g_cpu_capabilities.supports_x2apic = ecx & __CPUID_FEAT_ECX_X2APIC;
+            g_cpu_capabilities.supports_pcid = ecx & __CPUID_FEAT_ECX_PCIDE;
+            g_cpu_capabilities.supports_tsc_deadline =
+                ecx & __CPUID_FEAT_ECX_TSC_DEADLINE;
         }
         {
             uint64_t eax, ebx, ecx = 0, edx;
@@ -283,6 +312,10 @@ static void init_cpuid_features() {
             assert((ebx & expected_ebx_features) == expected_ebx_features);
             g_cpu_capabilities.supports_avx512 =
                 ebx & __CPUID_FEAT_EXT7_ECX0_EBX_AVX512F;
+            g_cpu_capabilities.supports_tsc_adjust =
+                ebx & __CPUID_FEAT_EXT7_ECX0_EBX_MSR_TSC_ADJUST;
+            g_cpu_capabilities.supports_fsrm =
+                edx & __CPUID_FEAT_EXT7_ECX0_EDX_FAST_SHORT_REP_PREFIX;
         }
         {
             uint64_t eax, ebx, ecx = 0, edx;
@@ -372,6 +405,33 @@ static void init_cpuid_features() {
                 printk(LOGLEVEL_INFO, "cpu: does NOT support 1gib pages\n");
             }
         }
+        {
+            uint64_t eax, ebx, ecx = 0, edx;
+            cpuid(CPUID_GET_LARGEST_EXTENDED_FUNCTION,
+                  /*subleaf=*/0,
+                  &eax,
+                  &ebx,
+                  &ecx,
+                  &edx);
+
+            if (eax >= CPUID_GET_ADVANCED_POWER_MGMT_INFO) {
+                cpuid(CPUID_GET_ADVANCED_POWER_MGMT_INFO,
+                      /*subleaf=*/0,
+                      &eax,
+                      &ebx,
+                      &ecx,
+                      &edx);
+
+                g_cpu_capabilities.supports_invariant_tsc =
+                    edx & __CPUID_FEAT_EXT80000007_EDX_TSC_INVARIANT;
+            }
+
+            if (g_cpu_capabilities.supports_invariant_tsc) {
+                printk(LOGLEVEL_INFO, "cpu: supports invariant tsc\n");
+            } else {
+                printk(LOGLEVEL_INFO, "cpu: does NOT support invariant tsc\n");
+            }
+        }
         {
             uint64_t eax, ebx, ecx, edx;
             cpuid(CPUID_GET_FEATURES_XSAVE,
@@ -402,7 +462,7 @@ static void init_cpuid_features() {
         {
             uint64_t eax, ebx, ecx = 1, edx;
             cpuid(CPUID_GET_FEATURES_XSAVE,
-                  /*subleaf=*/0,
+                  /*subleaf=*/1,
                   &eax,
                   &ebx,
                   &ecx,
@@ -419,14 +479,24 @@ static void init_cpuid_features() {
                    ecx,
                    edx);
 
-            const uint32_t expected_eax_features =
-                __CPUID_FEAT_XSAVE_ECX1_EAX_SUPPORTS_XSAVEOPT
-              | __CPUID_FEAT_XSAVE_ECX1_EAX_SUPPORTS_XSAVE_COMPACTED
-              | __CPUID_FEAT_XSAVE_ECX1_EAX_SUPPORTS_XGETBV
-              | __CPUID_FEAT_XSAVE_ECX1_EAX_SUPPORTS_XSAVES_XSTORS
-              | __CPUID_FEAT_XSAVE_ECX1_EAX_SUPPORTS_XFD;
+            g_cpu_capabilities.supports_xsaveopt =
+                eax & __CPUID_FEAT_XSAVE_ECX1_EAX_SUPPORTS_XSAVEOPT;
+            g_cpu_capabilities.has_compacted_xsave =
+                eax & __CPUID_FEAT_XSAVE_ECX1_EAX_SUPPORTS_XSAVE_COMPACTED;
+            g_cpu_capabilities.supports_xinuse =
+                eax & __CPUID_FEAT_XSAVE_ECX1_EAX_SUPPORTS_XGETBV;
+            g_cpu_capabilities.supports_xsaves =
+                eax & __CPUID_FEAT_XSAVE_ECX1_EAX_SUPPORTS_XSAVES_XSTORS;
+            g_cpu_capabilities.supports_xfd =
+                eax & __CPUID_FEAT_XSAVE_ECX1_EAX_SUPPORTS_XFD;
 
-            assert((eax & expected_eax_features) == expected_eax_features);
+            printk(LOGLEVEL_INFO,
+                   "cpu: xsave supports xsaveopt: %s, xsavec: %s, xsaves: %s, "
+                   "xinuse: %s\n",
+                   g_cpu_capabilities.supports_xsaveopt ? "yes" : "no",
+                   g_cpu_capabilities.has_compacted_xsave ? "yes" : "no",
+                   g_cpu_capabilities.supports_xsaves ? "yes" : "no",
+                   g_cpu_capabilities.supports_xinuse ? "yes" : "no");
 
             g_cpu_capabilities.xsave_supervisor_size = ebx;
             g_cpu_capabilities.xsave_supervisor_features =
@@ -438,6 +508,13 @@ static void init_cpuid_features() {
         }
     }
 
+    // CR4.PCIDE can only be set while CR3 has a pcid of 0, which is always the
+    // case this early.
+
+    if (g_cpu_capabilities.supports_pcid) {
+        write_cr4(read_cr4() | __CR4_BIT_PCIDE);
+    }
+
     // Enable Syscalls
     msr_write(IA32_MSR_EFER, msr_read(IA32_MSR_EFER) | __IA32_MSR_EFER_BIT_SCE);
 
@@ -453,9 +530,25 @@ static void init_cpuid_features() {
 
     xsave_init();
     if (!initialized) {
+        // The compacted size covers the features currently enabled in XCR0 and
+        // IA32_XSS. Otherwise, use the size of the standard format for every
+        // supported feature.
+
+        if (g_cpu_capabilities.has_compacted_xsave
+         || g_cpu_capabilities.supports_xsaves)
+        {
+            g_cpu_capabilities.xsave_buffer_size = xsave_get_compacted_size();
+        } else {
+            g_cpu_capabilities.xsave_buffer_size =
+                g_cpu_capabilities.xsave_user_size;
+        }
+
         printk(LOGLEVEL_INFO,
                "cpu: xsave compacted size is %" PRIu16 " bytes\n",
                xsave_get_compacted_size());
+        printk(LOGLEVEL_INFO,
+               "cpu: xsave buffer size is %" PRIu16 " bytes\n",
+               g_cpu_capabilities.xsave_buffer_size);
 
         initialized = true;
     }
@@ -468,15 +561,45 @@ __debug_optimize(3) const struct cpu_capabilities *get_cpu_capabilities() {
 __debug_optimize(3) void cpu_early_init() {
     msr_write(IA32_MSR_GS_BASE, (uint64_t)&kernel_main_thread);
     msr_write(IA32_MSR_KERNEL_GS_BASE, (uint64_t)&kernel_main_thread);
+    list_add(cpus_get_list(), &this_cpu_mut()->cpu_list);
 
     init_cpuid_features();
     g_base_cpu_init = true;
 }
 
+static void enable_static_keys() {
+    if (g_cpu_capabilities.supports_fsrm) {
+        static_key_enable(&g_cpu_fsrm_key);
+    }
+
+    if (g_cpu_capabilities.supports_xsaveopt) {
+        static_key_enable(&g_cpu_xsaveopt_key);
+    }
+
+    if (g_cpu_capabilities.has_compacted_xsave) {
+        static_key_enable(&g_cpu_xsavec_key);
+    }
+
+    if (g_cpu_capabilities.supports_xsaves) {
+        static_key_enable(&g_cpu_xsaves_key);
+    }
+
+    if (g_cpu_capabilities.supports_xinuse) {
+        static_key_enable(&g_cpu_xinuse_key);
+    }
+}
+
 void cpu_init() {
 
 }
 
+// The bsp's capabilities are found in cpu_early_init(), but the kernel's text
+// can only be patched once mm_arch_init() has switched to our own pagemap.
+
+void cpu_post_mm_init() {
+    enable_static_keys();
+}
+
 __debug_optimize(3) void cpu_init_for_smp() {
     init_cpuid_features();
     cpu_init();
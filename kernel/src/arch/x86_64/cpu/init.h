@@ -6,5 +6,6 @@
 #pragma once
 
 void cpu_init();
+void cpu_post_mm_init();
 void cpu_early_init();
 void cpu_init_for_smp();
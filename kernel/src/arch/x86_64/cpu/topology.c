@@ -0,0 +1,196 @@
+/*
+ * kernel/src/arch/x86_64/cpu/topology.c
+ * © suhas pai
+ */
+
+#include "asm/cpuid.h"
+#include "cpu/info.h"
+
+#include "lib/bits.h"
+
+#define CPUID_GET_CPU_TOPOLOGY_V2 0x1F
+#define CPUID_GET_AMD_CACHE_TOPOLOGY 0x8000001D
+
+#define CPUID_TOPOLOGY_MAX_LEVELS 8
+#define CPUID_CACHE_MAX_LEVELS 8
+
+enum cpuid_topology_level_kind {
+    CPUID_TOPOLOGY_LEVEL_INVALID,
+    CPUID_TOPOLOGY_LEVEL_SMT,
+};
+
+// Cpus are numbered by their apic-id, which is split into fields for every
+// level of the topology. The shifts are found on the bsp, but are the same on
+// every cpu.
+
+struct apic_id_shifts {
+    uint8_t smt;
+    uint8_t package;
+    uint8_t llc;
+};
+
+__debug_optimize(3) bool
+cpu_get_acpi_processor_id(const struct cpu_info *const cpu,
+                          uint32_t *const id_out)
+{
+    *id_out = cpu->processor_id;
+    return true;
+}
+
+__debug_optimize(3)
+uint64_t cpu_get_dtb_reg(const struct cpu_info *const cpu) {
+    return cpu->lapic_id;
+}
+
+// Leaf 0x1F supersedes leaf 0xB, and adds the module, tile and die levels,
+// which are all treated as part of the package here.
+
+static bool
+get_shifts_from_topology_leaf(const uint32_t leaf,
+                              struct apic_id_shifts *const shifts_out)
+{
+    bool found_any = false;
+
+    for (uint32_t subleaf = 0; subleaf != CPUID_TOPOLOGY_MAX_LEVELS; subleaf++)
+    {
+        uint64_t eax = 0;
+        uint64_t ebx = 0;
+        uint64_t ecx = 0;
+        uint64_t edx = 0;
+
+        cpuid(leaf, subleaf, &eax, &ebx, &ecx, &edx);
+
+        const uint8_t kind = (ecx >> 8) & 0xFF;
+        if (kind == CPUID_TOPOLOGY_LEVEL_INVALID) {
+            break;
+        }
+
+        const uint8_t shift = eax & 0x1F;
+        if (kind == CPUID_TOPOLOGY_LEVEL_SMT) {
+            shifts_out->smt = shift;
+        }
+
+        // The shift of the last level is the shift of the package.
+        shifts_out->package = shift;
+        found_any = true;
+    }
+
+    return found_any;
+}
+
+// Leaf 4 on intel, and leaf 0x8000001D on amd, list every cache along with the
+// number of cpus that share it.
+
+static bool
+get_llc_shift_from_cache_leaf(const uint32_t leaf, uint8_t *const shift_out) {
+    uint8_t llc_level = 0;
+    bool found_any = false;
+
+    for (uint32_t subleaf = 0; subleaf != CPUID_CACHE_MAX_LEVELS; subleaf++) {
+        uint64_t eax = 0;
+        uint64_t ebx = 0;
+        uint64_t ecx = 0;
+        uint64_t edx = 0;
+
+        cpuid(leaf, subleaf, &eax, &ebx, &ecx, &edx);
+
+        const uint8_t kind = eax & 0x1F;
+        if (kind == 0) {
+            break;
+        }
+
+        const uint8_t level = (eax >> 5) & 0x7;
+        if (level < llc_level) {
+            continue;
+        }
+
+        const uint32_t sharing_count = ((eax >> 14) & 0xFFF) + 1;
+
+        llc_level = level;
+        *shift_out =
+            sharing_count > 1
+                ? sizeof_bits(uint32_t) -
+                    count_msb_zero_bits(sharing_count - 1, /*start_index=*/0)
+                : 0;
+
+        found_any = true;
+    }
+
+    return found_any;
+}
+
+static bool get_apic_id_shifts(struct apic_id_shifts *const shifts_out) {
+    uint64_t eax = 0;
+    uint64_t ebx = 0;
+    uint64_t ecx = 0;
+    uint64_t edx = 0;
+
+    cpuid(CPUID_GET_VENDOR_STRING, /*subleaf=*/0, &eax, &ebx, &ecx, &edx);
+    const uint32_t max_leaf = eax;
+
+    cpuid(CPUID_GET_LARGEST_EXTENDED_FUNCTION,
+          /*subleaf=*/0,
+          &eax,
+          &ebx,
+          &ecx,
+          &edx);
+
+    const uint32_t max_ext_leaf = eax;
+    bool found = false;
+
+    if (max_leaf >= CPUID_GET_CPU_TOPOLOGY_V2) {
+        found = get_shifts_from_topology_leaf(CPUID_GET_CPU_TOPOLOGY_V2,
+                                              shifts_out);
+    }
+
+    if (!found && max_leaf >= CPUID_GET_CPU_TOPOLOGY) {
+        found = get_shifts_from_topology_leaf(CPUID_GET_CPU_TOPOLOGY,
+                                              shifts_out);
+    }
+
+    if (!found) {
+        return false;
+    }
+
+    bool found_llc = false;
+    if (max_leaf >= CPUID_GET_CACHE_PARAMETERS) {
+        found_llc =
+            get_llc_shift_from_cache_leaf(CPUID_GET_CACHE_PARAMETERS,
+                                          &shifts_out->llc);
+    }
+
+    if (!found_llc && max_ext_leaf >= CPUID_GET_AMD_CACHE_TOPOLOGY) {
+        found_llc =
+            get_llc_shift_from_cache_leaf(CPUID_GET_AMD_CACHE_TOPOLOGY,
+                                          &shifts_out->llc);
+    }
+
+    if (!found_llc) {
+        shifts_out->llc = shifts_out->package;
+    }
+
+    return true;
+}
+
+bool
+arch_get_cpu_topology(const struct cpu_info *const cpu,
+                      struct cpu_topology *const topology_out)
+{
+    struct apic_id_shifts shifts = {};
+    if (!get_apic_id_shifts(&shifts)) {
+        return false;
+    }
+
+    // There's no cluster level on x86_64, so a cluster is every core sharing
+    // the llc.
+
+    const uint32_t apic_id = cpu->lapic_id;
+
+    topology_out->package_id = apic_id >> shifts.package;
+    topology_out->cluster_id = apic_id >> shifts.llc;
+    topology_out->core_id = apic_id >> shifts.smt;
+    topology_out->thread_id = apic_id;
+    topology_out->llc_id = apic_id >> shifts.llc;
+
+    return true;
+}
@@ -0,0 +1,99 @@
+/*
+ * kernel/src/arch/x86_64/dev/ahci/bench.c
+ * © suhas pai
+ */
+
+#include "dev/printk.h"
+#include "dev/storage/bench.h"
+
+#include "sched/sleep.h"
+#include "time/time.h"
+
+#include "bench.h"
+#include "device.h"
+
+static struct storage_bench g_bench = {0};
+
+static void
+on_complete(struct ahci_hba_port *const port,
+            const bool result,
+            void *const cb_info)
+{
+    (void)port;
+    storage_bench_complete((struct storage_bench_request *)cb_info, result);
+}
+
+__debug_optimize(3) static bool
+submit_request(struct storage_bench_request *const request,
+               const uint64_t chunk)
+{
+    const struct range lba_range =
+        RANGE_INIT(chunk * AHCI_BENCH_REQUEST_SECTORS,
+                   AHCI_BENCH_REQUEST_SECTORS);
+
+    return ahci_hba_port_rw_async(request->bench->cb_info,
+                                  lba_range,
+                                  /*write=*/false,
+                                  page_to_phys(request->page),
+                                  on_complete,
+                                  request);
+}
+
+static void
+bench_port_at_depth(struct ahci_hba_port *const port, const uint32_t depth) {
+    const nsec_t begin = nsec_since_boot();
+    const uint32_t submitted_count = storage_bench_start(&g_bench, depth);
+
+    sched_sleep_us(AHCI_BENCH_DURATION_US);
+
+    const uint64_t complete_count = storage_bench_stop(&g_bench);
+    const nsec_t elapsed = nsec_since_boot() - begin;
+
+    storage_bench_wait(&g_bench);
+    printk(LOGLEVEL_INFO,
+           "ahci: bench: port #%" PRIu8 ": qd%" PRIu32 " (%" PRIu32 " in "
+           "flight): %" PRIu64 " iops, %" PRIu64 " errors\n",
+           port->index + 1,
+           depth,
+           submitted_count,
+           complete_count * NANO_IN_SECONDS / elapsed,
+           atomic_load_explicit(&g_bench.error_count, memory_order_relaxed));
+}
+
+static void bench_port(struct ahci_hba_port *const port) {
+    g_bench.cb_info = port;
+    g_bench.chunk_count = port->sector_count / AHCI_BENCH_REQUEST_SECTORS;
+
+    if (g_bench.chunk_count < AHCI_BENCH_MAX_QUEUE_DEPTH) {
+        printk(LOGLEVEL_WARN,
+               "ahci: bench: port #%" PRIu8 " is too small to benchmark\n",
+               port->index + 1);
+        return;
+    }
+
+    static const uint32_t depth_list[] = { 1, 8, AHCI_BENCH_MAX_QUEUE_DEPTH };
+    carr_foreach(depth_list, iter) {
+        bench_port_at_depth(port, *iter);
+    }
+}
+
+void ahci_bench_run() {
+    struct ahci_hba_device *const hba = ahci_hba_get();
+    struct page_zone *const zone =
+        hba->supports_64bit_dma ? NULL : page_zone_low4g();
+
+    g_bench.submit = submit_request;
+    if (!storage_bench_alloc_buffers(&g_bench, zone)) {
+        printk(LOGLEVEL_WARN, "ahci: bench: failed to alloc buffers\n");
+        return;
+    }
+
+    for (uint8_t index = 0; index != hba->port_count; index++) {
+        struct ahci_hba_port *const port = &hba->port_list[index];
+        if (port->supports_ncq) {
+            bench_port(port);
+        }
+    }
+
+    storage_bench_free_buffers(&g_bench);
+}
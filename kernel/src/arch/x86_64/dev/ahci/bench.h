@@ -0,0 +1,18 @@
+/*
+ * kernel/src/arch/x86_64/dev/ahci/bench.h
+ * © suhas pai
+ */
+
+#pragma once
+
+#include "dev/storage/bench.h"
+#include "lib/time.h"
+
+#define AHCI_BENCH_DURATION_US seconds_to_micro(2)
+#define AHCI_BENCH_REQUEST_SECTORS 8u
+#define AHCI_BENCH_MAX_QUEUE_DEPTH STORAGE_BENCH_MAX_QUEUE_DEPTH
+
+// Keep random 4KiB ncq reads in flight on every port that supports ncq, at
+// queue-depths of 1, 8 and 32, and report the iops reached at each.
+
+void ahci_bench_run();
@@ -12,8 +12,12 @@ static struct ahci_hba_device g_device = {
 
     .port_list = NULL,
 
+    .port_count = 0,
+    .cmd_slot_count = 0,
+
     .supports_64bit_dma = false,
     .supports_staggered_spinup = false,
+    .supports_ncq = false,
 };
 
 __debug_optimize(3) struct ahci_hba_device *ahci_hba_get() {
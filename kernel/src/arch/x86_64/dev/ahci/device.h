@@ -20,10 +20,13 @@ struct ahci_hba_device {
     struct ahci_hba_port *port_list;
 
     volatile struct ahci_spec_hba_regs *regs;
+
     uint8_t port_count;
+    uint8_t cmd_slot_count;
 
     bool supports_64bit_dma : 1;
     bool supports_staggered_spinup : 1;
+    bool supports_ncq : 1;
 };
 
 struct ahci_hba_device *ahci_hba_get();
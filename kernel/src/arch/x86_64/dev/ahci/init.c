@@ -17,6 +17,7 @@
 #include "mm/kmalloc.h"
 #include "sys/mmio.h"
 
+#include "bench.h"
 #include "device.h"
 #include "irq.h"
 
@@ -167,6 +168,23 @@ static bool init_with_regs(volatile struct ahci_spec_hba_regs *const regs) {
     hba->supports_64bit_dma = host_cap & __AHCI_HBA_HOST_CAP_64BIT_DMA;
     hba->supports_staggered_spinup =
         host_cap & __AHCI_HBA_HOST_CAP_SUPPORTS_STAGGERED_SPINUP;
+    hba->supports_ncq = host_cap & __AHCI_HBA_HOST_CAP_NATIVE_CMD_QUEUE;
+
+    // CAP.NCS is 0's based.
+    hba->cmd_slot_count =
+        ((host_cap & __AHCI_HBA_HOST_CAP_CMD_SLOTS_COUNT) >>
+            AHCI_HBA_HOST_CAP_CMD_SLOT_COUNT_SHIFT) + 1;
+
+    printk(LOGLEVEL_INFO,
+           "ahci: hba has %" PRIu8 " command slots per port\n",
+           hba->cmd_slot_count);
+
+    if (hba->supports_ncq) {
+        printk(LOGLEVEL_INFO, "ahci: hba supports native command queuing\n");
+    } else {
+        printk(LOGLEVEL_INFO,
+               "ahci: hba doesn't support native command queuing\n");
+    }
 
     if (hba->supports_64bit_dma) {
         printk(LOGLEVEL_INFO, "ahci: hba supports 64-bit dma\n");
@@ -196,6 +214,10 @@ static bool init_with_regs(volatile struct ahci_spec_hba_regs *const regs) {
     }
 
     printk(LOGLEVEL_INFO, "ahci: fully initialized\n");
+#if defined(AHCI_BENCH)
+    ahci_bench_run();
+#endif /* defined(AHCI_BENCH) */
+
     return true;
 }
 
@@ -242,18 +264,22 @@ static void init_from_pci(struct pci_entity_info *const pci_entity) {
                              __PCI_ENTITY_PRIVL_BUS_MASTER
                            | __PCI_ENTITY_PRIVL_MEM_ACCESS);
 
-    g_hba_vector = isr_alloc_msi_vector(&pci_entity->device, /*msi_index=*/0);
+    const struct cpu_info *const cpu = isr_get_cpu_for_msi();
+
+    g_hba_vector =
+        isr_alloc_msi_vector(&pci_entity->device, /*msi_index=*/0, cpu);
     assert(g_hba_vector != ISR_INVALID_VECTOR);
 
-    isr_set_vector(g_hba_vector, ahci_port_handle_irq, &ARCH_ISR_INFO_NONE());
-    pci_entity_enable_msi(pci_entity);
+    isr_set_msi_vector(cpu,
+                       g_hba_vector,
+                       ahci_port_handle_irq,
+                       &ARCH_ISR_INFO_NONE());
 
-    with_preempt_disabled({
-        pci_entity_bind_msi_to_vector(pci_entity,
-                                      this_cpu(),
-                                      g_hba_vector,
-                                      /*masked=*/false);
-    });
+    pci_entity_enable_msi(pci_entity);
+    pci_entity_bind_msi_to_vector(pci_entity,
+                                  cpu,
+                                  g_hba_vector,
+                                  /*masked=*/false);
 
     volatile struct ahci_spec_hba_regs *const regs =
         pci_entity_bar_get_base(bar);
@@ -286,6 +312,7 @@ static const struct pci_driver pci_driver = {
 
 __driver static const struct driver driver = {
     .name = SV_STATIC("x86_64-ahci-driver"),
+    .flags = __DRIVER_ASYNC_PROBE | __DRIVER_REQUIRED_FOR_BOOT,
     .dtb = NULL,
     .pci = &pci_driver
 };
\ No newline at end of file
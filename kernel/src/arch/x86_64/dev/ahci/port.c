@@ -33,28 +33,89 @@ _Static_assert(
     "AHCI_HBA_CMD_TABLE_PAGE_ORDER is too low to fit all "
     "struct ahci_spec_hba_cmd_table entries");
 
-__debug_optimize(3)
-static uint8_t find_free_cmdhdr(struct ahci_hba_port *const port) {
-    const int flag = spin_acquire_save_irq(&port->lock);
-    if (port->ports_bitset == UINT32_MAX) {
-        spin_release_restore_irq(&port->lock, flag);
+// Commands take a 16-bit sector count.
+#define AHCI_HBA_PORT_MAX_TRANSFER_SECTORS UINT16_MAX
+
+_Static_assert(
+    (uint64_t)AHCI_HBA_PORT_MAX_TRANSFER_SECTORS * SECTOR_SIZE
+        <= AHCI_HBA_MAX_PRDT_ENTRIES * AHCI_HBA_PORT_MAX_COUNT,
+    "AHCI_HBA_PORT_MAX_TRANSFER_SECTORS doesn't fit in a command's prdt");
+
+_Static_assert(
+    sizeof(struct ahci_spec_port_cmdhdr) * AHCI_HBA_CMD_HDR_COUNT
+        + sizeof(struct ahci_spec_hba_fis) <= PAGE_SIZE,
+    "cmd-list and received-fis area don't fit in a single page");
+
+// Caller must hold the port's lock. Non-queued commands can only be issued
+// once no other command is in flight, and have the port to themselves until
+// they complete.
+
+__debug_optimize(3) static uint8_t
+find_free_cmdhdr(struct ahci_hba_port *const port, const bool queued) {
+    if (port->nonqueued_slot != UINT8_MAX) {
         return UINT8_MAX;
     }
 
-    const uint8_t slot =
-       find_lsb_zero_bit(port->ports_bitset, /*start_index=*/0);
+    if (!queued && port->ports_bitset != 0) {
+        return UINT8_MAX;
+    }
 
-    if (!index_in_bounds(slot, sizeof_bits(uint32_t))) {
-        spin_release_restore_irq(&port->lock, flag);
+    const uint32_t free_bitset = port->slot_mask & ~port->ports_bitset;
+    if (free_bitset == 0) {
         return UINT8_MAX;
     }
 
+    const uint8_t slot = find_lsb_one_bit(free_bitset, /*start_index=*/0);
     port->ports_bitset |= 1ul << slot;
-    spin_release_restore_irq(&port->lock, flag);
+
+    if (!queued) {
+        port->nonqueued_slot = slot;
+    }
 
     return slot;
 }
 
+// Caller must hold the port's lock.
+
+__debug_optimize(3) static void
+release_cmdhdr(struct ahci_hba_port *const port, const uint8_t slot) {
+    port->ports_bitset = rm_mask(port->ports_bitset, 1ul << slot);
+    if (port->nonqueued_slot == slot) {
+        port->nonqueued_slot = UINT8_MAX;
+    }
+
+    if (port->slot_waiter_count != 0) {
+        event_trigger(&port->slot_event, /*drop_if_no_listeners=*/false);
+    }
+}
+
+__debug_optimize(3) static uint8_t
+alloc_cmdhdr(struct ahci_hba_port *const port, const bool queued) {
+    while (true) {
+        uint8_t slot = UINT8_MAX;
+        with_spinlock_irq_disabled(&port->lock, {
+            slot = find_free_cmdhdr(port, queued);
+            if (slot == UINT8_MAX) {
+                port->slot_waiter_count++;
+            }
+        });
+
+        if (slot != UINT8_MAX) {
+            return slot;
+        }
+
+        struct event *const event = &port->slot_event;
+        events_await(&event,
+                     /*events_count=*/1,
+                     /*block=*/true,
+                     /*drop_after_recv=*/true);
+
+        with_spinlock_irq_disabled(&port->lock, {
+            port->slot_waiter_count--;
+        });
+    }
+}
+
 #define MAX_ATTEMPTS 100
 
 __debug_optimize(3) static inline
@@ -351,8 +412,12 @@ handle_error(struct ahci_hba_port *const port, const uint32_t interrupt_status)
 
 __debug_optimize(3) static
 void enable_port_interrupts(volatile struct ahci_spec_hba_port *const port) {
+    // Queued commands complete through set-device-bits fises rather than
+    // device-to-host register fises.
+
     mmio_write(&port->interrupt_enable,
                __AHCI_HBA_IE_DEV_TO_HOST_FIS
+             | __AHCI_HBA_IE_SET_DEV_BITS_FIS
              | __AHCI_HBA_IE_PORT_CHANGE
              | __AHCI_HBA_PORT_IE_ERROR_FLAGS);
 }
@@ -363,9 +428,7 @@ handle_irq_for_port(struct ahci_hba_port *const port,
                     const uint32_t index)
 {
     volatile struct ahci_spec_hba_port *const spec = port->spec;
-
     const uint32_t interrupt_status = mmio_read(&spec->interrupt_status);
-    const uint32_t ci = mmio_read(&spec->command_issue);
 
     // Write to interrupt-status to clear bits.
     mmio_write(&spec->interrupt_status, interrupt_status);
@@ -375,17 +438,57 @@ handle_irq_for_port(struct ahci_hba_port *const port,
 
         handle_error(port, interrupt_status);
         with_spinlock_acquired(&port->lock, {
-            finished_cmdhdrs[index] = port->ports_bitset;
+            finished_cmdhdrs[index] = port->issued_bitset;
+            port->issued_bitset = 0;
         });
     } else {
+        // A non-queued command completes once its bit in PxCI clears, while a
+        // queued command only completes once the device clears its bit in
+        // PxSACT through a set-device-bits fis.
+
         with_spinlock_acquired(&port->lock, {
-            finished_cmdhdrs[index] = port->ports_bitset & ~ci;
+            const uint32_t in_flight =
+                mmio_read(&spec->sata_active)
+              | mmio_read(&spec->command_issue);
+
+            finished_cmdhdrs[index] = port->issued_bitset & ~in_flight;
+            port->issued_bitset &= in_flight;
         });
     }
 
     return interrupt_status;
 }
 
+__debug_optimize(3) static void
+complete_cmdhdr(struct ahci_hba_port *const port,
+                const uint8_t slot,
+                const bool result)
+{
+    struct ahci_hba_port_cmdhdr_info *const info =
+        &port->cmdhdr_info_list[slot];
+
+    const ahci_hba_port_callback_t callback = info->callback;
+    if (callback == NULL) {
+        info->result = AWAIT_RESULT_BOOL(result);
+        event_trigger(&info->event, /*drop_if_no_listeners=*/false);
+
+        return;
+    }
+
+    // Free the slot before calling the callback so it can submit another
+    // command in its place.
+
+    void *const cb_info = info->cb_info;
+    with_spinlock_acquired(&port->lock, {
+        info->callback = NULL;
+        info->cb_info = NULL;
+
+        release_cmdhdr(port, slot);
+    });
+
+    callback(port, result, cb_info);
+}
+
 __debug_optimize(3) void
 ahci_port_handle_irq(const uint64_t vector,
                      struct thread_context *const context)
@@ -397,7 +500,7 @@ ahci_port_handle_irq(const uint64_t vector,
     uint8_t port_count = 0;
 
     uint32_t port_interrupt_status[AHCI_HBA_MAX_PORT_COUNT] = {0};
-    uint32_t finished_cmdhdrs[AHCI_HBA_CMD_HDR_COUNT] = {0};
+    uint32_t finished_cmdhdrs[AHCI_HBA_MAX_PORT_COUNT] = {0};
 
     struct ahci_hba_device *const hba = ahci_hba_get();
     const uint32_t pending_ports = mmio_read(&hba->regs->interrupt_status);
@@ -443,12 +546,8 @@ ahci_port_handle_irq(const uint64_t vector,
         const bool result =
             (interrupt_status & __AHCI_HBA_PORT_IS_ERROR_FLAGS) == 0;
 
-        const struct await_result await_result = AWAIT_RESULT_BOOL(result);
         for_each_lsb_one_bit(finished_cmdhdrs[i], /*start_index=*/0, iter) {
-            struct event *const event = &port->cmdhdr_info_list[iter].event;
-            port->cmdhdr_info_list[iter].result = await_result;
-
-            event_trigger(event, /*drop_if_no_listeners=*/false);
+            complete_cmdhdr(port, iter, result);
         }
 
         enable_port_interrupts(port->spec);
@@ -641,10 +740,23 @@ bool ahci_spec_hba_port_init(struct ahci_hba_port *const port) {
     // We assume here that the port is idle.
     assert(ahci_hba_port_is_idle(port));
 
+    struct ahci_hba_device *const hba = ahci_hba_get();
+
+    port->lock = SPINLOCK_INIT();
+    port->ports_bitset = 0;
+    port->issued_bitset = 0;
+    port->slot_mask = (uint32_t)mask_for_n_bits(hba->cmd_slot_count);
+    port->nonqueued_slot = UINT8_MAX;
+    port->slot_waiter_count = 0;
+    port->slot_event = EVENT_INIT();
+    port->supports_ncq = false;
+    port->state = AHCI_HBA_PORT_STATE_OK;
+    port->sector_count = 0;
+
     struct page *cmd_list_page = NULL;
     struct page *cmd_table_pages = NULL;
 
-    const bool supports_64bit_dma = ahci_hba_get()->supports_64bit_dma;
+    const bool supports_64bit_dma = hba->supports_64bit_dma;
     if (supports_64bit_dma) {
         cmd_list_page = alloc_page(PAGE_STATE_USED, __ALLOC_ZERO);
         cmd_table_pages =
@@ -694,6 +806,19 @@ bool ahci_spec_hba_port_init(struct ahci_hba_port *const port) {
         mmio_write(&spec->cmd_list_base_phys_upper32, cmd_list_phys >> 32);
     }
 
+    // The command-list only takes up the first 1KiB of its page, so the
+    // received-fis area, where the set-device-bits fises of queued commands
+    // land, is placed right after it.
+
+    const uint64_t fis_phys =
+        cmd_list_phys
+      + sizeof(struct ahci_spec_port_cmdhdr) * AHCI_HBA_CMD_HDR_COUNT;
+
+    mmio_write(&spec->fis_base_address_lower32, fis_phys);
+    if (supports_64bit_dma) {
+        mmio_write(&spec->fis_base_address_upper32, fis_phys >> 32);
+    }
+
     struct ahci_hba_port_cmdhdr_info *const cmdhdr_info_list =
         kmalloc(sizeof(struct ahci_hba_port_cmdhdr_info)
                 * AHCI_HBA_CMD_HDR_COUNT);
@@ -851,6 +976,28 @@ bool ahci_spec_hba_port_init(struct ahci_hba_port *const port) {
            ident->capabilities & __ATA_IDENTITY_CAP_STANDBY_TIMER_SUPPORTED ?
             "yes" : "no");
 
+    if (port->sig == SATA_SIG_ATA) {
+        const struct ata_identity *const ata_ident = resp_ptr;
+        port->sector_count = ata_ident->max_lba_lower32;
+
+        if (hba->supports_ncq
+         && (ata_ident->sata_capabilities
+                & __ATA_IDENTITY_SATA_CAP_SUPPORTS_NCQ))
+        {
+            const uint8_t queue_depth =
+                (ata_ident->queue_depth & ATA_IDENTITY_QUEUE_DEPTH_MASK) + 1;
+
+            port->supports_ncq = true;
+            port->slot_mask &= (uint32_t)mask_for_n_bits(queue_depth);
+
+            printk(LOGLEVEL_INFO,
+                   "ahci: port #%" PRIu8 " supports ncq with a queue-depth of "
+                   "%" PRIu8 "\n",
+                   port->index + 1,
+                   queue_depth);
+        }
+    }
+
     if (port->sig == SATA_SIG_ATAPI) {
         result =
             ahci_hba_port_send_scsi_command(port,
@@ -904,9 +1051,11 @@ bool ahci_spec_hba_port_init(struct ahci_hba_port *const port) {
     free_page(resp_page);
     if (!storage_device_init(&port->device,
                              SECTOR_SIZE,
+                             AHCI_HBA_PORT_MAX_TRANSFER_SECTORS,
                              ahci_hba_port_read,
                              ahci_hba_port_write))
     {
+        port->supports_ncq = false;
         ahci_hba_port_stop(port);
         vunmap_mmio(mmio);
 
@@ -1003,29 +1152,28 @@ static inline bool fix_any_errors(struct ahci_hba_port *const port) {
 }
 
 __debug_optimize(3)
-static inline uint8_t prepare_port(struct ahci_hba_port *const port) {
-    if (!fix_any_errors(port)) {
-        return UINT8_MAX;
-    }
+static void free_cmdhdr(struct ahci_hba_port *const port, const uint8_t slot) {
+    with_spinlock_irq_disabled(&port->lock, {
+        release_cmdhdr(port, slot);
+    });
+}
 
-    if (!ahci_hba_port_stop_running(port)) {
-        printk(LOGLEVEL_WARN,
-               "ahci: failed to stop port #%" PRIu8 "\n",
-               port->index + 1);
-        return UINT8_MAX;
-    }
+__debug_optimize(3) static inline
+uint8_t prepare_port(struct ahci_hba_port *const port, const bool queued) {
+    // Reset the port while holding a non-queued slot, so that no other command
+    // is in flight while we do.
 
-    const uint8_t slot = find_free_cmdhdr(port);
-    if (slot == UINT8_MAX) {
-        printk(LOGLEVEL_WARN,
-               "ahci-port: port #%" PRIu8 " has no free command-headers\n",
-               port->index + 1);
-        return UINT8_MAX;
+    if (port->state != AHCI_HBA_PORT_STATE_OK) {
+        const uint8_t slot = alloc_cmdhdr(port, /*queued=*/false);
+        const bool fixed = fix_any_errors(port);
+
+        free_cmdhdr(port, slot);
+        if (!fixed) {
+            return UINT8_MAX;
+        }
     }
 
-    // Clear any pending interrupts
-    mmio_write(&port->spec->interrupt_status, 0);
-    return slot;
+    return alloc_cmdhdr(port, queued);
 }
 
 __debug_optimize(3) static void
@@ -1033,7 +1181,7 @@ setup_ata_h2d_fis(struct ahci_spec_hba_cmd_table *const cmd_table,
                   const uint8_t command,
                   const uint16_t feature,
                   const uint64_t sector_offset,
-                  const uint8_t sector_count)
+                  const uint16_t sector_count)
 {
     struct ahci_spec_fis_reg_h2d *const h2d_fis =
         (struct ahci_spec_fis_reg_h2d *)(uint64_t)cmd_table->command_fis;
@@ -1069,6 +1217,8 @@ setup_prdt_table(volatile struct ahci_spec_port_cmdhdr *const cmd_header,
                  const uint32_t flags)
 {
     mmio_write(&cmd_header->flags, flags);
+    mmio_write(&cmd_header->prd_byte_count, 0);
+
     volatile struct ahci_spec_hba_prdt_entry *const entries =
         cmd_table->prdt_entries;
 
@@ -1116,6 +1266,53 @@ setup_prdt_table(volatile struct ahci_spec_port_cmdhdr *const cmd_header,
     mmio_write(&last_entry->flags, last_entry_flags);
 }
 
+__debug_optimize(3) static inline struct ahci_spec_hba_cmd_table *
+cmd_table_for_slot(const struct ahci_hba_port *const port, const uint8_t slot) {
+    return (struct ahci_spec_hba_cmd_table *)phys_to_virt(port->cmdtable_phys)
+         + slot;
+}
+
+__debug_optimize(3) static void
+issue_cmdhdr(struct ahci_hba_port *const port,
+             const uint8_t slot,
+             const bool queued)
+{
+    // For queued commands, PxSACT must be set before PxCI. Both registers
+    // ignore writes of zero bits, so only the slot's bit is written.
+
+    const int flag = spin_acquire_save_irq(&port->lock);
+
+    port->issued_bitset |= 1ul << slot;
+    if (queued) {
+        mmio_write(&port->spec->sata_active, 1ul << slot);
+    }
+
+    mmio_write(&port->spec->command_issue, 1ul << slot);
+    spin_release_restore_irq(&port->lock, flag);
+}
+
+__debug_optimize(3) static bool
+wait_for_cmdhdr(struct ahci_hba_port *const port, const uint8_t slot) {
+    struct event *const event = &port->cmdhdr_info_list[slot].event;
+    events_await(&event,
+                 /*events_count=*/1,
+                 /*block=*/true,
+                 /*drop_after_recv=*/true);
+
+    const struct await_result await_result =
+        port->cmdhdr_info_list[slot].result;
+
+    free_cmdhdr(port, slot);
+    if (!await_result.result_bool) {
+        print_interrupt_status(port->error.interrupt_status);
+
+        print_serr_error(port->error.serr);
+        print_serr_diag(port->error.serr);
+    }
+
+    return await_result.result_bool;
+}
+
 static bool
 send_ata_command(struct ahci_hba_port *const port,
                  const enum ata_command command_kind,
@@ -1130,7 +1327,7 @@ send_ata_command(struct ahci_hba_port *const port,
         return true;
     }
 
-    const uint8_t slot = prepare_port(port);
+    const uint8_t slot = prepare_port(port, /*queued=*/false);
     if (slot == UINT8_MAX) {
         return false;
     }
@@ -1159,15 +1356,17 @@ send_ata_command(struct ahci_hba_port *const port,
             [[fallthrough]];
         case ATA_CMD_WRITE_PIO:
         case ATA_CMD_WRITE_PIO_EXT:
-            flags |= AHCI_HBA_PORT_CMDKIND_WRITE;
+            flags |= __AHCI_PORT_CMDHDR_WRITE;
             break;
+        case ATA_CMD_READ_FPDMA_QUEUED:
+        case ATA_CMD_WRITE_FPDMA_QUEUED:
+            verify_not_reached();
     }
 
     volatile struct ahci_spec_port_cmdhdr *const cmd_header =
         &port->headers[slot];
     struct ahci_spec_hba_cmd_table *const cmd_table =
-        (struct ahci_spec_hba_cmd_table *)phys_to_virt(port->cmdtable_phys)
-        + slot;
+        cmd_table_for_slot(port, slot);
 
     setup_prdt_table(cmd_header, cmd_table, phys_addr, sector_count, flags);
     setup_ata_h2d_fis(cmd_table,
@@ -1176,32 +1375,13 @@ send_ata_command(struct ahci_hba_port *const port,
                       sector_offset,
                       sector_count);
 
-    if (!wait_for_tfd_idle(port) || !ahci_hba_port_start_running(port)) {
+    if (!wait_for_tfd_idle(port)) {
+        free_cmdhdr(port, slot);
         return false;
     }
 
-    struct event *const event = &port->cmdhdr_info_list[slot].event;
-
-    mmio_write(&port->spec->command_issue, 1ull << slot);
-    assert(
-        events_await(&event,
-                     /*event_count=*/1,
-                     /*block=*/true,
-                     /*drop_after_recv=*/true) == 0);
-
-    struct await_result await_result = port->cmdhdr_info_list[slot].result;
-    with_spinlock_irq_disabled(&port->lock, {
-        port->ports_bitset = rm_mask(port->ports_bitset, 1ull << slot);
-    });
-
-    if (!await_result.result_bool) {
-        print_interrupt_status(port->error.interrupt_status);
-
-        print_serr_error(port->error.serr);
-        print_serr_diag(port->error.serr);
-    }
-
-    return await_result.result_bool;
+    issue_cmdhdr(port, slot, /*queued=*/false);
+    return wait_for_cmdhdr(port, slot);
 }
 
 __debug_optimize(3) static void
@@ -1238,7 +1418,7 @@ send_atapi_command(struct ahci_hba_port *const port,
         return true;
     }
 
-    const uint8_t slot = prepare_port(port);
+    const uint8_t slot = prepare_port(port, /*queued=*/false);
     if (slot == UINT8_MAX) {
         return false;
     }
@@ -1250,8 +1430,7 @@ send_atapi_command(struct ahci_hba_port *const port,
     volatile struct ahci_spec_port_cmdhdr *const cmd_header =
         &port->headers[slot];
     struct ahci_spec_hba_cmd_table *const cmd_table =
-        (struct ahci_spec_hba_cmd_table *)phys_to_virt(port->cmdtable_phys)
-      + slot;
+        cmd_table_for_slot(port, slot);
 
     setup_prdt_table(cmd_header, cmd_table, phys_addr, sector_count, flags);
     setup_ata_h2d_fis(cmd_table,
@@ -1263,32 +1442,109 @@ send_atapi_command(struct ahci_hba_port *const port,
     volatile uint8_t *const atapi_cmd = cmd_table->atapi_command;
     setup_atapi_command(atapi_cmd, command_kind, sector_offset, sector_count);
 
-    if (!wait_for_tfd_idle(port) || !ahci_hba_port_start_running(port)) {
+    if (!wait_for_tfd_idle(port)) {
+        free_cmdhdr(port, slot);
         return false;
     }
 
-    struct event *const event = &port->cmdhdr_info_list[slot].event;
+    issue_cmdhdr(port, slot, /*queued=*/false);
+    return wait_for_cmdhdr(port, slot);
+}
 
-    mmio_write(&port->spec->command_issue, 1ull << slot);
-    assert(
-        events_await(&event,
-                     /*event_count=*/1,
-                     /*block=*/true,
-                     /*drop_after_recv=*/true) == 0);
+// Caller must have allocated a queued slot.
 
-    struct await_result await_result = port->cmdhdr_info_list[slot].result;
-    with_spinlock_irq_disabled(&port->lock, {
-        port->ports_bitset = rm_mask(port->ports_bitset, 1ull << slot);
-    });
+__debug_optimize(3) static void
+issue_ncq_command(struct ahci_hba_port *const port,
+                  const uint8_t slot,
+                  const struct range lba_range,
+                  const bool write,
+                  const uint64_t phys_addr)
+{
+    uint16_t flags = sizeof(struct ahci_spec_fis_reg_h2d) / sizeof(uint32_t);
+    if (write) {
+        flags |= __AHCI_PORT_CMDHDR_WRITE;
+    }
 
-    if (!await_result.result_bool) {
-        print_interrupt_status(port->error.interrupt_status);
+    volatile struct ahci_spec_port_cmdhdr *const cmd_header =
+        &port->headers[slot];
+    struct ahci_spec_hba_cmd_table *const cmd_table =
+        cmd_table_for_slot(port, slot);
 
-        print_serr_error(port->error.serr);
-        print_serr_diag(port->error.serr);
+    setup_prdt_table(cmd_header, cmd_table, phys_addr, lba_range.size, flags);
+
+    // Queued commands carry their sector-count in the feature field, and their
+    // tag in bits 7:3 of the count field. A sector-count of 0 means 65536
+    // sectors, which we never send.
+
+    setup_ata_h2d_fis(cmd_table,
+                      write ?
+                        ATA_CMD_WRITE_FPDMA_QUEUED : ATA_CMD_READ_FPDMA_QUEUED,
+                      /*feature=*/(uint16_t)lba_range.size,
+                      lba_range.front,
+                      /*sector_count=*/(uint16_t)slot << ATA_NCQ_TAG_SHIFT);
+
+    issue_cmdhdr(port, slot, /*queued=*/true);
+}
+
+static bool
+send_ncq_command(struct ahci_hba_port *const port,
+                 const bool write,
+                 const uint64_t sector_offset,
+                 const uint16_t sector_count,
+                 const uint64_t phys_addr)
+{
+    if (__builtin_expect(sector_count == 0, 0)) {
+        printk(LOGLEVEL_WARN,
+               "ahci-port: port #%" PRIu8 " got a ncq request of 0 sectors\n",
+               port->index + 1);
+        return true;
     }
 
-    return await_result.result_bool;
+    const uint8_t slot = prepare_port(port, /*queued=*/true);
+    if (slot == UINT8_MAX) {
+        return false;
+    }
+
+    issue_ncq_command(port,
+                      slot,
+                      RANGE_INIT(sector_offset, sector_count),
+                      write,
+                      phys_addr);
+
+    return wait_for_cmdhdr(port, slot);
+}
+
+bool
+ahci_hba_port_rw_async(struct ahci_hba_port *const port,
+                       const struct range lba_range,
+                       const bool write,
+                       const uint64_t phys,
+                       const ahci_hba_port_callback_t callback,
+                       void *const cb_info)
+{
+    assert(callback != NULL);
+    assert(lba_range.size != 0
+        && lba_range.size <= AHCI_HBA_PORT_MAX_TRANSFER_SECTORS);
+
+    if (!port->supports_ncq || port->state != AHCI_HBA_PORT_STATE_OK) {
+        return false;
+    }
+
+    const int flag = spin_acquire_save_irq(&port->lock);
+    const uint8_t slot = find_free_cmdhdr(port, /*queued=*/true);
+
+    if (slot == UINT8_MAX) {
+        spin_release_restore_irq(&port->lock, flag);
+        return false;
+    }
+
+    port->cmdhdr_info_list[slot].callback = callback;
+    port->cmdhdr_info_list[slot].cb_info = cb_info;
+
+    spin_release_restore_irq(&port->lock, flag);
+    issue_ncq_command(port, slot, lba_range, write, phys);
+
+    return true;
 }
 
 bool
@@ -1321,6 +1577,14 @@ ahci_hba_port_send_scsi_command(struct ahci_hba_port *const port,
         case SCSI_CMD_READ:
             switch (port->sig) {
                 case SATA_SIG_ATA:
+                    if (port->supports_ncq) {
+                        return send_ncq_command(port,
+                                                /*write=*/false,
+                                                request.read.position,
+                                                request.read.length,
+                                                phys_addr);
+                    }
+
                     return send_ata_command(port,
                                             ATA_CMD_READ_DMA_EXT,
                                             request.read.position,
@@ -1341,6 +1605,14 @@ ahci_hba_port_send_scsi_command(struct ahci_hba_port *const port,
         case SCSI_CMD_WRITE:
             switch (port->sig) {
                 case SATA_SIG_ATA:
+                    if (port->supports_ncq) {
+                        return send_ncq_command(port,
+                                                /*write=*/true,
+                                                request.read.position,
+                                                request.read.length,
+                                                phys_addr);
+                    }
+
                     return send_ata_command(port,
                                             ATA_CMD_WRITE_DMA_EXT,
                                             request.read.position,
@@ -13,13 +13,29 @@
 
 #include "structs.h"
 
+struct ahci_hba_port;
+typedef void
+(*ahci_hba_port_callback_t)(struct ahci_hba_port *port,
+                            bool result,
+                            void *cb_info);
+
 struct ahci_hba_port_cmdhdr_info {
     struct event event;
     struct await_result result;
+
+    // Called from the irq handler once the command completes. Commands without
+    // a callback are waited on through `event` instead.
+
+    ahci_hba_port_callback_t callback;
+    void *cb_info;
 };
 
 #define AHCI_HBA_PORT_CMDHDR_INFO_INIT() \
-    ((struct ahci_hba_port_cmdhdr_info){ .event = EVENT_INIT() })
+    ((struct ahci_hba_port_cmdhdr_info){ \
+        .event = EVENT_INIT(), \
+        .callback = NULL, \
+        .cb_info = NULL \
+    })
 
 enum ahci_hba_port_state {
     AHCI_HBA_PORT_STATE_OK,
@@ -36,10 +52,29 @@ struct ahci_hba_port {
     struct mmio_region *mmio;
     struct spinlock lock;
 
+    // Slots that are allocated, and the subset of those whose commands were
+    // issued to the hba and haven't completed yet.
+
     uint32_t ports_bitset;
+    uint32_t issued_bitset;
+
+    // Slots that can be allocated. For ports using ncq, slot indices double as
+    // ncq tags, so this is limited to the device's queue-depth.
+
+    uint32_t slot_mask;
+
+    // Non-queued commands can't be issued while other commands are in flight,
+    // so they hold the port to themselves while in flight.
+
+    uint8_t nonqueued_slot;
     uint8_t index;
 
+    uint32_t slot_waiter_count;
+    struct event slot_event;
+
     bool result : 1;
+    bool supports_ncq : 1;
+
     enum ahci_hba_port_state state : 1;
 
     union {
@@ -50,6 +85,8 @@ struct ahci_hba_port {
     };
 
     uint64_t cmdtable_phys;
+    uint64_t sector_count;
+
     enum sata_sig sig;
 };
 
@@ -68,3 +105,17 @@ bool
 ahci_hba_port_send_scsi_command(struct ahci_hba_port *port,
                                 struct scsi_request quest,
                                 uint64_t phys_addr);
+
+// Issue an ncq read or write of `lba_range` to or from the physically
+// contiguous buffer at `phys` without waiting for it to complete. `callback`
+// is called from the port's irq handler once it does, so it may itself submit
+// another command. Returns false if the port doesn't support ncq, or has no
+// free command-slots.
+
+bool
+ahci_hba_port_rw_async(struct ahci_hba_port *port,
+                       struct range lba_range,
+                       bool write,
+                       uint64_t phys,
+                       ahci_hba_port_callback_t callback,
+                       void *cb_info);
@@ -368,6 +368,7 @@ static const struct pci_driver pci_driver = {
 
 __driver static const struct driver driver = {
     .name = SV_STATIC("ide-driver"),
+    .flags = __DRIVER_ASYNC_PROBE,
     .dtb = NULL,
     .pci = &pci_driver
 };
\ No newline at end of file
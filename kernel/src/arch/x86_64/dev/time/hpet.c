@@ -58,6 +58,7 @@ static struct mmio_region *g_hpet_mmio = NULL;
 static volatile struct hpet_addrspace *g_addrspace = NULL;
 
 static uint64_t g_frequency = 0;
+static fsec_t g_period = 0;
 
 static bitset_decl(g_bitset, sizeof_field(struct hpet_addrspace, timers));
 static struct spinlock g_lock = SPINLOCK_INIT();
@@ -65,15 +66,26 @@ static struct spinlock g_lock = SPINLOCK_INIT();
 static uint8_t g_timer_count = 0;
 static struct event g_bitset_event = EVENT_INIT();
 
-__debug_optimize(3) fsec_t hpet_get_femto() {
+__debug_optimize(3) uint64_t hpet_get_counter() {
     assert_msg(g_addrspace != NULL,
-               "hpet: hpet_get_femto() called before init");
+               "hpet: hpet_get_counter() called before init");
 
     return mmio_read(&g_addrspace->main_counter_value);
 }
 
+__debug_optimize(3) fsec_t hpet_get_period_femto() {
+    return g_period;
+}
+
+__debug_optimize(3) nsec_t hpet_get_nano() {
+    // Split the counter so the multiply by the period doesn't overflow.
+    const uint64_t counter = hpet_get_counter();
+    return (counter / FEMTO_IN_NANO) * g_period
+         + femto_to_nano((counter % FEMTO_IN_NANO) * g_period);
+}
+
 __debug_optimize(3) usec_t hpet_read() {
-    return femto_to_micro(hpet_get_femto());
+    return nano_to_micro(hpet_get_nano());
 }
 
 void hpet_oneshot_fsec(const fsec_t fsec) {
@@ -149,6 +161,7 @@ void hpet_init(const struct acpi_hpet *const hpet) {
            femto_to_nano(main_counter_period),
            femto_mod_nano(main_counter_period));
 
+    g_period = main_counter_period;
     g_frequency = femto_period_to_hz_freq(main_counter_period);
     printk(LOGLEVEL_INFO,
            "hpet: frequency is " FREQ_TO_UNIT_FMT "\n",
@@ -11,4 +11,7 @@
 void hpet_init(const struct acpi_hpet *hpet);
 void hpet_oneshot_fsec(fsec_t fsec);
 
-uint64_t hpet_get_femto();
+uint64_t hpet_get_counter();
+fsec_t hpet_get_period_femto();
+
+nsec_t hpet_get_nano();
@@ -4,14 +4,18 @@
  */
 
 #include "dev/time/hpet.h"
+#include "dev/time/tsc.h"
 #include "dev/pit.h"
 
 #include "lib/time.h"
 #include "sys/boot.h"
 
 __debug_optimize(3) nsec_t nsec_since_boot() {
-    return seconds_to_nano((sec_t)boot_get_time())
-         + femto_to_nano(hpet_get_femto());
+    if (__builtin_expect(tsc_is_clocksource(), 1)) {
+        return tsc_read_nano();
+    }
+
+    return seconds_to_nano((sec_t)boot_get_time()) + hpet_get_nano();
 }
 
 void arch_init_time() {
@@ -19,4 +23,5 @@ void arch_init_time() {
     // frequency
 
     pit_init(PIT_DEFAULT_FLAGS, PIT_GRANULARITY_5_MS);
-}
\ No newline at end of file
+    tsc_init();
+}
@@ -0,0 +1,279 @@
+/*
+ * kernel/src/arch/x86_64/dev/time/tsc.c
+ * © suhas pai
+ */
+
+#include "asm/cpuid.h"
+#include "asm/irqs.h"
+#include "asm/msr.h"
+#include "asm/pause.h"
+
+#include "cpu/info.h"
+#include "cpu/spinlock.h"
+#include "dev/printk.h"
+
+#include "lib/freq.h"
+#include "time/clock.h"
+#include "time/time.h"
+
+#include "hpet.h"
+#include "tsc.h"
+
+#define TSC_CALIBRATE_NANO (10 * NANO_IN_MILLI)
+#define TSC_SYNC_CHECK_MILLI 2
+#define TSC_CONVERSION_SHIFT 32
+
+struct tsc_conversion g_tsc_cycles_to_nano = {
+    .mult = 0,
+    .shift = TSC_CONVERSION_SHIFT
+};
+
+struct tsc_conversion g_tsc_micro_to_cycles = {
+    .mult = 0,
+    .shift = TSC_CONVERSION_SHIFT
+};
+
+static uint64_t g_frequency = 0;
+static bool g_is_clocksource = false;
+
+// Readings are relative to the time when the tsc became the clocksource, so
+// the clock doesn't jump when switching over from the hpet.
+
+static uint64_t g_base_cycles = 0;
+static nsec_t g_base_nano = 0;
+
+static int64_t g_bsp_tsc_adjust = 0;
+static struct clock g_clock;
+
+static struct spinlock g_sync_lock = SPINLOCK_INIT();
+static uint64_t g_sync_last_cycles = 0;
+static uint64_t g_sync_max_warp = 0;
+static uint64_t g_sync_warp_count = 0;
+
+static _Atomic uint32_t g_sync_start_count = 0;
+static _Atomic uint32_t g_sync_stop_count = 0;
+
+__debug_optimize(3) nsec_t tsc_read_nano() {
+    const uint64_t cycles = rdtsc();
+    if (__builtin_expect(cycles < g_base_cycles, 0)) {
+        return g_base_nano;
+    }
+
+    return g_base_nano + tsc_cycles_to_nano(cycles - g_base_cycles);
+}
+
+__debug_optimize(3) bool tsc_is_clocksource() {
+    return g_is_clocksource;
+}
+
+__debug_optimize(3) uint64_t tsc_get_frequency() {
+    return g_frequency;
+}
+
+static time_t tsc_clock_read(const struct clock *const clock) {
+    (void)clock;
+    return (time_t)tsc_read_nano();
+}
+
+static uint64_t frequency_from_cpuid() {
+    uint64_t eax, ebx, ecx, edx;
+    cpuid(CPUID_GET_VENDOR_STRING, /*subleaf=*/0, &eax, &ebx, &ecx, &edx);
+
+    if (eax < CPUID_GET_TSC_FREQ_INFO) {
+        return 0;
+    }
+
+    // eax and ebx are the denominator and numerator of the ratio of the tsc
+    // frequency to the core crystal clock frequency, which is in ecx.
+
+    cpuid(CPUID_GET_TSC_FREQ_INFO, /*subleaf=*/0, &eax, &ebx, &ecx, &edx);
+    if (eax == 0 || ebx == 0 || ecx == 0) {
+        return 0;
+    }
+
+    return ecx * ebx / eax;
+}
+
+static uint64_t frequency_from_hpet() {
+    nsec_t begin_nano = 0;
+    nsec_t end_nano = 0;
+
+    uint64_t begin_cycles = 0;
+    uint64_t end_cycles = 0;
+
+    with_interrupts_disabled({
+        begin_nano = hpet_get_nano();
+        begin_cycles = rdtsc_ordered();
+
+        do {
+            end_nano = hpet_get_nano();
+        } while (end_nano - begin_nano < TSC_CALIBRATE_NANO);
+
+        end_cycles = rdtsc_ordered();
+    });
+
+    return (end_cycles - begin_cycles) * NANO_IN_SECONDS
+         / (end_nano - begin_nano);
+}
+
+static void setup_conversions(const uint64_t frequency) {
+    g_tsc_cycles_to_nano.mult =
+        (NANO_IN_SECONDS << TSC_CONVERSION_SHIFT) / frequency;
+
+    // Split the frequency so the shift doesn't overflow.
+    g_tsc_micro_to_cycles.mult =
+        ((frequency / MICRO_IN_SECONDS) << TSC_CONVERSION_SHIFT)
+      + (((frequency % MICRO_IN_SECONDS) << TSC_CONVERSION_SHIFT)
+            / MICRO_IN_SECONDS);
+}
+
+void tsc_init() {
+    const struct cpu_capabilities *const caps = get_cpu_capabilities();
+    if (!caps->supports_invariant_tsc) {
+        printk(LOGLEVEL_WARN,
+               "tsc: tsc is not invariant, using hpet as clocksource\n");
+        return;
+    }
+
+    const char *source = "cpuid";
+    uint64_t frequency = frequency_from_cpuid();
+
+    if (frequency == 0) {
+        source = "hpet";
+        frequency = frequency_from_hpet();
+    }
+
+    if (frequency == 0) {
+        printk(LOGLEVEL_WARN,
+               "tsc: failed to calibrate, using hpet as clocksource\n");
+        return;
+    }
+
+    g_frequency = frequency;
+    setup_conversions(frequency);
+
+    if (caps->supports_tsc_adjust) {
+        g_bsp_tsc_adjust = (int64_t)msr_read(IA32_MSR_TSC_ADJUST);
+    }
+
+    with_interrupts_disabled({
+        g_base_nano = nsec_since_boot();
+        g_base_cycles = rdtsc_ordered();
+        g_is_clocksource = true;
+    });
+
+    g_clock.name = SV_STATIC("tsc");
+    g_clock.resolution = CLOCK_RES_NANO;
+    g_clock.one_shot_capable = false;
+
+    g_clock.read = tsc_clock_read;
+    g_clock.enable = NULL;
+    g_clock.disable = NULL;
+    g_clock.oneshot = NULL;
+
+    clock_add(&g_clock);
+    printk(LOGLEVEL_INFO,
+           "tsc: frequency is " FREQ_TO_UNIT_FMT " (from %s), using tsc as "
+           "clocksource\n",
+           FREQ_TO_UNIT_FMT_ARGS_ABBREV(frequency),
+           source);
+}
+
+// Both cpus repeatedly read their tsc and compare it against the last reading
+// by either cpu. A reading that's behind the last one means the two tscs
+// aren't in sync.
+
+static void check_warp() {
+    const uint64_t end =
+        rdtsc_ordered()
+      + g_frequency / MILLI_IN_SECOND * TSC_SYNC_CHECK_MILLI;
+
+    while (true) {
+        uint64_t prev = 0;
+        uint64_t now = 0;
+
+        with_spinlock_acquired(&g_sync_lock, {
+            prev = g_sync_last_cycles;
+            now = rdtsc_ordered();
+
+            g_sync_last_cycles = now;
+            if (prev > now) {
+                g_sync_warp_count++;
+                g_sync_max_warp = max(g_sync_max_warp, prev - now);
+            }
+        });
+
+        if (now >= end) {
+            break;
+        }
+    }
+}
+
+static void
+wait_for_count(_Atomic uint32_t *const count, const uint32_t value) {
+    while (atomic_load_explicit(count, memory_order_acquire) != value) {
+        cpu_pause();
+    }
+}
+
+void tsc_sync_source() {
+    if (!g_is_clocksource) {
+        return;
+    }
+
+    atomic_fetch_add_explicit(&g_sync_start_count, 1, memory_order_acq_rel);
+    wait_for_count(&g_sync_start_count, 2);
+
+    check_warp();
+    wait_for_count(&g_sync_stop_count, 1);
+
+    if (g_sync_warp_count != 0) {
+        printk(LOGLEVEL_WARN,
+               "tsc: cpus are out of sync by up to %" PRIu64 " cycles, using "
+               "hpet as clocksource\n",
+               g_sync_max_warp);
+
+        g_is_clocksource = false;
+    }
+
+    // Reset for the next cpu before letting the target continue.
+
+    g_sync_last_cycles = 0;
+    g_sync_max_warp = 0;
+    g_sync_warp_count = 0;
+
+    atomic_store_explicit(&g_sync_start_count, 0, memory_order_relaxed);
+    atomic_fetch_add_explicit(&g_sync_stop_count, 1, memory_order_acq_rel);
+}
+
+void tsc_sync_target() {
+    if (!g_is_clocksource) {
+        return;
+    }
+
+    // Firmware may have written to this cpu's tsc, which is recorded in its
+    // IA32_TSC_ADJUST msr. Undo it by matching the bsp's value.
+
+    if (get_cpu_capabilities()->supports_tsc_adjust) {
+        const int64_t adjust = (int64_t)msr_read(IA32_MSR_TSC_ADJUST);
+        if (adjust != g_bsp_tsc_adjust) {
+            printk(LOGLEVEL_WARN,
+                   "tsc: cpu has tsc-adjust of %" PRId64 ", but bsp has %"
+                   PRId64 ", resetting\n",
+                   adjust,
+                   g_bsp_tsc_adjust);
+
+            msr_write(IA32_MSR_TSC_ADJUST, (uint64_t)g_bsp_tsc_adjust);
+        }
+    }
+
+    atomic_fetch_add_explicit(&g_sync_start_count, 1, memory_order_acq_rel);
+    wait_for_count(&g_sync_start_count, 2);
+
+    check_warp();
+
+    atomic_fetch_add_explicit(&g_sync_stop_count, 1, memory_order_acq_rel);
+    wait_for_count(&g_sync_stop_count, 2);
+
+    atomic_store_explicit(&g_sync_stop_count, 0, memory_order_relaxed);
+}
@@ -0,0 +1,50 @@
+/*
+ * kernel/src/arch/x86_64/dev/time/tsc.h
+ * © suhas pai
+ */
+
+#pragma once
+
+#include "asm/tsc.h"
+#include "lib/time.h"
+
+// Calibrate the tsc and, if it's invariant, use it as the clocksource. Must be
+// called after the hpet is initialized.
+
+void tsc_init();
+
+// Called on the bsp while an ap is booting, and on the ap during its bringup,
+// to check that both cpus' tscs are in sync.
+
+void tsc_sync_source();
+void tsc_sync_target();
+
+bool tsc_is_clocksource();
+uint64_t tsc_get_frequency();
+
+// Conversions use a precomputed multiplier and shift, instead of a division.
+
+struct tsc_conversion {
+    uint64_t mult;
+    uint8_t shift;
+};
+
+extern struct tsc_conversion g_tsc_cycles_to_nano;
+extern struct tsc_conversion g_tsc_micro_to_cycles;
+
+__debug_optimize(3) static inline uint64_t
+tsc_convert(const struct tsc_conversion *const conv, const uint64_t value) {
+    return (uint64_t)(((__uint128_t)value * conv->mult) >> conv->shift);
+}
+
+__debug_optimize(3)
+static inline nsec_t tsc_cycles_to_nano(const uint64_t cycles) {
+    return tsc_convert(&g_tsc_cycles_to_nano, cycles);
+}
+
+__debug_optimize(3)
+static inline uint64_t tsc_micro_to_cycles(const usec_t usec) {
+    return tsc_convert(&g_tsc_micro_to_cycles, usec);
+}
+
+nsec_t tsc_read_nano();
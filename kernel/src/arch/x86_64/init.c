@@ -10,7 +10,9 @@
 #include "cpu/smp.h"
 #include "cpu/util.h"
 
+#include "dev/time/tsc.h"
 #include "mm/init.h"
+#include "mm/shootdown.h"
 #include "sched/scheduler.h"
 
 #include "sys/gdt.h"
@@ -21,7 +23,7 @@ void arch_early_init() {
 }
 
 void arch_post_mm_init() {
-
+    cpu_post_mm_init();
 }
 
 void sched_set_current_thread(struct thread *thread);
@@ -40,7 +42,10 @@ __debug_optimize(3) void arch_init_for_smp(struct limine_smp_info *const info) {
     sched_set_current_thread(cpu->idle_thread);
     switch_to_pagemap(&kernel_process.pagemap);
 
+    tsc_sync_target();
     lapic_init();
+    tlb_shootdown_init_on_cpu();
+
     atomic_store_explicit(&smp_info->booted, true, memory_order_seq_cst);
 
     // On cpu init, we point current-thread to the idle-thread, so we have to
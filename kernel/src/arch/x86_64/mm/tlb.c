@@ -3,26 +3,71 @@
  * © suhas pai
  */
 
+#include "apic/lapic.h"
+#include "asm/cr.h"
 #include "asm/tlb.h"
-#include "mm/page_alloc.h"
+#include "cpu/isr.h"
+#include "mm/mm_types.h"
 
 #include "tlb.h"
 
-__debug_optimize(3) static void tlb_flush_range(const struct range range) {
-    range_iterate(range, addr, PAGE_SIZE) {
-        invlpg(addr);
+static isr_vector_t g_shootdown_vector = 0;
+
+__debug_optimize(3) static void tlb_flush_all(const bool global) {
+    // Loading cr3 without the no-flush bit flushes the current pcid's entries.
+    if (!global) {
+        write_cr3(read_cr3());
+        return;
     }
-}
 
-__debug_optimize(3) void tlb_flush_pageop(struct pageop *const pageop) {
-    tlb_flush_range(pageop->flush_range);
+    // Global pages, and the entries of every pcid, are only flushed by
+    // toggling CR4.PGE.
+    const uint64_t cr4 = read_cr4();
+
+    write_cr4(rm_mask(cr4, __CR4_BIT_PGE));
+    write_cr4(cr4);
+}
 
-    struct page *page = NULL;
-    struct page *tmp = NULL;
+__debug_optimize(3)
+void tlb_flush_local(const struct tlb_flush_batch *const batch) {
+    if (batch->full) {
+        tlb_flush_all(batch->global);
+        return;
+    }
 
-    list_foreach_mut(page, tmp, &pageop->delayed_free, table.delayed_free_list)
-    {
-        list_deinit(&page->table.delayed_free_list);
-        free_page(page);
+    // invlpg flushes the page's translation for the current pcid, along with
+    // its global translation.
+    for (uint8_t i = 0; i != batch->range_count; i++) {
+        range_iterate(batch->range_list[i], addr, PAGE_SIZE) {
+            invlpg(addr);
+        }
     }
-}
\ No newline at end of file
+}
+
+__debug_optimize(3) uint16_t tlb_get_max_asid() {
+    return get_cpu_capabilities()->supports_pcid ? __CR3_PCID : 0;
+}
+
+__debug_optimize(3) static void
+handle_shootdown_ipi(const uint64_t intr_no,
+                     struct thread_context *const frame)
+{
+    (void)frame;
+
+    tlb_shootdown_handle_pending();
+    isr_eoi(intr_no);
+}
+
+void tlb_init_shootdown_ipi() {
+    g_shootdown_vector = isr_alloc_vector();
+    assert(g_shootdown_vector != ISR_INVALID_VECTOR);
+
+    isr_set_vector(g_shootdown_vector,
+                   handle_shootdown_ipi,
+                   &ARCH_ISR_INFO_NONE());
+}
+
+__debug_optimize(3)
+void tlb_send_shootdown_ipi(const struct cpu_info *const cpu) {
+    lapic_send_ipi(cpu->lapic_id, g_shootdown_vector);
+}
@@ -4,6 +4,10 @@
  */
 
 #pragma once
-#include "mm/pageop.h"
+#include "mm/shootdown.h"
 
-void tlb_flush_pageop(struct pageop *pageop);
+void tlb_flush_local(const struct tlb_flush_batch *batch);
+uint16_t tlb_get_max_asid();
+
+void tlb_init_shootdown_ipi();
+void tlb_send_shootdown_ipi(const struct cpu_info *cpu);
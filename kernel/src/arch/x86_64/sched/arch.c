@@ -4,14 +4,13 @@
  */
 
 #include "asm/context.h"
-#include "asm/xsave.h"
-
-#include "mm/kmalloc.h"
 #include "mm/page_alloc.h"
 
 #include "sched/process.h"
 #include "sched/thread.h"
 
+#include "fpu.h"
+
 #define KERNEL_STACK_SIZE_ORDER 2
 #define USER_STACK_SIZE_ORDER 2
 
@@ -23,21 +22,26 @@ __debug_optimize(3) void
 sched_thread_arch_info_init(struct thread *const thread,
                             const void *const entry)
 {
-    if (thread->process == &kernel_process) {
-        thread->arch_info.avx_state =
-            kmalloc(sizeof(struct xsave_fx_legacy_regs));
-    } else {
-        thread->arch_info.avx_state = kmalloc(sizeof(struct xsave_avx_state));
-    }
+    thread->arch_info.xsave_page = NULL;
+    thread->arch_info.xsave_order = 0;
+    thread->arch_info.fpu_in_use = 0;
+    thread->arch_info.fpu_cpu = NULL;
 
     thread->arch_info.kernel_stack =
         alloc_pages(PAGE_STATE_KERNEL_STACK,
                     __ALLOC_ZERO,
                     KERNEL_STACK_SIZE_ORDER);
 
-    assert(thread->arch_info.avx_state != NULL);
     assert(thread->arch_info.kernel_stack != NULL);
 
+    // Kernel threads never touch the fpu, so only user threads need a buffer
+    // for it, which is allocated here as it can't be once the thread runs.
+
+    if (thread->process != &kernel_process) {
+        const bool alloced_fpu_state = fpu_alloc_state(thread);
+        assert(alloced_fpu_state);
+    }
+
     void *const stack = page_to_virt(thread->arch_info.kernel_stack);
     thread->context =
         THREAD_CONTEXT_INIT(thread->process,
@@ -4,6 +4,7 @@
  */
 
 #pragma once
+#include <stdint.h>
 
 struct process_arch_info {
 
@@ -12,9 +13,20 @@ struct process_arch_info {
 struct process;
 void sched_process_arch_info_init(struct process *process);
 
+struct cpu_info;
 struct thread_arch_info {
     struct page *kernel_stack;
-    void *avx_state;
+
+    // Only allocated for user threads, see fpu_alloc_state().
+
+    struct page *xsave_page;
+    uint8_t xsave_order;
+
+    // The features that weren't in their initial state when the thread was
+    // last switched out, and the cpu it last loaded its fpu state on.
+
+    uint32_t fpu_in_use;
+    struct cpu_info *fpu_cpu;
 };
 
 struct thread;
@@ -0,0 +1,115 @@
+/*
+ * kernel/src/arch/x86_64/sched/fpu.c
+ * © suhas pai
+ */
+
+#include "asm/xsave.h"
+#include "cpu/info.h"
+
+#include "mm/page_alloc.h"
+#include "sched/thread.h"
+
+#include "fpu.h"
+
+// Restoring from a buffer whose header has every feature in its initial state
+// resets the registers without reading anything other than MXCSR.
+
+static struct {
+    struct xsave_fx_regs fx;
+    struct xsave_header header;
+} __aligned(64) g_init_state = {
+    .fx.legacy.mxcsr = XSAVE_MXCSR_INIT,
+    .header.xstate_bv = 0,
+    .header.xcomp_bv = 0,
+};
+
+bool fpu_alloc_state(struct thread *const thread) {
+    const uint16_t size = get_cpu_capabilities()->xsave_buffer_size;
+
+    uint8_t order = 0;
+    while ((PAGE_SIZE << order) < size) {
+        order++;
+    }
+
+    struct page *const page = alloc_pages(PAGE_STATE_USED, __ALLOC_ZERO, order);
+    if (page == NULL) {
+        return false;
+    }
+
+    thread->arch_info.xsave_page = page;
+    thread->arch_info.xsave_order = order;
+
+    return true;
+}
+
+__debug_optimize(3)
+void fpu_save(struct thread *const thread, struct cpu_info *const cpu) {
+    const xsave_feat_mask_t features =
+        get_cpu_capabilities()->xsave_user_features;
+
+    // A thread whose every feature is still in its initial state has nothing
+    // worth saving, and is restored from g_init_state instead.
+
+    xsave_feat_mask_t in_use = features;
+    if (static_key_enabled(&g_cpu_xinuse_key)) {
+        in_use &= xsave_get_features_in_use();
+        if (xsave_read_mxcsr() != XSAVE_MXCSR_INIT) {
+            in_use |= features & __XSAVE_FEAT_MASK(XSAVE_FEAT_SSE);
+        }
+    }
+
+    thread->arch_info.fpu_in_use = in_use;
+    if (in_use == 0) {
+        cpu->fpu_save_skip_count++;
+        return;
+    }
+
+    void *const buffer = page_to_virt(thread->arch_info.xsave_page);
+
+    // Always request every feature, so the header records the features that
+    // went back to their initial state since the last save.
+
+    if (static_key_enabled(&g_cpu_xsaves_key)) {
+        xsave_supervisor_into(buffer, features);
+    } else if (static_key_enabled(&g_cpu_xsavec_key)) {
+        xsavec_user_into(buffer, features);
+    } else if (static_key_enabled(&g_cpu_xsaveopt_key)) {
+        xsaveopt_user_into(buffer, features);
+    } else {
+        xsave_user_into(buffer, features);
+    }
+
+    cpu->fpu_bytes_saved += xsave_get_size_for_features(in_use);
+}
+
+__debug_optimize(3)
+void fpu_restore(struct thread *const thread, struct cpu_info *const cpu) {
+    // The registers still hold the thread's state if no other user thread
+    // loaded its own on this cpu, and the thread didn't run anywhere else in
+    // the meantime.
+
+    if (cpu->fpu_owner == thread && thread->arch_info.fpu_cpu == cpu) {
+        cpu->fpu_restore_skip_count++;
+        return;
+    }
+
+    const xsave_feat_mask_t features =
+        get_cpu_capabilities()->xsave_user_features;
+
+    if (thread->arch_info.fpu_in_use == 0) {
+        xrstor_user_from(&g_init_state, features);
+    } else {
+        const void *const buffer = page_to_virt(thread->arch_info.xsave_page);
+        if (static_key_enabled(&g_cpu_xsaves_key)) {
+            xrstor_supervisor_from(buffer, features);
+        } else {
+            xrstor_user_from(buffer, features);
+        }
+
+        cpu->fpu_bytes_restored +=
+            xsave_get_size_for_features(thread->arch_info.fpu_in_use);
+    }
+
+    cpu->fpu_owner = thread;
+    thread->arch_info.fpu_cpu = cpu;
+}
@@ -0,0 +1,25 @@
+/*
+ * kernel/src/arch/x86_64/sched/fpu.h
+ * © suhas pai
+ */
+
+#pragma once
+#include <stdbool.h>
+
+struct cpu_info;
+struct thread;
+
+// Allocate the buffer the fpu state of the user thread `thread` is saved into.
+// Called when the thread is created, as fpu_save() can't allocate.
+
+bool fpu_alloc_state(struct thread *thread);
+
+// Save the fpu state of `thread`, which must be the user thread that was just
+// running on `cpu`. Nothing is saved if the thread didn't touch the fpu.
+
+void fpu_save(struct thread *thread, struct cpu_info *cpu);
+
+// Load the fpu state of the user thread `thread` into the registers of `cpu`,
+// unless it's still there from the last time the thread ran on `cpu`.
+
+void fpu_restore(struct thread *thread, struct cpu_info *cpu);
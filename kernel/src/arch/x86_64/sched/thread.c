@@ -4,12 +4,13 @@
  */
 
 #include "asm/fsgsbase.h"
-#include "asm/xsave.h"
+#include "asm/msr.h"
 
 #include "cpu/info.h"
 #include "lib/assert.h"
 
 #include "sched/thread.h"
+#include "fpu.h"
 
 __debug_optimize(3) struct thread *current_thread() {
     return (struct thread *)gsbase_read();
@@ -27,20 +28,19 @@ sched_save_restore_context(struct thread *const prev,
                            struct thread *const next,
                            struct thread_context *const prev_context)
 {
-    if (prev->process == &kernel_process) {
-        // xsave_supervisor_into(&prev->arch_info.avx_state);
-    } else {
-        xsave_user_into(&prev->arch_info.avx_state);
+    // Kernel threads never touch the fpu, so only user threads have fpu state
+    // to save and restore.
+
+    struct cpu_info *const cpu = next->cpu;
+    if (prev->process != &kernel_process) {
+        fpu_save(prev, cpu);
     }
 
-    if (next->process == &kernel_process) {
-        // xrstor_supervisor_from(&next->arch_info.avx_state);
-    } else {
-        xrstor_user_from(&next->arch_info.avx_state);
+    if (next->process != &kernel_process) {
+        fpu_restore(next, cpu);
     }
 
     // Don't overwrite context of idle threads
-    struct cpu_info *const cpu = next->cpu;
     if (prev != cpu->idle_thread) {
         prev->context = *prev_context;
     }
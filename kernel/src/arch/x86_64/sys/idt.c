@@ -15,6 +15,9 @@
 
 #include "dev/printk.h"
 
+#include "mm/fault.h"
+#include "sched/thread.h"
+
 #include "gdt.h"
 #include "pic.h"
 
@@ -114,8 +117,42 @@ void idt_init() {
     idt_load();
 }
 
+// Faults on the lower half are resolved in the current process's pagemap, and
+// faults on the higher half in the kernel's pagemap.
+
+static bool resolve_page_fault(const struct thread_context *const context) {
+    const uint64_t addr = read_cr2();
+    struct pagemap *const pagemap =
+        (addr >> 63) == 0
+            ? &current_thread()->process->pagemap
+            : &kernel_process.pagemap;
+
+    uint32_t flags = 0;
+    if (context->err_code & __PAGE_FAULT_ERROR_CODE_PRESENT) {
+        flags |= __PAGE_FAULT_PRESENT;
+    }
+
+    if (context->err_code & __PAGE_FAULT_ERROR_CODE_WRITE) {
+        flags |= __PAGE_FAULT_WRITE;
+    }
+
+    if (context->err_code & __PAGE_FAULT_ERROR_CODE_INSTRUCTION_FETCH) {
+        flags |= __PAGE_FAULT_EXEC;
+    }
+
+    if (context->err_code & __PAGE_FAULT_ERROR_CODE_USER) {
+        flags |= __PAGE_FAULT_USER;
+    }
+
+    return handle_page_fault(pagemap, addr, flags) == E_PAGE_FAULT_OK;
+}
+
 void
 handle_exception(const uint64_t intr_no, struct thread_context *const context) {
+    if (intr_no == EXCEPTION_PAGE_FAULT && resolve_page_fault(context)) {
+        return;
+    }
+
     this_cpu_mut()->in_exception = true;
 
     const char *except_str = "<unknown>";
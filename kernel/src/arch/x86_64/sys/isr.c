@@ -3,6 +3,8 @@
  * © suhas pai
  */
 
+#include <stdatomic.h>
+
 #include "lib/adt/bitset.h"
 #include "acpi/api.h"
 
@@ -19,8 +21,9 @@
 #include "lib/align.h"
 #include "lib/util.h"
 
-#define ISR_EXCEPTION_COUNT 32
-#define ISR_IRQ_COUNT 256
+// Vectors from isr_alloc_vector() are reserved in g_bitset on every cpu, while
+// msi vectors are only reserved in the vector-table of the cpu they target.
+// g_lock covers both.
 
 static struct spinlock g_lock = SPINLOCK_INIT();
 
@@ -31,28 +34,111 @@ static isr_vector_t g_spur_vector = 0;
 static isr_vector_t g_lapic_vector = 0;
 static isr_vector_t g_hpet_vector = 0;
 
+__debug_optimize(3)
+static bool vector_used_by_any_cpu(const isr_vector_t vector) {
+    const struct cpu_info *iter = NULL;
+    list_foreach(iter, cpus_get_list(), cpu_list) {
+        if (bitset_has(iter->isr_vector_bitset, vector)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
 __debug_optimize(3) isr_vector_t isr_alloc_vector() {
-    uint64_t bit_index = 0;
-    with_spinlock_irq_disabled(&g_lock, {
-        bit_index = bitset_find_unset(g_bitset, ISR_IRQ_COUNT, /*invert=*/true);
-    });
+    isr_vector_t vector = ISR_INVALID_VECTOR;
+    const int flag = spin_acquire_save_irq(&g_lock);
+
+    for (uint16_t i = ISR_EXCEPTION_COUNT; i != ISR_IRQ_COUNT; i++) {
+        if (!bitset_has(g_bitset, i) && !vector_used_by_any_cpu(i)) {
+            bitset_set(g_bitset, i);
+            vector = (isr_vector_t)i;
 
-    if (bit_index == BITSET_INVALID) {
+            break;
+        }
+    }
+
+    spin_release_restore_irq(&g_lock, flag);
+    if (vector == ISR_INVALID_VECTOR) {
         return ISR_INVALID_VECTOR;
     }
 
-    const isr_vector_t vector = (isr_vector_t)bit_index;
     printk(LOGLEVEL_INFO, "isr: allocated vector " ISR_VECTOR_FMT "\n", vector);
-
     return vector;
 }
 
+// Reserve `vector` in the vector-table of `cpu` for msi-vector `msi_index` of
+// `device`. Must be called with g_lock held.
+
+__debug_optimize(3) static void
+reserve_msi_vector(struct cpu_info *const cpu,
+                   const isr_vector_t vector,
+                   struct device *const device,
+                   const uint16_t msi_index,
+                   const isr_func_t handler)
+{
+    struct isr_vector_entry *const entry = &cpu->isr_vector_list[vector];
+
+    entry->handler = handler;
+    entry->device = device;
+    entry->count = 0;
+    entry->last_count = 0;
+    entry->msi_index = msi_index;
+    entry->pinned = false;
+
+    bitset_set(cpu->isr_vector_bitset, vector);
+    cpu->isr_msi_vector_count++;
+}
+
+// Must be called with g_lock held.
+__debug_optimize(3) static void
+release_msi_vector(struct cpu_info *const cpu, const isr_vector_t vector) {
+    struct isr_vector_entry *const entry = &cpu->isr_vector_list[vector];
+
+    entry->handler = NULL;
+    entry->device = NULL;
+
+    bitset_unset(cpu->isr_vector_bitset, vector);
+    cpu->isr_msi_vector_count--;
+}
+
 __debug_optimize(3) isr_vector_t
-isr_alloc_msi_vector(struct device *const device, const uint16_t msi_index) {
-    (void)device;
-    (void)msi_index;
+isr_alloc_msi_vector(struct device *const device,
+                     const uint16_t msi_index,
+                     const struct cpu_info *const cpu)
+{
+    assert_msg(cpu != NULL, "isr: msi vectors must target a cpu on x86_64");
+
+    struct cpu_info *const target = (struct cpu_info *)(uint64_t)cpu;
+    isr_vector_t vector = ISR_INVALID_VECTOR;
+
+    with_spinlock_irq_disabled(&g_lock, {
+        for (uint16_t i = ISR_EXCEPTION_COUNT; i != ISR_IRQ_COUNT; i++) {
+            if (!bitset_has(g_bitset, i)
+             && !bitset_has(target->isr_vector_bitset, i))
+            {
+                vector = (isr_vector_t)i;
+                reserve_msi_vector(target,
+                                   vector,
+                                   device,
+                                   msi_index,
+                                   /*handler=*/NULL);
+                break;
+            }
+        }
+    });
 
-    return isr_alloc_vector();
+    if (vector == ISR_INVALID_VECTOR) {
+        return ISR_INVALID_VECTOR;
+    }
+
+    printk(LOGLEVEL_INFO,
+           "isr: allocated msi vector " ISR_VECTOR_FMT " on cpu %" PRIu32 "\n",
+           vector,
+           cpu->processor_id);
+
+    return vector;
 }
 
 __debug_optimize(3) void isr_free_vector(const isr_vector_t vector) {
@@ -67,15 +153,202 @@ __debug_optimize(3) void isr_free_vector(const isr_vector_t vector) {
     printk(LOGLEVEL_INFO, "isr: freed vector " ISR_VECTOR_FMT "\n", vector);
 }
 
+// Find the cpu whose vector-table has `vector` reserved for msi-vector
+// `msi_index` of `device`. Must be called with g_lock held.
+
+__debug_optimize(3) static struct cpu_info *
+find_cpu_for_msi_vector(const struct device *const device,
+                        const isr_vector_t vector,
+                        const uint16_t msi_index)
+{
+    struct cpu_info *iter = NULL;
+    list_foreach(iter, cpus_get_list(), cpu_list) {
+        if (!bitset_has(iter->isr_vector_bitset, vector)) {
+            continue;
+        }
+
+        const struct isr_vector_entry *const entry =
+            &iter->isr_vector_list[vector];
+
+        if (entry->device == device && entry->msi_index == msi_index) {
+            return iter;
+        }
+    }
+
+    return NULL;
+}
+
 __debug_optimize(3) void
 isr_free_msi_vector(struct device *const device,
                     const isr_vector_t vector,
                     const uint16_t msi_index)
 {
-    (void)device;
-    (void)msi_index;
+    // The vector may have moved since it was allocated, so find the cpu it's on
+    // now.
+
+    bool found = false;
+    with_spinlock_irq_disabled(&g_lock, {
+        struct cpu_info *const cpu =
+            find_cpu_for_msi_vector(device, vector, msi_index);
+
+        if (cpu != NULL) {
+            release_msi_vector(cpu, vector);
+            found = true;
+        }
+    });
+
+    assert_msg(found,
+               "isr_free_msi_vector() called on unallocated vector "
+               ISR_VECTOR_FMT,
+               vector);
+
+    printk(LOGLEVEL_INFO, "isr: freed msi vector " ISR_VECTOR_FMT "\n", vector);
+}
+
+__debug_optimize(3) const struct cpu_info *isr_get_cpu_for_msi() {
+    const struct cpu_info *result = NULL;
+    const int flag = spin_acquire_save_irq(&g_lock);
+
+    const struct cpu_info *iter = NULL;
+    list_foreach(iter, cpus_get_list(), cpu_list) {
+        if (result == NULL
+         || iter->isr_msi_vector_count < result->isr_msi_vector_count)
+        {
+            result = iter;
+        }
+    }
+
+    spin_release_restore_irq(&g_lock, flag);
+    return result;
+}
+
+__debug_optimize(3) bool
+isr_get_msi_vector_owner(const isr_vector_t vector,
+                         struct device **const device_out,
+                         uint16_t *const msi_index_out)
+{
+    const struct cpu_info *const cpu = this_cpu();
+    if (!index_in_bounds(vector, ISR_IRQ_COUNT)
+     || !bitset_has(cpu->isr_vector_bitset, vector))
+    {
+        return false;
+    }
+
+    const struct isr_vector_entry *const entry = &cpu->isr_vector_list[vector];
+    if (entry->device == NULL) {
+        return false;
+    }
+
+    *device_out = entry->device;
+    *msi_index_out = entry->msi_index;
+
+    return true;
+}
+
+__debug_optimize(3) void
+isr_pin_msi_vector(const struct cpu_info *const cpu, const isr_vector_t vector)
+{
+    struct cpu_info *const target = (struct cpu_info *)(uint64_t)cpu;
+    with_spinlock_irq_disabled(&g_lock, {
+        target->isr_vector_list[vector].pinned = true;
+    });
+}
+
+__debug_optimize(3) const struct cpu_info *
+isr_start_move_msi_vector(struct device *const device,
+                          const isr_vector_t vector,
+                          const uint16_t msi_index,
+                          const struct cpu_info *const cpu)
+{
+    struct cpu_info *const target = (struct cpu_info *)(uint64_t)cpu;
+    const struct cpu_info *result = NULL;
+
+    with_spinlock_irq_disabled(&g_lock, {
+        struct cpu_info *const from =
+            find_cpu_for_msi_vector(device, vector, msi_index);
+
+        // The vector keeps its number, so drivers can keep identifying their
+        // queues by it, which requires the number to be free on the target.
+
+        if (from != NULL
+         && from != target
+         && !from->isr_vector_list[vector].pinned
+         && !bitset_has(target->isr_vector_bitset, vector))
+        {
+            reserve_msi_vector(target,
+                               vector,
+                               device,
+                               msi_index,
+                               from->isr_vector_list[vector].handler);
+            result = from;
+        }
+    });
+
+    return result;
+}
+
+// reserve_msi_vector() cleared the count on the new cpu, so any interrupt it
+// has since received came from the device's new address.
+
+__debug_optimize(3) bool
+isr_moved_msi_vector_fired(const struct cpu_info *const cpu,
+                           const isr_vector_t vector)
+{
+    return atomic_load_explicit(&cpu->isr_vector_list[vector].count,
+                                memory_order_relaxed) != 0;
+}
 
-    return isr_free_vector(vector);
+__debug_optimize(3) void
+isr_release_moved_msi_vector(const struct cpu_info *const cpu,
+                             const isr_vector_t vector)
+{
+    struct cpu_info *const from = (struct cpu_info *)(uint64_t)cpu;
+    with_spinlock_irq_disabled(&g_lock, {
+        release_msi_vector(from, vector);
+    });
+}
+
+__debug_optimize(3) uint32_t
+isr_get_msi_vector_list(struct isr_msi_vector_info *const list,
+                        const uint32_t max)
+{
+    uint32_t count = 0;
+    const int flag = spin_acquire_save_irq(&g_lock);
+
+    struct cpu_info *iter = NULL;
+    list_foreach(iter, cpus_get_list(), cpu_list) {
+        for (uint16_t i = ISR_EXCEPTION_COUNT; i != ISR_IRQ_COUNT; i++) {
+            if (count == max) {
+                goto done;
+            }
+
+            struct isr_vector_entry *const entry = &iter->isr_vector_list[i];
+            if (!bitset_has(iter->isr_vector_bitset, i)
+             || entry->handler == NULL)
+            {
+                continue;
+            }
+
+            const uint64_t total =
+                atomic_load_explicit(&entry->count, memory_order_relaxed);
+
+            list[count] = (struct isr_msi_vector_info){
+                .device = entry->device,
+                .cpu = iter,
+                .vector = (isr_vector_t)i,
+                .msi_index = entry->msi_index,
+                .pinned = entry->pinned,
+                .count = total - entry->last_count
+            };
+
+            entry->last_count = total;
+            count++;
+        }
+    }
+
+done:
+    spin_release_restore_irq(&g_lock, flag);
+    return count;
 }
 
 __debug_optimize(3) isr_vector_t isr_get_lapic_vector() {
@@ -104,6 +377,16 @@ handle_exception(const uint64_t vector, struct thread_context *const frame);
 __debug_optimize(3) void
 isr_handle_interrupt(const uint64_t vector, struct thread_context *const frame)
 {
+    struct isr_vector_entry *const entry =
+        &this_cpu_mut()->isr_vector_list[vector];
+
+    if (entry->handler != NULL) {
+        atomic_fetch_add_explicit(&entry->count, 1, memory_order_relaxed);
+        entry->handler(vector, frame);
+
+        return;
+    }
+
     if (__builtin_expect(g_funcs[vector] != NULL, 1)) {
         g_funcs[vector](vector, frame);
         return;
@@ -157,11 +440,21 @@ isr_set_vector(const isr_vector_t vector,
 }
 
 __debug_optimize(3) void
-isr_set_msi_vector(const isr_vector_t vector,
+isr_set_msi_vector(const struct cpu_info *const cpu,
+                   const isr_vector_t vector,
                    const isr_func_t handler,
                    struct arch_isr_info *const info)
 {
-    isr_set_vector(vector, handler, info);
+    struct cpu_info *const target = (struct cpu_info *)(uint64_t)cpu;
+    with_spinlock_irq_disabled(&g_lock, {
+        assert_msg(bitset_has(target->isr_vector_bitset, vector),
+                   "isr_set_msi_vector() called on vector not allocated on "
+                   "cpu");
+
+        target->isr_vector_list[vector].handler = handler;
+    });
+
+    idt_set_vector(vector, info->ist, IDT_DEFAULT_FLAGS);
 }
 
 __debug_optimize(3) void
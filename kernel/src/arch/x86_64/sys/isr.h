@@ -5,6 +5,7 @@
 
 #pragma once
 
+#include <stdbool.h>
 #include "asm/context.h"
 #include "sys/idt.h"
 
@@ -25,6 +26,25 @@ typedef idt_vector_t isr_vector_t;
 
 typedef void (*isr_func_t)(uint64_t intr_no, struct thread_context *frame);
 
+#define ISR_EXCEPTION_COUNT 32
+#define ISR_IRQ_COUNT 256
+
+struct device;
+
+// An msi vector in the vector-table of the cpu it targets.
+struct isr_vector_entry {
+    isr_func_t handler;
+    struct device *device;
+
+    _Atomic uint64_t count;
+
+    // Value of count at the last call to isr_get_msi_vector_list().
+    uint64_t last_count;
+    uint16_t msi_index;
+
+    bool pinned : 1;
+};
+
 isr_vector_t isr_get_spur_vector();
 isr_vector_t isr_get_lapic_vector();
 isr_vector_t isr_get_hpet_vector();
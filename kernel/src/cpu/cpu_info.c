@@ -4,6 +4,7 @@
  */
 
 #include "asm/irqs.h"
+#include "lib/string.h"
 #include "sched/thread.h"
 
 static struct list g_cpu_list = LIST_INIT(g_cpu_list);
@@ -25,13 +26,23 @@ __debug_optimize(3) struct cpu_info *this_cpu_mut() {
 }
 
 __debug_optimize(3) void cpu_info_base_init(struct cpu_info *const cpu) {
-    list_init(&cpu->alarm_list);
+    alarm_wheel_init(&cpu->alarm_wheel);
     list_init(&cpu->cpu_list);
     list_init(&cpu->pagemap_node);
 
     cpu->idle_thread = NULL;
     cpu->spur_intr_count = 0;
-    cpu->sched_info = SCHED_PERCPU_INFO_INIT();
+    sched_percpu_info_init(&cpu->sched_info);
+
+    bzero(cpu->slab_cache_list, sizeof(cpu->slab_cache_list));
+    page_pcp_init(&cpu->page_pcp);
+
+    tlb_cpu_state_init(&cpu->tlb_state);
+    asid_cpu_state_init(&cpu->asid_state);
+    printk_ring_init(&cpu->printk_ring);
+
+    cpu->topology = (struct cpu_topology)CPU_TOPOLOGY_INIT();
+    cpu->numa_node = 0;
 }
 
 __debug_optimize(3) struct list *cpus_get_list() {
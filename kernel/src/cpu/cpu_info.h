@@ -6,14 +6,22 @@
 #pragma once
 #include <stdbool.h>
 
+#include "cpu/topology.h"
+#include "dev/printk.h"
 #include "lib/list.h"
+#include "mm/asid.h"
+#include "mm/numa.h"
+#include "mm/pcp.h"
+#include "mm/shootdown.h"
+#include "mm/slab.h"
+#include "sched/alarm_wheel.h"
 #include "sched/info.h"
 
 #include "limine.h"
 
 struct cpu_info;
 struct cpu_info_base {
-    struct list alarm_list;
+    struct alarm_wheel alarm_wheel;
     struct list cpu_list;
     struct list pagemap_node;
 
@@ -22,15 +30,38 @@ struct cpu_info_base {
     // Keep track of spurious interrupts for every cpu.
     uint64_t spur_intr_count;
     struct sched_percpu_info sched_info;
+
+    // Per-cpu magazines for slab-allocators created with
+    // __SLAB_ALLOC_CPU_CACHE, indexed by slab_allocator::cpu_cache_index.
+
+    struct slab_cpu_cache slab_cache_list[SLAB_CPU_CACHE_MAX];
+    struct page_pcp page_pcp;
+
+    struct tlb_cpu_state tlb_state;
+    struct asid_cpu_state asid_state;
+    struct printk_ring printk_ring;
+
+    // Filled in by cpu_topology_init(), once every cpu has been added.
+    struct cpu_topology topology;
+
+    // Filled in by numa_init_cpus(), right after every cpu has been added.
+    numa_node_t numa_node;
 };
 
 #define CPU_INFO_BASE_INIT(name) \
-    .alarm_list = LIST_INIT(name.alarm_list), \
+    .alarm_wheel = ALARM_WHEEL_INIT(), \
     .cpu_list = LIST_INIT(name.cpu_list), \
     .pagemap_node = LIST_INIT(name.pagemap_node), \
     .idle_thread = NULL, \
     .spur_intr_count = 0, \
-    .sched_info = SCHED_PERCPU_INFO_INIT()
+    .sched_info = SCHED_PERCPU_INFO_INIT(name.sched_info), \
+    .slab_cache_list = {}, \
+    .page_pcp = PAGE_PCP_INIT(name.page_pcp), \
+    .tlb_state = TLB_CPU_STATE_INIT(), \
+    .asid_state = ASID_CPU_STATE_INIT(), \
+    .printk_ring = PRINTK_RING_INIT(), \
+    .topology = CPU_TOPOLOGY_INIT(), \
+    .numa_node = 0
 
 void cpu_info_base_init(struct cpu_info *cpu);
 
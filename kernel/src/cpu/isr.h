@@ -14,7 +14,28 @@
 void isr_init();
 
 isr_vector_t isr_alloc_vector();
-isr_vector_t isr_alloc_msi_vector(struct device *device, uint16_t msi_index);
+
+// Msi vectors are allocated in the vector-table of the cpu they're delivered
+// to, so each cpu has a full set of vectors for its devices' queues.
+// isr_get_cpu_for_msi() returns the cpu with the fewest msi vectors allocated.
+
+isr_vector_t
+isr_alloc_msi_vector(struct device *device,
+                     uint16_t msi_index,
+                     const struct cpu_info *cpu);
+
+const struct cpu_info *isr_get_cpu_for_msi();
+
+// Find the device and msi-index that the current cpu's `vector` was allocated
+// for. Returns false if `vector` isn't an msi vector.
+//
+// Meant to be called from the vector's handler, where the vector can't be
+// freed or released from the cpu underneath us, so no lock is taken.
+
+bool
+isr_get_msi_vector_owner(isr_vector_t vector,
+                         struct device **device_out,
+                         uint16_t *msi_index_out);
 
 void isr_free_vector(isr_vector_t vector);
 
@@ -31,10 +52,58 @@ isr_set_vector(isr_vector_t vector,
                struct arch_isr_info *info);
 
 void
-isr_set_msi_vector(isr_vector_t vector,
+isr_set_msi_vector(const struct cpu_info *cpu,
+                   isr_vector_t vector,
                    isr_func_t handler,
                    struct arch_isr_info *info);
 
+// Keep `vector` on `cpu` for good. Meant for vectors of per-cpu queues, which
+// are already delivered to the cpu that submits to the queue, so the vector is
+// never moved and isr_start_move_msi_vector() refuses it.
+
+void isr_pin_msi_vector(const struct cpu_info *cpu, isr_vector_t vector);
+
+// Moving an msi vector keeps its number. isr_start_move_msi_vector() reserves
+// the vector on `cpu` with the same handler, and returns the cpu the vector was
+// on, or NULL if the vector can't be moved there. Once the device was
+// reprogrammed, the caller releases the vector on whichever cpu no longer
+// receives it with isr_release_moved_msi_vector().
+//
+// Interrupts the device sent before it was reprogrammed may still be in flight
+// to the old cpu, so the old cpu should only be released once
+// isr_moved_msi_vector_fired() returns true for the new cpu.
+
+const struct cpu_info *
+isr_start_move_msi_vector(struct device *device,
+                          isr_vector_t vector,
+                          uint16_t msi_index,
+                          const struct cpu_info *cpu);
+
+bool
+isr_moved_msi_vector_fired(const struct cpu_info *cpu, isr_vector_t vector);
+
+void
+isr_release_moved_msi_vector(const struct cpu_info *cpu, isr_vector_t vector);
+
+struct isr_msi_vector_info {
+    struct device *device;
+    const struct cpu_info *cpu;
+
+    isr_vector_t vector;
+    uint16_t msi_index;
+    bool pinned;
+
+    // Number of interrupts received since the previous call to
+    // isr_get_msi_vector_list().
+    uint64_t count;
+};
+
+// Fill `list` with up to `max` allocated msi vectors, returning the number
+// filled in.
+
+uint32_t
+isr_get_msi_vector_list(struct isr_msi_vector_info *list, uint32_t max);
+
 void
 isr_assign_irq_to_cpu(const struct cpu_info *cpu,
                       uint8_t irq,
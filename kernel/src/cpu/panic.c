@@ -13,6 +13,7 @@
 
 __debug_optimize(3) void panic(const char *const fmt, ...) {
     disable_interrupts();
+    printk_bust_locks();
 
     va_list list;
     va_start(list, fmt);
@@ -12,6 +12,10 @@
 #include "sched/scheduler.h"
 #include "sys/boot.h"
 
+#if defined(__x86_64__)
+    #include "dev/time/tsc.h"
+#endif /* defined(__x86_64__) */
+
 #include "smp.h"
 
 extern void arch_init_for_smp();
@@ -81,6 +85,10 @@ void smp_boot_all_cpus() {
             cpu_list[i]->extra_argument = (uint64_t)&boot_info;
             cpu_list[i]->goto_address = arch_init_for_smp;
 
+        #if defined(__x86_64__)
+            tsc_sync_source();
+        #endif /* defined(__x86_64__) */
+
             while (!atomic_load_explicit(&boot_info.booted,
                                          memory_order_seq_cst))
             {
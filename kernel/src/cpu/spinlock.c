@@ -8,6 +8,7 @@
 #include "asm/irqs.h"
 #include "asm/pause.h"
 
+#include "mm/shootdown.h"
 #include "sched/thread.h"
 
 #if defined(DEBUG_LOCKS)
@@ -28,6 +29,7 @@ __debug_optimize(3) void spin_acquire(struct spinlock *const lock) {
             return;
         }
 
+        tlb_shootdown_poll();
         cpu_pause();
     }
 }
@@ -0,0 +1,45 @@
+/*
+ * kernel/src/cpu/static_key.c
+ * © suhas pai
+ */
+
+#include "dev/printk.h"
+#include "static_key.h"
+
+extern struct static_key_entry static_keys_start[];
+extern struct static_key_entry static_keys_end[];
+
+static void update_key(struct static_key *const key, const bool enabled) {
+    if (key->enabled == enabled) {
+        return;
+    }
+
+    key->enabled = enabled;
+#if __has_include("asm/static_key.h")
+    uint32_t site_count = 0;
+    for (const struct static_key_entry *entry = static_keys_start;
+         entry != static_keys_end;
+         entry++)
+    {
+        if (entry->key != key) {
+            continue;
+        }
+
+        arch_static_key_patch(entry, enabled);
+        site_count++;
+    }
+
+    printk(LOGLEVEL_INFO,
+           "static-key: patched %" PRIu32 " site(s) of key %p\n",
+           site_count,
+           (void *)key);
+#endif /* __has_include("asm/static_key.h") */
+}
+
+void static_key_enable(struct static_key *const key) {
+    update_key(key, /*enabled=*/true);
+}
+
+void static_key_disable(struct static_key *const key) {
+    update_key(key, /*enabled=*/false);
+}
@@ -0,0 +1,49 @@
+/*
+ * kernel/src/cpu/static_key.h
+ * © suhas pai
+ */
+
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "lib/macros.h"
+
+// A static key is a boolean that's checked by patching the code of every site
+// that checks it, instead of loading it and branching on the result. A
+// disabled key's sites are a nop, and are rewritten into a jump when the key is
+// enabled.
+//
+// Keys are only meant to be flipped during boot, after the kernel's text has
+// been mapped and before the other cpus are started, as sites are patched
+// without stopping other cpus.
+
+struct static_key {
+    bool enabled;
+};
+
+#define STATIC_KEY_INIT() { .enabled = false }
+
+// Each site of a key adds an entry to the .static_keys section, recording the
+// address of its nop and the address it jumps to when the key is enabled.
+
+struct static_key_entry {
+    uint64_t code;
+    uint64_t target;
+
+    struct static_key *key;
+};
+
+#if __has_include("asm/static_key.h")
+    #include "asm/static_key.h"
+
+    #define static_key_enabled(key) arch_static_key_enabled(key)
+
+    void
+    arch_static_key_patch(const struct static_key_entry *entry, bool enabled);
+#else
+    #define static_key_enabled(key) __builtin_expect((key)->enabled, 0)
+#endif /* __has_include("asm/static_key.h") */
+
+void static_key_enable(struct static_key *key);
+void static_key_disable(struct static_key *key);
@@ -0,0 +1,268 @@
+/*
+ * kernel/src/cpu/topology.c
+ * © suhas pai
+ */
+
+#include "acpi/api.h"
+#include "acpi/pptt.h"
+
+#include "cpu/info.h"
+#include "dev/dtb/tree.h"
+
+#include "dev/printk.h"
+#include "topology.h"
+
+// Cache phandles and the ids given to cpu-map nodes come from different
+// spaces, so the top bit keeps them from ever comparing equal.
+
+#define DTB_CACHE_LLC_ID_BIT (1u << 31)
+#define DTB_MAX_CACHE_LEVELS 8
+
+__debug_optimize(3)
+const struct cpu_topology *cpu_get_topology(const struct cpu_info *const cpu) {
+    return &cpu->topology;
+}
+
+__debug_optimize(3) bool
+cpu_shares_topology_level(const struct cpu_info *const cpu,
+                          const struct cpu_info *const other,
+                          const enum cpu_topology_level level)
+{
+    if (cpu == other) {
+        return true;
+    }
+
+    const struct cpu_topology *const topology = &cpu->topology;
+    const struct cpu_topology *const other_topology = &other->topology;
+
+    if (topology->source == CPU_TOPOLOGY_SOURCE_NONE
+     || topology->source != other_topology->source)
+    {
+        return false;
+    }
+
+    switch (level) {
+        case CPU_TOPOLOGY_LEVEL_SMT:
+            return topology->core_id == other_topology->core_id;
+        case CPU_TOPOLOGY_LEVEL_LLC:
+            return topology->llc_id == other_topology->llc_id;
+        case CPU_TOPOLOGY_LEVEL_CLUSTER:
+            return topology->cluster_id == other_topology->cluster_id;
+        case CPU_TOPOLOGY_LEVEL_PACKAGE:
+            return topology->package_id == other_topology->package_id;
+    }
+
+    verify_not_reached();
+}
+
+static void init_from_pptt(const struct acpi_pptt *const pptt) {
+    struct cpu_info *cpu = NULL;
+    list_foreach(cpu, cpus_get_list(), cpu_list) {
+        uint32_t acpi_id = 0;
+        if (!cpu_get_acpi_processor_id(cpu, &acpi_id)) {
+            continue;
+        }
+
+        if (pptt_get_cpu_topology(pptt, acpi_id, &cpu->topology)) {
+            cpu->topology.source = CPU_TOPOLOGY_SOURCE_PPTT;
+        }
+    }
+}
+
+static struct cpu_info *find_cpu_for_dtb_reg(const uint64_t reg) {
+    struct cpu_info *cpu = NULL;
+    list_foreach(cpu, cpus_get_list(), cpu_list) {
+        if (cpu_get_dtb_reg(cpu) == reg) {
+            return cpu;
+        }
+    }
+
+    return NULL;
+}
+
+// The last-level cache of a cpu is at the end of the chain of
+// 'next-level-cache' phandles starting at the cpu's node.
+
+static bool
+get_dtb_llc_phandle(const struct devicetree *const tree,
+                    const struct devicetree_node *node,
+                    uint32_t *const phandle_out)
+{
+    bool result = false;
+    for (uint32_t i = 0; i != DTB_MAX_CACHE_LEVELS; i++) {
+        const struct devicetree_prop_other *const prop =
+            devicetree_node_get_other_prop(node,
+                                           SV_STATIC("next-level-cache"));
+
+        uint32_t phandle = 0;
+        if (prop == NULL || !devicetree_prop_other_get_u32(prop, &phandle)) {
+            break;
+        }
+
+        node = devicetree_get_node_for_phandle(tree, phandle);
+        if (node == NULL) {
+            break;
+        }
+
+        *phandle_out = phandle;
+        result = true;
+    }
+
+    return result;
+}
+
+static void
+set_dtb_cpu_topology(const struct devicetree *const tree,
+                     const struct devicetree_node *const node,
+                     const struct cpu_topology *const topology)
+{
+    const struct devicetree_prop_other *const cpu_prop =
+        devicetree_node_get_other_prop(node, SV_STATIC("cpu"));
+
+    uint32_t phandle = 0;
+    if (cpu_prop == NULL || !devicetree_prop_other_get_u32(cpu_prop, &phandle))
+    {
+        printk(LOGLEVEL_WARN,
+               "cpu: cpu-map node " SV_FMT " is missing a 'cpu' prop\n",
+               SV_FMT_ARGS(node->name));
+        return;
+    }
+
+    const struct devicetree_node *const cpu_node =
+        devicetree_get_node_for_phandle(tree, phandle);
+
+    if (cpu_node == NULL) {
+        printk(LOGLEVEL_WARN,
+               "cpu: cpu-map node " SV_FMT " points to a missing cpu\n",
+               SV_FMT_ARGS(node->name));
+        return;
+    }
+
+    const struct devicetree_prop_reg *const reg_prop =
+        (const struct devicetree_prop_reg *)(uint64_t)
+            devicetree_node_get_prop(cpu_node, DEVICETREE_PROP_REG);
+
+    if (reg_prop == NULL || array_item_count(reg_prop->list) != 1) {
+        return;
+    }
+
+    const struct devicetree_prop_reg_info *const reg =
+        array_front(reg_prop->list);
+
+    struct cpu_info *const cpu = find_cpu_for_dtb_reg(reg->address);
+    if (cpu == NULL || cpu->topology.source != CPU_TOPOLOGY_SOURCE_NONE) {
+        return;
+    }
+
+    cpu->topology = *topology;
+    cpu->topology.source = CPU_TOPOLOGY_SOURCE_DTB;
+
+    uint32_t llc_phandle = 0;
+    if (get_dtb_llc_phandle(tree, cpu_node, &llc_phandle)) {
+        cpu->topology.llc_id = llc_phandle | DTB_CACHE_LLC_ID_BIT;
+    }
+}
+
+// Walk the socket, cluster, core and thread nodes of the cpu-map, giving each
+// node a new id. Clusters may be nested, in which case the innermost cluster
+// is used.
+
+static void
+walk_cpu_map_node(const struct devicetree *const tree,
+                  const struct devicetree_node *const node,
+                  const struct cpu_topology *const parent_topology,
+                  uint32_t *const next_id)
+{
+    devicetree_node_foreach_child(node, iter) {
+        struct cpu_topology topology = *parent_topology;
+        const uint32_t id = (*next_id)++;
+
+        if (sv_has_prefix(iter->name, SV_STATIC("socket"))) {
+            topology.package_id = id;
+            topology.cluster_id = id;
+            topology.llc_id = id;
+        } else if (sv_has_prefix(iter->name, SV_STATIC("cluster"))) {
+            topology.cluster_id = id;
+            topology.llc_id = id;
+        } else if (sv_has_prefix(iter->name, SV_STATIC("core"))) {
+            topology.core_id = id;
+            topology.thread_id = id;
+
+            if (list_empty(&iter->child_list)) {
+                set_dtb_cpu_topology(tree, iter, &topology);
+                continue;
+            }
+        } else if (sv_has_prefix(iter->name, SV_STATIC("thread"))) {
+            topology.thread_id = id;
+            set_dtb_cpu_topology(tree, iter, &topology);
+
+            continue;
+        } else {
+            continue;
+        }
+
+        walk_cpu_map_node(tree, iter, &topology, next_id);
+    }
+}
+
+static void init_from_dtb(const struct devicetree *const tree) {
+    const struct devicetree_node *const cpu_map =
+        devicetree_get_node_at_path(tree, SV_STATIC("/cpus/cpu-map"));
+
+    if (cpu_map == NULL) {
+        return;
+    }
+
+    // A cpu-map without socket nodes describes a single package.
+    const struct cpu_topology topology = CPU_TOPOLOGY_INIT();
+    uint32_t next_id = 1;
+
+    walk_cpu_map_node(tree, cpu_map, &topology, &next_id);
+}
+
+static const char *
+get_source_string(const enum cpu_topology_source source) {
+    switch (source) {
+        case CPU_TOPOLOGY_SOURCE_NONE:
+            return "unknown";
+        case CPU_TOPOLOGY_SOURCE_PPTT:
+            return "pptt";
+        case CPU_TOPOLOGY_SOURCE_DTB:
+            return "dtb";
+        case CPU_TOPOLOGY_SOURCE_ARCH:
+            return "arch";
+    }
+
+    verify_not_reached();
+}
+
+void cpu_topology_init() {
+    const struct acpi_pptt *const pptt = get_acpi_info()->pptt;
+    if (pptt != NULL) {
+        init_from_pptt(pptt);
+    }
+
+    init_from_dtb(dtb_get_tree());
+
+    struct cpu_info *cpu = NULL;
+    list_foreach(cpu, cpus_get_list(), cpu_list) {
+        struct cpu_topology *const topology = &cpu->topology;
+        if (topology->source == CPU_TOPOLOGY_SOURCE_NONE
+         && arch_get_cpu_topology(cpu, topology))
+        {
+            topology->source = CPU_TOPOLOGY_SOURCE_ARCH;
+        }
+
+        printk(LOGLEVEL_INFO,
+               "cpu: cpu %" PRIu32 " topology (%s): package %" PRIu32 ", "
+               "cluster %" PRIu32 ", core %" PRIu32 ", thread %" PRIu32 ", "
+               "llc %" PRIu32 "\n",
+               cpu_get_id(cpu),
+               get_source_string(topology->source),
+               topology->package_id,
+               topology->cluster_id,
+               topology->core_id,
+               topology->thread_id,
+               topology->llc_id);
+    }
+}
@@ -0,0 +1,78 @@
+/*
+ * kernel/src/cpu/topology.h
+ * © suhas pai
+ */
+
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+
+// Every cpu's place in the system's topology is found once at boot by
+// cpu_topology_init(), from (in order of preference) the acpi pptt, the
+// devicetree's cpu-map, or whatever the architecture itself reports (cpuid on
+// x86_64, mpidr on aarch64).
+//
+// The ids are opaque, and are only meaningful when compared against the same
+// id of another cpu whose topology came from the same source. Cpus whose
+// topology couldn't be found share nothing with any other cpu.
+
+enum cpu_topology_source {
+    CPU_TOPOLOGY_SOURCE_NONE,
+    CPU_TOPOLOGY_SOURCE_PPTT,
+    CPU_TOPOLOGY_SOURCE_DTB,
+    CPU_TOPOLOGY_SOURCE_ARCH,
+};
+
+enum cpu_topology_level {
+    // Cpus that are threads of the same core.
+    CPU_TOPOLOGY_LEVEL_SMT,
+
+    // Cpus sharing the last-level cache.
+    CPU_TOPOLOGY_LEVEL_LLC,
+
+    CPU_TOPOLOGY_LEVEL_CLUSTER,
+    CPU_TOPOLOGY_LEVEL_PACKAGE,
+};
+
+struct cpu_topology {
+    enum cpu_topology_source source;
+
+    uint32_t package_id;
+    uint32_t cluster_id;
+    uint32_t core_id;
+    uint32_t thread_id;
+    uint32_t llc_id;
+};
+
+#define CPU_TOPOLOGY_INIT() \
+    { \
+        .source = CPU_TOPOLOGY_SOURCE_NONE, \
+        .package_id = 0, \
+        .cluster_id = 0, \
+        .core_id = 0, \
+        .thread_id = 0, \
+        .llc_id = 0 \
+    }
+
+struct cpu_info;
+
+const struct cpu_topology *cpu_get_topology(const struct cpu_info *cpu);
+
+bool
+cpu_shares_topology_level(const struct cpu_info *cpu,
+                          const struct cpu_info *other,
+                          enum cpu_topology_level level);
+
+void cpu_topology_init();
+
+// Implemented by every architecture in arch/*/cpu/topology.c.
+
+bool
+cpu_get_acpi_processor_id(const struct cpu_info *cpu, uint32_t *id_out);
+
+// Returns the value of the 'reg' prop of `cpu`'s node in the devicetree.
+uint64_t cpu_get_dtb_reg(const struct cpu_info *cpu);
+
+bool
+arch_get_cpu_topology(const struct cpu_info *cpu,
+                      struct cpu_topology *topology_out);
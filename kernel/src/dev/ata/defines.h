@@ -37,6 +37,8 @@ enum ata_command {
     ATA_CMD_WRITE_PIO_EXT = 0x34,
     ATA_CMD_WRITE_DMA = 0xCA,
     ATA_CMD_WRITE_DMA_EXT = 0x35,
+    ATA_CMD_READ_FPDMA_QUEUED = 0x60,
+    ATA_CMD_WRITE_FPDMA_QUEUED = 0x61,
     ATA_CMD_CACHE_FLUSH = 0xE7,
     ATA_CMD_CACHE_FLUSH_EXT = 0xEA,
     ATA_CMD_PACKET = 0xA0,
@@ -62,6 +64,9 @@ enum ata_ident_sata_cap_flags {
     __ATA_IDENTITY_SATA_CAP_SUPPORTS_NCQ = 1 << 8,
 };
 
+#define ATA_IDENTITY_QUEUE_DEPTH_MASK 0b11111
+#define ATA_NCQ_TAG_SHIFT 3
+
 struct ata_identity {
     uint16_t device_type;
     uint16_t cylinder_count;
@@ -86,7 +91,10 @@ struct ata_identity {
     const char reserved_5[18];
 
     uint32_t max_lba_lower32;
-    const char reserved_6[28];
+    const char reserved_6[26];
+
+    // Bits 4:0 hold the maximum ncq queue-depth supported, minus one.
+    uint16_t queue_depth;
 
     uint16_t sata_capabilities;
     uint16_t sata_capabilities_ext;
@@ -12,11 +12,18 @@ enum device_kind {
 
 struct device {
     enum device_kind kind;
+
+    // Set by the driver bound to the device, so its msi handlers can find
+    // their state from the device a vector belongs to, see
+    // isr_get_msi_vector_owner().
+
+    void *driver_info;
 };
 
 #define DEVICE_INIT(kind_) \
     ((struct device){ \
-        .kind = (kind_) \
+        .kind = (kind_), \
+        .driver_info = NULL \
     })
 
 uint64_t device_get_id(struct device *device);
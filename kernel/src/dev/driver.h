@@ -8,8 +8,17 @@
 #include "dtb/driver.h"
 #include "pci/driver.h"
 
+enum driver_flags {
+    // Probe every device of the driver on a worker thread, see dev/probe.h.
+    __DRIVER_ASYNC_PROBE = 1 << 0,
+
+    // Boot waits for the driver's async probes to finish before continuing.
+    __DRIVER_REQUIRED_FOR_BOOT = 1 << 1,
+};
+
 struct driver {
     const struct string_view name;
+    const uint32_t flags;
 
     const struct dtb_driver *dtb;
     const struct pci_driver *pci;
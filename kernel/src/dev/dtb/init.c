@@ -5,6 +5,7 @@
 
 #include "dev/driver.h"
 #include "dev/printk.h"
+#include "dev/probe.h"
 
 #include "sys/boot.h"
 #include "parse.h"
@@ -12,19 +13,17 @@
 static struct devicetree_node g_device_tree_root;
 static struct devicetree g_device_tree;
 
-bool
-dtb_init_nodes_for_driver(const struct dtb_driver *const driver,
-                          const struct devicetree *const tree,
-                          const struct devicetree_node *const node)
+__debug_optimize(3) static bool
+node_matches_driver(const struct dtb_driver *const driver,
+                    const struct devicetree_node *const node)
 {
-    bool result = false;
     if (driver->match_flags & __DTB_DRIVER_MATCH_COMPAT) {
         struct devicetree_prop_compat *const compat_prop =
             (struct devicetree_prop_compat *)(uint64_t)
                 devicetree_node_get_prop(node, DEVICETREE_PROP_COMPAT);
 
         if (compat_prop == NULL) {
-            goto next;
+            return false;
         }
 
         bool found = false;
@@ -37,7 +36,7 @@ dtb_init_nodes_for_driver(const struct dtb_driver *const driver,
         }
 
         if (!found) {
-            goto next;
+            return false;
         }
     }
 
@@ -47,17 +46,27 @@ dtb_init_nodes_for_driver(const struct dtb_driver *const driver,
                 devicetree_node_get_prop(node, DEVICETREE_PROP_DEVICE_TYPE);
 
         if (device_type_prop == NULL) {
-            goto next;
+            return false;
         }
 
         if (!sv_equals(device_type_prop->name, driver->device_type)) {
-            goto next;
+            return false;
         }
     }
 
-    result = driver->init(tree, node);
+    return true;
+}
+
+bool
+dtb_init_nodes_for_driver(const struct dtb_driver *const driver,
+                          const struct devicetree *const tree,
+                          const struct devicetree_node *const node)
+{
+    bool result = false;
+    if (node_matches_driver(driver, node)) {
+        result = driver->init(tree, node);
+    }
 
-next:
     devicetree_node_foreach_child(node, iter) {
         if (dtb_init_nodes_for_driver(driver, tree, iter)) {
             result = true;
@@ -67,6 +76,36 @@ next:
     return result;
 }
 
+static void probe_func(const struct driver *const driver, void *const arg) {
+    driver->dtb->init(&g_device_tree, (const struct devicetree_node *)arg);
+}
+
+// Probe every node matching `driver` in the tree at `node`. A node's probe
+// depends on the probe of the closest ancestor the driver matched, so a bus is
+// always probed before its children.
+
+static void
+probe_nodes_for_driver(const struct driver *const driver,
+                       const struct devicetree_node *const node,
+                       struct probe_job *parent_job)
+{
+    if (node_matches_driver(driver->dtb, node)) {
+        struct probe_job *const job =
+            probe_schedule(driver,
+                           probe_func,
+                           (void *)(uint64_t)node,
+                           parent_job);
+
+        if (job != NULL) {
+            parent_job = job;
+        }
+    }
+
+    devicetree_node_foreach_child(node, iter) {
+        probe_nodes_for_driver(driver, iter, parent_job);
+    }
+}
+
 static void dtb_init_drivers() {
     driver_foreach(driver) {
         assert_msg(driver->name.length != 0, "driver is missing a name");
@@ -95,7 +134,9 @@ static void dtb_init_drivers() {
                        SV_FMT_ARGS(driver->name));
         }
 
-        dtb_init_nodes_for_driver(dtb, &g_device_tree, &g_device_tree_root);
+        probe_nodes_for_driver(driver,
+                               &g_device_tree_root,
+                               /*parent_job=*/NULL);
     }
 }
 
@@ -0,0 +1,179 @@
+/*
+ * kernel/src/dev/dtb/numa.c
+ * © suhas pai
+ */
+
+#include "dev/printk.h"
+#include "fdt/libfdt.h"
+#include "mm/numa.h"
+
+#include "numa.h"
+
+__debug_optimize(3) static inline bool
+read_cells(const fdt32_t **const iter_ptr,
+           const fdt32_t *const end,
+           const int cell_count,
+           uint64_t *const result_out)
+{
+    const fdt32_t *iter = *iter_ptr;
+    if (cell_count < 0 || cell_count > 2 || iter + cell_count > end) {
+        return false;
+    }
+
+    uint64_t result = 0;
+    for (int i = 0; i != cell_count; i++, iter++) {
+        result = result << 32 | fdt32_ld(iter);
+    }
+
+    *result_out = result;
+    *iter_ptr = iter;
+
+    return true;
+}
+
+static bool
+get_node_id(const void *const dtb,
+            const int nodeoff,
+            numa_node_t *const node_out)
+{
+    int length = 0;
+    const fdt32_t *const prop =
+        fdt_getprop(dtb, nodeoff, "numa-node-id", &length);
+
+    if (prop == NULL || length != sizeof(fdt32_t)) {
+        return false;
+    }
+
+    const numa_node_t node = numa_add_domain(fdt32_ld(prop));
+    if (node == NUMA_NO_NODE) {
+        return false;
+    }
+
+    *node_out = node;
+    return true;
+}
+
+static void parse_memory_node(const void *const dtb, const int nodeoff) {
+    numa_node_t node = 0;
+    if (!get_node_id(dtb, nodeoff, &node)) {
+        return;
+    }
+
+    const int parent_off = fdt_parent_offset(dtb, nodeoff);
+    const int addr_cells = fdt_address_cells(dtb, parent_off);
+    const int size_cells = fdt_size_cells(dtb, parent_off);
+
+    int length = 0;
+    const fdt32_t *iter = fdt_getprop(dtb, nodeoff, "reg", &length);
+
+    if (iter == NULL || length < 0) {
+        return;
+    }
+
+    const fdt32_t *const end = iter + (uint32_t)length / sizeof(fdt32_t);
+    while (iter != end) {
+        uint64_t address = 0;
+        uint64_t size = 0;
+
+        if (!read_cells(&iter, end, addr_cells, &address)
+         || !read_cells(&iter, end, size_cells, &size))
+        {
+            printk(LOGLEVEL_WARN,
+                   "devicetree: numa: memory node has an invalid reg prop\n");
+            return;
+        }
+
+        struct range range = RANGE_EMPTY();
+        if (range_create_and_verify(address, size, &range)) {
+            numa_add_mem_range(node, range);
+        }
+    }
+}
+
+static void parse_cpus_node(const void *const dtb, const int cpus_off) {
+    const int addr_cells = fdt_address_cells(dtb, cpus_off);
+
+    int nodeoff = 0;
+    fdt_for_each_subnode(nodeoff, dtb, cpus_off) {
+        numa_node_t node = 0;
+        if (!get_node_id(dtb, nodeoff, &node)) {
+            continue;
+        }
+
+        int length = 0;
+        const fdt32_t *iter = fdt_getprop(dtb, nodeoff, "reg", &length);
+
+        if (iter == NULL || length < 0) {
+            continue;
+        }
+
+        uint64_t reg = 0;
+        const fdt32_t *const end = iter + (uint32_t)length / sizeof(fdt32_t);
+
+        if (read_cells(&iter, end, addr_cells, &reg)) {
+            numa_add_cpu(NUMA_CPU_ID_DTB_REG, reg, node);
+        }
+    }
+}
+
+// The distance-matrix prop is a list of (from, to, distance) triplets.
+
+static void parse_distance_map(const void *const dtb, const int nodeoff) {
+    int length = 0;
+    const fdt32_t *iter =
+        fdt_getprop(dtb, nodeoff, "distance-matrix", &length);
+
+    if (iter == NULL
+     || length < 0
+     || (uint32_t)length % (sizeof(fdt32_t) * 3) != 0)
+    {
+        return;
+    }
+
+    const fdt32_t *const end = iter + (uint32_t)length / sizeof(fdt32_t);
+    for (; iter != end; iter += 3) {
+        const numa_node_t from = numa_node_for_domain(fdt32_ld(&iter[0]));
+        const numa_node_t to = numa_node_for_domain(fdt32_ld(&iter[1]));
+        const uint32_t distance = fdt32_ld(&iter[2]);
+
+        if (from == NUMA_NO_NODE || to == NUMA_NO_NODE || distance > UINT8_MAX)
+        {
+            continue;
+        }
+
+        numa_set_distance(from, to, (uint8_t)distance);
+    }
+}
+
+void dtb_numa_init(const void *const dtb) {
+    int nodeoff =
+        fdt_node_offset_by_prop_value(dtb,
+                                      /*startoffset=*/-1,
+                                      "device_type",
+                                      "memory",
+                                      sizeof("memory"));
+
+    while (nodeoff >= 0) {
+        parse_memory_node(dtb, nodeoff);
+        nodeoff =
+            fdt_node_offset_by_prop_value(dtb,
+                                          nodeoff,
+                                          "device_type",
+                                          "memory",
+                                          sizeof("memory"));
+    }
+
+    const int cpus_off = fdt_path_offset(dtb, "/cpus");
+    if (cpus_off >= 0) {
+        parse_cpus_node(dtb, cpus_off);
+    }
+
+    const int map_off =
+        fdt_node_offset_by_compatible(dtb,
+                                      /*startoffset=*/-1,
+                                      "numa-distance-map-v1");
+
+    if (map_off >= 0) {
+        parse_distance_map(dtb, map_off);
+    }
+}
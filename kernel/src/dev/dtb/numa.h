@@ -0,0 +1,11 @@
+/*
+ * kernel/src/dev/dtb/numa.h
+ * © suhas pai
+ */
+
+#pragma once
+
+// Called by numa_init(), before the devicetree is parsed, so `dtb` is read
+// directly with libfdt.
+
+void dtb_numa_init(const void *dtb);
@@ -100,6 +100,7 @@ void setup_flanterm() {
         g_fb_info_list[i].ctx = context;
         g_fb_info_list[i].terminal.emit_ch = flanterm_write_char;
         g_fb_info_list[i].terminal.emit_sv = flanterm_write_sv;
+        g_fb_info_list[i].terminal.bust_locks = NULL;
 
         printk(LOGLEVEL_INFO,
                "flanterm: framebuffer %" PRIu64 " successfully setup\n",
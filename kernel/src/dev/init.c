@@ -12,9 +12,11 @@
 #endif /* defined(__x86_64__) */
 
 #include "acpi/api.h"
+#include "cpu/topology.h"
 #include "dtb/init.h"
 
 #include "dev/printk.h"
+#include "dev/probe.h"
 #include "pci/init.h"
 
 #include "time/time.h"
@@ -78,6 +80,7 @@ void arch_init_time();
 
 void dev_init() {
     acpi_init();
+    cpu_topology_init();
 
     arch_init_dev();
     arch_init_time();
@@ -88,7 +91,11 @@ void dev_init() {
 }
 
 void dev_init_drivers() {
+    probe_start_workers();
+
     arch_init_dev_drivers();
     dtb_init();
     pci_init();
+
+    probe_finish_scheduling();
 }
\ No newline at end of file
@@ -0,0 +1,166 @@
+/*
+ * kernel/src/dev/irq_balance.c
+ * © suhas pai
+ */
+
+#include <stdatomic.h>
+
+#include "cpu/isr.h"
+#include "dev/pci/entity.h"
+
+#include "mm/kmalloc.h"
+#include "sched/scheduler.h"
+#include "sched/sleep.h"
+
+#include "irq_balance.h"
+#include "printk.h"
+
+static _Atomic uint64_t g_pass_count = 0;
+static _Atomic uint64_t g_move_count = 0;
+static _Atomic uint64_t g_move_fail_count = 0;
+
+__debug_optimize(3) static uint64_t
+get_cpu_load(const struct isr_msi_vector_info *const list,
+             const uint32_t count,
+             const struct cpu_info *const cpu)
+{
+    uint64_t load = 0;
+    for (uint32_t i = 0; i != count; i++) {
+        if (list[i].cpu == cpu) {
+            load += list[i].count;
+        }
+    }
+
+    return load;
+}
+
+// Find the busiest vector of `from` whose move to a cpu with `to_load` wouldn't
+// just make that cpu the busier one.
+
+__debug_optimize(3) static struct isr_msi_vector_info *
+find_vector_to_move(struct isr_msi_vector_info *const list,
+                    const uint32_t count,
+                    const struct cpu_info *const from,
+                    const uint64_t from_load,
+                    const uint64_t to_load)
+{
+    struct isr_msi_vector_info *result = NULL;
+    for (uint32_t i = 0; i != count; i++) {
+        struct isr_msi_vector_info *const info = &list[i];
+        if (info->cpu != from
+         || info->device == NULL
+         || info->pinned
+         || info->device->kind != DEVICE_KIND_PCI_ENTITY
+         || info->count == 0
+         || to_load + info->count >= from_load)
+        {
+            continue;
+        }
+
+        if (result == NULL || info->count > result->count) {
+            result = info;
+        }
+    }
+
+    return result;
+}
+
+static void
+balance_pass(struct isr_msi_vector_info *const list, const uint32_t count) {
+    for (uint32_t move = 0; move != IRQ_BALANCE_MAX_MOVES_PER_PASS; move++) {
+        const struct cpu_info *busiest = NULL;
+        const struct cpu_info *idlest = NULL;
+
+        uint64_t busiest_load = 0;
+        uint64_t idlest_load = UINT64_MAX;
+
+        const struct cpu_info *iter = NULL;
+        list_foreach(iter, cpus_get_list(), cpu_list) {
+            const uint64_t load = get_cpu_load(list, count, iter);
+            if (busiest == NULL || load > busiest_load) {
+                busiest = iter;
+                busiest_load = load;
+            }
+
+            if (idlest == NULL || load < idlest_load) {
+                idlest = iter;
+                idlest_load = load;
+            }
+        }
+
+        if (busiest == idlest || busiest_load < IRQ_BALANCE_MIN_IRQS) {
+            return;
+        }
+
+        struct isr_msi_vector_info *const info =
+            find_vector_to_move(list,
+                                count,
+                                busiest,
+                                busiest_load,
+                                idlest_load);
+
+        if (info == NULL) {
+            return;
+        }
+
+        struct pci_entity_info *const entity =
+            container_of(info->device, struct pci_entity_info, device);
+
+        if (!pci_entity_set_msi_affinity(entity,
+                                         info->vector,
+                                         info->msi_index,
+                                         idlest))
+        {
+            atomic_fetch_add_explicit(&g_move_fail_count,
+                                      1,
+                                      memory_order_relaxed);
+            return;
+        }
+
+        info->cpu = idlest;
+        atomic_fetch_add_explicit(&g_move_count, 1, memory_order_relaxed);
+    }
+}
+
+__noreturn static void irq_balance_worker() {
+    struct isr_msi_vector_info *const list =
+        kmalloc(sizeof(struct isr_msi_vector_info) * IRQ_BALANCE_MAX_VECTORS);
+
+    assert_msg(list != NULL, "dev: irq-balance: failed to allocate list");
+    while (true) {
+        sched_sleep_us(IRQ_BALANCE_INTERVAL_US);
+
+        const uint32_t count =
+            isr_get_msi_vector_list(list, IRQ_BALANCE_MAX_VECTORS);
+
+        balance_pass(list, count);
+        atomic_fetch_add_explicit(&g_pass_count, 1, memory_order_relaxed);
+    }
+}
+
+struct irq_balance_stats irq_balance_get_stats() {
+    return (struct irq_balance_stats){
+        .pass_count = atomic_load_explicit(&g_pass_count, memory_order_relaxed),
+        .move_count = atomic_load_explicit(&g_move_count, memory_order_relaxed),
+        .move_fail_count =
+            atomic_load_explicit(&g_move_fail_count, memory_order_relaxed),
+    };
+}
+
+void irq_balance_print_stats() {
+    const struct irq_balance_stats stats = irq_balance_get_stats();
+    printk(LOGLEVEL_INFO,
+           "dev: irq-balance: %" PRIu64 " passes, %" PRIu64 " vectors moved "
+           "(%" PRIu64 " failed)\n",
+           stats.pass_count,
+           stats.move_count,
+           stats.move_fail_count);
+}
+
+void irq_balance_init() {
+    struct thread *const thread =
+        sched_create_kernel_thread(irq_balance_worker);
+
+    assert_msg(thread != NULL, "dev: irq-balance: failed to create thread");
+    printk(LOGLEVEL_INFO, "dev: started irq-balance thread\n");
+}
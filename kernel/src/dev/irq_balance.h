@@ -0,0 +1,32 @@
+/*
+ * kernel/src/dev/irq_balance.h
+ * © suhas pai
+ */
+
+#pragma once
+#include "lib/time.h"
+
+// The irq balancer wakes up every IRQ_BALANCE_INTERVAL_US, and moves the
+// busiest msi vectors of the busiest cpu to the least busy cpu, as long as
+// that brings the two cpus closer together. Only vectors of pci entities are
+// moved, see pci_entity_set_msi_affinity(), and never those pinned to the cpu
+// of their queue with isr_pin_msi_vector().
+//
+// A cpu is only considered busy if it got at least IRQ_BALANCE_MIN_IRQS
+// interrupts since the previous pass, so idle systems are left alone.
+
+#define IRQ_BALANCE_INTERVAL_US seconds_to_micro(1)
+#define IRQ_BALANCE_MAX_VECTORS 256
+#define IRQ_BALANCE_MAX_MOVES_PER_PASS 4
+#define IRQ_BALANCE_MIN_IRQS 1000
+
+struct irq_balance_stats {
+    uint64_t pass_count;
+    uint64_t move_count;
+    uint64_t move_fail_count;
+};
+
+struct irq_balance_stats irq_balance_get_stats();
+void irq_balance_print_stats();
+
+void irq_balance_init();
@@ -9,6 +9,7 @@
 #include "dev/printk.h"
 
 #include "mm/kmalloc.h"
+#include "sched/sleep.h"
 #include "sys/mmio.h"
 
 #include "entity.h"
@@ -254,6 +255,85 @@ pci_entity_bind_msi_to_vector(struct pci_entity_info *const entity,
 }
 
 #if ISR_SUPPORTS_MSI
+    __debug_optimize(3) static bool
+    move_msi(const struct pci_entity_info *const entity,
+             const isr_vector_t vector,
+             const uint64_t address)
+    {
+        const uint16_t data =
+            entity->msi.supports_64bit ?
+                pci_read_from_base(entity,
+                                   entity->msi_pcie_offset,
+                                   struct pci_spec_cap_msi,
+                                   bits64.msg_data) :
+                pci_read_from_base(entity,
+                                   entity->msi_pcie_offset,
+                                   struct pci_spec_cap_msi,
+                                   bits32.msg_data);
+
+        if (data != vector) {
+            return false;
+        }
+
+        pci_write_from_base(entity,
+                            entity->msi_pcie_offset,
+                            struct pci_spec_cap_msi,
+                            msg_address,
+                            (uint32_t)address);
+        return true;
+    }
+
+    // Msix vectors of a device may share a number if they target different
+    // cpus, so find the entry by its address as well.
+
+    __debug_optimize(3) static bool
+    move_msix(const struct pci_entity_info *const entity,
+              const isr_vector_t vector,
+              const uint64_t old_address,
+              const uint64_t address)
+    {
+        struct pci_entity_bar_info *const bar = entity->msix.table_bar;
+        if (bar->mmio == NULL) {
+            return false;
+        }
+
+        volatile struct pci_spec_cap_msix_table_entry *const table =
+            pci_entity_bar_get_base(bar) + entity->msix.table_offset;
+
+        for (uint32_t i = 0; i != entity->msix.table_size; i++) {
+            if (!bitset_has(entity->msix.bitset, i)) {
+                continue;
+            }
+
+            volatile struct pci_spec_cap_msix_table_entry *const entry =
+                &table[i];
+
+            const uint64_t entry_address =
+                (uint64_t)mmio_read(&entry->msg_address_upper32) << 32
+              | mmio_read(&entry->msg_address_lower32);
+
+            if (mmio_read(&entry->data) != vector
+             || entry_address != old_address)
+            {
+                continue;
+            }
+
+            // Entries must be masked while they're rewritten, so the device
+            // never sends a message with half of the new address.
+
+            const uint32_t control = mmio_read(&entry->control);
+
+            mmio_write(&entry->control, control | 1);
+            mmio_write(&entry->msg_address_lower32, (uint32_t)address);
+            mmio_write(&entry->msg_address_upper32, address >> 32);
+            mmio_write(&entry->control, control);
+
+            return true;
+        }
+
+        return false;
+    }
+
     __debug_optimize(3) static void
     toggle_msi_vector_mask(const struct pci_entity_info *const entity,
                            const isr_vector_t vector,
@@ -333,6 +413,88 @@ pci_entity_toggle_msi_vector_mask(struct pci_entity_info *const entity,
     verify_not_reached();
 }
 
+bool
+pci_entity_set_msi_affinity(struct pci_entity_info *const entity,
+                            const isr_vector_t vector,
+                            const uint16_t msi_index,
+                            const struct cpu_info *const cpu)
+{
+#if ISR_SUPPORTS_MSI
+    const struct cpu_info *const from =
+        isr_start_move_msi_vector(&entity->device, vector, msi_index, cpu);
+
+    if (from == NULL) {
+        return false;
+    }
+
+    bool result = true;
+    switch (entity->msi_support) {
+        case PCI_ENTITY_MSI_SUPPORT_NONE:
+            result = false;
+            break;
+        case PCI_ENTITY_MSI_SUPPORT_MSI: {
+            const uint64_t old_address = isr_get_msi_address(from, vector);
+            const uint64_t address = isr_get_msi_address(cpu, vector);
+
+            if (address != old_address) {
+                with_spinlock_preempt_disabled(&entity->lock, {
+                    result = move_msi(entity, vector, address);
+                });
+            }
+
+            break;
+        }
+        case PCI_ENTITY_MSI_SUPPORT_MSIX: {
+            const uint64_t old_address = isr_get_msix_address(from, vector);
+            const uint64_t address = isr_get_msix_address(cpu, vector);
+
+            if (address != old_address) {
+                with_spinlock_preempt_disabled(&entity->lock, {
+                    result = move_msix(entity, vector, old_address, address);
+                });
+            }
+
+            break;
+        }
+    }
+
+    if (!result) {
+        isr_release_moved_msi_vector(cpu, vector);
+        return false;
+    }
+
+    // Interrupts sent to the old address may still be in flight, so keep the
+    // vector on the old cpu until the device is seen using the new one. Both
+    // cpus have the vector's owner, so either can handle it in the meantime.
+
+    for (usec_t waited = 0;
+         waited < PCI_ENTITY_MSI_MOVE_GRACE_US
+      && !isr_moved_msi_vector_fired(cpu, vector);
+         waited += PCI_ENTITY_MSI_MOVE_POLL_US)
+    {
+        sched_sleep_us(PCI_ENTITY_MSI_MOVE_POLL_US);
+    }
+
+    isr_release_moved_msi_vector(from, vector);
+    printk(LOGLEVEL_INFO,
+           "pcie: moved vector " ISR_VECTOR_FMT " of entity "
+           PCI_ENTITY_INFO_FMT " from cpu %" PRIu32 " to cpu %" PRIu32 "\n",
+           vector,
+           PCI_ENTITY_INFO_FMT_ARGS(entity),
+           cpu_get_id(from),
+           cpu_get_id(cpu));
+
+    return true;
+#else
+    (void)entity;
+    (void)vector;
+    (void)msi_index;
+    (void)cpu;
+
+    return false;
+#endif /* defined(ISR_SUPPORTS_MSI) */
+}
+
 __debug_optimize(3) void
 pci_entity_enable_privls(struct pci_entity_info *const entity,
                          const uint16_t privls)
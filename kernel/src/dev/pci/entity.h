@@ -7,14 +7,20 @@
 
 #include "cpu/info.h"
 #include "dev/device.h"
+#include "lib/time.h"
 #include "sys/isr.h"
 
 #include "bar.h"
 #include "bus.h"
 
+struct probe_job;
+
 #define PCI_ENTITY_MAX_BAR_COUNT 6
 #define PCI_ENTITY_MAX_MSIX_TABLE_SIZE 2048
 
+#define PCI_ENTITY_MSI_MOVE_GRACE_US milli_to_micro(10)
+#define PCI_ENTITY_MSI_MOVE_POLL_US 100
+
 enum pci_entity_msi_support {
     PCI_ENTITY_MSI_SUPPORT_NONE,
     PCI_ENTITY_MSI_SUPPORT_MSI,
@@ -32,6 +38,11 @@ struct pci_entity_info {
     struct pci_bus *bus;
     struct pci_location loc;
 
+    // The last async probe-job scheduled for this entity, so that drivers
+    // matching the same entity probe it one after the other.
+
+    struct probe_job *probe_job;
+
     uint16_t id;
     uint16_t vendor_id;
     uint16_t status;
@@ -104,6 +115,19 @@ pci_entity_toggle_msi_vector_mask(struct pci_entity_info *entity,
                                   isr_vector_t vector,
                                   bool mask);
 
+// Move msi-vector `msi_index` of `entity`, bound to `vector`, to `cpu`. The
+// vector keeps its number, so the driver doesn't have to be told.
+//
+// The old cpu keeps handling the vector until the new cpu receives its first
+// interrupt, or until PCI_ENTITY_MSI_MOVE_GRACE_US passes, so this sleeps and
+// must not be called with preemption disabled.
+
+bool
+pci_entity_set_msi_affinity(struct pci_entity_info *entity,
+                            isr_vector_t vector,
+                            uint16_t msi_index,
+                            const struct cpu_info *cpu);
+
 enum pci_entity_privilege {
     __PCI_ENTITY_PRIVL_PIO_ACCESS = 1ull << 0,
     __PCI_ENTITY_PRIVL_MEM_ACCESS = 1ull << 1,
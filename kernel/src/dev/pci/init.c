@@ -13,6 +13,7 @@
 
 #include "dev/driver.h"
 #include "dev/printk.h"
+#include "dev/probe.h"
 
 #include "lib/util.h"
 #include "mm/kmalloc.h"
@@ -475,9 +476,11 @@ parse_function(struct pci_bus *const bus,
         return;
     }
 
+    entity->device = DEVICE_INIT(DEVICE_KIND_PCI_ENTITY);
     entity->bus = bus;
     entity->loc = *loc;
     entity->lock = SPINLOCK_INIT();
+    entity->probe_job = NULL;
 
     list_init(&entity->list_in_entities);
     list_init(&entity->list_in_domain);
@@ -774,6 +777,22 @@ void pci_find_entities(struct pci_bus *const bus) {
     }
 }
 
+static void probe_func(const struct driver *const driver, void *const arg) {
+    driver->pci->init((struct pci_entity_info *)arg);
+}
+
+static void
+probe_entity(const struct driver *const driver,
+             struct pci_entity_info *const entity)
+{
+    struct probe_job *const job =
+        probe_schedule(driver, probe_func, entity, entity->probe_job);
+
+    if (job != NULL) {
+        entity->probe_job = job;
+    }
+}
+
 void pci_init_drivers() {
     driver_foreach(driver) {
         if (driver->pci == NULL) {
@@ -786,7 +805,7 @@ void pci_init_drivers() {
         list_foreach(entity, &g_entity_list, list_in_entities) {
             if (pci_driver->match == PCI_DRIVER_MATCH_VENDOR) {
                 if (entity->vendor_id == pci_driver->vendor) {
-                    pci_driver->init(entity);
+                    probe_entity(driver, entity);
                 }
 
                 continue;
@@ -806,7 +825,7 @@ void pci_init_drivers() {
                 }
 
                 if (found) {
-                    pci_driver->init(entity);
+                    probe_entity(driver, entity);
                 }
 
                 continue;
@@ -830,7 +849,7 @@ void pci_init_drivers() {
                 }
             }
 
-            pci_driver->init(entity);
+            probe_entity(driver, entity);
         }
     }
 }
@@ -8,11 +8,36 @@
 #include "cpu/cpu_info.h"
 #include "cpu/spinlock.h"
 
+#include "lib/align.h"
 #include "lib/parse_printf.h"
+#include "lib/util.h"
+
+#include "mm/page_alloc.h"
+
+#include "sched/scheduler.h"
+#include "sched/sleep.h"
+
+#include "time/time.h"
 #include "printk.h"
 
+#define PRINTK_RECORD_ALIGN sizeof(struct printk_record)
+#define PRINTK_RECORD_MAX_SIZE \
+    (sizeof(struct printk_record) + PRINTK_RECORD_MAX_LENGTH)
+
+_Static_assert(PRINTK_RECORD_MAX_SIZE % PRINTK_RECORD_ALIGN == 0,
+               "printk: max record size should be aligned");
+
 static struct terminal *g_first_term = NULL;
 
+// Protects writing to the terminals, and reading records out of every cpu's
+// ring.
+
+static struct spinlock g_print_lock = SPINLOCK_INIT();
+
+static _Atomic bool g_deferred = false;
+static _Atomic enum log_level g_log_level = LOGLEVEL_INFO;
+static _Atomic uint64_t g_sync_count = 0;
+
 __debug_optimize(3) void printk_add_terminal(struct terminal *const term) {
     with_interrupts_disabled({
         term->next = g_first_term;
@@ -20,9 +45,12 @@ __debug_optimize(3) void printk_add_terminal(struct terminal *const term) {
     });
 }
 
+__debug_optimize(3) void printk_set_log_level(const enum log_level level) {
+    atomic_store_explicit(&g_log_level, level, memory_order_relaxed);
+}
+
 __debug_optimize(3)
 void printk(const enum log_level loglevel, const char *const string, ...) {
-    (void)loglevel;
     va_list list;
 
     va_start(list, string);
@@ -68,24 +96,6 @@ write_sv(struct printf_spec_info *const spec_info,
     return sv.length;
 }
 
-static struct spinlock g_print_lock = SPINLOCK_INIT();
-
-__debug_optimize(3)
-void putk(const enum log_level level, const char *const string) {
-    with_spinlock_irq_disabled(&g_print_lock, {
-        putk_sv(level, sv_create_length(string, strlen(string)));
-    });
-}
-
-__debug_optimize(3)
-void putk_sv(const enum log_level level, const struct string_view sv) {
-    (void)level;
-
-    with_spinlock_irq_disabled(&g_print_lock, {
-        write_sv(/*spec_info=*/NULL, /*cb_info=*/NULL, sv, /*cont_out=*/NULL);
-    });
-}
-
 __debug_optimize(3)
 void vprintk_internal(const char *const string, va_list list) {
     parse_printf(string,
@@ -104,16 +114,422 @@ __debug_optimize(3) static void printk_internal(const char *const string, ...) {
     va_end(list);
 }
 
+void printk_ring_init(struct printk_ring *const ring) {
+    ring->buffer = NULL;
+
+    atomic_store_explicit(&ring->head, 0, memory_order_relaxed);
+    atomic_store_explicit(&ring->tail, 0, memory_order_relaxed);
+    atomic_store_explicit(&ring->queued_count, 0, memory_order_relaxed);
+    atomic_store_explicit(&ring->dropped_count, 0, memory_order_relaxed);
+}
+
+__debug_optimize(3)
+static inline uint64_t record_size(const struct printk_record *const record) {
+    return align_up_assert(sizeof(*record) + record->length,
+                           PRINTK_RECORD_ALIGN);
+}
+
+// Reserve space for a record of the max size at the ring's head. A record is
+// never split across the end of the ring, so the rest of the ring is padded
+// out if the record doesn't fit before it.
+
+__debug_optimize(3) static struct printk_record *
+ring_reserve(struct printk_ring *const ring, uint64_t *const head_out) {
+    const uint64_t head =
+        atomic_load_explicit(&ring->head, memory_order_relaxed);
+    const uint64_t tail =
+        atomic_load_explicit(&ring->tail, memory_order_acquire);
+
+    const uint64_t index = head % PRINTK_RING_SIZE;
+    uint64_t pad = 0;
+
+    if (PRINTK_RING_SIZE - index < PRINTK_RECORD_MAX_SIZE) {
+        pad = PRINTK_RING_SIZE - index;
+    }
+
+    if (PRINTK_RING_SIZE - (head - tail) < pad + PRINTK_RECORD_MAX_SIZE) {
+        return NULL;
+    }
+
+    if (pad != 0) {
+        struct printk_record *const pad_record =
+            (struct printk_record *)(ring->buffer + index);
+
+        pad_record->length = 0;
+        pad_record->flags = __PRINTK_RECORD_PAD;
+    }
+
+    const uint64_t record_head = head + pad;
+
+    *head_out = record_head;
+    return (struct printk_record *)
+        (ring->buffer + record_head % PRINTK_RING_SIZE);
+}
+
+__debug_optimize(3) static void
+ring_commit(struct printk_ring *const ring,
+            const uint64_t head,
+            const struct printk_record *const record)
+{
+    atomic_store_explicit(&ring->head,
+                          head + record_size(record),
+                          memory_order_release);
+    atomic_fetch_add_explicit(&ring->queued_count, 1, memory_order_relaxed);
+}
+
+__debug_optimize(3) static uint32_t
+record_write_char(struct printf_spec_info *const spec_info,
+                  void *const cb_info,
+                  const char ch,
+                  const uint32_t amount,
+                  bool *const cont_out)
+{
+    (void)spec_info;
+
+    struct printk_record *const record = (struct printk_record *)cb_info;
+    const uint32_t count =
+        min(amount, (uint32_t)(PRINTK_RECORD_MAX_LENGTH - record->length));
+
+    memset(record->text + record->length, ch, count);
+    record->length += count;
+
+    if (count != amount) {
+        *cont_out = false;
+    }
+
+    return count;
+}
+
+__debug_optimize(3) static uint32_t
+record_write_sv(struct printf_spec_info *const spec_info,
+                void *const cb_info,
+                const struct string_view sv,
+                bool *const cont_out)
+{
+    (void)spec_info;
+
+    struct printk_record *const record = (struct printk_record *)cb_info;
+    const uint32_t count =
+        min(sv.length, (uint32_t)(PRINTK_RECORD_MAX_LENGTH - record->length));
+
+    memcpy(record->text + record->length, sv.begin, count);
+    record->length += count;
+
+    if (count != sv.length) {
+        *cont_out = false;
+    }
+
+    return count;
+}
+
+// Returns the ring of this cpu if messages should be queued into it, or NULL
+// if they should be written to the terminals right away. Must be called with
+// interrupts disabled.
+
+__debug_optimize(3) static struct printk_ring *this_cpu_ring() {
+    if (!atomic_load_explicit(&g_deferred, memory_order_acquire)) {
+        return NULL;
+    }
+
+    if (cpu_in_bad_state()) {
+        return NULL;
+    }
+
+    struct printk_ring *const ring = &this_cpu_mut()->printk_ring;
+    if (ring->buffer == NULL) {
+        return NULL;
+    }
+
+    return ring;
+}
+
+// Reserve a record in the ring and fill out its header, or count it as dropped
+// if the ring is full. Must be called with interrupts disabled.
+
+__debug_optimize(3) static struct printk_record *
+record_begin(struct printk_ring *const ring,
+             const enum log_level level,
+             const uint8_t flags,
+             uint64_t *const head_out)
+{
+    struct printk_record *const record = ring_reserve(ring, head_out);
+    if (record == NULL) {
+        atomic_fetch_add_explicit(&ring->dropped_count,
+                                  1,
+                                  memory_order_relaxed);
+        return NULL;
+    }
+
+    record->nsec = nsec_since_boot();
+    record->cpu_id = cpu_get_id(this_cpu());
+    record->length = 0;
+    record->level = (uint8_t)level;
+    record->flags = flags;
+
+    return record;
+}
+
+// Returns the oldest record of the ring, skipping past any padding at the end
+// of the ring. Must be called with the print-lock held.
+
+__debug_optimize(3)
+static struct printk_record *ring_peek(struct printk_ring *const ring) {
+    if (ring->buffer == NULL) {
+        return NULL;
+    }
+
+    uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    const uint64_t head =
+        atomic_load_explicit(&ring->head, memory_order_acquire);
+
+    if (tail == head) {
+        return NULL;
+    }
+
+    struct printk_record *record =
+        (struct printk_record *)(ring->buffer + tail % PRINTK_RING_SIZE);
+
+    if (record->flags & __PRINTK_RECORD_PAD) {
+        tail += PRINTK_RING_SIZE - tail % PRINTK_RING_SIZE;
+        atomic_store_explicit(&ring->tail, tail, memory_order_release);
+
+        if (tail == head) {
+            return NULL;
+        }
+
+        record = (struct printk_record *)ring->buffer;
+    }
+
+    return record;
+}
+
+__debug_optimize(3) static void
+ring_pop(struct printk_ring *const ring,
+         const struct printk_record *const record)
+{
+    const uint64_t tail =
+        atomic_load_explicit(&ring->tail, memory_order_relaxed);
+
+    atomic_store_explicit(&ring->tail,
+                          tail + record_size(record),
+                          memory_order_release);
+}
+
+__debug_optimize(3)
+static void emit_record(const struct printk_record *const record) {
+    if ((record->flags & __PRINTK_RECORD_RAW) == 0) {
+        printk_internal("[%" PRIu64 ".%06" PRIu64 "] [cpu %" PRIu32 "] ",
+                        record->nsec / NANO_IN_SECONDS,
+                        (record->nsec % NANO_IN_SECONDS) / NANO_IN_MICRO,
+                        record->cpu_id);
+    }
+
+    write_sv(/*spec_info=*/NULL,
+             /*cb_info=*/NULL,
+             sv_create_length(record->text, record->length),
+             /*cont_out=*/NULL);
+}
+
+// Write out the oldest record out of every cpu's ring. Returns false if every
+// ring is empty. Must be called with the print-lock held.
+
+__debug_optimize(3) static bool drain_one() {
+    struct printk_ring *oldest_ring = NULL;
+    struct printk_record *oldest_record = NULL;
+
+    struct cpu_info *cpu = NULL;
+    list_foreach(cpu, cpus_get_list(), cpu_list) {
+        struct printk_ring *const ring = &cpu->printk_ring;
+        struct printk_record *const record = ring_peek(ring);
+
+        if (record == NULL) {
+            continue;
+        }
+
+        if (oldest_record == NULL || record->nsec < oldest_record->nsec) {
+            oldest_ring = ring;
+            oldest_record = record;
+        }
+    }
+
+    if (oldest_record == NULL) {
+        return false;
+    }
+
+    emit_record(oldest_record);
+    ring_pop(oldest_ring, oldest_record);
+
+    return true;
+}
+
+__debug_optimize(3) void printk_flush() {
+    // Drop the print-lock between records, so other cpus writing straight to
+    // the terminals aren't held up by a long backlog.
+
+    bool drained = true;
+    while (drained) {
+        with_spinlock_irq_disabled(&g_print_lock, {
+            drained = drain_one();
+        });
+    }
+}
+
+__debug_optimize(3)
+static inline bool level_enabled(const enum log_level level) {
+    return level >= atomic_load_explicit(&g_log_level, memory_order_relaxed);
+}
+
+__debug_optimize(3)
+void putk(const enum log_level level, const char *const string) {
+    putk_sv(level, sv_create_length(string, strlen(string)));
+}
+
+__debug_optimize(3)
+void putk_sv(const enum log_level level, const struct string_view sv) {
+    if (!level_enabled(level)) {
+        return;
+    }
+
+    bool queued = false;
+    with_interrupts_disabled({
+        struct printk_ring *const ring = this_cpu_ring();
+        if (ring != NULL) {
+            uint64_t head = 0;
+            struct printk_record *const record =
+                record_begin(ring, level, __PRINTK_RECORD_RAW, &head);
+
+            if (record != NULL) {
+                bool cont = true;
+
+                record_write_sv(/*spec_info=*/NULL, record, sv, &cont);
+                ring_commit(ring, head, record);
+            }
+
+            queued = true;
+        }
+    });
+
+    if (!queued) {
+        with_spinlock_irq_disabled(&g_print_lock, {
+            write_sv(/*spec_info=*/NULL, /*cb_info=*/NULL, sv, NULL);
+        });
+
+        atomic_fetch_add_explicit(&g_sync_count, 1, memory_order_relaxed);
+    }
+}
+
 __debug_optimize(3) void
 vprintk(const enum log_level loglevel, const char *const string, va_list list) {
-    (void)loglevel;
-    with_spinlock_irq_disabled(&g_print_lock, {
-        printk_internal("[cpu %" PRIu32 "] ", cpu_get_id(this_cpu()));
-        parse_printf(string,
-                     write_char,
-                     /*char_cb_info=*/NULL,
-                     write_sv,
-                     /*sv_cb_info=*/NULL,
-                     list);
+    if (!level_enabled(loglevel)) {
+        return;
+    }
+
+    bool queued = false;
+    with_interrupts_disabled({
+        struct printk_ring *const ring = this_cpu_ring();
+        if (ring != NULL) {
+            uint64_t head = 0;
+            struct printk_record *const record =
+                record_begin(ring, loglevel, /*flags=*/0, &head);
+
+            if (record != NULL) {
+                parse_printf(string,
+                             record_write_char,
+                             /*char_cb_info=*/record,
+                             record_write_sv,
+                             /*sv_cb_info=*/record,
+                             list);
+
+                ring_commit(ring, head, record);
+            }
+
+            queued = true;
+        }
     });
-}
\ No newline at end of file
+
+    if (!queued) {
+        with_spinlock_irq_disabled(&g_print_lock, {
+            printk_internal("[cpu %" PRIu32 "] ", cpu_get_id(this_cpu()));
+            vprintk_internal(string, list);
+        });
+
+        atomic_fetch_add_explicit(&g_sync_count, 1, memory_order_relaxed);
+    }
+}
+
+void printk_bust_locks() {
+    atomic_store_explicit(&g_deferred, false, memory_order_release);
+    g_print_lock = SPINLOCK_INIT();
+
+    for (struct terminal *term = g_first_term; term != NULL; term = term->next)
+    {
+        if (term->bust_locks != NULL) {
+            term->bust_locks(term);
+        }
+    }
+
+    printk_flush();
+}
+
+struct printk_stats printk_get_stats() {
+    struct printk_stats stats = {
+        .queued_count = 0,
+        .dropped_count = 0,
+        .sync_count =
+            atomic_load_explicit(&g_sync_count, memory_order_relaxed),
+    };
+
+    const struct cpu_info *cpu = NULL;
+    list_foreach(cpu, cpus_get_list(), cpu_list) {
+        const struct printk_ring *const ring = &cpu->printk_ring;
+
+        stats.queued_count +=
+            atomic_load_explicit(&ring->queued_count, memory_order_relaxed);
+        stats.dropped_count +=
+            atomic_load_explicit(&ring->dropped_count, memory_order_relaxed);
+    }
+
+    return stats;
+}
+
+void printk_print_stats() {
+    const struct printk_stats stats = printk_get_stats();
+    printk(LOGLEVEL_INFO,
+           "printk: %" PRIu64 " records queued, %" PRIu64 " dropped, "
+           "%" PRIu64 " written synchronously\n",
+           stats.queued_count,
+           stats.dropped_count,
+           stats.sync_count);
+}
+
+__noreturn static void printk_drain_worker() {
+    while (true) {
+        printk_flush();
+        sched_sleep_us(PRINTK_DRAIN_INTERVAL_US);
+    }
+}
+
+void printk_init() {
+    struct cpu_info *cpu = NULL;
+    list_foreach(cpu, cpus_get_list(), cpu_list) {
+        struct page *const page =
+            alloc_pages(PAGE_STATE_USED, /*alloc_flags=*/0, PRINTK_RING_ORDER);
+
+        if (page == NULL) {
+            printk(LOGLEVEL_WARN,
+                   "printk: failed to allocate ring for cpu %" PRIu32 "\n",
+                   cpu_get_id(cpu));
+            continue;
+        }
+
+        cpu->printk_ring.buffer = page_to_virt(page);
+    }
+
+    struct thread *const thread =
+        sched_create_kernel_thread(printk_drain_worker);
+
+    assert_msg(thread != NULL, "printk: failed to create drain thread");
+    atomic_store_explicit(&g_deferred, true, memory_order_release);
+
+    printk(LOGLEVEL_INFO, "printk: started drain thread\n");
+}
@@ -4,7 +4,9 @@
  */
 
 #pragma once
+
 #include <stdarg.h>
+#include <stdatomic.h>
 
 #include "lib/adt/string_view.h"
 #include "lib/inttypes.h"
@@ -30,9 +32,91 @@ enum log_level {
     LOGLEVEL_CRITICAL
 };
 
+// Once printk_init() is called, each cpu writes its messages as timestamped
+// records into its own ring, without taking any lock shared with other cpus.
+// A background thread drains the records of every cpu to the terminals in
+// order of their timestamps.
+//
+// Messages are written to the terminals right away before printk_init(), on a
+// cpu in a bad state, and after printk_bust_locks(). Messages that don't fit
+// in a full ring are dropped.
+
+#define PRINTK_RING_ORDER 2
+#define PRINTK_RING_SIZE (PAGE_SIZE << PRINTK_RING_ORDER)
+
+#define PRINTK_RECORD_MAX_LENGTH 512
+#define PRINTK_DRAIN_INTERVAL_US milli_to_micro(10)
+
+enum printk_record_flags {
+    // Fills the end of the ring when a record doesn't fit before it.
+    __PRINTK_RECORD_PAD = 1 << 0,
+
+    // Written out as-is, without the timestamp and cpu prefix.
+    __PRINTK_RECORD_RAW = 1 << 1,
+};
+
+struct printk_record {
+    uint64_t nsec;
+    uint32_t cpu_id;
+    uint16_t length;
+
+    uint8_t level;
+    uint8_t flags;
+
+    char text[];
+};
+
+// Only the ring's cpu writes records, with interrupts disabled, and only the
+// holder of the print-lock reads them.
+
+struct printk_ring {
+    char *buffer;
+
+    _Atomic uint64_t head;
+    _Atomic uint64_t tail;
+
+    _Atomic uint64_t queued_count;
+    _Atomic uint64_t dropped_count;
+};
+
+#define PRINTK_RING_INIT() \
+    { \
+        .buffer = NULL, \
+        .head = 0, \
+        .tail = 0, \
+        .queued_count = 0, \
+        .dropped_count = 0 \
+    }
+
+void printk_ring_init(struct printk_ring *ring);
+
+struct printk_stats {
+    uint64_t queued_count;
+    uint64_t dropped_count;
+    uint64_t sync_count;
+};
+
 __printf_format(2, 3)
 void printk(enum log_level loglevel, const char *string, ...);
 void vprintk(enum log_level loglevel, const char *string, va_list list);
 
 void putk(enum log_level loglevel, const char *string);
 void putk_sv(enum log_level loglevel, struct string_view sv);
+
+// Messages below `level` are discarded.
+void printk_set_log_level(enum log_level level);
+
+// Write every queued record to the terminals before returning.
+void printk_flush();
+
+// Used by panic(), which may have interrupted a cpu in the middle of writing to
+// a terminal. Resets the locks of printk and every terminal, flushes every
+// queued record, and has every later message written to the terminals right
+// away.
+
+void printk_bust_locks();
+
+struct printk_stats printk_get_stats();
+void printk_print_stats();
+
+void printk_init();
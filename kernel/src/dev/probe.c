@@ -0,0 +1,241 @@
+/*
+ * kernel/src/dev/probe.c
+ * © suhas pai
+ */
+
+#include <stdatomic.h>
+
+#include "cpu/info.h"
+#include "cpu/spinlock.h"
+
+#include "mm/kmalloc.h"
+#include "sched/scheduler.h"
+#include "sched/sleep.h"
+#include "time/time.h"
+
+#include "dev/printk.h"
+
+#include "driver.h"
+#include "probe.h"
+
+static struct list g_job_list = LIST_INIT(g_job_list);
+static struct spinlock g_job_list_lock = SPINLOCK_INIT();
+
+static _Atomic bool g_scheduling_done = false;
+
+static _Atomic uint32_t g_worker_count = 0;
+static _Atomic uint32_t g_required_remaining = 0;
+static _Atomic uint32_t g_async_job_count = 0;
+
+static nsec_t g_workers_begin = 0;
+
+__debug_optimize(3)
+static inline bool job_is_done(const struct probe_job *const job) {
+    return atomic_load_explicit(&job->done, memory_order_acquire);
+}
+
+static void run_job(struct probe_job *const job, const bool is_async) {
+    const nsec_t begin = nsec_since_boot();
+    job->func(job->driver, job->arg);
+
+    job->duration = nsec_since_boot() - begin;
+    printk(LOGLEVEL_INFO,
+           "dev: probe by " SV_FMT " took %" PRIu64 "us (%s)\n",
+           SV_FMT_ARGS(job->driver->name),
+           nano_to_micro(job->duration),
+           is_async ? "async" : "sync");
+
+    atomic_store_explicit(&job->done, true, memory_order_release);
+}
+
+static void wait_for_job(const struct probe_job *const job) {
+    while (!job_is_done(job)) {
+        sched_sleep_us(PROBE_POLL_INTERVAL_US);
+    }
+}
+
+static void
+run_sync(const struct driver *const driver,
+         const probe_func_t func,
+         void *const arg,
+         struct probe_job *const dependency)
+{
+    if (dependency != NULL) {
+        wait_for_job(dependency);
+    }
+
+    struct probe_job job = {
+        .driver = driver,
+        .dependency = dependency,
+        .func = func,
+        .arg = arg,
+        .done = false,
+        .duration = 0
+    };
+
+    run_job(&job, /*is_async=*/false);
+}
+
+struct probe_job *
+probe_schedule(const struct driver *const driver,
+               const probe_func_t func,
+               void *const arg,
+               struct probe_job *const dependency)
+{
+    if ((driver->flags & __DRIVER_ASYNC_PROBE) == 0) {
+        run_sync(driver, func, arg, dependency);
+        return NULL;
+    }
+
+    // Jobs are never freed, as other jobs, and the devices they probed, may
+    // still point to them.
+
+    struct probe_job *const job = kmalloc(sizeof(*job));
+    if (job == NULL) {
+        printk(LOGLEVEL_WARN,
+               "dev: failed to allocate probe-job for " SV_FMT ", probing "
+               "synchronously\n",
+               SV_FMT_ARGS(driver->name));
+
+        run_sync(driver, func, arg, dependency);
+        return NULL;
+    }
+
+    list_init(&job->list);
+
+    job->driver = driver;
+    job->dependency = dependency;
+    job->func = func;
+    job->arg = arg;
+    job->done = false;
+    job->duration = 0;
+
+    // Jobs required for boot are put at the front, so workers pick them first.
+
+    const bool is_required = (driver->flags & __DRIVER_REQUIRED_FOR_BOOT) != 0;
+    if (is_required) {
+        atomic_fetch_add_explicit(&g_required_remaining,
+                                  1,
+                                  memory_order_relaxed);
+    }
+
+    atomic_fetch_add_explicit(&g_async_job_count, 1, memory_order_relaxed);
+    with_spinlock_irq_disabled(&g_job_list_lock, {
+        if (is_required) {
+            list_add(&g_job_list, &job->list);
+        } else {
+            list_add(g_job_list.prev, &job->list);
+        }
+    });
+
+    return job;
+}
+
+// Take the first job whose dependency is done off the job-list. Sets
+// `list_empty_out` to whether the job-list had no jobs at all.
+
+__debug_optimize(3) static struct probe_job *
+take_runnable_job(bool *const list_empty_out) {
+    struct probe_job *result = NULL;
+    const int flag = spin_acquire_save_irq(&g_job_list_lock);
+
+    *list_empty_out = list_empty(&g_job_list);
+
+    struct probe_job *iter = NULL;
+    list_foreach(iter, &g_job_list, list) {
+        if (iter->dependency == NULL || job_is_done(iter->dependency)) {
+            list_remove(&iter->list);
+            result = iter;
+
+            break;
+        }
+    }
+
+    spin_release_restore_irq(&g_job_list_lock, flag);
+    return result;
+}
+
+__noreturn static void probe_worker() {
+    do {
+        bool list_empty = false;
+        struct probe_job *const job = take_runnable_job(&list_empty);
+
+        if (job != NULL) {
+            const bool is_required =
+                (job->driver->flags & __DRIVER_REQUIRED_FOR_BOOT) != 0;
+
+            run_job(job, /*is_async=*/true);
+            if (is_required) {
+                atomic_fetch_sub_explicit(&g_required_remaining,
+                                          1,
+                                          memory_order_release);
+            }
+
+            continue;
+        }
+
+        if (list_empty
+         && atomic_load_explicit(&g_scheduling_done, memory_order_acquire))
+        {
+            break;
+        }
+
+        sched_sleep_us(PROBE_POLL_INTERVAL_US);
+    } while (true);
+
+    const uint32_t remaining =
+        atomic_fetch_sub_explicit(&g_worker_count, 1, memory_order_acq_rel) - 1;
+
+    if (remaining == 0) {
+        printk(LOGLEVEL_INFO,
+               "dev: finished %" PRIu32 " async probe(s) in %" PRIu64 "us\n",
+               atomic_load_explicit(&g_async_job_count, memory_order_relaxed),
+               nano_to_micro(nsec_since_boot() - g_workers_begin));
+    }
+
+    sched_dequeue_thread(current_thread());
+    sched_yield();
+
+    verify_not_reached();
+}
+
+void probe_start_workers() {
+    const uint32_t cpu_count =
+        (uint32_t)list_count(cpus_get_list(), struct cpu_info, cpu_list);
+
+    g_workers_begin = nsec_since_boot();
+    for (uint32_t i = 0; i != cpu_count; i++) {
+        // Count the worker before it starts, so it can't see a worker-count of
+        // zero while other workers are still being created.
+
+        atomic_fetch_add_explicit(&g_worker_count, 1, memory_order_relaxed);
+        if (sched_create_kernel_thread(probe_worker) == NULL) {
+            atomic_fetch_sub_explicit(&g_worker_count,
+                                      1,
+                                      memory_order_relaxed);
+
+            printk(LOGLEVEL_WARN, "dev: failed to create probe worker\n");
+            break;
+        }
+    }
+
+    assert_msg(atomic_load_explicit(&g_worker_count, memory_order_relaxed) != 0,
+               "dev: failed to create any probe workers");
+}
+
+void probe_finish_scheduling() {
+    atomic_store_explicit(&g_scheduling_done, true, memory_order_release);
+}
+
+void probe_wait_for_required() {
+    const nsec_t begin = nsec_since_boot();
+    while (atomic_load_explicit(&g_required_remaining, memory_order_acquire)
+            != 0)
+    {
+        sched_sleep_us(PROBE_POLL_INTERVAL_US);
+    }
+
+    printk(LOGLEVEL_INFO,
+           "dev: waited %" PRIu64 "us for probes required for boot\n",
+           nano_to_micro(nsec_since_boot() - begin));
+}
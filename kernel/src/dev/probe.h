@@ -0,0 +1,59 @@
+/*
+ * kernel/src/dev/probe.h
+ * © suhas pai
+ */
+
+#pragma once
+
+#include "lib/list.h"
+#include "lib/time.h"
+
+// Drivers marked with __DRIVER_ASYNC_PROBE have each of their devices probed
+// by a job running on a pool of worker threads spread across every cpu, instead
+// of on the boot cpu. Every other driver is probed synchronously as before, but
+// through the same path, so every probe's duration is logged.
+//
+// A job may depend on another job, in which case it's only started once its
+// dependency finished. This is used to probe a bus before its children, and
+// to keep two drivers from probing the same device at the same time.
+//
+// kmain() only waits on jobs of drivers marked __DRIVER_REQUIRED_FOR_BOOT, see
+// probe_wait_for_required(). The rest finish in the background.
+
+#define PROBE_POLL_INTERVAL_US 100
+
+struct driver;
+struct probe_job;
+
+typedef void (*probe_func_t)(const struct driver *driver, void *arg);
+
+struct probe_job {
+    struct list list;
+
+    const struct driver *driver;
+    struct probe_job *dependency;
+
+    probe_func_t func;
+    void *arg;
+
+    _Atomic bool done;
+    nsec_t duration;
+};
+
+// Probe `arg` with `func`, either now, or on a worker thread if `driver` is
+// marked __DRIVER_ASYNC_PROBE. Returns the scheduled job for async drivers, so
+// that other jobs can depend on it, or NULL otherwise.
+
+struct probe_job *
+probe_schedule(const struct driver *driver,
+               probe_func_t func,
+               void *arg,
+               struct probe_job *dependency);
+
+// Workers are started before any driver is probed, and only exit once
+// probe_finish_scheduling() was called and every job is done.
+
+void probe_start_workers();
+void probe_finish_scheduling();
+
+void probe_wait_for_required();
@@ -0,0 +1,153 @@
+/*
+ * kernel/src/dev/storage/bench.c
+ * © suhas pai
+ */
+
+#include "mm/page_alloc.h"
+#include "sched/scheduler.h"
+
+#include "bench.h"
+
+__debug_optimize(3) static inline uint64_t next_rand(uint64_t *const state) {
+    // xorshift64
+    uint64_t x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+
+    *state = x;
+    return x;
+}
+
+__debug_optimize(3)
+static bool submit_request(struct storage_bench_request *const request) {
+    struct storage_bench *const bench = request->bench;
+    if (!atomic_load_explicit(&bench->running, memory_order_relaxed)) {
+        return false;
+    }
+
+    if (bench->request_limit != 0) {
+        const uint32_t count =
+            atomic_fetch_add_explicit(&bench->submitted_count,
+                                      1,
+                                      memory_order_relaxed);
+
+        if (count >= bench->request_limit) {
+            return false;
+        }
+    }
+
+    const uint64_t chunk = next_rand(&request->rand_state) % bench->chunk_count;
+    if (!bench->submit(request, chunk)) {
+        atomic_fetch_add_explicit(&bench->error_count, 1, memory_order_relaxed);
+        return false;
+    }
+
+    return true;
+}
+
+__debug_optimize(3) void
+storage_bench_complete(struct storage_bench_request *const request,
+                       const bool result)
+{
+    struct storage_bench *const bench = request->bench;
+    if (result) {
+        atomic_fetch_add_explicit(&bench->complete_count,
+                                  1,
+                                  memory_order_relaxed);
+
+        if (submit_request(request)) {
+            return;
+        }
+    } else {
+        atomic_fetch_add_explicit(&bench->error_count, 1, memory_order_relaxed);
+    }
+
+    atomic_fetch_sub_explicit(&bench->in_flight_count,
+                              1,
+                              memory_order_release);
+}
+
+uint32_t
+storage_bench_start(struct storage_bench *const bench, const uint32_t depth) {
+    assert(depth <= STORAGE_BENCH_MAX_QUEUE_DEPTH);
+
+    atomic_store_explicit(&bench->submitted_count, 0, memory_order_relaxed);
+    atomic_store_explicit(&bench->complete_count, 0, memory_order_relaxed);
+    atomic_store_explicit(&bench->error_count, 0, memory_order_relaxed);
+    atomic_store_explicit(&bench->running, true, memory_order_relaxed);
+
+    uint32_t submitted_count = 0;
+    for (; submitted_count != depth; submitted_count++) {
+        atomic_fetch_add_explicit(&bench->in_flight_count,
+                                  1,
+                                  memory_order_relaxed);
+
+        if (!submit_request(&bench->request_list[submitted_count])) {
+            atomic_fetch_sub_explicit(&bench->in_flight_count,
+                                      1,
+                                      memory_order_relaxed);
+            break;
+        }
+    }
+
+    return submitted_count;
+}
+
+uint64_t storage_bench_stop(struct storage_bench *const bench) {
+    atomic_store_explicit(&bench->running, false, memory_order_relaxed);
+    return atomic_load_explicit(&bench->complete_count, memory_order_relaxed);
+}
+
+void storage_bench_wait(struct storage_bench *const bench) {
+    while (atomic_load_explicit(&bench->in_flight_count, memory_order_acquire)
+            != 0)
+    {
+        sched_yield();
+    }
+}
+
+bool
+storage_bench_alloc_buffers(struct storage_bench *const bench,
+                            struct page_zone *const zone)
+{
+    for (uint32_t i = 0; i != STORAGE_BENCH_MAX_QUEUE_DEPTH; i++) {
+        struct page *page = NULL;
+        if (zone != NULL) {
+            page =
+                alloc_pages_from_zone(zone,
+                                      PAGE_STATE_USED,
+                                      /*alloc_flags=*/0,
+                                      /*order=*/0,
+                                      /*allow_fallback=*/false);
+        } else {
+            page = alloc_page(PAGE_STATE_USED, /*alloc_flags=*/0);
+        }
+
+        if (page == NULL) {
+            for (uint32_t j = 0; j != i; j++) {
+                free_page(bench->request_list[j].page);
+                bench->request_list[j].page = NULL;
+            }
+
+            return false;
+        }
+
+        bench->request_list[i] = (struct storage_bench_request){
+            .bench = bench,
+            .page = page,
+            .rand_state = i + 1,
+            .index = i,
+        };
+    }
+
+    return true;
+}
+
+void storage_bench_free_buffers(struct storage_bench *const bench) {
+    for (uint32_t i = 0; i != STORAGE_BENCH_MAX_QUEUE_DEPTH; i++) {
+        free_page(bench->request_list[i].page);
+        bench->request_list[i].page = NULL;
+    }
+}
@@ -0,0 +1,72 @@
+/*
+ * kernel/src/dev/storage/bench.h
+ * © suhas pai
+ */
+
+#pragma once
+
+#include <stdatomic.h>
+#include "mm/zone.h"
+
+#define STORAGE_BENCH_MAX_QUEUE_DEPTH 32u
+
+// Random-read benchmarks of storage drivers are built on a storage_bench,
+// which keeps up to a queue-depth of requests in flight, each reading a random
+// chunk of the device into its own page. Drivers only provide the submit
+// callback, and call storage_bench_complete() once a read finishes, which
+// resubmits the request while the bench is still running.
+
+struct storage_bench;
+struct storage_bench_request {
+    struct storage_bench *bench;
+    struct page *page;
+
+    uint64_t rand_state;
+    uint32_t index;
+};
+
+// Read the chunk at index `chunk` into the request's page. Returns false if
+// the read couldn't be submitted.
+
+typedef bool
+(*storage_bench_submit_t)(struct storage_bench_request *request,
+                          uint64_t chunk);
+
+struct storage_bench {
+    storage_bench_submit_t submit;
+    void *cb_info;
+
+    uint64_t chunk_count;
+
+    // If non-zero, at most this many requests are submitted by a run, which
+    // then ends on its own.
+
+    uint32_t request_limit;
+
+    _Atomic bool running;
+    _Atomic uint32_t submitted_count;
+    _Atomic uint32_t in_flight_count;
+    _Atomic uint64_t complete_count;
+    _Atomic uint64_t error_count;
+
+    struct storage_bench_request request_list[STORAGE_BENCH_MAX_QUEUE_DEPTH];
+};
+
+// Alloc a buffer page for every request, from `zone` if it isn't NULL.
+bool
+storage_bench_alloc_buffers(struct storage_bench *bench,
+                            struct page_zone *zone);
+
+void storage_bench_free_buffers(struct storage_bench *bench);
+
+// Submit `depth` requests. Returns how many were actually submitted.
+uint32_t storage_bench_start(struct storage_bench *bench, uint32_t depth);
+
+// Stop resubmitting requests. Returns the number that completed so far.
+uint64_t storage_bench_stop(struct storage_bench *bench);
+
+// Wait for every request in flight to complete.
+void storage_bench_wait(struct storage_bench *bench);
+
+void
+storage_bench_complete(struct storage_bench_request *request, bool result);
@@ -1,70 +1,544 @@
 /*
- * kernel/src/dev/storage/nvme/cache.c
+ * kernel/src/dev/storage/cache.c
  * © suhas pai
  */
 
 #include "dev/printk.h"
-#include "cache.h"
 
-#define NVME_CACHE_HASHMAP_BUCKET_COUNT 15
+#include "mm/kmalloc.h"
+#include "mm/page_alloc.h"
 
-void storage_cache_create(struct storage_cache *const cache) {
-    cache->items =
-        HASHMAP_INIT(sizeof(struct storage_cache_item),
-                     NVME_CACHE_HASHMAP_BUCKET_COUNT,
-                     hashmap_no_hash,
-                     /*hash_cb_info=*/NULL);
+#include "device.h"
 
-    cache->lock = SPINLOCK_INIT();
-    cache->most_recent = NULL;
+__debug_optimize(3) static inline uint64_t hash_index(const uint64_t index) {
+    return index * 0x9e3779b97f4a7c15ull;
 }
 
-void
-storage_cache_push(struct storage_cache *const cache,
-                   const uint64_t lba,
-                   void *const block)
+__debug_optimize(3) static inline struct storage_cache_shard *
+shard_for_index(const struct storage_cache *const cache, const uint64_t index) {
+    return &cache->shard_list[(hash_index(index) >> 32)
+                              % STORAGE_CACHE_SHARD_COUNT];
+}
+
+__debug_optimize(3) static inline struct list *
+bucket_for_index(struct storage_cache_shard *const shard,
+                 const uint64_t index)
+{
+    return &shard->bucket_list[(hash_index(index) >> 48)
+                               % STORAGE_CACHE_SHARD_BUCKET_COUNT];
+}
+
+_Static_assert(sizeof(struct storage_cache_shard) * STORAGE_CACHE_SHARD_COUNT
+                 <= KMALLOC_MAX,
+    "the shard-list of a storage-cache must fit in a single kmalloc()");
+
+bool
+storage_cache_create(struct storage_cache *const cache,
+                     const uint32_t lba_size,
+                     const uint64_t max_pages)
+{
+    cache->shard_list =
+        kmalloc(sizeof(struct storage_cache_shard) * STORAGE_CACHE_SHARD_COUNT);
+
+    if (cache->shard_list == NULL) {
+        return false;
+    }
+
+    for (uint32_t i = 0; i != STORAGE_CACHE_SHARD_COUNT; i++) {
+        struct storage_cache_shard *const shard = &cache->shard_list[i];
+
+        shard->lock = SPINLOCK_INIT();
+        carr_foreach_mut(shard->bucket_list, iter) {
+            list_init(iter);
+        }
+
+        list_init(&shard->clock_list);
+
+        shard->page_count = 0;
+        shard->generation = 0;
+
+        shard->hit_count = 0;
+        shard->miss_count = 0;
+        shard->eviction_count = 0;
+        shard->readahead_count = 0;
+        shard->readahead_used_count = 0;
+    }
+
+    // An entry is a page, unless the lba-size is larger than a page, in which
+    // case an entry is a single lba.
+
+    const uint32_t entry_size = max(lba_size, (uint32_t)PAGE_SIZE);
+
+    cache->max_pages = max_pages;
+    cache->lba_size = lba_size;
+    cache->entry_size = entry_size;
+    cache->entry_lba_count = entry_size / lba_size;
+    cache->entry_order = (uint8_t)__builtin_ctz(entry_size >> PAGE_SHIFT);
+
+    cache->seq_lock = SPINLOCK_INIT();
+    cache->seq_last_index = UINT64_MAX;
+    cache->seq_readahead_end = 0;
+    cache->seq_streak = 0;
+    cache->seq_window = STORAGE_CACHE_READAHEAD_MIN_WINDOW;
+
+    return true;
+}
+
+// Caller must hold the shard's lock.
+
+__debug_optimize(3) static struct storage_cache_entry *
+find_entry(struct storage_cache_shard *const shard, const uint64_t index) {
+    struct list *const bucket = bucket_for_index(shard, index);
+    struct storage_cache_entry *entry = NULL;
+
+    list_foreach(entry, bucket, hash_list) {
+        if (entry->index == index) {
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+// Caller must hold the shard's lock. Evicted entries are moved to `free_list`
+// so they can be freed after the lock is released.
+
+static void
+evict_entries(const struct storage_cache *const cache,
+              struct storage_cache_shard *const shard,
+              struct list *const free_list)
+{
+    const uint64_t max_pages =
+        max(cache->max_pages / STORAGE_CACHE_SHARD_COUNT,
+            1ull << cache->entry_order);
+
+    while (shard->page_count > max_pages) {
+        struct storage_cache_entry *const entry =
+            list_head(&shard->clock_list,
+                      struct storage_cache_entry,
+                      clock_list);
+
+        // Give recently used entries a second chance.
+        if (entry->referenced) {
+            entry->referenced = false;
+
+            list_remove(&entry->clock_list);
+            list_radd(&shard->clock_list, &entry->clock_list);
+
+            continue;
+        }
+
+        list_remove(&entry->hash_list);
+        list_remove(&entry->clock_list);
+        list_radd(free_list, &entry->clock_list);
+
+        shard->page_count -= 1ull << cache->entry_order;
+        shard->eviction_count++;
+    }
+}
+
+static void
+free_entry(const struct storage_cache *const cache,
+           struct storage_cache_entry *const entry)
+{
+    free_pages(entry->page, cache->entry_order);
+    kfree(entry);
+}
+
+static void
+free_entry_list(const struct storage_cache *const cache,
+                struct list *const free_list)
+{
+    struct storage_cache_entry *entry = NULL;
+    struct storage_cache_entry *tmp = NULL;
+
+    list_foreach_mut(entry, tmp, free_list, clock_list) {
+        list_remove(&entry->clock_list);
+        free_entry(cache, entry);
+    }
+}
+
+// Read in the entry at `index` from the device. The returned entry isn't in the
+// cache yet.
+
+static struct storage_cache_entry *
+read_entry(struct storage_device *const device, const uint64_t index) {
+    struct storage_cache *const cache = &device->cache;
+    struct storage_cache_entry *const entry = kmalloc(sizeof(*entry));
+
+    if (entry == NULL) {
+        return NULL;
+    }
+
+    struct page *const page =
+        alloc_pages(PAGE_STATE_LRU_CACHE,
+                    /*alloc_flags=*/0,
+                    cache->entry_order);
+
+    if (page == NULL) {
+        kfree(entry);
+        return NULL;
+    }
+
+    const uint64_t phys = page_to_phys(page);
+    const uint64_t lba = index * cache->entry_lba_count;
+    const uint32_t lba_count = cache->entry_lba_count;
+
+    uint32_t valid_count = 0;
+    if (device->read(device, phys, RANGE_INIT(lba, lba_count)) == lba_count) {
+        valid_count = lba_count;
+    } else if (lba_count != 1) {
+        // The entry may run past the end of the device, so read in as many lbas
+        // as we can.
+
+        for (; valid_count != lba_count; valid_count++) {
+            const uint64_t lba_phys = phys + valid_count * cache->lba_size;
+            const struct range range = RANGE_INIT(lba + valid_count, 1);
+
+            if (device->read(device, lba_phys, range) != 1) {
+                break;
+            }
+        }
+    }
+
+    if (valid_count == 0) {
+        free_pages(page, cache->entry_order);
+        kfree(entry);
+
+        return NULL;
+    }
+
+    list_init(&entry->hash_list);
+    list_init(&entry->clock_list);
+
+    entry->page = page;
+    entry->index = index;
+    entry->valid_count = valid_count;
+    entry->referenced = false;
+    entry->readahead = false;
+
+    return entry;
+}
+
+// Caller must hold the shard's lock. Returns false if the entry couldn't be
+// added, in which case the caller still owns it.
+
+static bool
+insert_entry(const struct storage_cache *const cache,
+             struct storage_cache_shard *const shard,
+             struct storage_cache_entry *const entry,
+             const uint64_t generation,
+             struct list *const free_list)
+{
+    if (shard->generation != generation
+     || find_entry(shard, entry->index) != NULL)
+    {
+        return false;
+    }
+
+    list_add(bucket_for_index(shard, entry->index), &entry->hash_list);
+    list_radd(&shard->clock_list, &entry->clock_list);
+
+    shard->page_count += 1ull << cache->entry_order;
+    evict_entries(cache, shard, free_list);
+
+    return true;
+}
+
+__debug_optimize(3) static inline bool
+copy_from_entry(const struct storage_cache *const cache,
+                const struct storage_cache_entry *const entry,
+                const uint32_t offset,
+                void *const buf,
+                const uint32_t size)
+{
+    if (offset + size > entry->valid_count * cache->lba_size) {
+        return false;
+    }
+
+    memcpy(buf, page_to_virt(entry->page) + offset, size);
+    return true;
+}
+
+static void
+readahead(struct storage_device *const device,
+          const uint64_t front,
+          const uint64_t end)
 {
-    bool result = false;
-    with_spinlock_preempt_disabled(&cache->lock, {
-        result = hashmap_add(&cache->items, hashmap_key_create(lba), &block);
-    });
+    struct storage_cache *const cache = &device->cache;
+    for (uint64_t index = front; index != end; index++) {
+        struct storage_cache_shard *const shard =
+            shard_for_index(cache, index);
+
+        spin_acquire_preempt_disable(&shard->lock);
+
+        const bool cached = find_entry(shard, index) != NULL;
+        const uint64_t generation = shard->generation;
+
+        spin_release_preempt_enable(&shard->lock);
+        if (cached) {
+            continue;
+        }
+
+        struct storage_cache_entry *const entry = read_entry(device, index);
+        if (entry == NULL) {
+            return;
+        }
+
+        struct list free_list = LIST_INIT(free_list);
+        const bool partial = entry->valid_count != cache->entry_lba_count;
+
+        entry->readahead = true;
+
+        spin_acquire_preempt_disable(&shard->lock);
+
+        const bool inserted =
+            insert_entry(cache, shard, entry, generation, &free_list);
+
+        if (inserted) {
+            shard->readahead_count++;
+        }
+
+        spin_release_preempt_enable(&shard->lock);
+        if (!inserted) {
+            free_entry(cache, entry);
+        }
+
+        free_entry_list(cache, &free_list);
+
+        // A partial entry marks the end of the device.
+        if (partial) {
+            return;
+        }
+    }
+}
+
+// Track whether the device is being accessed sequentially, and if so, read
+// ahead of the current position.
+
+static void
+note_access(struct storage_device *const device, const uint64_t index) {
+    struct storage_cache *const cache = &device->cache;
+
+    uint64_t front = 0;
+    uint64_t end = 0;
+
+    spin_acquire_preempt_disable(&cache->seq_lock);
+    if (index == cache->seq_last_index) {
+        spin_release_preempt_enable(&cache->seq_lock);
+        return;
+    }
+
+    if (index == cache->seq_last_index + 1) {
+        cache->seq_streak++;
+    } else {
+        cache->seq_streak = 0;
+        cache->seq_window = STORAGE_CACHE_READAHEAD_MIN_WINDOW;
+        cache->seq_readahead_end = 0;
+    }
 
-    if (!result) {
-        printk(LOGLEVEL_WARN,
-               "nvme: attempting to push already-cached item at "
-               "lba %" PRIu64 "\n",
-               lba);
+    cache->seq_last_index = index;
+
+    // Issue the next window once we're within half a window of the end of the
+    // last one, so reads stay ahead of the reader.
+
+    if (cache->seq_streak >= STORAGE_CACHE_READAHEAD_TRIGGER
+     && index + cache->seq_window / 2 >= cache->seq_readahead_end)
+    {
+        front = max(index + 1, cache->seq_readahead_end);
+        end = index + 1 + cache->seq_window;
+
+        cache->seq_readahead_end = end;
+        cache->seq_window =
+            min(cache->seq_window * 2, STORAGE_CACHE_READAHEAD_MAX_WINDOW);
+    }
+
+    spin_release_preempt_enable(&cache->seq_lock);
+    if (front < end) {
+        readahead(device, front, end);
     }
 }
 
-void *
-storage_cache_find(struct storage_cache *const cache, const uint64_t lba) {
-    spin_acquire_preempt_disable(&cache->lock);
+bool
+storage_cache_read(struct storage_device *const device,
+                   const uint64_t index,
+                   const uint32_t offset,
+                   void *const buf,
+                   const uint32_t size)
+{
+    struct storage_cache *const cache = &device->cache;
+    struct storage_cache_shard *const shard = shard_for_index(cache, index);
+
+    spin_acquire_preempt_disable(&shard->lock);
+    struct storage_cache_entry *entry = find_entry(shard, index);
+
+    if (entry != NULL) {
+        const bool result = copy_from_entry(cache, entry, offset, buf, size);
 
-    struct storage_cache_item *const most_recent = cache->most_recent;
-    if (most_recent != NULL) {
-        if (most_recent->lba == lba) {
-            spin_release_preempt_enable(&cache->lock);
-            return most_recent->block;
+        if (entry->readahead) {
+            entry->readahead = false;
+            shard->readahead_used_count++;
         }
+
+        entry->referenced = true;
+        shard->hit_count++;
+
+        spin_release_preempt_enable(&shard->lock);
+
+        note_access(device, index);
+        return result;
+    }
+
+    const uint64_t generation = shard->generation;
+    shard->miss_count++;
+
+    spin_release_preempt_enable(&shard->lock);
+
+    entry = read_entry(device, index);
+    if (entry == NULL) {
+        return false;
     }
 
-    void *result = NULL;
-    struct storage_cache_item *const item =
-        hashmap_get(&cache->items, hashmap_key_create(lba));
+    // Copy out before adding the entry, after which it may be evicted at any
+    // time.
 
-    if (item != NULL) {
-        result = item->block;
-        cache->most_recent = item;
+    const bool result = copy_from_entry(cache, entry, offset, buf, size);
+    struct list free_list = LIST_INIT(free_list);
+
+    spin_acquire_preempt_disable(&shard->lock);
+    const bool inserted =
+        insert_entry(cache, shard, entry, generation, &free_list);
+    spin_release_preempt_enable(&shard->lock);
+
+    if (!inserted) {
+        free_entry(cache, entry);
     }
 
-    spin_release_preempt_enable(&cache->lock);
+    free_entry_list(cache, &free_list);
+    note_access(device, index);
+
     return result;
 }
 
+void
+storage_cache_update(struct storage_cache *const cache,
+                     const struct range lba_range,
+                     const void *const buf)
+{
+    const uint32_t entry_lba_count = cache->entry_lba_count;
+    const uint64_t lba_end = range_get_end_assert(lba_range);
+
+    uint64_t lba = lba_range.front;
+    while (lba != lba_end) {
+        const uint64_t index = lba / entry_lba_count;
+        const uint32_t lba_index = lba % entry_lba_count;
+        const uint32_t count =
+            (uint32_t)min(lba_end - lba,
+                          (uint64_t)(entry_lba_count - lba_index));
+
+        struct storage_cache_shard *const shard = shard_for_index(cache, index);
+        spin_acquire_preempt_disable(&shard->lock);
+
+        shard->generation++;
+        struct storage_cache_entry *entry = find_entry(shard, index);
+
+        if (entry != NULL) {
+            // The write succeeding means the lbas exist, so a partial entry can
+            // be extended if the lbas start at or before its last valid one.
+
+            if (lba_index <= entry->valid_count) {
+                memcpy(page_to_virt(entry->page) + lba_index * cache->lba_size,
+                       buf + (lba - lba_range.front) * cache->lba_size,
+                       count * cache->lba_size);
+
+                entry->valid_count = max(entry->valid_count, lba_index + count);
+                entry = NULL;
+            } else {
+                list_remove(&entry->hash_list);
+                list_remove(&entry->clock_list);
+
+                shard->page_count -= 1ull << cache->entry_order;
+            }
+        }
+
+        spin_release_preempt_enable(&shard->lock);
+        if (entry != NULL) {
+            free_entry(cache, entry);
+        }
+
+        lba += count;
+    }
+}
+
+void
+storage_cache_get_stats(struct storage_cache *const cache,
+                        struct storage_cache_stats *const stats_out)
+{
+    stats_out->hit_count = 0;
+    stats_out->miss_count = 0;
+    stats_out->eviction_count = 0;
+    stats_out->readahead_count = 0;
+    stats_out->readahead_used_count = 0;
+    stats_out->page_count = 0;
+
+    for (uint32_t i = 0; i != STORAGE_CACHE_SHARD_COUNT; i++) {
+        struct storage_cache_shard *const shard = &cache->shard_list[i];
+        with_spinlock_preempt_disabled(&shard->lock, {
+            stats_out->hit_count += shard->hit_count;
+            stats_out->miss_count += shard->miss_count;
+            stats_out->eviction_count += shard->eviction_count;
+            stats_out->readahead_count += shard->readahead_count;
+            stats_out->readahead_used_count += shard->readahead_used_count;
+            stats_out->page_count += shard->page_count;
+        });
+    }
+}
+
+void storage_cache_print_stats(struct storage_cache *const cache) {
+    struct storage_cache_stats stats;
+    storage_cache_get_stats(cache, &stats);
+
+    const uint64_t access_count = stats.hit_count + stats.miss_count;
+    const uint64_t hit_percent =
+        access_count != 0 ? (stats.hit_count * 100) / access_count : 0;
+    const uint64_t readahead_percent =
+        stats.readahead_count != 0 ?
+            (stats.readahead_used_count * 100) / stats.readahead_count : 0;
+
+    printk(LOGLEVEL_INFO,
+           "storage: cache has %" PRIu64 "/%" PRIu64 " pages, "
+           "%" PRIu64 " hits, %" PRIu64 " misses (%" PRIu64 "%% hit-rate), "
+           "%" PRIu64 " evictions, %" PRIu64 "/%" PRIu64 " readahead entries "
+           "used (%" PRIu64 "%% efficiency)\n",
+           stats.page_count,
+           cache->max_pages,
+           stats.hit_count,
+           stats.miss_count,
+           hit_percent,
+           stats.eviction_count,
+           stats.readahead_used_count,
+           stats.readahead_count,
+           readahead_percent);
+}
+
 void storage_cache_destroy(struct storage_cache *const cache) {
-    spinlock_deinit(&cache->lock);
-    hashmap_destroy(&cache->items);
+    for (uint32_t i = 0; i != STORAGE_CACHE_SHARD_COUNT; i++) {
+        struct storage_cache_shard *const shard = &cache->shard_list[i];
+        struct storage_cache_entry *entry = NULL;
+        struct storage_cache_entry *tmp = NULL;
+
+        list_foreach_mut(entry, tmp, &shard->clock_list, clock_list) {
+            list_remove(&entry->hash_list);
+            list_remove(&entry->clock_list);
+
+            free_entry(cache, entry);
+        }
+
+        spinlock_deinit(&shard->lock);
+    }
+
+    spinlock_deinit(&cache->seq_lock);
+    kfree(cache->shard_list);
 
-    cache->most_recent = NULL;
+    cache->shard_list = NULL;
 }
@@ -5,23 +5,130 @@
 
 #pragma once
 
-#include "lib/adt/hashmap.h"
 #include "cpu/spinlock.h"
 
-struct storage_cache_item {
-    void *block;
-    uint64_t lba;
+#include "lib/adt/range.h"
+#include "lib/list.h"
+
+// The cache is split into shards, each with their own lock, so that accesses
+// to unrelated blocks don't contend on a single lock. Each entry caches a
+// page-sized run of consecutive lbas, stored in a page with state
+// PAGE_STATE_LRU_CACHE.
+
+// Every shard is kept in one kmalloc()'d list, so the shards together must fit
+// under KMALLOC_MAX.
+
+#define STORAGE_CACHE_SHARD_COUNT 16u
+#define STORAGE_CACHE_SHARD_BUCKET_COUNT 32u
+
+// The default memory budget of a device's cache, in pages. Once a shard grows
+// past its share of the budget, entries are evicted using the CLOCK algorithm.
+
+#define STORAGE_CACHE_DEFAULT_MAX_PAGES 2048u
+
+// Readahead starts once this many consecutive entries have been accessed in
+// order. The readahead window then doubles on every sequential miss, up to the
+// max.
+
+#define STORAGE_CACHE_READAHEAD_TRIGGER 2u
+#define STORAGE_CACHE_READAHEAD_MIN_WINDOW 2u
+#define STORAGE_CACHE_READAHEAD_MAX_WINDOW 16u
+
+struct page;
+struct storage_cache_entry {
+    struct list hash_list;
+    struct list clock_list;
+
+    struct page *page;
+    uint64_t index;
+
+    // The amount of lbas in the entry that were read in. This is only ever
+    // less than the entry's lba-count for the entries at the end of the
+    // device.
+
+    uint32_t valid_count;
+
+    bool referenced : 1;
+    bool readahead : 1;
 };
 
-struct storage_cache {
-    struct hashmap items;
+struct storage_cache_shard {
     struct spinlock lock;
 
-    struct storage_cache_item *most_recent;
+    struct list bucket_list[STORAGE_CACHE_SHARD_BUCKET_COUNT];
+    struct list clock_list;
+
+    uint64_t page_count;
+
+    // Incremented on every write to the shard's entries, so that an entry read
+    // in while a write was in progress isn't added to the cache with stale
+    // contents.
+
+    uint64_t generation;
+
+    uint64_t hit_count;
+    uint64_t miss_count;
+    uint64_t eviction_count;
+    uint64_t readahead_count;
+    uint64_t readahead_used_count;
+};
+
+struct storage_cache {
+    struct storage_cache_shard *shard_list;
+
+    uint64_t max_pages;
+    uint32_t lba_size;
+    uint32_t entry_size;
+    uint32_t entry_lba_count;
+    uint8_t entry_order;
+
+    // Sequential-access detection state.
+    struct spinlock seq_lock;
+
+    uint64_t seq_last_index;
+    uint64_t seq_readahead_end;
+
+    uint32_t seq_streak;
+    uint32_t seq_window;
 };
 
-void storage_cache_create(struct storage_cache *cache);
-void storage_cache_push(struct storage_cache *cache, uint64_t lba, void *block);
+struct storage_cache_stats {
+    uint64_t hit_count;
+    uint64_t miss_count;
+    uint64_t eviction_count;
+    uint64_t readahead_count;
+    uint64_t readahead_used_count;
+    uint64_t page_count;
+};
+
+bool
+storage_cache_create(struct storage_cache *cache,
+                     uint32_t lba_size,
+                     uint64_t max_pages);
+
+struct storage_device;
+
+// Copy `size` bytes at `offset` in the cache entry at `index` into `buf`,
+// reading in the entry from `device` on a miss.
+
+bool
+storage_cache_read(struct storage_device *device,
+                   uint64_t index,
+                   uint32_t offset,
+                   void *buf,
+                   uint32_t size);
+
+// Update the cached copies, if any, of the lbas in `lba_range` after they were
+// written to with `buf`.
+
+void
+storage_cache_update(struct storage_cache *cache,
+                     struct range lba_range,
+                     const void *buf);
+
+void
+storage_cache_get_stats(struct storage_cache *cache,
+                        struct storage_cache_stats *stats_out);
 
-void *storage_cache_find(struct storage_cache *cache, uint64_t lba);
+void storage_cache_print_stats(struct storage_cache *cache);
 void storage_cache_destroy(struct storage_cache *cache);
@@ -5,9 +5,12 @@
 
 #include "dev/printk.h"
 #include "fs/driver.h"
+
+#include "lib/align.h"
 #include "lib/util.h"
 
 #include "mm/kmalloc.h"
+#include "mm/page_alloc.h"
 #include "mm/phalloc.h"
 
 #include "partitions/gpt.h"
@@ -164,14 +167,22 @@ static bool identify_partitions(struct storage_device *const device) {
 bool
 storage_device_init(struct storage_device *const device,
                     const uint32_t lba_size,
+                    const uint32_t max_transfer_lbas,
                     const storage_device_read_t read,
                     const storage_device_write_t write)
 {
-    storage_cache_create(&device->cache);
+    if (!storage_cache_create(&device->cache,
+                              lba_size,
+                              STORAGE_CACHE_DEFAULT_MAX_PAGES))
+    {
+        printk(LOGLEVEL_WARN, "storage: failed to allocate device's cache\n");
+        return false;
+    }
 
     device->read = read;
     device->write = write;
     device->lba_size = lba_size;
+    device->max_transfer_lbas = max_transfer_lbas;
 
     if (!identify_partitions(device)) {
         printk(LOGLEVEL_WARN,
@@ -214,31 +225,174 @@ storage_device_init(struct storage_device *const device,
     return found_atleast_one_fs;
 }
 
-__debug_optimize(3) static inline void *
-find_in_cache_or_read_block(struct storage_device *const device,
-                            const uint64_t lba)
+// Read `size` bytes at byte-offset `front` through the cache.
+
+static uint64_t
+read_via_cache(struct storage_device *const device,
+               const uint64_t front,
+               void *const buf,
+               const uint64_t size)
 {
-    void *block = storage_cache_find(&device->cache, lba);
-    if (block != NULL) {
-        return block;
+    const uint32_t entry_size = device->cache.entry_size;
+
+    uint64_t index = front / entry_size;
+    uint32_t entry_offset = front % entry_size;
+    uint64_t buf_offset = 0;
+
+    while (buf_offset < size) {
+        const uint32_t copy_size =
+            (uint32_t)min(size - buf_offset,
+                          (uint64_t)(entry_size - entry_offset));
+
+        if (!storage_cache_read(device,
+                                index,
+                                entry_offset,
+                                buf + buf_offset,
+                                copy_size))
+        {
+            return buf_offset;
+        }
+
+        buf_offset += copy_size;
+        index++;
+
+        entry_offset = 0;
     }
 
-    const uint64_t phys = phalloc(device->lba_size);
-    if (phys == INVALID_PHYS) {
+    return size;
+}
+
+// Only buffers in the hhdm are known to be physically contiguous, and have a
+// physical address we can calculate cheaply.
+
+__debug_optimize(3) static inline bool
+buffer_can_dma(const void *const buf, const uint64_t size) {
+    const uint64_t addr = (uint64_t)buf;
+    return addr >= HHDM_OFFSET
+        && size <= PAGE_OFFSET - addr
+        && has_align(addr, STORAGE_DEVICE_DMA_ALIGN);
+}
+
+__debug_optimize(3) static inline uint64_t
+submit_lbas(struct storage_device *const device,
+            const uint64_t phys,
+            const struct range lba_range,
+            const bool write)
+{
+    if (write) {
+        return device->write(device, phys, lba_range);
+    }
+
+    return device->read(device, phys, lba_range);
+}
+
+static struct page *
+alloc_bounce_pages(const struct storage_device *const device,
+                   uint8_t *const order_out)
+{
+    uint8_t min_order = 0;
+    while ((PAGE_SIZE << min_order) < device->lba_size) {
+        min_order++;
+    }
+
+    uint8_t order = max(min_order, (uint8_t)STORAGE_DEVICE_BOUNCE_ORDER);
+    while (true) {
+        struct page *const page =
+            alloc_pages(PAGE_STATE_USED, /*alloc_flags=*/0, order);
+
+        if (page != NULL || order == min_order) {
+            *order_out = order;
+            return page;
+        }
+
+        order--;
+    }
+}
+
+// Transfer whole lbas to or from `buf`, coalescing them into as few commands
+// as the controller allows. Buffers we can dma into directly are never copied,
+// while others are bounced through a temporary buffer. Returns the number of
+// lbas transferred.
+
+static uint64_t
+transfer_lbas(struct storage_device *const device,
+              const struct range lba_range,
+              void *const read_buf,
+              const void *const write_buf,
+              const bool write)
+{
+    const uint32_t lba_size = device->lba_size;
+    const void *const buf = write ? write_buf : read_buf;
+
+    uint64_t done = 0;
+    if (buffer_can_dma(buf, lba_range.size * lba_size)) {
+        while (done != lba_range.size) {
+            const uint64_t count =
+                min(lba_range.size - done, (uint64_t)device->max_transfer_lbas);
+            const struct range range =
+                RANGE_INIT(lba_range.front + done, count);
+
+            const uint64_t phys = virt_to_phys(buf + done * lba_size);
+            if (submit_lbas(device, phys, range, write) != count) {
+                break;
+            }
+
+            done += count;
+        }
+
+        return done;
+    }
+
+    uint8_t order = 0;
+    struct page *const bounce = alloc_bounce_pages(device, &order);
+
+    if (bounce == NULL) {
         printk(LOGLEVEL_WARN,
-               "nvme: failed to alloc phys-memory while reading\n");
-        return NULL;
+               "storage: failed to alloc bounce buffer for transfer\n");
+        return 0;
     }
 
-    if (device->read(device, phys, RANGE_INIT(lba, 1)) != 1) {
-        phalloc_free(phys);
-        return NULL;
+    const uint64_t phys = page_to_phys(bounce);
+    void *const virt = phys_to_virt(phys);
+
+    const uint64_t bounce_lbas =
+        min((PAGE_SIZE << order) / lba_size,
+            (uint64_t)device->max_transfer_lbas);
+
+    while (done != lba_range.size) {
+        const uint64_t count = min(lba_range.size - done, bounce_lbas);
+        const struct range range = RANGE_INIT(lba_range.front + done, count);
+        const uint64_t offset = done * lba_size;
+
+        if (write) {
+            memcpy(virt, write_buf + offset, count * lba_size);
+        }
+
+        if (submit_lbas(device, phys, range, write) != count) {
+            break;
+        }
+
+        if (!write) {
+            memcpy(read_buf + offset, virt, count * lba_size);
+        }
+
+        done += count;
     }
 
-    block = phys_to_virt(phys);
-    storage_cache_push(&device->cache, lba, block);
+    free_pages(bounce, order);
+    return done;
+}
+
+// Returns the size of the part of `range` before its first lba boundary.
+
+__debug_optimize(3) static inline uint64_t
+get_head_size(const struct range range, const uint32_t lba_size) {
+    const uint64_t offset = range.front % lba_size;
+    if (offset == 0) {
+        return 0;
+    }
 
-    return block;
+    return min(range.size, lba_size - offset);
 }
 
 uint64_t
@@ -246,99 +400,135 @@ storage_device_read(struct storage_device *const device,
                     const struct range range,
                     void *const buf)
 {
-    uint64_t lba = range.front / device->lba_size;
-    uint64_t block_offset = range.front % device->lba_size;
-    uint64_t buf_offset = 0;
+    const uint32_t lba_size = device->lba_size;
 
-    if (__builtin_expect(buf_offset < range.size, 1)) {
-        while (true) {
-            void *const block = find_in_cache_or_read_block(device, lba);
-            if (block == NULL) {
-                return buf_offset;
-            }
+    // Split the range into a partial head lba, whole lbas, and a partial tail
+    // lba. Only large runs of whole lbas are read directly.
 
-            const uint64_t left = range.size - buf_offset;
-            uint64_t copy_size = device->lba_size - block_offset;
+    const uint64_t head_size = get_head_size(range, lba_size);
+    const uint64_t full_size = align_down(range.size - head_size, lba_size);
 
-            if (left <= copy_size) {
-                memcpy(buf + buf_offset, block + block_offset, left);
-                break;
-            }
-
-            memcpy(buf + buf_offset, block + block_offset, copy_size);
+    if (full_size < STORAGE_DEVICE_DIRECT_READ_MIN_SIZE) {
+        return read_via_cache(device, range.front, buf, range.size);
+    }
 
-            buf_offset += copy_size;
-            lba++;
+    if (head_size != 0) {
+        const uint64_t result =
+            read_via_cache(device, range.front, buf, head_size);
 
-            block_offset = 0;
+        if (result != head_size) {
+            return result;
         }
     }
 
+    const uint64_t full_count = full_size / lba_size;
+    const struct range lba_range =
+        RANGE_INIT((range.front + head_size) / lba_size, full_count);
+
+    const uint64_t count =
+        transfer_lbas(device,
+                      lba_range,
+                      buf + head_size,
+                      /*write_buf=*/NULL,
+                      /*write=*/false);
+
+    if (count != full_count) {
+        return head_size + count * lba_size;
+    }
+
+    const uint64_t offset = head_size + full_size;
+    if (offset != range.size) {
+        return offset + read_via_cache(device,
+                                       range.front + offset,
+                                       buf + offset,
+                                       range.size - offset);
+    }
+
     return range.size;
 }
 
+// Write `size` bytes at byte-offset `front` that lie within a single lba,
+// reading in the rest of the lba first.
+
+static bool
+write_partial_lba(struct storage_device *const device,
+                  const uint64_t front,
+                  const void *const buf,
+                  const uint64_t size)
+{
+    const uint32_t lba_size = device->lba_size;
+    const uint64_t phys = phalloc(lba_size);
+
+    if (phys == INVALID_PHYS) {
+        return false;
+    }
+
+    const uint64_t lba = front / lba_size;
+    void *const virt = phys_to_virt(phys);
+
+    if (read_via_cache(device, lba * lba_size, virt, lba_size) != lba_size) {
+        phalloc_free(phys);
+        return false;
+    }
+
+    memcpy(virt + (front % lba_size), buf, size);
+    if (device->write(device, phys, RANGE_INIT(lba, 1)) != 1) {
+        phalloc_free(phys);
+        return false;
+    }
+
+    storage_cache_update(&device->cache, RANGE_INIT(lba, 1), virt);
+    phalloc_free(phys);
+
+    return true;
+}
+
 uint64_t
 storage_device_write(struct storage_device *const device,
                      const struct range range,
                      const void *const buf)
 {
-    uint64_t lba = range.front / device->lba_size;
-    uint64_t lba_offset = range.front % device->lba_size;
+    const uint32_t lba_size = device->lba_size;
+    const uint64_t head_size = get_head_size(range, lba_size);
 
-    uint64_t copy_size = device->lba_size - lba_offset;
-    uint64_t offset = 0;
-
-    const uint64_t phys = phalloc(SECTOR_SIZE);
-    if (phys == INVALID_PHYS) {
-        return UINT64_MAX;
+    if (head_size != 0) {
+        if (!write_partial_lba(device, range.front, buf, head_size)) {
+            return 0;
+        }
     }
 
-    void *const virt = phys_to_virt(phys);
-    if (__builtin_expect(offset < range.size, 1)) {
-        while (true) {
-            const uint64_t left = range.size - offset;
-            bool should_break = left < copy_size;
-
-            if (should_break) {
-                void *const block = find_in_cache_or_read_block(device, lba);
-                if (block == NULL) {
-                    phalloc_free(phys);
-                    return offset;
-                }
-
-                if (lba_offset != 0) {
-                    memcpy(virt, block, lba_offset);
-                }
-
-                memcpy(virt + lba_offset, buf + offset, left);
-
-                const uint64_t final_part = SECTOR_SIZE - (lba_offset + left);
-                if (final_part != 0) {
-                    memcpy(virt + lba_offset + left,
-                           block + lba_offset + left,
-                           final_part);
-                }
-            } else {
-                memcpy(virt + lba_offset, buf + offset, copy_size);
-            }
+    const uint64_t full_size = align_down(range.size - head_size, lba_size);
+    if (full_size != 0) {
+        const uint64_t full_count = full_size / lba_size;
+        const struct range lba_range =
+            RANGE_INIT((range.front + head_size) / lba_size, full_count);
 
-            if (device->write(device, phys, RANGE_INIT(lba, 1)) != 1) {
-                phalloc_free(phys);
-                return offset;
-            }
+        const uint64_t count =
+            transfer_lbas(device,
+                          lba_range,
+                          /*read_buf=*/NULL,
+                          buf + head_size,
+                          /*write=*/true);
 
-            if (should_break) {
-                break;
-            }
+        storage_cache_update(&device->cache,
+                             RANGE_INIT(lba_range.front, count),
+                             buf + head_size);
 
-            offset += copy_size;
-            lba++;
+        if (count != full_count) {
+            return head_size + count * lba_size;
+        }
+    }
 
-            lba_offset = 0;
-            copy_size = SECTOR_SIZE;
+    const uint64_t offset = head_size + full_size;
+    if (offset != range.size) {
+        if (!write_partial_lba(device,
+                               range.front + offset,
+                               buf + offset,
+                               range.size - offset))
+        {
+            return offset;
         }
     }
 
-    phalloc_free(phys);
     return range.size;
 }
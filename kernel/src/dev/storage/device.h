@@ -8,6 +8,7 @@
 #include "dev/storage/cache.h"
 #include "lib/adt/range.h"
 #include "lib/list.h"
+#include "lib/size.h"
 
 struct storage_device;
 
@@ -29,11 +30,30 @@ struct storage_device {
     storage_device_write_t write;
 
     uint32_t lba_size;
+
+    // The most lbas the controller can transfer in a single command.
+    uint32_t max_transfer_lbas;
 };
 
+// Reads of at least this many lba-aligned bytes bypass the cache and are read
+// directly into the caller's buffer.
+
+#define STORAGE_DEVICE_DIRECT_READ_MIN_SIZE kib(64)
+
+// The storage controllers' dma engines need buffers to be at least
+// dword-aligned.
+
+#define STORAGE_DEVICE_DMA_ALIGN 4u
+
+// Order of the buffer used to bounce transfers for caller buffers we can't dma
+// into directly.
+
+#define STORAGE_DEVICE_BOUNCE_ORDER 4u
+
 bool
 storage_device_init(struct storage_device *device,
                     uint32_t lba_size,
+                    uint32_t max_transfer_lbas,
                     storage_device_read_t read,
                     storage_device_write_t write);
 
@@ -13,43 +13,54 @@ nvme_identify(struct nvme_controller *const controller,
               const enum nvme_identify_cns cns,
               const uint64_t out)
 {
-    const struct nvme_command command =
-        NVME_IDENTIFY_CMD(&controller->admin_queue, nsid, cns, out);
-
+    const struct nvme_command command = NVME_IDENTIFY_CMD(nsid, cns, out);
     return nvme_queue_submit_command(&controller->admin_queue, &command);
 }
 
 bool
 nvme_create_submit_queue(struct nvme_controller *const controller,
-                         const struct nvme_namespace *const namespace)
+                         const struct nvme_queue *const queue)
 {
     const struct nvme_command submit_command =
-        NVME_CREATE_SUBMIT_QUEUE_CMD(controller, &namespace->io_queue);
+        NVME_CREATE_SUBMIT_QUEUE_CMD(queue);
 
     return nvme_queue_submit_command(&controller->admin_queue, &submit_command);
 }
 
 bool
 nvme_create_completion_queue(struct nvme_controller *const controller,
-                             const struct nvme_namespace *const namespace)
+                             const struct nvme_queue *const queue)
 {
     const struct nvme_command comp_command =
-        NVME_CREATE_COMPLETION_QUEUE_CMD(controller,
-                                         &namespace->io_queue,
-                                         controller->msix_vector);
+        NVME_CREATE_COMPLETION_QUEUE_CMD(queue, queue->msix_vector);
 
     return nvme_queue_submit_command(&controller->admin_queue, &comp_command);
 }
 
-bool
+uint16_t
 nvme_set_number_of_queues(struct nvme_controller *const controller,
                           const uint16_t queue_count)
 {
-    const struct nvme_command setft_command =
-        NVME_SET_FEATURES_CMD(NVME_CMD_FEATURE_QUEUE_COUNT,
-                              (uint32_t)queue_count << 16 | queue_count,
-                              /*prp1=*/0,
-                              /*prp2=*/0);
-
-    return nvme_queue_submit_command(&controller->admin_queue, &setft_command);
-}
\ No newline at end of file
+    // The counts are 0-based.
+    const uint16_t count = queue_count - 1;
+    struct nvme_request request =
+        NVME_REQUEST_INIT(
+            NVME_SET_FEATURES_CMD(NVME_CMD_FEATURE_QUEUE_COUNT,
+                                  (uint32_t)count << 16 | count,
+                                  /*prp1=*/0,
+                                  /*prp2=*/0),
+            /*callback=*/NULL,
+            /*cb_info=*/NULL);
+
+    if (!nvme_queue_submit_request(&controller->admin_queue, &request)) {
+        return 0;
+    }
+
+    // The result holds the number of submit-queues granted in its lower 16
+    // bits, and the number of completion-queues granted in its upper 16 bits.
+
+    const uint16_t submit_count = (uint16_t)request.result + 1;
+    const uint16_t completion_count = (uint16_t)(request.result >> 16) + 1;
+
+    return min(submit_count, completion_count);
+}
@@ -8,11 +8,13 @@
 #include "queue.h"
 #include "structs.h"
 
-#define NVME_IDENTIFY_CMD(queue, nsid_, cns_, out) \
+// Command-ids are filled in when the command is enqueued, see
+// nvme_queue_enqueue().
+
+#define NVME_IDENTIFY_CMD(nsid_, cns_, out) \
     ((struct nvme_command){ \
         .identify = { \
             .opcode = NVME_CMD_ADMIN_OPCODE_IDENTIFY, \
-            .cid = nvme_queue_get_cmdid(queue), \
             .nsid = (nsid_), \
             .cns = (cns_), \
             .prp1 = out, \
@@ -20,11 +22,10 @@
         } \
     })
 
-#define NVME_CREATE_SUBMIT_QUEUE_CMD(controller, queue) \
+#define NVME_CREATE_SUBMIT_QUEUE_CMD(queue) \
     ((struct nvme_command){ \
         .create_submit_queue = { \
             .opcode = NVME_CMD_ADMIN_OPCODE_CREATE_SQ, \
-            .cid = nvme_queue_get_cmdid(&(controller)->admin_queue), \
             .prp1 = (queue)->submit_queue_phys, \
             .sqid = (queue)->id, \
             .cqid = (queue)->id, \
@@ -33,11 +34,10 @@
         } \
     })
 
-#define NVME_CREATE_COMPLETION_QUEUE_CMD(controller, queue, vector) \
+#define NVME_CREATE_COMPLETION_QUEUE_CMD(queue, vector) \
     ((struct nvme_command){ \
         .create_comp_queue = { \
             .opcode = NVME_CMD_ADMIN_OPCODE_CREATE_CQ, \
-            .cid = nvme_queue_get_cmdid(&(controller)->admin_queue), \
             .prp1 = (queue)->completion_queue_phys, \
             .cqid = (queue)->id, \
             .size = (queue)->entry_count - 1, \
@@ -59,15 +59,16 @@
         } \
     })
 
-#define NVME_IO_CMD(namespace, write, buf_phys, lba_range) \
+// The prps of io commands are filled in from the request's data buffer.
+
+#define NVME_IO_CMD(namespace, write, lba_range) \
     ((struct nvme_command){ \
         .readwrite = { \
             .opcode = (write) ? NVME_CMD_OPCODE_WRITE : NVME_CMD_OPCODE_READ, \
             .flags = 0, \
-            .cid = nvme_queue_get_cmdid(&namespace->io_queue), \
             .nsid = (namespace)->nsid, \
             .metadata = 0, \
-            .prp1 = (buf_phys), \
+            .prp1 = 0, \
             .prp2 = 0, \
             .slba = (lba_range).front, \
             .len = ((lba_range).size - 1), \
@@ -89,12 +90,14 @@ struct nvme_namespace;
 
 bool
 nvme_create_submit_queue(struct nvme_controller *controller,
-                         const struct nvme_namespace *namespace);
+                         const struct nvme_queue *queue);
 
 bool
 nvme_create_completion_queue(struct nvme_controller *controller,
-                             const struct nvme_namespace *namespace);
+                             const struct nvme_queue *queue);
 
-bool
+// Returns the number of io queue-pairs the controller granted, or 0 on failure.
+
+uint16_t
 nvme_set_number_of_queues(struct nvme_controller *controller,
                           uint16_t queue_count);
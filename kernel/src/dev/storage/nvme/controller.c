@@ -6,6 +6,8 @@
 #include "asm/pause.h"
 
 #include "cpu/isr.h"
+
+#include "dev/pci/entity.h"
 #include "dev/printk.h"
 
 #include "lib/util.h"
@@ -19,6 +21,9 @@
 #include "command.h"
 #include "namespace.h"
 
+// Io queue-pairs are created per-cpu, up to this many.
+#define NVME_MAX_IO_QUEUE_COUNT 64ull
+
 // Recommended values from spec
 #define NVME_SUBMIT_QUEUE_SIZE 6
 #define NVME_COMPLETION_QUEUE_SIZE 4
@@ -29,91 +34,53 @@
    | (uint32_t)minor << NVME_VERSION_MINOR_SHIFT \
    | (uint32_t)tertiary)
 
+// Controllers may be probed on several cpus at once, see dev/probe.h.
+
 static struct list g_controller_list = LIST_INIT(g_controller_list);
+static struct spinlock g_controller_list_lock = SPINLOCK_INIT();
 static uint32_t g_controller_count = 0;
 
-static bool notify_queue_if_done(struct nvme_queue *const queue) {
-    volatile struct nvme_completion_queue_entry *const completion_queue =
-        queue->completion_queue_mmio->base;
-
-    spin_acquire(&queue->lock);
-
-    uint8_t head = queue->completion_queue_head;
-    const uint32_t status = mmio_read(&completion_queue[head].status);
-
-    if (status == 0) {
-        spin_release(&queue->lock);
-        return false;
-    }
-
-    const uint8_t phase = queue->phase;
-    if ((status & __NVME_COMPL_QUEUE_ENTRY_STATUS_PHASE) != phase) {
-        spin_release(&queue->lock);
-        printk(LOGLEVEL_WARN,
-               "nvme: queue with qid %" PRIu8 " has a phase mismatch error\n",
-               queue->id);
-
-        return false;
-    }
-
-    queue->completion_queue_head++;
-    if (queue->completion_queue_head == queue->entry_count) {
-        queue->completion_queue_head = 0;
-        queue->phase = !queue->phase;
-    }
-
-    mmio_write(&queue->doorbells->complete, queue->completion_queue_head);
-
-    event_trigger(&queue->event, /*drop_if_no_listeners=*/false);
-    spin_release(&queue->lock);
-
-    return true;
-}
-
 __debug_optimize(3)
 void handle_irq(const uint64_t int_no, struct thread_context *const context) {
     (void)context;
 
-    struct nvme_controller *iter = NULL;
-    bool found = false;
+    // Msi vectors are only unique per-cpu, so the queue is found from the
+    // controller and msi-index the vector was allocated for on this cpu. An io
+    // queue's msi-index is its id, while msi-index 0 is the controller's own
+    // vector, shared by the admin queue and every io queue without a vector of
+    // its own.
 
-    list_foreach(iter, &g_controller_list, list) {
-        if (iter->isr_vector == int_no) {
-            found = true;
-            break;
-        }
-    }
+    struct device *device = NULL;
+    uint16_t msi_index = 0;
 
-    if (!found) {
+    if (!isr_get_msi_vector_owner((isr_vector_t)int_no, &device, &msi_index)
+     || device->driver_info == NULL)
+    {
         isr_eoi(int_no);
         printk(LOGLEVEL_WARN,
                "nvme: got spurious interrupt from vector w/o corresponding "
                "controller: %" PRIu64 "\n",
                int_no);
-
         return;
     }
 
-    if (notify_queue_if_done(&iter->admin_queue)) {
-        isr_eoi(int_no);
-        return;
-    }
-
-    // TODO: use GET_FEATURES command to check for interrupt coalescing
-
-    struct nvme_namespace *ns_iter = NULL;
-    list_foreach(ns_iter, &iter->namespace_list, list) {
-        if (notify_queue_if_done(&ns_iter->io_queue)) {
-            isr_eoi(int_no);
-            return;
+    struct nvme_controller *const controller = device->driver_info;
+    if (msi_index != 0) {
+        if (msi_index <= controller->io_queue_count) {
+            nvme_queue_process_completions(
+                &controller->io_queue_list[msi_index - 1]);
+        }
+    } else {
+        nvme_queue_process_completions(&controller->admin_queue);
+        for (uint16_t i = 0; i != controller->io_queue_count; i++) {
+            struct nvme_queue *const queue = &controller->io_queue_list[i];
+            if (queue->msix_vector == controller->msix_vector) {
+                nvme_queue_process_completions(queue);
+            }
         }
     }
 
     isr_eoi(int_no);
-    printk(LOGLEVEL_WARN,
-           "nvme: got spurious interrupt w/o any corresponding queue\n");
-
-    return;
 }
 
 #define MAX_ATTEMPTS 100
@@ -151,6 +118,173 @@ bool wait_until_ready(volatile struct nvme_registers *const regs) {
     return false;
 }
 
+static struct cpu_info *
+cpu_for_io_queue(const uint16_t index, const uint16_t queue_count) {
+    struct cpu_info *iter = NULL;
+    list_foreach(iter, cpus_get_list(), cpu_list) {
+        if (cpu_get_id(iter) % queue_count == index) {
+            return iter;
+        }
+    }
+
+    return NULL;
+}
+
+// Give the queue its own msix vector targeting `cpu`. If that isn't possible,
+// the queue shares the controller's vector instead.
+//
+// With fewer queues than cpus, cpu_for_io_queue() has other cpus submit to the
+// queue as well, so the vector is only pinned to `cpu` if `per_cpu` is set.
+
+static void
+setup_io_queue_irq(struct nvme_controller *const controller,
+                   struct nvme_queue *const queue,
+                   const struct cpu_info *const cpu,
+                   const bool per_cpu)
+{
+    queue->isr_vector = controller->isr_vector;
+    queue->msix_vector = controller->msix_vector;
+
+    struct pci_entity_info *const pci_entity =
+        container_of(controller->device, struct pci_entity_info, device);
+
+    if (pci_entity->msi_support != PCI_ENTITY_MSI_SUPPORT_MSIX || cpu == NULL) {
+        return;
+    }
+
+    const isr_vector_t vector =
+        isr_alloc_msi_vector(controller->device, /*msi_index=*/queue->id, cpu);
+
+    if (vector == ISR_INVALID_VECTOR) {
+        return;
+    }
+
+    const int32_t msix_index =
+        pci_entity_bind_msi_to_vector(pci_entity,
+                                      cpu,
+                                      vector,
+                                      /*masked=*/false);
+
+    if (msix_index < 0) {
+        isr_free_msi_vector(controller->device, vector, queue->id);
+        return;
+    }
+
+    // The queue is only submitted to from `cpu`, so its completions should be
+    // handled there too, rather than wherever the irq balancer moves them.
+
+    if (per_cpu) {
+        isr_pin_msi_vector(cpu, vector);
+    }
+
+    isr_set_msi_vector(cpu, vector, handle_irq, &ARCH_ISR_INFO_NONE());
+
+    queue->isr_vector = vector;
+    queue->msix_vector = (uint16_t)msix_index;
+}
+
+static void
+destroy_io_queue(struct nvme_controller *const controller,
+                 struct nvme_queue *const queue)
+{
+    if (queue->msix_vector != controller->msix_vector) {
+        isr_free_msi_vector(controller->device, queue->isr_vector, queue->id);
+    }
+
+    nvme_queue_destroy(queue);
+}
+
+_Static_assert((1ull << NVME_MAX_TRANSFER_SHIFT) / PAGE_SIZE * sizeof(uint64_t)
+                 <= PAGE_SIZE,
+               "the prp list of an io command must fit in a single page");
+
+static bool
+create_io_queues(struct nvme_controller *const controller,
+                 const uint16_t max_queue_entry_count)
+{
+    const uint64_t cpu_count =
+        list_count(cpus_get_list(), struct cpu_info, cpu_list);
+    const uint16_t granted_count =
+        nvme_set_number_of_queues(controller,
+                                  (uint16_t)min(cpu_count,
+                                                NVME_MAX_IO_QUEUE_COUNT));
+
+    if (granted_count == 0) {
+        printk(LOGLEVEL_WARN, "nvme: failed to set number of queues\n");
+        return false;
+    }
+
+    const uint16_t queue_count =
+        (uint16_t)min(min((uint64_t)granted_count, cpu_count),
+                      NVME_MAX_IO_QUEUE_COUNT);
+
+    controller->io_queue_list =
+        kmalloc(sizeof(struct nvme_queue) * queue_count);
+
+    if (controller->io_queue_list == NULL) {
+        printk(LOGLEVEL_WARN, "nvme: failed to alloc io queue list\n");
+        return false;
+    }
+
+    const uint16_t entry_count =
+        min(max_queue_entry_count, (uint16_t)NVME_IO_QUEUE_ENTRY_COUNT);
+
+    for (uint16_t i = 0; i != queue_count; i++) {
+        struct nvme_queue *const queue = &controller->io_queue_list[i];
+        if (!nvme_queue_create(queue,
+                               controller,
+                               /*id=*/i + 1,
+                               entry_count,
+                               (uint8_t)controller->max_transfer_shift))
+        {
+            break;
+        }
+
+        setup_io_queue_irq(controller,
+                           queue,
+                           cpu_for_io_queue(i, queue_count),
+                           /*per_cpu=*/queue_count == cpu_count);
+
+        // The irq handler only looks at queues below the io queue count.
+        controller->io_queue_count = i + 1;
+
+        if (!nvme_create_completion_queue(controller, queue)
+         || !nvme_create_submit_queue(controller, queue))
+        {
+            controller->io_queue_count = i;
+            destroy_io_queue(controller, queue);
+
+            break;
+        }
+    }
+
+    if (controller->io_queue_count == 0) {
+        kfree(controller->io_queue_list);
+        controller->io_queue_list = NULL;
+
+        printk(LOGLEVEL_WARN, "nvme: failed to create any io queues\n");
+        return false;
+    }
+
+    printk(LOGLEVEL_INFO,
+           "nvme: created %" PRIu16 " io queue-pair(s) with %" PRIu16 " "
+           "entries each\n",
+           controller->io_queue_count,
+           entry_count);
+
+    return true;
+}
+
+__debug_optimize(3) struct nvme_queue *
+nvme_controller_get_io_queue(struct nvme_controller *const controller) {
+    cpu_id_t id = 0;
+    with_preempt_disabled({
+        id = cpu_get_id(this_cpu());
+    });
+
+    return &controller->io_queue_list[id % controller->io_queue_count];
+}
+
 static bool
 identify_namespaces(struct nvme_controller *const controller,
                     const uint16_t max_queue_cmd_count)
@@ -179,12 +313,17 @@ identify_namespaces(struct nvme_controller *const controller,
     uint32_t max_transfer_shift = 0;
     const uint32_t max_data_transfer_shift = ident->max_data_transfer_shift;
 
+    // The max data transfer size is in units of the controller's min page
+    // size.
+
     if (max_data_transfer_shift != 0) {
         max_transfer_shift =
             ((regs->capabilities & __NVME_CAP_MEM_PAGE_SIZE_MIN_4KiB) >>
-                NVME_CAP_MEM_PAGE_SIZE_MIN_SHIFT) + 12;
+                NVME_CAP_MEM_PAGE_SIZE_MIN_SHIFT) + 12
+          + max_data_transfer_shift;
+        max_transfer_shift = min(max_transfer_shift, NVME_MAX_TRANSFER_SHIFT);
     } else {
-        max_transfer_shift = 20;
+        max_transfer_shift = NVME_MAX_TRANSFER_SHIFT;
     }
 
     const uint32_t namespace_count = ident->namespace_count;
@@ -214,10 +353,9 @@ identify_namespaces(struct nvme_controller *const controller,
         return false;
     }
 
-    if (!nvme_set_number_of_queues(controller, /*queue_count=*/4)) {
+    controller->max_transfer_shift = max_transfer_shift;
+    if (!create_io_queues(controller, max_queue_cmd_count)) {
         phalloc_free(identity_phys);
-        printk(LOGLEVEL_WARN, "nvme: failed to set number of queues\n");
-
         return false;
     }
 
@@ -233,11 +371,7 @@ identify_namespaces(struct nvme_controller *const controller,
             continue;
         }
 
-        if (!nvme_namespace_create(namespace,
-                                   controller,
-                                   nsid,
-                                   max_queue_cmd_count,
-                                   max_transfer_shift))
+        if (!nvme_namespace_create(namespace, controller, nsid))
         {
             kfree(namespace);
             continue;
@@ -257,6 +391,7 @@ nvme_controller_create(struct nvme_controller *const controller,
                        struct device *const device,
                        volatile struct nvme_registers *const regs,
                        const isr_vector_t isr_vector,
+                       const struct cpu_info *const isr_cpu,
                        const uint16_t msix_vector)
 {
     list_init(&controller->list);
@@ -267,6 +402,11 @@ nvme_controller_create(struct nvme_controller *const controller,
     controller->lock = SPINLOCK_INIT();
     controller->msix_vector = msix_vector;
     controller->isr_vector = isr_vector;
+    controller->isr_cpu = isr_cpu;
+
+    controller->io_queue_list = NULL;
+    controller->io_queue_count = 0;
+    controller->max_transfer_shift = 0;
 
     if (!nvme_queue_create(&controller->admin_queue,
                            controller,
@@ -277,6 +417,9 @@ nvme_controller_create(struct nvme_controller *const controller,
         return false;
     }
 
+    controller->admin_queue.isr_vector = isr_vector;
+    controller->admin_queue.msix_vector = msix_vector;
+
     const uint32_t capabilities = mmio_read(&regs->capabilities);
     const uint16_t max_queue_cmd_count =
         (capabilities & __NVME_CAP_MAX_QUEUE_ENTRIES) + 1;
@@ -343,19 +486,25 @@ nvme_controller_create(struct nvme_controller *const controller,
            controller->isr_vector,
            controller->msix_vector);
 
-    isr_set_msi_vector(controller->isr_vector,
+    device->driver_info = controller;
+    isr_set_msi_vector(controller->isr_cpu,
+                       controller->isr_vector,
                        handle_irq,
                        &ARCH_ISR_INFO_NONE());
 
-    list_add(&g_controller_list, &controller->list);
-    g_controller_count++;
+    with_spinlock_irq_disabled(&g_controller_list_lock, {
+        list_add(&g_controller_list, &controller->list);
+        g_controller_count++;
+    });
 
     if (!identify_namespaces(controller, max_queue_cmd_count)) {
         mmio_write(&regs->config, 0);
+        with_spinlock_irq_disabled(&g_controller_list_lock, {
+            list_remove(&controller->list);
+            g_controller_count--;
+        });
 
-        list_remove(&controller->list);
-        g_controller_count--;
-
+        device->driver_info = NULL;
         return false;
     }
 
@@ -371,10 +520,21 @@ bool nvme_controller_destroy(struct nvme_controller *const controller) {
         nvme_namespace_destroy(iter);
     }
 
+    for (uint16_t i = 0; i != controller->io_queue_count; i++) {
+        destroy_io_queue(controller, &controller->io_queue_list[i]);
+    }
+
+    kfree(controller->io_queue_list);
+
+    controller->io_queue_list = NULL;
+    controller->io_queue_count = 0;
+
     isr_free_msi_vector(controller->device,
                         controller->isr_vector,
                         /*msi_index=*/0);
 
+    controller->device->driver_info = NULL;
+
     list_deinit(&controller->list);
     list_deinit(&controller->namespace_list);
 
@@ -382,6 +542,7 @@ bool nvme_controller_destroy(struct nvme_controller *const controller) {
     controller->stride = 0;
     controller->msix_vector = 0;
     controller->isr_vector = 0;
+    controller->isr_cpu = NULL;
 
     kfree(controller);
     return true;
@@ -9,6 +9,12 @@
 #include "queue.h"
 
 #define NVME_ADMIN_QUEUE_COUNT 32
+#define NVME_IO_QUEUE_ENTRY_COUNT 128
+
+// Transfers are capped at 1MiB so that the prp list of every command-id on
+// every io queue-pair fits in a single page.
+
+#define NVME_MAX_TRANSFER_SHIFT 20u
 
 struct nvme_controller {
     struct list list;
@@ -20,10 +26,19 @@ struct nvme_controller {
     struct nvme_queue admin_queue;
     struct list namespace_list;
 
+    // Io queue-pairs are shared by all namespaces. Each cpu submits to the
+    // queue-pair at index (cpu-id % io_queue_count).
+
+    struct nvme_queue *io_queue_list;
+    uint16_t io_queue_count;
+
     uint8_t stride;
     uint16_t msix_vector;
 
     isr_vector_t isr_vector;
+    const struct cpu_info *isr_cpu;
+
+    uint32_t max_transfer_shift;
 };
 
 bool
@@ -31,6 +46,11 @@ nvme_controller_create(struct nvme_controller *controller,
                        struct device *device,
                        volatile struct nvme_registers *regs,
                        isr_vector_t isr_vector,
+                       const struct cpu_info *isr_cpu,
                        uint16_t msix_vector);
 
 bool nvme_controller_destroy(struct nvme_controller *controller);
+
+// Returns the io queue-pair the current cpu should submit commands to.
+struct nvme_queue *
+nvme_controller_get_io_queue(struct nvme_controller *controller);
@@ -67,8 +67,12 @@ static void init_from_pci(struct pci_entity_info *const pci_entity) {
         return;
     }
 
+    // The admin queue's vector goes to whichever cpu has the fewest msi
+    // vectors, instead of to the cpu that happened to probe the controller.
+
+    const struct cpu_info *const isr_cpu = isr_get_cpu_for_msi();
     const isr_vector_t isr_vector =
-        isr_alloc_msi_vector(&pci_entity->device, /*msi_index=*/0);
+        isr_alloc_msi_vector(&pci_entity->device, /*msi_index=*/0, isr_cpu);
 
     if (isr_vector == ISR_INVALID_VECTOR) {
         printk(LOGLEVEL_WARN,
@@ -88,12 +92,10 @@ static void init_from_pci(struct pci_entity_info *const pci_entity) {
         return;
     }
 
-    with_preempt_disabled({
-        pci_entity_bind_msi_to_vector(pci_entity,
-                                      this_cpu(),
-                                      isr_vector,
-                                      /*masked=*/false);
-    });
+    pci_entity_bind_msi_to_vector(pci_entity,
+                                  isr_cpu,
+                                  isr_vector,
+                                  /*masked=*/false);
 
     struct nvme_controller *const controller = kmalloc(sizeof(*controller));
     if (controller == NULL) {
@@ -113,6 +115,7 @@ static void init_from_pci(struct pci_entity_info *const pci_entity) {
                                 &pci_entity->device,
                                 regs,
                                 isr_vector,
+                                isr_cpu,
                                 /*msix_vector=*/0))
     {
         kfree(controller);
@@ -137,6 +140,7 @@ static const struct pci_driver pci_driver = {
 
 __driver static const struct driver driver = {
     .name = SV_STATIC("nvme-driver"),
+    .flags = __DRIVER_ASYNC_PROBE | __DRIVER_REQUIRED_FOR_BOOT,
     .dtb = NULL,
     .pci = &pci_driver
 };
\ No newline at end of file
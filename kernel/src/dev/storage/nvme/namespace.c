@@ -13,8 +13,6 @@
 #include "command.h"
 #include "namespace.h"
 
-#define NVME_IO_QUEUE_COUNT 1024ul
-
 __debug_optimize(3) static uint64_t
 nvme_read(struct storage_device *const device,
           const uint64_t phys,
@@ -48,9 +46,7 @@ nvme_write(struct storage_device *const device,
 bool
 nvme_namespace_create(struct nvme_namespace *const namespace,
                       struct nvme_controller *const controller,
-                      const uint32_t nsid,
-                      const uint16_t max_queue_entry_count,
-                      const uint32_t max_transfer_shift)
+                      const uint32_t nsid)
 {
     const uint64_t identity_phys = phalloc(sizeof(struct nvme_nsidentity));
     if (identity_phys == INVALID_PHYS) {
@@ -165,20 +161,6 @@ nvme_namespace_create(struct nvme_namespace *const namespace,
            identity->iee_uid);
 
     phalloc_free(identity_phys);
-    if (!nvme_queue_create(&namespace->io_queue,
-                           controller,
-                           /*id=*/nsid,
-                           min(NVME_IO_QUEUE_COUNT, max_queue_entry_count),
-                           max_transfer_shift))
-    {
-        return false;
-    }
-
-    if (!nvme_create_completion_queue(controller, namespace)
-     || !nvme_create_submit_queue(controller, namespace))
-    {
-        return false;
-    }
 
     namespace->controller = controller;
     namespace->nsid = nsid;
@@ -187,8 +169,13 @@ nvme_namespace_create(struct nvme_namespace *const namespace,
     list_init(&namespace->list);
     list_add(&controller->namespace_list, &namespace->list);
 
+    const uint32_t max_transfer_lbas =
+        (uint32_t)max((1ull << controller->max_transfer_shift) / lba_size,
+                      1ull);
+
     if (!storage_device_init(&namespace->device,
                              lba_size,
+                             max_transfer_lbas,
                              nvme_read,
                              nvme_write))
     {
@@ -198,11 +185,12 @@ nvme_namespace_create(struct nvme_namespace *const namespace,
     return true;
 }
 
-bool
-nvme_namespace_rwlba(struct nvme_namespace *const namespace,
-                     const struct range lba_range,
-                     const bool write,
-                     const uint64_t out)
+static bool
+prepare_io_request(struct nvme_namespace *const namespace,
+                   struct nvme_request *const request,
+                   const struct range lba_range,
+                   const bool write,
+                   const uint64_t phys)
 {
     if (__builtin_expect(range_empty(lba_range), 0)) {
         printk(LOGLEVEL_WARN,
@@ -228,32 +216,49 @@ nvme_namespace_rwlba(struct nvme_namespace *const namespace,
         return false;
     }
 
-    struct nvme_command command = NVME_IO_CMD(namespace, write, out, lba_range);
-    if (total_size > PAGE_SIZE) {
-        const uint32_t prp_count = PAGE_COUNT(total_size) - 1;
-        if (prp_count != 0) {
-            uint64_t *const prp_list =
-                &namespace->io_queue.phys_region_page_list[
-                    namespace->io_queue.phys_region_pages_count
-                  * command.readwrite.cid];
-
-            for (uint32_t i = 0; i != prp_count; i++) {
-                prp_list[i] = command.readwrite.prp2 + (PAGE_SIZE * i);
-            }
-
-            command.readwrite.prp2 = virt_to_phys(prp_list);
-        } else {
-            command.readwrite.prp2 = out + PAGE_SIZE;
-        }
+    request->command = NVME_IO_CMD(namespace, write, lba_range);
+    request->data_phys = phys;
+    request->data_size = total_size;
+
+    return true;
+}
+
+bool
+nvme_namespace_rwlba(struct nvme_namespace *const namespace,
+                     const struct range lba_range,
+                     const bool write,
+                     const uint64_t out)
+{
+    struct nvme_request request = {};
+    if (!prepare_io_request(namespace, &request, lba_range, write, out)) {
+        return false;
+    }
+
+    struct nvme_queue *const queue =
+        nvme_controller_get_io_queue(namespace->controller);
+
+    return nvme_queue_submit_request(queue, &request);
+}
+
+bool
+nvme_namespace_rwlba_async(struct nvme_namespace *const namespace,
+                           struct nvme_queue *const queue,
+                           struct nvme_request *const request,
+                           const struct range lba_range,
+                           const bool write,
+                           const uint64_t phys)
+{
+    assert(request->callback != NULL);
+    if (!prepare_io_request(namespace, request, lba_range, write, phys)) {
+        return false;
     }
 
-    return nvme_queue_submit_command(&namespace->io_queue, &command);
+    return nvme_queue_enqueue(queue, request);
 }
 
 void nvme_namespace_destroy(struct nvme_namespace *const namespace) {
     struct nvme_controller *const controller = namespace->controller;
     with_spinlock_irq_disabled(&controller->lock, {
-        nvme_queue_destroy(&namespace->io_queue);
         list_deinit(&namespace->list);
     });
 
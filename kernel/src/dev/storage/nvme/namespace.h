@@ -10,7 +10,6 @@
 
 struct nvme_namespace {
     struct nvme_controller *controller;
-    struct nvme_queue io_queue;
 
     struct list list;
     struct storage_device device;
@@ -22,9 +21,7 @@ struct nvme_namespace {
 bool
 nvme_namespace_create(struct nvme_namespace *namespace,
                       struct nvme_controller *controller,
-                      uint32_t nsid,
-                      uint16_t max_queue_count,
-                      uint32_t max_transfer_shift);
+                      uint32_t nsid);
 
 bool
 nvme_namespace_rwlba(struct nvme_namespace *namespace,
@@ -32,4 +29,17 @@ nvme_namespace_rwlba(struct nvme_namespace *namespace,
                      bool write,
                      uint64_t out_phys);
 
+// Enqueue a read or write on `queue` without waiting for it, or necessarily
+// ringing the queue's doorbell. `request` must have a callback, which is called
+// from the queue's irq handler once the command completes. Several requests can
+// be enqueued before calling nvme_queue_flush() once to submit them all.
+
+bool
+nvme_namespace_rwlba_async(struct nvme_namespace *namespace,
+                           struct nvme_queue *queue,
+                           struct nvme_request *request,
+                           struct range lba_range,
+                           bool write,
+                           uint64_t phys);
+
 void nvme_namespace_destroy(struct nvme_namespace *namespace);
@@ -5,18 +5,64 @@
  */
 
 #include "dev/printk.h"
+
 #include "lib/align.h"
+#include "lib/util.h"
 
+#include "mm/kmalloc.h"
 #include "mm/page_alloc.h"
-#include "mm/phalloc.h"
 
 #include "sys/mmio.h"
 #include "controller.h"
 
+// Each command-id gets its own prp list, which the controller requires not to
+// cross a page boundary. Lists are packed into single pages rather than one
+// large allocation, which wouldn't fit in phalloc() for the larger transfer
+// sizes, and would need a high-order allocation otherwise.
+
+__debug_optimize(3) static inline uint16_t
+prp_lists_per_page(const struct nvme_queue *const queue) {
+    return PAGE_SIZE / (queue->phys_region_pages_count * sizeof(uint64_t));
+}
+
+static void
+free_prp_lists(struct nvme_queue *const queue, const uint16_t count) {
+    const uint16_t per_page = prp_lists_per_page(queue);
+    for (uint16_t cid = 0; cid < count; cid += per_page) {
+        free_page(virt_to_page(queue->slot_list[cid].prp_list));
+    }
+
+    for (uint16_t cid = 0; cid != count; cid++) {
+        queue->slot_list[cid].prp_list = NULL;
+    }
+}
+
+static bool alloc_prp_lists(struct nvme_queue *const queue) {
+    const uint16_t cid_count = queue->entry_count - 1;
+    const uint16_t per_page = prp_lists_per_page(queue);
+
+    assert(per_page != 0);
+    for (uint16_t cid = 0; cid < cid_count; cid += per_page) {
+        struct page *const page = alloc_page(PAGE_STATE_USED, /*flags=*/0);
+        if (page == NULL) {
+            free_prp_lists(queue, /*count=*/cid);
+            return false;
+        }
+
+        uint64_t *const list = page_to_virt(page);
+        for (uint16_t i = 0; i != per_page && cid + i != cid_count; i++) {
+            queue->slot_list[cid + i].prp_list =
+                &list[queue->phys_region_pages_count * i];
+        }
+    }
+
+    return true;
+}
+
 bool
 nvme_queue_create(struct nvme_queue *const queue,
                   struct nvme_controller *const device,
-                  const uint8_t id,
+                  const uint16_t id,
                   const uint16_t entry_count,
                   const uint8_t max_transfer_shift)
 {
@@ -99,7 +145,7 @@ nvme_queue_create(struct nvme_queue *const queue,
     queue->completion_queue_mmio = completion_queue_mmio;
 
     queue->lock = SPINLOCK_INIT();
-    queue->event = EVENT_INIT();
+    queue->cid_event = EVENT_INIT();
     queue->id = id;
 
     queue->submit_queue_head = 0;
@@ -112,65 +158,86 @@ nvme_queue_create(struct nvme_queue *const queue,
                    device->stride * id);
 
     queue->entry_count = entry_count;
-    queue->cmd_identifier = 0;
+    queue->pending_count = 0;
     queue->phase = true;
 
+    queue->isr_vector = 0;
+    queue->msix_vector = 0;
+
     queue->submit_alloc_order = submit_order;
     queue->completion_alloc_order = completion_order;
 
+    const uint16_t cid_count = entry_count - 1;
+
+    queue->slot_list = kmalloc(sizeof(struct nvme_queue_slot) * cid_count);
+    queue->free_cid_list = kmalloc(sizeof(uint16_t) * cid_count);
+
+    if (queue->slot_list == NULL || queue->free_cid_list == NULL) {
+        kfree(queue->slot_list);
+        kfree(queue->free_cid_list);
+
+        vunmap_mmio(submit_queue_mmio);
+        vunmap_mmio(completion_queue_mmio);
+
+        free_pages(submit_queue_page, submit_order);
+        free_pages(completion_queue_page, completion_order);
+
+        printk(LOGLEVEL_WARN,
+               "nvme: failed to alloc command-id info for nvme-queue\n");
+        return false;
+    }
+
+    // Hand out lower command-ids first.
+    for (uint16_t i = 0; i != cid_count; i++) {
+        queue->slot_list[i].request = NULL;
+        queue->slot_list[i].event = EVENT_INIT();
+        queue->slot_list[i].prp_list = NULL;
+
+        queue->free_cid_list[i] = cid_count - 1 - i;
+    }
+
+    queue->free_cid_count = cid_count;
+    queue->cid_waiter_count = 0;
+
     if (max_transfer_shift != 0) {
         queue->phys_region_pages_count =
             div_round_up(1ull << max_transfer_shift, PAGE_SIZE);
 
-        const uint64_t phys_region_page_list_size =
-            queue->phys_region_pages_count
-          * queue->entry_count
-          * sizeof(uint64_t);
+        if (!alloc_prp_lists(queue)) {
+            kfree(queue->slot_list);
+            kfree(queue->free_cid_list);
 
-        const uint64_t prp_phys = phalloc(phys_region_page_list_size);
-        if (prp_phys == INVALID_PHYS) {
             vunmap_mmio(submit_queue_mmio);
+            vunmap_mmio(completion_queue_mmio);
 
-            phalloc_free(submit_queue_phys);
-            phalloc_free(completion_queue_phys);
+            free_pages(submit_queue_page, submit_order);
+            free_pages(completion_queue_page, completion_order);
 
             printk(LOGLEVEL_WARN,
                    "nvme: failed to alloc list of physical region pages\n");
 
             return false;
         }
-
-        queue->phys_region_page_list = phys_to_virt(prp_phys);
     } else {
-        queue->phys_region_page_list = NULL;
+        queue->phys_region_pages_count = 0;
     }
 
     return true;
 }
 
-__debug_optimize(3)
-uint16_t nvme_queue_get_cmdid(struct nvme_queue *const queue) {
-    uint16_t result = 0;
-    with_spinlock_irq_disabled(&queue->lock, {
-        result = queue->cmd_identifier;
-        queue->cmd_identifier++;
-
-        if (queue->cmd_identifier >= queue->entry_count) {
-            queue->cmd_identifier = 0;
-        }
-    });
-
-    return result;
-}
-
 __debug_optimize(3) void nvme_queue_destroy(struct nvme_queue *const queue) {
-    if (queue->phys_region_page_list != NULL) {
-        phalloc_free(virt_to_phys(queue->phys_region_page_list));
-
-        queue->phys_region_page_list = NULL;
+    if (queue->phys_region_pages_count != 0) {
+        free_prp_lists(queue, /*count=*/queue->entry_count - 1);
         queue->phys_region_pages_count = 0;
     }
 
+    kfree(queue->slot_list);
+    kfree(queue->free_cid_list);
+
+    queue->slot_list = NULL;
+    queue->free_cid_list = NULL;
+    queue->free_cid_count = 0;
+
     vunmap_mmio(queue->submit_queue_mmio);
     vunmap_mmio(queue->completion_queue_mmio);
 
@@ -193,30 +260,287 @@ __debug_optimize(3) void nvme_queue_destroy(struct nvme_queue *const queue) {
     queue->phase = false;
 }
 
-bool
-nvme_queue_submit_command(struct nvme_queue *const queue,
-                          const struct nvme_command *const command)
+// Returns the number of entries in the queue's prp list the request needs, or
+// UINT64_MAX if its data doesn't fit in a single command.
+
+__debug_optimize(3) static uint64_t
+prp_list_count_for_request(const struct nvme_queue *const queue,
+                           const struct nvme_request *const request)
 {
-    with_spinlock_irq_disabled(&queue->lock, {
-        const uint8_t tail = queue->submit_queue_tail;
-        volatile struct nvme_command *const submit_queue =
-            queue->submit_queue_mmio->base;
+    if (request->data_size == 0) {
+        return 0;
+    }
 
-        submit_queue[tail] = *command;
-        queue->submit_queue_tail++;
+    // The first prp may point anywhere within a page, while every later one
+    // points to the start of a page.
 
-        if (queue->submit_queue_tail == queue->entry_count) {
-            queue->submit_queue_tail = 0;
-        }
+    const uint64_t first_size = PAGE_SIZE - (request->data_phys % PAGE_SIZE);
+    if (request->data_size <= first_size) {
+        return 0;
+    }
+
+    const uint64_t count =
+        div_round_up(request->data_size - first_size, PAGE_SIZE);
+
+    if (count == 1) {
+        return 0;
+    }
+
+    if (count > queue->phys_region_pages_count) {
+        return UINT64_MAX;
+    }
+
+    return count;
+}
+
+// Caller must hold the queue's lock.
+
+__debug_optimize(3) static void
+setup_prps(struct nvme_queue *const queue,
+           struct nvme_request *const request,
+           const uint64_t prp_count)
+{
+    struct nvme_command *const command = &request->command;
+    if (request->data_size == 0) {
+        return;
+    }
+
+    const uint64_t phys = request->data_phys;
+    const uint64_t second_page = phys + PAGE_SIZE - (phys % PAGE_SIZE);
+
+    command->common.prp1 = phys;
+    if (prp_count == 0) {
+        command->common.prp2 =
+            request->data_size > second_page - phys ? second_page : 0;
+        return;
+    }
+
+    uint64_t *const prp_list = queue->slot_list[request->cid].prp_list;
+    for (uint64_t i = 0; i != prp_count; i++) {
+        prp_list[i] = second_page + (PAGE_SIZE * i);
+    }
+
+    command->common.prp2 = virt_to_phys(prp_list);
+}
+
+// Caller must hold the queue's lock.
+
+__debug_optimize(3)
+static inline void ring_submit_doorbell(struct nvme_queue *const queue) {
+    mmio_write(&queue->doorbells->submit, queue->submit_queue_tail);
+    queue->pending_count = 0;
+}
+
+// Caller must hold the queue's lock.
+
+__debug_optimize(3)
+static void free_cid(struct nvme_queue *const queue, const uint16_t cid) {
+    queue->slot_list[cid].request = NULL;
+    queue->free_cid_list[queue->free_cid_count] = cid;
+    queue->free_cid_count++;
+
+    if (queue->cid_waiter_count != 0) {
+        event_trigger(&queue->cid_event, /*drop_if_no_listeners=*/false);
+    }
+}
 
-        mmio_write(&queue->doorbells->submit, queue->submit_queue_tail);
+__debug_optimize(3) bool
+nvme_queue_enqueue(struct nvme_queue *const queue,
+                   struct nvme_request *const request)
+{
+    const uint64_t prp_count = prp_list_count_for_request(queue, request);
+    if (prp_count == UINT64_MAX) {
+        printk(LOGLEVEL_WARN,
+               "nvme: request is larger than the controller's max transfer "
+               "size\n");
+        return false;
+    }
+
+    const int flag = spin_acquire_save_irq(&queue->lock);
+    if (queue->free_cid_count == 0) {
+        spin_release_restore_irq(&queue->lock, flag);
+        return false;
+    }
+
+    queue->free_cid_count--;
+    const uint16_t cid = queue->free_cid_list[queue->free_cid_count];
+
+    list_init(&request->list);
+
+    request->queue = queue;
+    request->cid = cid;
+    request->status = 0;
+    request->result = 0;
+    request->command.common.cid = cid;
+
+    setup_prps(queue, request, prp_count);
+    queue->slot_list[cid].request = request;
+
+    volatile struct nvme_command *const submit_queue =
+        queue->submit_queue_mmio->base;
+
+    submit_queue[queue->submit_queue_tail] = request->command;
+    queue->submit_queue_tail++;
+
+    if (queue->submit_queue_tail == queue->entry_count) {
+        queue->submit_queue_tail = 0;
+    }
+
+    queue->pending_count++;
+    if (queue->pending_count >= NVME_QUEUE_DOORBELL_BATCH) {
+        ring_submit_doorbell(queue);
+    }
+
+    spin_release_restore_irq(&queue->lock, flag);
+    return true;
+}
+
+__debug_optimize(3) void nvme_queue_flush(struct nvme_queue *const queue) {
+    with_spinlock_irq_disabled(&queue->lock, {
+        if (queue->pending_count != 0) {
+            ring_submit_doorbell(queue);
+        }
     });
+}
 
-    struct event *const event = &queue->event;
+bool
+nvme_queue_wait(struct nvme_queue *const queue,
+                struct nvme_request *const request)
+{
+    struct event *const event = &queue->slot_list[request->cid].event;
     events_await(&event,
                  /*events_count=*/1,
                  /*block=*/true,
                  /*drop_after_recv=*/true);
 
-    return true;
-}
\ No newline at end of file
+    // The irq handler leaves freeing the command-id of requests without a
+    // callback to us, so the slot's event can't be reused before we've
+    // received it.
+
+    with_spinlock_irq_disabled(&queue->lock, {
+        free_cid(queue, request->cid);
+    });
+
+    return request->status == 0;
+}
+
+bool
+nvme_queue_submit_request(struct nvme_queue *const queue,
+                          struct nvme_request *const request)
+{
+    assert(request->callback == NULL);
+    if (prp_list_count_for_request(queue, request) == UINT64_MAX) {
+        return false;
+    }
+
+    while (!nvme_queue_enqueue(queue, request)) {
+        bool has_free_cid = false;
+        with_spinlock_irq_disabled(&queue->lock, {
+            has_free_cid = queue->free_cid_count != 0;
+            if (!has_free_cid) {
+                queue->cid_waiter_count++;
+            }
+        });
+
+        if (has_free_cid) {
+            continue;
+        }
+
+        struct event *const event = &queue->cid_event;
+        events_await(&event,
+                     /*events_count=*/1,
+                     /*block=*/true,
+                     /*drop_after_recv=*/true);
+
+        with_spinlock_irq_disabled(&queue->lock, {
+            queue->cid_waiter_count--;
+        });
+    }
+
+    nvme_queue_flush(queue);
+    return nvme_queue_wait(queue, request);
+}
+
+bool
+nvme_queue_submit_command(struct nvme_queue *const queue,
+                          const struct nvme_command *const command)
+{
+    struct nvme_request request =
+        NVME_REQUEST_INIT(*command, /*callback=*/NULL, /*cb_info=*/NULL);
+
+    return nvme_queue_submit_request(queue, &request);
+}
+
+uint32_t nvme_queue_process_completions(struct nvme_queue *const queue) {
+    volatile struct nvme_completion_queue_entry *const completion_queue =
+        queue->completion_queue_mmio->base;
+
+    struct list done_list = LIST_INIT(done_list);
+    uint32_t count = 0;
+
+    spin_acquire(&queue->lock);
+    while (true) {
+        volatile struct nvme_completion_queue_entry *const entry =
+            &completion_queue[queue->completion_queue_head];
+
+        const uint16_t status = mmio_read(&entry->status);
+        const bool phase = status & __NVME_COMPL_QUEUE_ENTRY_STATUS_PHASE;
+
+        if (phase != queue->phase) {
+            break;
+        }
+
+        const uint16_t cid = mmio_read(&entry->cid);
+        const uint32_t result = mmio_read(&entry->result);
+
+        queue->submit_queue_head = mmio_read(&entry->sqhead);
+        queue->completion_queue_head++;
+
+        if (queue->completion_queue_head == queue->entry_count) {
+            queue->completion_queue_head = 0;
+            queue->phase = !queue->phase;
+        }
+
+        count++;
+        if (!index_in_bounds(cid, queue->entry_count - 1)
+         || queue->slot_list[cid].request == NULL)
+        {
+            printk(LOGLEVEL_WARN,
+                   "nvme: queue with qid %" PRIu16 " got completion for "
+                   "unknown command-id %" PRIu16 "\n",
+                   queue->id,
+                   cid);
+            continue;
+        }
+
+        struct nvme_queue_slot *const slot = &queue->slot_list[cid];
+        struct nvme_request *const request = slot->request;
+
+        request->status = status >> 1;
+        request->result = result;
+
+        if (request->callback != NULL) {
+            free_cid(queue, cid);
+            list_radd(&done_list, &request->list);
+        } else {
+            event_trigger(&slot->event, /*drop_if_no_listeners=*/false);
+        }
+    }
+
+    // Acknowledge every processed completion with a single doorbell write.
+    if (count != 0) {
+        mmio_write(&queue->doorbells->complete, queue->completion_queue_head);
+    }
+
+    spin_release(&queue->lock);
+
+    struct nvme_request *request = NULL;
+    struct nvme_request *tmp = NULL;
+
+    list_foreach_mut(request, tmp, &done_list, list) {
+        list_remove(&request->list);
+        request->callback(request);
+    }
+
+    return count;
+}
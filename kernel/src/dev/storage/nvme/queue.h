@@ -5,22 +5,76 @@
 
 #pragma once
 
+#include "lib/list.h"
 #include "mm/mmio.h"
 #include "sched/event.h"
+#include "sys/isr.h"
 
 #include "structs.h"
 
+// Commands are only written to a queue's submit-queue doorbell once this many
+// have been enqueued, or when the queue is flushed.
+
+#define NVME_QUEUE_DOORBELL_BATCH 16
+
 struct nvme_queue_doorbells {
     volatile uint32_t submit;
     volatile uint32_t complete;
 };
 
+struct nvme_request;
+typedef void (*nvme_request_callback_t)(struct nvme_request *request);
+
+struct nvme_queue;
+struct nvme_request {
+    struct list list;
+    struct nvme_command command;
+
+    // Called from the queue's irq handler once the command completes. Requests
+    // without a callback are waited on with nvme_queue_wait().
+
+    nvme_request_callback_t callback;
+    void *cb_info;
+
+    // If non-zero, the queue fills in the command's prps to point to this
+    // physically contiguous buffer.
+
+    uint64_t data_phys;
+    uint64_t data_size;
+
+    struct nvme_queue *queue;
+    uint16_t cid;
+
+    // Set on completion. A status of 0 means success.
+    uint16_t status;
+    uint32_t result;
+};
+
+#define NVME_REQUEST_INIT(command_, callback_, cb_info_) \
+    ((struct nvme_request){ \
+        .command = (command_), \
+        .callback = (callback_), \
+        .cb_info = (cb_info_), \
+        .data_phys = 0, \
+        .data_size = 0, \
+        .queue = NULL, \
+        .cid = 0, \
+        .status = 0, \
+        .result = 0, \
+    })
+
+struct nvme_queue_slot {
+    struct nvme_request *request;
+    struct event event;
+
+    // Only allocated if the queue was created with a max transfer size.
+    uint64_t *prp_list;
+};
+
 struct nvme_controller;
 struct nvme_queue {
     struct nvme_controller *controller;
-
     struct spinlock lock;
-    struct event event;
 
     uint64_t submit_queue_phys;
     uint64_t completion_queue_phys;
@@ -30,36 +84,67 @@ struct nvme_queue {
 
     volatile struct nvme_queue_doorbells *doorbells;
 
-    uint8_t id;
-    uint8_t submit_queue_head;
-    uint8_t completion_queue_head;
-    uint8_t submit_queue_tail;
+    uint16_t id;
+    uint16_t submit_queue_head;
+    uint16_t completion_queue_head;
+    uint16_t submit_queue_tail;
 
     uint16_t entry_count;
-    uint16_t cmd_identifier;
 
+    // Number of commands written to the submit-queue since the doorbell was
+    // last rung.
+
+    uint16_t pending_count;
     bool phase : 1;
 
     uint8_t submit_alloc_order;
     uint8_t completion_alloc_order;
 
+    // Command-ids index into the slot list. At most entry_count - 1 commands
+    // can be in flight, so the submit-queue can never overflow.
+
+    struct nvme_queue_slot *slot_list;
+    uint16_t *free_cid_list;
+
+    uint16_t free_cid_count;
+    uint16_t cid_waiter_count;
+
+    struct event cid_event;
+
+    isr_vector_t isr_vector;
+    uint16_t msix_vector;
+
+    // The number of entries in each command-id's prp list.
     uint32_t phys_region_pages_count;
-    uint64_t *phys_region_page_list;
 };
 
-struct nvme_controller;
-
 bool
 nvme_queue_create(struct nvme_queue *queue,
                   struct nvme_controller *device,
-                  uint8_t id,
+                  uint16_t id,
                   uint16_t entry_count,
                   uint8_t max_transfer_shift);
 
-uint16_t nvme_queue_get_cmdid(struct nvme_queue *queue);
+// Write a request's command to the queue without necessarily ringing the
+// doorbell. Returns false if the queue has no free command-ids, or the
+// request's data is too large for a single command.
+
+bool nvme_queue_enqueue(struct nvme_queue *queue, struct nvme_request *request);
+void nvme_queue_flush(struct nvme_queue *queue);
+
+// Wait for a request without a callback to complete.
+bool nvme_queue_wait(struct nvme_queue *queue, struct nvme_request *request);
+
+bool
+nvme_queue_submit_request(struct nvme_queue *queue,
+                          struct nvme_request *request);
 
 bool
 nvme_queue_submit_command(struct nvme_queue *queue,
                           const struct nvme_command *command);
 
+// Process the queue's completed commands. Called from the queue's irq handler.
+// Returns the number of commands that completed.
+
+uint32_t nvme_queue_process_completions(struct nvme_queue *queue);
 void nvme_queue_destroy(struct nvme_queue *queue);
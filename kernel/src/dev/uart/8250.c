@@ -125,6 +125,12 @@ uart8250_send_char(struct terminal *const term,
     });
 }
 
+__debug_optimize(3)
+static void uart8250_bust_locks(struct terminal *const term) {
+    struct uart8250_info *const info = (struct uart8250_info *)term;
+    info->lock = SPINLOCK_INIT();
+}
+
 __debug_optimize(3) static void
 uart8250_send_sv(struct terminal *const term, const struct string_view sv) {
     struct uart8250_info *const info = (struct uart8250_info *)term;
@@ -199,6 +205,7 @@ uart8250_init(const port_t base,
 
     info->term.emit_ch = uart8250_send_char;
     info->term.emit_sv = uart8250_send_sv;
+    info->term.bust_locks = uart8250_bust_locks;
 
     printk_add_terminal(&info->term);
     return true;
@@ -0,0 +1,151 @@
+/*
+ * kernel/src/dev/virtio/bench.c
+ * © suhas pai
+ */
+
+#include "dev/printk.h"
+#include "dev/storage/bench.h"
+
+#include "time/time.h"
+
+#include "queue/queue.h"
+#include "bench.h"
+
+static struct storage_bench g_bench = {0};
+static struct virtio_block_request
+    g_block_request_list[STORAGE_BENCH_MAX_QUEUE_DEPTH] = {0};
+
+__debug_optimize(3)
+static void on_complete(struct virtio_block_request *const request) {
+    storage_bench_complete(request->cb_info, request->status == 0);
+}
+
+__debug_optimize(3) static bool
+submit_request(struct storage_bench_request *const request,
+               const uint64_t chunk)
+{
+    struct virtio_block_queue *const queue = request->bench->cb_info;
+    struct virtio_block_request *const block_request =
+        &g_block_request_list[request->index];
+
+    *block_request = VIRTIO_BLOCK_REQUEST_INIT(on_complete, request);
+    block_request->sector =
+        chunk * (VIRTIO_BENCH_REQUEST_SIZE / VIRTIO_BLOCK_SECTOR_SIZE);
+    block_request->data_phys = page_to_phys(request->page);
+    block_request->data_size = VIRTIO_BENCH_REQUEST_SIZE;
+
+    if (!virtio_block_queue_enqueue(queue, block_request)) {
+        return false;
+    }
+
+    // Flush every request on its own, so the device decides how many
+    // notifications are actually needed.
+
+    virtio_block_queue_flush(queue);
+    return true;
+}
+
+struct bench_counts {
+    uint64_t notify_count;
+    uint64_t notify_suppressed_count;
+    uint64_t irq_count;
+};
+
+static struct bench_counts
+read_counts(const struct virtio_block_device *const device) {
+    struct bench_counts counts = {0};
+    for (uint16_t i = 0; i != device->queue_count; i++) {
+        const struct virtio_block_queue *const queue = &device->queue_list[i];
+
+        counts.notify_count += queue->virtq->notify_count;
+        counts.notify_suppressed_count += queue->virtq->notify_suppressed_count;
+        counts.irq_count += queue->irq_count;
+    }
+
+    return counts;
+}
+
+__debug_optimize(3) static inline uint64_t
+per_10k_requests(const uint64_t count, const uint64_t request_count) {
+    return count * 10000 / request_count;
+}
+
+static void bench_device(struct virtio_block_device *const device) {
+    struct virtio_block_queue *const queue =
+        virtio_block_device_get_queue(device);
+
+    g_bench.cb_info = queue;
+
+    const struct bench_counts begin_counts = read_counts(device);
+    const nsec_t begin = nsec_since_boot();
+
+    storage_bench_start(&g_bench, VIRTIO_BENCH_QUEUE_DEPTH);
+    storage_bench_wait(&g_bench);
+
+    const nsec_t elapsed = nsec_since_boot() - begin;
+    const struct bench_counts end_counts = read_counts(device);
+    const uint64_t complete_count = storage_bench_stop(&g_bench);
+
+    if (complete_count == 0) {
+        printk(LOGLEVEL_WARN, "virtio-block: bench: no requests completed\n");
+        return;
+    }
+
+    const struct virtio_queue *const virtq = queue->virtq;
+    printk(LOGLEVEL_INFO,
+           "virtio-block: bench: %s queue, event-idx %s, indirect descs %s: "
+           "%" PRIu64 " requests at qd%" PRIu32 " in %" PRIu64 "us, "
+           "%" PRIu64 " errors\n"
+           "\tnotifications per 10k requests: %" PRIu64 " (%" PRIu64 " "
+           "suppressed)\n"
+           "\tinterrupts per 10k requests: %" PRIu64 "\n",
+           virtq->is_packed ? "packed" : "split",
+           virtq->event_idx ? "enabled" : "disabled",
+           virtq->indirect ? "enabled" : "disabled",
+           complete_count,
+           VIRTIO_BENCH_QUEUE_DEPTH,
+           elapsed / 1000,
+           atomic_load_explicit(&g_bench.error_count, memory_order_relaxed),
+           per_10k_requests(end_counts.notify_count
+                            - begin_counts.notify_count,
+                            complete_count),
+           per_10k_requests(end_counts.notify_suppressed_count
+                            - begin_counts.notify_suppressed_count,
+                            complete_count),
+           per_10k_requests(end_counts.irq_count - begin_counts.irq_count,
+                            complete_count));
+}
+
+void virtio_block_bench_run(struct virtio_block_device *const device) {
+    const uint32_t segment_count =
+        div_round_up(VIRTIO_BENCH_REQUEST_SIZE, device->max_segment_size);
+
+    if (segment_count > device->max_segment_count) {
+        printk(LOGLEVEL_WARN,
+               "virtio-block: bench: device can't transfer %" PRIu32 " bytes "
+               "in one request\n",
+               VIRTIO_BENCH_REQUEST_SIZE);
+        return;
+    }
+
+    g_bench.chunk_count =
+        device->sector_count
+      / (VIRTIO_BENCH_REQUEST_SIZE / VIRTIO_BLOCK_SECTOR_SIZE);
+
+    if (g_bench.chunk_count < VIRTIO_BENCH_QUEUE_DEPTH) {
+        printk(LOGLEVEL_WARN,
+               "virtio-block: bench: device is too small to benchmark\n");
+        return;
+    }
+
+    g_bench.submit = submit_request;
+    g_bench.request_limit = VIRTIO_BENCH_REQUEST_COUNT;
+
+    if (!storage_bench_alloc_buffers(&g_bench, /*zone=*/NULL)) {
+        printk(LOGLEVEL_WARN, "virtio-block: bench: failed to alloc buffers\n");
+        return;
+    }
+
+    bench_device(device);
+    storage_bench_free_buffers(&g_bench);
+}
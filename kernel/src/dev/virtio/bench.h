@@ -0,0 +1,20 @@
+/*
+ * kernel/src/dev/virtio/bench.h
+ * © suhas pai
+ */
+
+#pragma once
+
+#include "dev/storage/bench.h"
+#include "drivers/block.h"
+
+#define VIRTIO_BENCH_REQUEST_COUNT 10000u
+#define VIRTIO_BENCH_REQUEST_SIZE 4096u
+#define VIRTIO_BENCH_QUEUE_DEPTH STORAGE_BENCH_MAX_QUEUE_DEPTH
+
+// Send VIRTIO_BENCH_REQUEST_COUNT random 4KiB reads to `device` at a
+// queue-depth of 32, flushing after every request, and report the number of
+// notifications sent to and interrupts received from the device per 10k
+// requests.
+
+void virtio_block_bench_run(struct virtio_block_device *device);
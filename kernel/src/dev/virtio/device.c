@@ -59,6 +59,7 @@ void virtio_device_destroy(struct virtio_device *const device) {
 
             device->mmio.region = NULL;
             device->mmio.header = NULL;
+            device->mmio.irq = ISR_INVALID_VECTOR;
 
             break;
         case VIRTIO_DEVICE_TRANSPORT_PCI:
@@ -78,6 +79,7 @@ void virtio_device_destroy(struct virtio_device *const device) {
     }
 
     device->queue_list = NULL;
+    device->features = 0;
     device->queue_count = 0;
 
     device->transport_kind = VIRTIO_DEVICE_TRANSPORT_MMIO;
@@ -7,6 +7,8 @@
 #include "lib/adt/array.h"
 
 #include "mm/mmio.h"
+#include "sys/isr.h"
+
 #include "structs.h"
 
 struct virtio_device_shmem_region {
@@ -26,6 +28,7 @@ enum virtio_device_transport_kind {
     VIRTIO_DEVICE_TRANSPORT_PCI,
 };
 
+struct virtio_queue;
 struct virtio_device {
     struct list list;
     union {
@@ -47,6 +50,9 @@ struct virtio_device {
         struct {
             struct mmio_region *region;
             volatile struct virtio_mmio_device *header;
+
+            // The irq-line from the dtb-node's 'interrupts' property.
+            isr_vector_t irq;
         } mmio;
     };
 
@@ -55,8 +61,12 @@ struct virtio_device {
 
     // Array of uint8_t
     struct array vendor_cfg_list;
-    struct virtio_split_queue *queue_list;
+    struct virtio_queue *queue_list;
+
+    // The features accepted by the driver, which also pick the layout of the
+    // device's queues.
 
+    uint64_t features;
     uint8_t queue_count;
 
     enum virtio_device_transport_kind transport_kind : 1;
@@ -75,6 +85,7 @@ struct virtio_device {
         .shmem_regions = ARRAY_INIT(sizeof(struct virtio_device_shmem_region)),\
         .vendor_cfg_list = ARRAY_INIT(sizeof(uint8_t)), \
         .queue_list = NULL, \
+        .features = 0, \
         .queue_count = 0, \
         .transport_kind = VIRTIO_DEVICE_TRANSPORT_PCI, \
         .kind = VIRTIO_DEVICE_KIND_INVALID \
@@ -85,9 +96,11 @@ struct virtio_device {
         .list = LIST_INIT(name.list), \
         .mmio.region = NULL, \
         .mmio.header = NULL, \
+        .mmio.irq = ISR_INVALID_VECTOR, \
         .shmem_regions = ARRAY_INIT(sizeof(struct virtio_device_shmem_region)),\
         .vendor_cfg_list = ARRAY_INIT(sizeof(uint8_t)), \
         .queue_list = NULL, \
+        .features = 0, \
         .queue_count = 0, \
         .transport_kind = VIRTIO_DEVICE_TRANSPORT_MMIO, \
         .kind = VIRTIO_DEVICE_KIND_INVALID \
@@ -10,29 +10,49 @@
 
 #include "device.h"
 
+// Called before the device is marked DRIVER_OK, to setup the device's queues.
+// Returns the driver's own copy of the device, as the passed in device isn't
+// persistent.
+
 typedef struct virtio_device *
 (*virtio_driver_init_t)(struct virtio_device *device, uint64_t features);
 
+// Called once the device is live and can process requests.
+typedef void (*virtio_driver_start_t)(struct virtio_device *device);
+
 struct virtio_driver {
     virtio_driver_init_t init;
+    virtio_driver_start_t start;
 
     uint16_t virtqueue_count;
+
     uint64_t required_features;
+    uint64_t optional_features;
 };
 
 static const struct virtio_driver virtio_drivers[] = {
     [VIRTIO_DEVICE_KIND_BLOCK_DEVICE] = {
         .init = virtio_block_driver_init,
-        .virtqueue_count = 2,
-        .required_features =
-            __VIRTIO_BLOCK_HAS_SEG_MAX
+        .start = virtio_block_driver_start,
+
+        // The driver sets up its own queues, as their count depends on
+        // whether multi-queue was negotiated.
+
+        .virtqueue_count = 0,
+        .required_features = 0,
+        .optional_features =
+            __VIRTIO_BLOCK_HAS_MAX_SIZE
+          | __VIRTIO_BLOCK_HAS_SEG_MAX
+          | __VIRTIO_BLOCK_IS_READONLY
           | __VIRTIO_BLOCK_HAS_BLOCK_SIZE
           | __VIRTIO_BLOCK_SUPPORTS_MULTI_QUEUE,
     },
     [VIRTIO_DEVICE_KIND_SCSI_HOST] = {
         .init = virtio_scsi_driver_init,
+        .start = NULL,
         .virtqueue_count = 0,
         .required_features = __VIRTIO_SCSI_HOTPLUG | __VIRTIO_SCSI_CHANGE,
+        .optional_features = 0,
     }
 };
 
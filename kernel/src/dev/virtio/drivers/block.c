@@ -3,10 +3,25 @@
  * © suhas pai
  */
 
-#include "../transport.h"
+#include "cpu/isr.h"
 
+#include "dev/pci/entity.h"
 #include "dev/printk.h"
+
 #include "lib/size.h"
+#include "lib/util.h"
+
+#include "mm/kmalloc.h"
+#include "mm/page_alloc.h"
+
+#include "../queue/queue.h"
+
+#if defined(VIRTIO_BENCH)
+    #include "../bench.h"
+#endif /* defined(VIRTIO_BENCH) */
+
+#include "../init.h"
+#include "../transport.h"
 
 #include "block.h"
 
@@ -58,15 +73,783 @@ struct virtio_block_config {
                                       struct virtio_block_config, \
                                       field))
 
+enum virtio_block_request_kind {
+    VIRTIO_BLOCK_REQUEST_IN,
+    VIRTIO_BLOCK_REQUEST_OUT,
+};
+
+enum virtio_block_request_status {
+    VIRTIO_BLOCK_REQUEST_STATUS_OK,
+    VIRTIO_BLOCK_REQUEST_STATUS_IOERR,
+    VIRTIO_BLOCK_REQUEST_STATUS_UNSUPP,
+};
+
+struct virtio_block_request_header {
+    le32_t kind;
+    le32_t reserved;
+    le64_t sector;
+};
+
+struct virtio_block_request_buffer {
+    struct virtio_block_request_header header;
+    uint8_t status;
+};
+
+// Devices may be probed on several cpus at once, see dev/probe.h.
+
+static struct list g_device_list = LIST_INIT(g_device_list);
+static struct spinlock g_device_list_lock = SPINLOCK_INIT();
+static uint32_t g_device_count = 0;
+
+// Msi-index 0 is the device's own vector, shared by every queue without a
+// vector of its own, while the queue at index i has msi-index i + 1.
+
+__debug_optimize(3) static void
+handle_msi(struct virtio_block_device *const device, const uint16_t msi_index) {
+    if (msi_index != 0) {
+        if (msi_index <= device->queue_count) {
+            virtio_block_queue_process_used(&device->queue_list[msi_index - 1]);
+        }
+
+        return;
+    }
+
+    for (uint16_t i = 0; i != device->queue_count; i++) {
+        struct virtio_block_queue *const queue = &device->queue_list[i];
+        if (queue->msi_index == 0) {
+            virtio_block_queue_process_used(queue);
+        }
+    }
+}
+
+__debug_optimize(3) static void
+handle_irq(const uint64_t int_no, struct thread_context *const context) {
+    (void)context;
+
+    // Msi vectors are only unique per-cpu, so the device is found from the
+    // vector this cpu allocated for it, without taking any lock.
+
+    struct device *device = NULL;
+    uint16_t msi_index = 0;
+
+    if (isr_get_msi_vector_owner((isr_vector_t)int_no, &device, &msi_index)
+     && device->driver_info != NULL)
+    {
+        handle_msi(device->driver_info, msi_index);
+        isr_eoi(int_no);
+
+        return;
+    }
+
+    // Mmio devices each have a wired irq instead.
+
+    struct virtio_block_device *iter = NULL;
+    bool found = false;
+
+    spin_acquire(&g_device_list_lock);
+    list_foreach(iter, &g_device_list, list) {
+        if (iter->virtio.transport_kind != VIRTIO_DEVICE_TRANSPORT_MMIO
+         || iter->isr_vector != int_no)
+        {
+            continue;
+        }
+
+        virtio_mmio_ack_interrupts(&iter->virtio);
+        for (uint16_t i = 0; i != iter->queue_count; i++) {
+            virtio_block_queue_process_used(&iter->queue_list[i]);
+        }
+
+        found = true;
+    }
+
+    spin_release(&g_device_list_lock);
+    isr_eoi(int_no);
+
+    if (!found) {
+        printk(LOGLEVEL_WARN,
+               "virtio-block: got spurious interrupt from vector w/o "
+               "corresponding device: %" PRIu64 "\n",
+               int_no);
+    }
+}
+
+// Caller must hold the queue's lock.
+
+__debug_optimize(3) static void
+free_request_slot(struct virtio_block_queue *const queue, const uint16_t id) {
+    queue->slot_list[id].request = NULL;
+    queue->free_id_list[queue->free_id_count] = id;
+    queue->free_id_count++;
+
+    if (queue->waiter_count != 0) {
+        event_trigger(&queue->free_event, /*drop_if_no_listeners=*/false);
+    }
+}
+
+// Returns whether the queue currently has room for a request taking up
+// `desc_count` descs. Caller must hold the queue's lock.
+
+__debug_optimize(3) static inline bool
+has_room_for_request(const struct virtio_block_queue *const queue,
+                     const uint16_t desc_count)
+{
+    const struct virtio_queue *const virtq = queue->virtq;
+    const uint16_t needed_count =
+        virtio_queue_chain_is_indirect(virtq, desc_count) ? 1 : desc_count;
+
+    return queue->free_id_count != 0 && virtq->free_count >= needed_count;
+}
+
+__debug_optimize(3) bool
+virtio_block_queue_enqueue(struct virtio_block_queue *const queue,
+                           struct virtio_block_request *const request)
+{
+    const struct virtio_block_device *const device = queue->device;
+    const uint32_t segment_count =
+        div_round_up(request->data_size, device->max_segment_size);
+
+    if (segment_count == 0 || segment_count > device->max_segment_count) {
+        printk(LOGLEVEL_WARN,
+               "virtio-block: request is larger than the device's max "
+               "transfer size\n");
+        return false;
+    }
+
+    // Each request's chain is its header, followed by its data's segments,
+    // followed by its status byte.
+
+    const uint16_t desc_count = (uint16_t)segment_count + 2;
+
+    const int flag = spin_acquire_save_irq(&queue->lock);
+    if (!has_room_for_request(queue, desc_count)) {
+        spin_release_restore_irq(&queue->lock, flag);
+        return false;
+    }
+
+    // The id is only taken off the free list once the chain is added.
+    const uint16_t id = queue->free_id_list[queue->free_id_count - 1];
+    struct virtio_block_request_buffer *const buffer = &queue->buffer_list[id];
+
+    buffer->header.kind =
+        cpu_to_le((uint32_t)(request->write ?
+            VIRTIO_BLOCK_REQUEST_OUT : VIRTIO_BLOCK_REQUEST_IN));
+    buffer->header.reserved = 0;
+    buffer->header.sector = cpu_to_le(request->sector);
+    buffer->status = UINT8_MAX;
+
+    const uint64_t buffer_phys =
+        page_to_phys(queue->buffer_page)
+      + (sizeof(struct virtio_block_request_buffer) * id);
+
+    struct virtio_queue_request req_list[VIRTIO_BLOCK_MAX_SEGMENT_COUNT + 2];
+    req_list[0] = (struct virtio_queue_request){
+        .phys = buffer_phys + offsetof(struct virtio_block_request_buffer,
+                                       header),
+        .size = sizeof(struct virtio_block_request_header),
+        .kind = VIRTIO_QUEUE_REQUEST_READ,
+    };
+
+    uint64_t phys = request->data_phys;
+    uint32_t remaining = request->data_size;
+
+    for (uint32_t i = 1; i != segment_count + 1; i++) {
+        const uint32_t size = min(remaining, device->max_segment_size);
+        req_list[i] = (struct virtio_queue_request){
+            .phys = phys,
+            .size = size,
+            .kind =
+                request->write ?
+                    VIRTIO_QUEUE_REQUEST_READ : VIRTIO_QUEUE_REQUEST_WRITE,
+        };
+
+        phys += size;
+        remaining -= size;
+    }
+
+    req_list[desc_count - 1] = (struct virtio_queue_request){
+        .phys = buffer_phys + offsetof(struct virtio_block_request_buffer,
+                                       status),
+        .size = sizeof(uint8_t),
+        .kind = VIRTIO_QUEUE_REQUEST_WRITE,
+    };
+
+    if (!virtio_queue_add(queue->virtq, req_list, desc_count, id)) {
+        spin_release_restore_irq(&queue->lock, flag);
+        return false;
+    }
+
+    list_init(&request->list);
+
+    request->queue = queue;
+    request->id = id;
+    request->status = 0;
+
+    queue->free_id_count--;
+    queue->slot_list[id].request = request;
+
+    spin_release_restore_irq(&queue->lock, flag);
+
+    return true;
+}
+
+__debug_optimize(3)
+void virtio_block_queue_flush(struct virtio_block_queue *const queue) {
+    with_spinlock_irq_disabled(&queue->lock, {
+        virtio_queue_commit(&queue->device->virtio, queue->virtq);
+    });
+}
+
+bool
+virtio_block_queue_wait(struct virtio_block_queue *const queue,
+                        struct virtio_block_request *const request)
+{
+    struct event *const event = &queue->slot_list[request->id].event;
+    events_await(&event,
+                 /*events_count=*/1,
+                 /*block=*/true,
+                 /*drop_after_recv=*/true);
+
+    // The irq handler leaves freeing the slot of requests without a callback
+    // to us, so the slot's event can't be reused before we've received it.
+
+    with_spinlock_irq_disabled(&queue->lock, {
+        free_request_slot(queue, request->id);
+    });
+
+    return request->status == VIRTIO_BLOCK_REQUEST_STATUS_OK;
+}
+
+bool
+virtio_block_queue_submit_request(struct virtio_block_queue *const queue,
+                                  struct virtio_block_request *const request)
+{
+    assert(request->callback == NULL);
+    const uint32_t segment_count =
+        div_round_up(request->data_size, queue->device->max_segment_size);
+
+    if (segment_count == 0
+     || segment_count > queue->device->max_segment_count)
+    {
+        return false;
+    }
+
+    const uint16_t desc_count = (uint16_t)segment_count + 2;
+    while (!virtio_block_queue_enqueue(queue, request)) {
+        bool has_room = false;
+        with_spinlock_irq_disabled(&queue->lock, {
+            has_room = has_room_for_request(queue, desc_count);
+            if (!has_room) {
+                queue->waiter_count++;
+            }
+        });
+
+        if (has_room) {
+            // The queue had room for the request, so the request itself must
+            // be invalid.
+
+            return false;
+        }
+
+        struct event *const event = &queue->free_event;
+        events_await(&event,
+                     /*events_count=*/1,
+                     /*block=*/true,
+                     /*drop_after_recv=*/true);
+
+        with_spinlock_irq_disabled(&queue->lock, {
+            queue->waiter_count--;
+        });
+    }
+
+    virtio_block_queue_flush(queue);
+    return virtio_block_queue_wait(queue, request);
+}
+
+uint32_t virtio_block_queue_process_used(struct virtio_block_queue *const queue)
+{
+    struct list done_list = LIST_INIT(done_list);
+    uint32_t count = 0;
+
+    uint16_t id = 0;
+    uint32_t len = 0;
+
+    spin_acquire(&queue->lock);
+    queue->irq_count++;
+
+    // With VIRTIO_F_EVENT_IDX, the device only interrupts again once it's past
+    // the used entries we've seen, so keep going until no more completions
+    // arrive after rearming.
+
+    do {
+        while (virtio_queue_pop_used(queue->virtq, &id, &len)) {
+            count++;
+            if (!index_in_bounds(id, queue->virtq->desc_count)
+             || queue->slot_list[id].request == NULL)
+            {
+                printk(LOGLEVEL_WARN,
+                       "virtio-block: queue %" PRIu16 " got completion for "
+                       "unknown id %" PRIu16 "\n",
+                       queue->virtq->index,
+                       id);
+                continue;
+            }
+
+            struct virtio_block_queue_slot *const slot = &queue->slot_list[id];
+            struct virtio_block_request *const request = slot->request;
+
+            request->status = queue->buffer_list[id].status;
+            if (request->callback != NULL) {
+                free_request_slot(queue, id);
+                list_radd(&done_list, &request->list);
+            } else {
+                event_trigger(&slot->event, /*drop_if_no_listeners=*/false);
+            }
+        }
+    } while (virtio_queue_rearm_interrupts(queue->virtq));
+
+    spin_release(&queue->lock);
+
+    struct virtio_block_request *request = NULL;
+    struct virtio_block_request *tmp = NULL;
+
+    list_foreach_mut(request, tmp, &done_list, list) {
+        list_remove(&request->list);
+        request->callback(request);
+    }
+
+    return count;
+}
+
+__debug_optimize(3) struct virtio_block_queue *
+virtio_block_device_get_queue(struct virtio_block_device *const device) {
+    cpu_id_t id = 0;
+    with_preempt_disabled({
+        id = cpu_get_id(this_cpu());
+    });
+
+    return &device->queue_list[id % device->queue_count];
+}
+
+__debug_optimize(3) bool
+virtio_block_device_rw(struct virtio_block_device *const device,
+                       const struct range lba_range,
+                       const bool write,
+                       const uint64_t phys)
+{
+    if (write && device->readonly) {
+        printk(LOGLEVEL_WARN,
+               "virtio-block: attempting to write to readonly device\n");
+        return false;
+    }
+
+    const uint32_t sectors_per_lba =
+        device->lba_size / VIRTIO_BLOCK_SECTOR_SIZE;
+
+    struct virtio_block_request request =
+        VIRTIO_BLOCK_REQUEST_INIT(/*callback=*/NULL, /*cb_info=*/NULL);
+
+    request.sector = lba_range.front * sectors_per_lba;
+    request.data_phys = phys;
+    request.data_size = (uint32_t)(lba_range.size * device->lba_size);
+    request.write = write;
+
+    return virtio_block_queue_submit_request(
+        virtio_block_device_get_queue(device), &request);
+}
+
+__debug_optimize(3) static uint64_t
+virtio_block_read(struct storage_device *const device,
+                  const uint64_t phys,
+                  const struct range lba_range)
+{
+    struct virtio_block_device *const block =
+        container_of(device, struct virtio_block_device, storage);
+
+    if (virtio_block_device_rw(block, lba_range, /*write=*/false, phys)) {
+        return lba_range.size;
+    }
+
+    return 0;
+}
+
+__debug_optimize(3) static uint64_t
+virtio_block_write(struct storage_device *const device,
+                   const uint64_t phys,
+                   const struct range lba_range)
+{
+    struct virtio_block_device *const block =
+        container_of(device, struct virtio_block_device, storage);
+
+    if (virtio_block_device_rw(block, lba_range, /*write=*/true, phys)) {
+        return lba_range.size;
+    }
+
+    return 0;
+}
+
+static struct cpu_info *
+cpu_for_queue(const uint16_t index, const uint16_t queue_count) {
+    struct cpu_info *iter = NULL;
+    list_foreach(iter, cpus_get_list(), cpu_list) {
+        if (cpu_get_id(iter) % queue_count == index) {
+            return iter;
+        }
+    }
+
+    return NULL;
+}
+
+// Give the queue its own msix vector targeting the cpu that submits to it. If
+// that isn't possible, the queue shares the device's vector instead.
+
+static bool
+setup_queue_msix(struct virtio_block_device *const device,
+                 struct virtio_block_queue *const queue,
+                 const uint16_t index,
+                 const uint16_t device_msix_index)
+{
+    struct pci_entity_info *const pci_entity = device->virtio.pci.entity;
+    const struct cpu_info *const cpu =
+        cpu_for_queue(index, device->queue_count);
+
+    // With fewer queues than cpus, cpu_for_queue() has other cpus submit to the
+    // queue too, so its vector is only pinned to `cpu` if the queue is its own.
+
+    const bool per_cpu =
+        device->queue_count
+            == list_count(cpus_get_list(), struct cpu_info, cpu_list);
+
+    uint16_t msix_index = device_msix_index;
+    if (cpu != NULL) {
+        const uint16_t msi_index = index + 1;
+        const isr_vector_t vector =
+            isr_alloc_msi_vector(&pci_entity->device, msi_index, cpu);
+
+        if (vector != ISR_INVALID_VECTOR) {
+            const int32_t result =
+                pci_entity_bind_msi_to_vector(pci_entity,
+                                              cpu,
+                                              vector,
+                                              /*masked=*/false);
+
+            if (result >= 0) {
+                if (per_cpu) {
+                    isr_pin_msi_vector(cpu, vector);
+                }
+
+                isr_set_msi_vector(cpu,
+                                   vector,
+                                   handle_irq,
+                                   &ARCH_ISR_INFO_NONE());
+
+                queue->isr_vector = vector;
+                queue->msi_index = msi_index;
+
+                msix_index = (uint16_t)result;
+            } else {
+                isr_free_msi_vector(&pci_entity->device, vector, msi_index);
+            }
+        }
+    }
+
+    virtio_device_select_queue(&device->virtio, index);
+    if (virtio_pci_set_selected_queue_msix_vector(&device->virtio,
+                                                  msix_index))
+    {
+        return true;
+    }
+
+    // The device couldn't allocate the resources for the queue's own vector,
+    // so fall back to the device's vector.
+
+    if (queue->msi_index != 0) {
+        isr_free_msi_vector(&pci_entity->device,
+                            queue->isr_vector,
+                            queue->msi_index);
+
+        queue->isr_vector = device->isr_vector;
+        queue->msi_index = 0;
+    }
+
+    return virtio_pci_set_selected_queue_msix_vector(&device->virtio,
+                                                     device_msix_index);
+}
+
+static void free_irqs(struct virtio_block_device *const device) {
+    if (device->isr_vector == ISR_INVALID_VECTOR) {
+        return;
+    }
+
+    switch (device->virtio.transport_kind) {
+        case VIRTIO_DEVICE_TRANSPORT_MMIO:
+            isr_mask_irq(device->isr_vector);
+            break;
+        case VIRTIO_DEVICE_TRANSPORT_PCI: {
+            struct pci_entity_info *const pci_entity =
+                device->virtio.pci.entity;
+
+            for (uint16_t i = 0; i != device->queue_count; i++) {
+                struct virtio_block_queue *const queue = &device->queue_list[i];
+                if (queue->msi_index != 0) {
+                    isr_free_msi_vector(&pci_entity->device,
+                                        queue->isr_vector,
+                                        queue->msi_index);
+                }
+            }
+
+            pci_entity_disable_msi(pci_entity);
+            isr_free_msi_vector(&pci_entity->device,
+                                device->isr_vector,
+                                /*msi_index=*/0);
+
+            pci_entity->device.driver_info = NULL;
+            break;
+        }
+    }
+
+    device->isr_vector = ISR_INVALID_VECTOR;
+}
+
+static bool setup_pci_irqs(struct virtio_block_device *const device) {
+    struct pci_entity_info *const pci_entity = device->virtio.pci.entity;
+    if (pci_entity->msi_support == PCI_ENTITY_MSI_SUPPORT_NONE) {
+        printk(LOGLEVEL_WARN, "virtio-block: device doesn't support msi[x]\n");
+        return false;
+    }
+
+    const struct cpu_info *const isr_cpu = isr_get_cpu_for_msi();
+    const isr_vector_t isr_vector =
+        isr_alloc_msi_vector(&pci_entity->device, /*msi_index=*/0, isr_cpu);
+
+    if (isr_vector == ISR_INVALID_VECTOR) {
+        printk(LOGLEVEL_WARN, "virtio-block: failed to alloc isr vector\n");
+        return false;
+    }
+
+    if (!pci_entity_enable_msi(pci_entity)) {
+        isr_free_msi_vector(&pci_entity->device, isr_vector, /*msi_index=*/0);
+        printk(LOGLEVEL_WARN, "virtio-block: failed to enable msi[x]\n");
+
+        return false;
+    }
+
+    const int32_t device_msix_index =
+        pci_entity_bind_msi_to_vector(pci_entity,
+                                      isr_cpu,
+                                      isr_vector,
+                                      /*masked=*/false);
+
+    if (device_msix_index < 0) {
+        pci_entity_disable_msi(pci_entity);
+        isr_free_msi_vector(&pci_entity->device, isr_vector, /*msi_index=*/0);
+
+        printk(LOGLEVEL_WARN, "virtio-block: failed to bind msi[x] vector\n");
+        return false;
+    }
+
+    pci_entity->device.driver_info = device;
+    isr_set_msi_vector(isr_cpu, isr_vector, handle_irq, &ARCH_ISR_INFO_NONE());
+
+    device->isr_vector = isr_vector;
+
+    for (uint16_t i = 0; i != device->queue_count; i++) {
+        struct virtio_block_queue *const queue = &device->queue_list[i];
+
+        queue->isr_vector = isr_vector;
+        queue->msi_index = 0;
+    }
+
+    // Without msix, the device sends every interrupt to its single msi
+    // vector.
+
+    if (pci_entity->msi_support != PCI_ENTITY_MSI_SUPPORT_MSIX) {
+        return true;
+    }
+
+    // Config-change interrupts aren't handled.
+    virtio_pci_set_config_msix_vector(&device->virtio,
+                                      VIRTIO_PCI_NO_MSIX_VECTOR);
+
+    for (uint16_t i = 0; i != device->queue_count; i++) {
+        if (!setup_queue_msix(device,
+                              &device->queue_list[i],
+                              i,
+                              (uint16_t)device_msix_index))
+        {
+            printk(LOGLEVEL_WARN,
+                   "virtio-block: failed to set msix vector of queue "
+                   "%" PRIu16 "\n",
+                   i);
+
+            free_irqs(device);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool setup_mmio_irq(struct virtio_block_device *const device) {
+    const isr_vector_t irq = device->virtio.mmio.irq;
+    if (irq == ISR_INVALID_VECTOR) {
+        printk(LOGLEVEL_WARN, "virtio-block: mmio device has no irq\n");
+        return false;
+    }
+
+    isr_set_vector(irq, handle_irq, &ARCH_ISR_INFO_NONE());
+    isr_unmask_irq(irq);
+
+    device->isr_vector = irq;
+    for (uint16_t i = 0; i != device->queue_count; i++) {
+        struct virtio_block_queue *const queue = &device->queue_list[i];
+
+        queue->isr_vector = irq;
+        queue->msi_index = 0;
+    }
+
+    return true;
+}
+
+static bool
+init_queue(struct virtio_block_device *const device,
+           struct virtio_block_queue *const queue,
+           const uint16_t index)
+{
+    _Static_assert(
+        sizeof(struct virtio_block_request_buffer) * VIRTQ_MAX_DESC_COUNT
+            <= PAGE_SIZE,
+        "virtio-block: request buffers of a queue don't fit in a page");
+
+    struct virtio_queue *const virtq = &device->virtio.queue_list[index];
+
+    // Without indirect descs, a request needs at least three descs: its
+    // header, its data, and its status byte.
+
+    if (!virtq->indirect && virtq->desc_count < 3) {
+        printk(LOGLEVEL_WARN,
+               "virtio-block: queue %" PRIu16 " is too small\n",
+               index);
+        return false;
+    }
+
+    struct page *const buffer_page =
+        alloc_page(PAGE_STATE_USED, __ALLOC_ZERO);
+
+    if (buffer_page == NULL) {
+        printk(LOGLEVEL_WARN,
+               "virtio-block: failed to alloc request buffers for queue "
+               "%" PRIu16 "\n",
+               index);
+        return false;
+    }
+
+    const uint16_t id_count = virtq->desc_count;
+
+    queue->slot_list =
+        kmalloc(sizeof(struct virtio_block_queue_slot) * id_count);
+
+    if (queue->slot_list == NULL) {
+        free_page(buffer_page);
+        printk(LOGLEVEL_WARN,
+               "virtio-block: failed to alloc slots for queue %" PRIu16 "\n",
+               index);
+
+        return false;
+    }
+
+    queue->free_id_list = kmalloc(sizeof(uint16_t) * id_count);
+    if (queue->free_id_list == NULL) {
+        kfree(queue->slot_list);
+        free_page(buffer_page);
+
+        printk(LOGLEVEL_WARN,
+               "virtio-block: failed to alloc ids for queue %" PRIu16 "\n",
+               index);
+
+        return false;
+    }
+
+    // Hand out the lowest ids first.
+    for (uint16_t i = 0; i != id_count; i++) {
+        queue->slot_list[i].request = NULL;
+        queue->slot_list[i].event = EVENT_INIT();
+        queue->free_id_list[i] = id_count - 1 - i;
+    }
+
+    queue->device = device;
+    queue->virtq = virtq;
+    queue->lock = SPINLOCK_INIT();
+    queue->buffer_list = page_to_virt(buffer_page);
+    queue->buffer_page = buffer_page;
+    queue->free_id_count = id_count;
+    queue->waiter_count = 0;
+    queue->free_event = EVENT_INIT();
+    queue->irq_count = 0;
+
+    // Without indirect descs, requests can't have more segments than fit in
+    // the queue alongside their header and status.
+
+    if (!virtq->indirect) {
+        device->max_segment_count =
+            min(device->max_segment_count, (uint16_t)(id_count - 2));
+    }
+
+    return true;
+}
+
+static void
+destroy_queue(struct virtio_block_queue *const queue) {
+    kfree(queue->slot_list);
+    kfree(queue->free_id_list);
+    free_page(queue->buffer_page);
+
+    queue->slot_list = NULL;
+    queue->free_id_list = NULL;
+    queue->buffer_list = NULL;
+    queue->buffer_page = NULL;
+}
+
+// Reset the device so it stops accessing the queues, and free everything the
+// driver allocated for it.
+
+static void
+destroy_device(struct virtio_block_device *const device,
+               const uint16_t init_queue_count)
+{
+    virtio_device_write_status(&device->virtio, /*status=*/0);
+    free_irqs(device);
+
+    for (uint16_t i = 0; i != init_queue_count; i++) {
+        destroy_queue(&device->queue_list[i]);
+    }
+
+    if (device->virtio.queue_list != NULL) {
+        for (uint8_t i = 0; i != device->virtio.queue_count; i++) {
+            virtio_queue_destroy(&device->virtio.queue_list[i]);
+        }
+
+        kfree(device->virtio.queue_list);
+
+        device->virtio.queue_list = NULL;
+        device->virtio.queue_count = 0;
+    }
+
+    kfree(device->queue_list);
+    kfree(device);
+}
+
 struct virtio_device *
 virtio_block_driver_init(struct virtio_device *const device,
                          const uint64_t features)
 {
-    if (features & __VIRTIO_BLOCK_IS_READONLY) {
+    const bool readonly = features & __VIRTIO_BLOCK_IS_READONLY;
+    if (readonly) {
         printk(LOGLEVEL_INFO, "virtio-block: device is readonly\n");
     }
 
-    const uint64_t capacity = virtio_block_read_config_field(device, capacity);
+    const uint64_t sector_count =
+        virtio_block_read_config_field(device, capacity);
+
     printk(LOGLEVEL_INFO,
            "virtio-block: device has the following info:\n"
            "\tcapacity: " SIZE_UNIT_FMT "\n"
@@ -81,7 +864,7 @@ virtio_block_driver_init(struct virtio_device *const device,
            "\t\tmin io-size: %" PRIu16 "\n"
            "\t\toptimal io-size: %" PRIu32 "\n"
            "\tqueue count: %" PRIu16 "\n",
-           SIZE_UNIT_FMT_ARGS(capacity),
+           SIZE_UNIT_FMT_ARGS(sector_count * VIRTIO_BLOCK_SECTOR_SIZE),
            virtio_block_read_config_field(device, geometry.cylinders),
            virtio_block_read_config_field(device, geometry.heads),
            virtio_block_read_config_field(device, geometry.sectors),
@@ -92,5 +875,162 @@ virtio_block_driver_init(struct virtio_device *const device,
            virtio_block_read_config_field(device, topology.opt_io_size),
            virtio_block_read_config_field(device, num_queues));
 
-    return NULL;
-}
\ No newline at end of file
+    // The device's block-size is only used as our lba-size if it's a
+    // power-of-two a page can hold.
+
+    uint32_t lba_size = VIRTIO_BLOCK_SECTOR_SIZE;
+    if (features & __VIRTIO_BLOCK_HAS_BLOCK_SIZE) {
+        const uint32_t block_size =
+            virtio_block_read_config_field(device, block_size);
+
+        if (block_size > VIRTIO_BLOCK_SECTOR_SIZE
+         && block_size <= PAGE_SIZE
+         && (block_size & (block_size - 1)) == 0)
+        {
+            lba_size = block_size;
+        }
+    }
+
+    uint16_t queue_count = 1;
+    if (features & __VIRTIO_BLOCK_SUPPORTS_MULTI_QUEUE) {
+        const uint16_t num_queues =
+            virtio_block_read_config_field(device, num_queues);
+        const uint64_t cpu_count =
+            list_count(cpus_get_list(), struct cpu_info, cpu_list);
+
+        queue_count =
+            (uint16_t)min(min((uint64_t)num_queues, cpu_count),
+                          (uint64_t)VIRTIO_BLOCK_MAX_QUEUE_COUNT);
+
+        if (queue_count == 0) {
+            queue_count = 1;
+        }
+    }
+
+    struct virtio_block_device *const block = kmalloc(sizeof(*block));
+    if (block == NULL) {
+        printk(LOGLEVEL_WARN, "virtio-block: failed to alloc device\n");
+        return NULL;
+    }
+
+    block->queue_list =
+        kmalloc(sizeof(struct virtio_block_queue) * queue_count);
+    if (block->queue_list == NULL) {
+        kfree(block);
+        printk(LOGLEVEL_WARN, "virtio-block: failed to alloc queue list\n");
+
+        return NULL;
+    }
+
+    block->virtio = *device;
+    list_init(&block->virtio.list);
+    list_init(&block->list);
+
+    block->queue_count = queue_count;
+    block->isr_vector = ISR_INVALID_VECTOR;
+    block->sector_count = sector_count;
+    block->lba_size = lba_size;
+    block->readonly = readonly;
+
+    block->max_segment_size = VIRTIO_BLOCK_MAX_TRANSFER_SIZE;
+    if (features & __VIRTIO_BLOCK_HAS_MAX_SIZE) {
+        const uint32_t size_max =
+            virtio_block_read_config_field(device, size_max);
+
+        if (size_max >= VIRTIO_BLOCK_SECTOR_SIZE) {
+            block->max_segment_size =
+                min(size_max, (uint32_t)VIRTIO_BLOCK_MAX_TRANSFER_SIZE);
+        }
+    }
+
+    block->max_segment_count = 1;
+    if (features & __VIRTIO_BLOCK_HAS_SEG_MAX) {
+        const uint32_t seg_max =
+            virtio_block_read_config_field(device, seg_max);
+
+        if (seg_max != 0) {
+            block->max_segment_count =
+                (uint16_t)min(seg_max, VIRTIO_BLOCK_MAX_SEGMENT_COUNT);
+        }
+    }
+
+    // Queue vectors have to be set before the queues are enabled.
+    const bool setup_irqs =
+        block->virtio.transport_kind == VIRTIO_DEVICE_TRANSPORT_PCI ?
+            setup_pci_irqs(block) : setup_mmio_irq(block);
+
+    if (!setup_irqs) {
+        destroy_device(block, /*init_queue_count=*/0);
+        return NULL;
+    }
+
+    // Each request's header and status take up a desc alongside its segments.
+    if (!virtio_device_init_queues(&block->virtio,
+                                   queue_count,
+                                   block->max_segment_count + 2))
+    {
+        destroy_device(block, /*init_queue_count=*/0);
+        return NULL;
+    }
+
+    for (uint16_t i = 0; i != queue_count; i++) {
+        if (!init_queue(block, &block->queue_list[i], i)) {
+            destroy_device(block, /*init_queue_count=*/i);
+            return NULL;
+        }
+    }
+
+    with_spinlock_irq_disabled(&g_device_list_lock, {
+        list_add(&g_device_list, &block->list);
+        g_device_count++;
+    });
+
+    printk(LOGLEVEL_INFO,
+           "virtio-block: created %" PRIu16 " queue(s), requests have up to "
+           "%" PRIu16 " segment(s) of " SIZE_UNIT_FMT " each\n",
+           queue_count,
+           block->max_segment_count,
+           SIZE_UNIT_FMT_ARGS_ABBREV(block->max_segment_size));
+
+    const struct virtio_queue *const virtq = block->queue_list[0].virtq;
+    printk(LOGLEVEL_INFO,
+           "virtio-block: queues are %s with %" PRIu16 " descs, event-idx "
+           "%s, indirect descs %s\n",
+           virtq->is_packed ? "packed" : "split",
+           virtq->desc_count,
+           virtq->event_idx ? "enabled" : "disabled",
+           virtq->indirect ? "enabled" : "disabled");
+
+    return &block->virtio;
+}
+
+void virtio_block_driver_start(struct virtio_device *const device) {
+    struct virtio_block_device *const block =
+        container_of(device, struct virtio_block_device, virtio);
+
+    const uint64_t max_transfer_size =
+        min((uint64_t)block->max_segment_size * block->max_segment_count,
+            (uint64_t)VIRTIO_BLOCK_MAX_TRANSFER_SIZE);
+
+    if (max_transfer_size < block->lba_size) {
+        printk(LOGLEVEL_WARN,
+               "virtio-block: device's max transfer size is smaller than its "
+               "block-size\n");
+        return;
+    }
+
+    if (!storage_device_init(&block->storage,
+                             block->lba_size,
+                             (uint32_t)(max_transfer_size / block->lba_size),
+                             virtio_block_read,
+                             virtio_block_write))
+    {
+        printk(LOGLEVEL_WARN, "virtio-block: failed to init storage device\n");
+        return;
+    }
+
+    printk(LOGLEVEL_INFO, "virtio-block: finished init\n");
+#if defined(VIRTIO_BENCH)
+    virtio_block_bench_run(block);
+#endif /* defined(VIRTIO_BENCH) */
+}
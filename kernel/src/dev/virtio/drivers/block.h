@@ -4,11 +4,159 @@
  */
 
 #pragma once
+
+#include "dev/storage/device.h"
 #include "dev/virtio/device.h"
 
-struct virtio_block_host_device {
+#include "sched/event.h"
+
+// Requests are sent on per-cpu queues, up to this many.
+#define VIRTIO_BLOCK_MAX_QUEUE_COUNT 64u
+
+// Sectors in virtio-block requests are always 512 bytes, regardless of the
+// device's block-size.
+
+#define VIRTIO_BLOCK_SECTOR_SIZE 512u
+
+// A request's data is split into segments of at most the device's max
+// segment-size, with each segment taking up one descriptor, unless the
+// request's chain is put in an indirect table.
+
+#define VIRTIO_BLOCK_MAX_SEGMENT_COUNT 16u
+#define VIRTIO_BLOCK_MAX_TRANSFER_SIZE mib(1)
+
+struct virtio_block_request;
+typedef void
+(*virtio_block_request_callback_t)(struct virtio_block_request *request);
+
+struct virtio_block_queue;
+struct virtio_block_request {
+    struct list list;
+
+    // Called from the queue's irq handler once the request completes. Requests
+    // without a callback are waited on with virtio_block_queue_wait().
+
+    virtio_block_request_callback_t callback;
+    void *cb_info;
+
+    uint64_t sector;
+    uint64_t data_phys;
+    uint32_t data_size;
+
+    bool write : 1;
+
+    struct virtio_block_queue *queue;
+    uint16_t id;
+
+    // Set on completion. A status of 0 means success.
+    uint8_t status;
+};
+
+#define VIRTIO_BLOCK_REQUEST_INIT(callback_, cb_info_) \
+    ((struct virtio_block_request){ \
+        .callback = (callback_), \
+        .cb_info = (cb_info_), \
+        .sector = 0, \
+        .data_phys = 0, \
+        .data_size = 0, \
+        .write = false, \
+        .queue = NULL, \
+        .id = 0, \
+        .status = 0, \
+    })
+
+struct virtio_block_queue_slot {
+    struct virtio_block_request *request;
+    struct event event;
+};
+
+struct virtio_block_request_buffer;
+struct virtio_block_device;
+
+struct virtio_block_queue {
+    struct virtio_block_device *device;
+    struct virtio_queue *virtq;
+
+    struct spinlock lock;
+
+    // Requests are identified by an id below the queue's desc-count, which
+    // indexes into both the slot list and the buffer list. The buffers hold
+    // each request's header and status byte.
 
+    struct virtio_block_queue_slot *slot_list;
+    struct virtio_block_request_buffer *buffer_list;
+    struct page *buffer_page;
+
+    uint16_t *free_id_list;
+    uint16_t free_id_count;
+
+    // Submitters wait on free_event when the queue is out of ids or descs.
+    uint16_t waiter_count;
+    struct event free_event;
+
+    isr_vector_t isr_vector;
+    uint16_t msi_index;
+
+    // Number of times the queue's irq handler processed the queue.
+    uint64_t irq_count;
+};
+
+struct virtio_block_device {
+    struct virtio_device virtio;
+    struct storage_device storage;
+
+    struct list list;
+
+    // Each cpu submits to the queue at index (cpu-id % queue_count).
+    struct virtio_block_queue *queue_list;
+    uint16_t queue_count;
+
+    isr_vector_t isr_vector;
+
+    uint64_t sector_count;
+    uint32_t lba_size;
+
+    uint32_t max_segment_size;
+    uint16_t max_segment_count;
+
+    bool readonly : 1;
 };
 
 struct virtio_device *
 virtio_block_driver_init(struct virtio_device *device, uint64_t features);
+
+void virtio_block_driver_start(struct virtio_device *device);
+
+struct virtio_block_queue *
+virtio_block_device_get_queue(struct virtio_block_device *device);
+
+// Add a request to `queue` without making it visible to the device. Returns
+// false if the queue doesn't have enough free descriptors, or the request's
+// data is too large for a single request. Several requests can be enqueued
+// before calling virtio_block_queue_flush() once to submit them all.
+
+bool
+virtio_block_queue_enqueue(struct virtio_block_queue *queue,
+                           struct virtio_block_request *request);
+
+void virtio_block_queue_flush(struct virtio_block_queue *queue);
+
+// Wait for a request without a callback to complete.
+bool
+virtio_block_queue_wait(struct virtio_block_queue *queue,
+                        struct virtio_block_request *request);
+
+bool
+virtio_block_queue_submit_request(struct virtio_block_queue *queue,
+                                  struct virtio_block_request *request);
+
+// Process the requests the device has completed on `queue`. Called from the
+// queue's irq handler. Returns the number of requests that completed.
+
+uint32_t virtio_block_queue_process_used(struct virtio_block_queue *queue);
+
+bool
+virtio_block_device_rw(struct virtio_block_device *device,
+                       struct range lba_range,
+                       bool write,
+                       uint64_t phys);
@@ -109,7 +109,10 @@ virtio_scsi_driver_init(struct virtio_device *const device,
            "virtio-scsi: initializing %" PRIu32 " queues\n",
            queue_count);
 
-    if (!virtio_device_init_queues(device, queue_count)) {
+    if (!virtio_device_init_queues(device,
+                                   queue_count,
+                                   /*max_chain_length=*/1))
+    {
         return NULL;
     }
 
@@ -5,20 +5,24 @@
 
 #include "dev/printk.h"
 #include "mm/kmalloc.h"
-#include "queue/split.h"
+#include "queue/queue.h"
 
 #include "driver.h"
 #include "transport.h"
 
+// Devices may be probed on several cpus at once, see dev/probe.h.
+
 static struct list g_device_list = LIST_INIT(g_device_list);
+static struct spinlock g_device_list_lock = SPINLOCK_INIT();
 static uint32_t g_device_count = 0;
 
 bool
 virtio_device_init_queues(struct virtio_device *const device,
-                          const uint16_t queue_count)
+                          const uint16_t queue_count,
+                          const uint16_t max_chain_length)
 {
-    struct virtio_split_queue *const queue_list =
-        kmalloc(sizeof(struct virtio_split_queue) * queue_count);
+    struct virtio_queue *const queue_list =
+        kmalloc(sizeof(struct virtio_queue) * queue_count);
 
     if (queue_list == NULL) {
         printk(LOGLEVEL_WARN,
@@ -29,7 +33,15 @@ virtio_device_init_queues(struct virtio_device *const device,
     }
 
     for (uint16_t index = 0; index != queue_count; index++) {
-        if (!virtio_split_queue_init(device, &queue_list[index], index)) {
+        if (!virtio_queue_init(device,
+                               &queue_list[index],
+                               index,
+                               max_chain_length))
+        {
+            for (uint16_t i = 0; i != index; i++) {
+                virtio_queue_destroy(&queue_list[i]);
+            }
+
             kfree(queue_list);
             return false;
         }
@@ -42,13 +54,6 @@ virtio_device_init_queues(struct virtio_device *const device,
 }
 
 struct virtio_device *virtio_device_init(struct virtio_device *const device) {
-    struct virtio_device *iter = NULL;
-    list_foreach(iter, &g_device_list, list) {
-        if (iter->kind == device->kind) {
-            return NULL;
-        }
-    }
-
     const struct virtio_driver *const driver = &virtio_drivers[device->kind];
     if (driver->init == NULL) {
         printk(LOGLEVEL_WARN, "virtio-pci: ignoring device, no driver found\n");
@@ -71,16 +76,35 @@ struct virtio_device *virtio_device_init(struct virtio_device *const device) {
     // driver MAY read (but MUST NOT write) the device-specific configuration
     // fields to check that it can support the device before accepting it.
 
-    uint64_t features = virtio_device_read_features(device);
-    if ((features & driver->required_features) != driver->required_features) {
+    const uint64_t device_features = virtio_device_read_features(device);
+    if ((device_features & driver->required_features)
+            != driver->required_features)
+    {
         printk(LOGLEVEL_WARN,
                "virtio-pci: device is missing required features, features: "
                "%" PRIu64 "\n",
-               features);
+               device_features);
         return NULL;
     }
 
+    // Only accept the features the driver actually implements. Accepting a
+    // feature changes the layout of the rings and requests, so the device's
+    // full feature set can't be written back.
+
+    uint64_t features =
+        device_features
+      & (driver->required_features
+       | driver->optional_features
+       | VIRTIO_QUEUE_FEATURES
+       | __VIRTIO_DEVFEATURE_VERSION_1);
+
+    // Packed queues only exist on non-legacy devices.
+    if ((features & __VIRTIO_DEVFEATURE_VERSION_1) == 0) {
+        features &= ~__VIRTIO_DEVFEATURES_PACKED_RING;
+    }
+
     virtio_device_write_features(device, features);
+    device->features = features;
 
     // The transitional driver MUST execute the initialization sequence as
     // described in 3.1 but omitting the steps 5 and 6.
@@ -108,11 +132,16 @@ struct virtio_device *virtio_device_init(struct virtio_device *const device) {
         printk(LOGLEVEL_INFO, "virtio-pci: device is legacy\n");
     }
 
-    status = virtio_device_read_status(device);
-    virtio_device_write_status(device, status | __VIRTIO_DEVSTATUS_DRIVER_OK);
+    // 7. Perform device-specific setup, including discovery of virtqueues for
+    // the device, optional per-bus setup, reading and possibly writing the
+    // device’s virtio configuration space, and population of virtqueues.
 
+    status = virtio_device_read_status(device);
     if (driver->virtqueue_count != 0) {
-        if (!virtio_device_init_queues(device, driver->virtqueue_count)) {
+        if (!virtio_device_init_queues(device,
+                                       driver->virtqueue_count,
+                                       /*max_chain_length=*/1))
+        {
             status |= __VIRTIO_DEVSTATUS_FAILED;
             virtio_device_write_status(device, status);
 
@@ -126,8 +155,18 @@ struct virtio_device *virtio_device_init(struct virtio_device *const device) {
         return NULL;
     }
 
-    list_add(&g_device_list, &ret_device->list);
-    g_device_count++;
+    // 8. Set the DRIVER_OK status bit. At this point the device is “live”.
+    virtio_device_write_status(ret_device,
+                               status | __VIRTIO_DEVSTATUS_DRIVER_OK);
+
+    with_spinlock_irq_disabled(&g_device_list_lock, {
+        list_add(&g_device_list, &ret_device->list);
+        g_device_count++;
+    });
+
+    if (driver->start != NULL) {
+        driver->start(ret_device);
+    }
 
     return ret_device;
-}
\ No newline at end of file
+}
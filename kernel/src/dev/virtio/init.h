@@ -6,7 +6,12 @@
 #pragma once
 #include "device.h"
 
+// Chains of up to `max_chain_length` buffers take up a single desc on each
+// queue if the device supports indirect descs.
+
 bool
-virtio_device_init_queues(struct virtio_device *device, uint16_t queue_count);
+virtio_device_init_queues(struct virtio_device *device,
+                          uint16_t queue_count,
+                          uint16_t max_chain_length);
 
 struct virtio_device *virtio_device_init(struct virtio_device *device);
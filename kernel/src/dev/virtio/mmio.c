@@ -98,7 +98,24 @@ init_from_dtb(const struct devicetree *const tree,
     virt_device.mmio.header =
         mmio->base + (reg_info->address - mmio_range.front);
 
-    virtio_mmio_init(&virt_device);
+    const struct devicetree_prop_interrupts *const intr_prop =
+        (const struct devicetree_prop_interrupts *)(uint64_t)
+            devicetree_node_get_prop(node, DEVICETREE_PROP_INTERRUPTS);
+
+    if (intr_prop != NULL && !array_empty(intr_prop->list)) {
+        const struct devicetree_prop_intr_info *const intr_info =
+            array_front(intr_prop->list);
+
+        virt_device.mmio.irq = (isr_vector_t)intr_info->num;
+    } else {
+        printk(LOGLEVEL_WARN,
+               "virtio-mmio: dtb-node is missing an 'interrupts' property\n");
+    }
+
+    if (virtio_mmio_init(&virt_device) == NULL) {
+        virtio_device_destroy(&virt_device);
+    }
+
     return true;
 }
 
@@ -113,8 +130,12 @@ static const struct dtb_driver dtb_driver = {
     .compat_count = countof(compat_list)
 };
 
+// Virtio-block devices are probed through this driver, so boot has to wait on
+// it like the other storage drivers.
+
 __driver static const struct driver driver = {
     .name = SV_STATIC("virtio-driver"),
+    .flags = __DRIVER_ASYNC_PROBE | __DRIVER_REQUIRED_FOR_BOOT,
     .dtb = &dtb_driver,
     .pci = NULL
 };
\ No newline at end of file
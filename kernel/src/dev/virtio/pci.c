@@ -195,6 +195,12 @@ static void init_from_pci(struct pci_entity_info *const pci_entity) {
                 volatile void *const base = pci_entity_bar_get_base(bar);
                 virt_device.pci.notify_cfg_range =
                     RANGE_INIT((uint64_t)base + offset, length);
+                virt_device.pci.notify_off_multiplier =
+                    le_to_cpu(
+                        pci_read_from_base(pci_entity,
+                                           *iter,
+                                           struct virtio_pci_notify_cfg_cap,
+                                           notify_off_multiplier));
 
                 cfg_kind = "notify-cfg";
                 break;
@@ -322,8 +328,12 @@ static const struct pci_driver pci_driver = {
     .vendor = 0x1af4,
 };
 
+// Virtio-block devices are probed through this driver, so boot has to wait on
+// it like the other storage drivers.
+
 __driver static const struct driver driver = {
     .name = SV_STATIC("virtio-driver"),
+    .flags = __DRIVER_ASYNC_PROBE | __DRIVER_REQUIRED_FOR_BOOT,
     .dtb = NULL,
     .pci = &pci_driver
 };
\ No newline at end of file
@@ -0,0 +1,349 @@
+/*
+ * kernel/src/dev/virtio/queue/packed.c
+ * © suhas pai
+ */
+
+#include <stdatomic.h>
+
+#include "cpu/panic.h"
+#include "dev/printk.h"
+#include "lib/util.h"
+#include "mm/kmalloc.h"
+#include "mm/page_alloc.h"
+#include "sys/mmio.h"
+
+#include "../transport.h"
+#include "queue.h"
+
+_Static_assert(
+    // Desc Ring
+    (sizeof(struct virtq_packed_desc) * VIRTQ_MAX_DESC_COUNT)
+    // Driver and Device Event Suppression
+    + (sizeof(struct virtq_packed_event) * 2)
+        <= PAGE_SIZE,
+    "virtio/packed-queue: queue's rings don't fit in one page");
+
+__debug_optimize(3) static inline uint16_t
+avail_flags(const bool wrap_counter) {
+    // A desc is made available by setting its AVAIL bit to the driver's wrap
+    // counter, and its USED bit to the inverse.
+
+    return wrap_counter
+        ? __VIRTQ_PACKED_DESC_F_AVAIL
+        : __VIRTQ_PACKED_DESC_F_USED;
+}
+
+__debug_optimize(3) static inline uint16_t
+event_off_wrap(const uint16_t index, const bool wrap_counter) {
+    return index | (uint16_t)wrap_counter << VIRTQ_PACKED_EVENT_WRAP_SHIFT;
+}
+
+bool
+virtio_packed_queue_init(struct virtio_device *const device,
+                         struct virtio_queue *const queue)
+{
+    uint16_t *const chain_length_list =
+        kmalloc(sizeof(uint16_t) * queue->desc_count);
+
+    if (chain_length_list == NULL) {
+        printk(LOGLEVEL_WARN,
+               "virtio/packed-queue: failed to allocate chain-length list for "
+               "queue at index %" PRIu16 "\n",
+               queue->index);
+        return false;
+    }
+
+    const uint16_t desc_count = queue->desc_count;
+    void *const page_ptr = page_to_virt(queue->page);
+
+    struct virtq_packed_desc *const desc_ring = page_ptr;
+    struct virtq_packed_event *const driver_event =
+        (struct virtq_packed_event *)(desc_ring + desc_count);
+    struct virtq_packed_event *const device_event = driver_event + 1;
+
+    const uint64_t page_phys = page_to_phys(queue->page);
+    const uint32_t desc_ring_size =
+        sizeof(struct virtq_packed_desc) * desc_count;
+
+    // Interrupts stay enabled the whole time. With VIRTIO_F_EVENT_IDX, the
+    // driver-event is moved forward to the next used desc each time the used
+    // descs are processed.
+
+    driver_event->off_wrap = cpu_to_le(event_off_wrap(0, /*wrap_counter=*/1));
+    driver_event->flags =
+        cpu_to_le((uint16_t)(queue->event_idx
+            ? VIRTQ_PACKED_EVENT_FLAGS_DESC
+            : VIRTQ_PACKED_EVENT_FLAGS_ENABLE));
+
+    virtio_device_set_selected_queue_desc_phys(device, page_phys);
+    virtio_device_set_selected_queue_driver_phys(device,
+                                                 page_phys + desc_ring_size);
+    virtio_device_set_selected_queue_device_phys(
+        device,
+        page_phys + desc_ring_size + sizeof(struct virtq_packed_event));
+
+    queue->packed.desc_ring = desc_ring;
+    queue->packed.driver_event = driver_event;
+    queue->packed.device_event = device_event;
+    queue->packed.chain_length_list = chain_length_list;
+    queue->packed.next_avail_index = 0;
+    queue->packed.next_used_index = 0;
+    queue->packed.added_desc_count = 0;
+    queue->packed.avail_wrap_counter = 1;
+    queue->packed.used_wrap_counter = 1;
+
+    return true;
+}
+
+__debug_optimize(3) static void
+fill_indirect_table(struct virtio_queue *const queue,
+                    const struct virtio_queue_request *const req_list,
+                    const uint16_t count,
+                    const uint16_t id)
+{
+    // Descs in an indirect table are never made available on their own, so
+    // only their WRITE flag is used.
+
+    struct virtq_packed_desc *const table =
+        queue->indirect_table_list
+      + virtio_queue_indirect_table_offset(queue, id);
+
+    for (uint16_t i = 0; i != count; i++) {
+        const struct virtio_queue_request *const req = &req_list[i];
+        struct virtq_packed_desc *const desc = &table[i];
+
+        desc->phys_addr = cpu_to_le(req->phys);
+        desc->len = cpu_to_le(req->size);
+        desc->id = cpu_to_le(id);
+        desc->flags =
+            cpu_to_le((uint16_t)(req->kind == VIRTIO_QUEUE_REQUEST_WRITE
+                ? __VIRTQ_PACKED_DESC_F_WRITE
+                : 0));
+    }
+}
+
+__debug_optimize(3) bool
+virtio_packed_queue_add(struct virtio_queue *const queue,
+                        const struct virtio_queue_request *const req_list,
+                        const uint16_t count,
+                        const uint16_t id)
+{
+    const bool indirect = virtio_queue_chain_is_indirect(queue, count);
+    const uint16_t desc_count = indirect ? 1 : count;
+
+    if (desc_count > queue->free_count) {
+        return false;
+    }
+
+    struct virtio_packed_queue *const packed = &queue->packed;
+
+    const uint16_t head_index = packed->next_avail_index;
+    uint16_t head_flags = 0;
+
+    uint16_t index = head_index;
+    bool wrap_counter = packed->avail_wrap_counter;
+
+    if (indirect) {
+        fill_indirect_table(queue, req_list, count, id);
+
+        struct virtq_packed_desc *const desc = &packed->desc_ring[index];
+        desc->phys_addr =
+            cpu_to_le(queue->indirect_table_phys
+                      + virtio_queue_indirect_table_offset(queue, id));
+        desc->len =
+            cpu_to_le((uint32_t)(sizeof(struct virtq_packed_desc) * count));
+        desc->id = cpu_to_le(id);
+
+        head_flags = __VIRTQ_PACKED_DESC_F_INDIRECT | avail_flags(wrap_counter);
+        index++;
+
+        if (index == queue->desc_count) {
+            index = 0;
+            wrap_counter = !wrap_counter;
+        }
+    } else {
+        for (uint16_t i = 0; i != count; i++) {
+            const struct virtio_queue_request *const req = &req_list[i];
+            struct virtq_packed_desc *const desc = &packed->desc_ring[index];
+
+            desc->phys_addr = cpu_to_le(req->phys);
+            desc->len = cpu_to_le(req->size);
+            desc->id = cpu_to_le(id);
+
+            uint16_t flags = avail_flags(wrap_counter);
+            if (i != count - 1) {
+                flags |= __VIRTQ_PACKED_DESC_F_NEXT;
+            }
+
+            if (req->kind == VIRTIO_QUEUE_REQUEST_WRITE) {
+                flags |= __VIRTQ_PACKED_DESC_F_WRITE;
+            }
+
+            // The head's flags are written last, as they make the whole chain
+            // available at once.
+
+            if (i == 0) {
+                head_flags = flags;
+            } else {
+                desc->flags = cpu_to_le(flags);
+            }
+
+            index++;
+            if (index == queue->desc_count) {
+                index = 0;
+                wrap_counter = !wrap_counter;
+            }
+        }
+    }
+
+    packed->next_avail_index = index;
+    packed->avail_wrap_counter = wrap_counter;
+    packed->added_desc_count += desc_count;
+    packed->chain_length_list[id] = desc_count;
+
+    queue->free_count -= desc_count;
+
+    // Unlike the split ring, there's no separate index to publish chains, so
+    // each chain is available to the device from here on. The device is only
+    // notified of them on commit.
+
+    atomic_thread_fence(memory_order_release);
+    mmio_write(&packed->desc_ring[head_index].flags, cpu_to_le(head_flags));
+
+    return true;
+}
+
+__debug_optimize(3)
+bool virtio_packed_queue_commit(struct virtio_queue *const queue) {
+    struct virtio_packed_queue *const packed = &queue->packed;
+
+    // Make sure the device sees the descs before we check whether it wants to
+    // be notified of them.
+
+    atomic_thread_fence(memory_order_seq_cst);
+
+    const uint16_t new_index = packed->next_avail_index;
+    const uint16_t old_index = new_index - packed->added_desc_count;
+
+    packed->added_desc_count = 0;
+
+    const uint16_t off_wrap =
+        le_to_cpu(mmio_read(&packed->device_event->off_wrap));
+    const uint16_t flags = le_to_cpu(mmio_read(&packed->device_event->flags));
+
+    switch ((enum virtq_packed_event_flags)flags) {
+        case VIRTQ_PACKED_EVENT_FLAGS_ENABLE:
+            return true;
+        case VIRTQ_PACKED_EVENT_FLAGS_DISABLE:
+            return false;
+        case VIRTQ_PACKED_EVENT_FLAGS_DESC:
+            break;
+        default:
+            // Reserved value, notify to be safe.
+            return true;
+    }
+
+    // The device asked to be notified once the desc at its event offset is
+    // made available. If that offset is in the previous lap of the ring, the
+    // indices are compared as if it were one lap behind.
+
+    uint16_t event_index = off_wrap & ~(1u << VIRTQ_PACKED_EVENT_WRAP_SHIFT);
+    const bool wrap_counter = off_wrap >> VIRTQ_PACKED_EVENT_WRAP_SHIFT;
+
+    if (wrap_counter != packed->avail_wrap_counter) {
+        event_index -= queue->desc_count;
+    }
+
+    return virtio_queue_need_event(event_index, new_index, old_index);
+}
+
+__debug_optimize(3) static inline bool
+has_used(const struct virtio_queue *const queue) {
+    const struct virtio_packed_queue *const packed = &queue->packed;
+    const uint16_t flags =
+        le_to_cpu(mmio_read(&packed->desc_ring[packed->next_used_index].flags));
+
+    const bool avail = flags & __VIRTQ_PACKED_DESC_F_AVAIL;
+    const bool used = flags & __VIRTQ_PACKED_DESC_F_USED;
+
+    return avail == used && used == packed->used_wrap_counter;
+}
+
+__debug_optimize(3) bool
+virtio_packed_queue_pop_used(struct virtio_queue *const queue,
+                             uint16_t *const id_out,
+                             uint32_t *const len_out)
+{
+    if (!has_used(queue)) {
+        return false;
+    }
+
+    // Don't read the used desc's id and len before its flags.
+    atomic_thread_fence(memory_order_acquire);
+
+    struct virtio_packed_queue *const packed = &queue->packed;
+    struct virtq_packed_desc *const desc =
+        &packed->desc_ring[packed->next_used_index];
+
+    const uint16_t id = le_to_cpu(mmio_read(&desc->id));
+    const uint32_t len = le_to_cpu(mmio_read(&desc->len));
+
+    if (!index_in_bounds(id, queue->desc_count)) {
+        // We don't know how many descs the chain took up, so the ring can't be
+        // used anymore.
+
+        panic("virtio/packed-queue: device returned invalid id %" PRIu16 " on "
+              "queue %" PRIu16 "\n",
+              id,
+              queue->index);
+    }
+
+    const uint16_t chain_length = packed->chain_length_list[id];
+    uint16_t next_used_index = packed->next_used_index + chain_length;
+
+    if (next_used_index >= queue->desc_count) {
+        next_used_index -= queue->desc_count;
+        packed->used_wrap_counter = !packed->used_wrap_counter;
+    }
+
+    packed->next_used_index = next_used_index;
+    queue->free_count += chain_length;
+
+    *id_out = id;
+    *len_out = len;
+
+    return true;
+}
+
+__debug_optimize(3)
+bool virtio_packed_queue_rearm_interrupts(struct virtio_queue *const queue) {
+    if (!queue->event_idx) {
+        return false;
+    }
+
+    // Ask for an interrupt once the device marks the desc after the last one we
+    // consumed as used, then check that the device didn't do so before it
+    // could see our update.
+
+    struct virtio_packed_queue *const packed = &queue->packed;
+    packed->driver_event->off_wrap =
+        cpu_to_le(event_off_wrap(packed->next_used_index,
+                                 packed->used_wrap_counter));
+
+    atomic_thread_fence(memory_order_seq_cst);
+    return has_used(queue);
+}
+
+void virtio_packed_queue_destroy(struct virtio_queue *const queue) {
+    kfree(queue->packed.chain_length_list);
+
+    queue->packed.desc_ring = NULL;
+    queue->packed.driver_event = NULL;
+    queue->packed.device_event = NULL;
+    queue->packed.chain_length_list = NULL;
+    queue->packed.next_avail_index = 0;
+    queue->packed.next_used_index = 0;
+    queue->packed.added_desc_count = 0;
+    queue->packed.avail_wrap_counter = 0;
+    queue->packed.used_wrap_counter = 0;
+}
@@ -0,0 +1,54 @@
+/*
+ * kernel/src/dev/virtio/queue/packed.h
+ * © suhas pai
+ */
+
+#pragma once
+
+#include "../device.h"
+#include "request.h"
+
+struct virtio_packed_queue {
+    struct virtq_packed_desc *desc_ring;
+
+    struct virtq_packed_event *driver_event;
+    volatile struct virtq_packed_event *device_event;
+
+    // Number of descs taken up by the chain of each id, which the used desc
+    // doesn't report.
+
+    uint16_t *chain_length_list;
+
+    uint16_t next_avail_index;
+    uint16_t next_used_index;
+
+    // Number of descs made available since the last commit.
+    uint16_t added_desc_count;
+
+    bool avail_wrap_counter : 1;
+    bool used_wrap_counter : 1;
+};
+
+struct virtio_queue;
+bool
+virtio_packed_queue_init(struct virtio_device *device,
+                         struct virtio_queue *queue);
+
+bool
+virtio_packed_queue_add(struct virtio_queue *queue,
+                        const struct virtio_queue_request *req_list,
+                        uint16_t count,
+                        uint16_t id);
+
+// Returns true if the device needs to be notified of the chains added since
+// the last commit.
+
+bool virtio_packed_queue_commit(struct virtio_queue *queue);
+
+bool
+virtio_packed_queue_pop_used(struct virtio_queue *queue,
+                             uint16_t *id_out,
+                             uint32_t *len_out);
+
+bool virtio_packed_queue_rearm_interrupts(struct virtio_queue *queue);
+void virtio_packed_queue_destroy(struct virtio_queue *queue);
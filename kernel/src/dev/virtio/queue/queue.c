@@ -0,0 +1,221 @@
+/*
+ * kernel/src/dev/virtio/queue/queue.c
+ * © suhas pai
+ */
+
+#include "dev/printk.h"
+#include "lib/util.h"
+#include "mm/page_alloc.h"
+
+#include "../transport.h"
+#include "queue.h"
+
+#define VIRTIO_QUEUE_ALLOC_PAGE_ORDER 0
+
+static bool
+init_indirect_tables(struct virtio_queue *const queue,
+                     const uint16_t max_chain_length)
+{
+    const uint32_t size =
+        (uint32_t)queue->desc_count
+      * max_chain_length
+      * sizeof(struct virtq_desc);
+
+    uint8_t order = 0;
+    while ((PAGE_SIZE << order) < size) {
+        order++;
+    }
+
+    struct page *const page = alloc_pages(PAGE_STATE_USED, __ALLOC_ZERO, order);
+    if (page == NULL) {
+        return false;
+    }
+
+    queue->indirect_page = page;
+    queue->indirect_table_list = page_to_virt(page);
+    queue->indirect_table_phys = page_to_phys(page);
+    queue->indirect_table_length = max_chain_length;
+    queue->indirect_order = order;
+
+    return true;
+}
+
+bool
+virtio_queue_init(struct virtio_device *const device,
+                  struct virtio_queue *const queue,
+                  const uint16_t queue_index,
+                  const uint16_t max_chain_length)
+{
+    virtio_device_select_queue(device, queue_index);
+    const uint16_t max_size = virtio_device_selected_queue_max_size(device);
+
+    if (max_size == 0) {
+        printk(LOGLEVEL_WARN,
+               "virtio/queue: queue at index %" PRIu16 " is unavailable\n",
+               queue_index);
+        return false;
+    }
+
+    // Pick the largest power of two the device supports.
+
+    uint16_t desc_count = VIRTQ_MAX_DESC_COUNT;
+    while (desc_count > max_size) {
+        desc_count >>= 1;
+    }
+
+    struct page *const page =
+        alloc_pages(PAGE_STATE_USED,
+                    __ALLOC_ZERO,
+                    VIRTIO_QUEUE_ALLOC_PAGE_ORDER);
+
+    if (page == NULL) {
+        printk(LOGLEVEL_WARN,
+               "virtio/queue: failed to allocate buffer for queue at index "
+               "%" PRIu16 "\n",
+               queue_index);
+
+        return false;
+    }
+
+    queue->page = page;
+    queue->indirect_page = NULL;
+    queue->indirect_table_list = NULL;
+    queue->indirect_table_phys = 0;
+    queue->indirect_table_length = 0;
+    queue->indirect_order = 0;
+    queue->desc_count = desc_count;
+    queue->free_count = desc_count;
+    queue->added_count = 0;
+    queue->index = queue_index;
+    queue->notify_offset = virtio_device_selected_queue_notify_offset(device);
+    queue->notify_count = 0;
+    queue->notify_suppressed_count = 0;
+    queue->is_packed = device->features & __VIRTIO_DEVFEATURES_PACKED_RING;
+    queue->event_idx = device->features & __VIRTIO_DEVFEATURE_EVENT_IDX;
+    queue->indirect = false;
+
+    // Indirect tables are only worth it for chains that would otherwise take
+    // up more than one desc.
+
+    if ((device->features & __VIRTIO_DEVFEATURE_INDR_DESC) != 0
+     && max_chain_length > 1)
+    {
+        if (init_indirect_tables(queue, max_chain_length)) {
+            queue->indirect = true;
+        } else {
+            printk(LOGLEVEL_WARN,
+                   "virtio/queue: failed to allocate indirect tables for queue "
+                   "at index %" PRIu16 ", using direct descs\n",
+                   queue_index);
+        }
+    }
+
+    virtio_device_set_selected_queue_size(device, desc_count);
+
+    const bool result =
+        queue->is_packed
+            ? virtio_packed_queue_init(device, queue)
+            : virtio_split_queue_init(device, queue);
+
+    if (!result) {
+        if (queue->indirect_page != NULL) {
+            free_pages(queue->indirect_page, queue->indirect_order);
+        }
+
+        free_pages(page, VIRTIO_QUEUE_ALLOC_PAGE_ORDER);
+        return false;
+    }
+
+    virtio_device_enable_selected_queue(device);
+    return true;
+}
+
+__debug_optimize(3) bool
+virtio_queue_add(struct virtio_queue *const queue,
+                 const struct virtio_queue_request *const req_list,
+                 const uint16_t count,
+                 const uint16_t id)
+{
+    assert_msg(count != 0, "virtio/queue: add() got count=0");
+    assert_msg(index_in_bounds(id, queue->desc_count),
+               "virtio/queue: add() got invalid id %" PRIu16,
+               id);
+
+    const bool result =
+        queue->is_packed
+            ? virtio_packed_queue_add(queue, req_list, count, id)
+            : virtio_split_queue_add(queue, req_list, count, id);
+
+    if (result) {
+        queue->added_count++;
+    }
+
+    return result;
+}
+
+__debug_optimize(3) void
+virtio_queue_commit(struct virtio_device *const device,
+                    struct virtio_queue *const queue)
+{
+    if (queue->added_count == 0) {
+        return;
+    }
+
+    const bool notify =
+        queue->is_packed
+            ? virtio_packed_queue_commit(queue)
+            : virtio_split_queue_commit(queue);
+
+    queue->added_count = 0;
+    if (notify) {
+        virtio_device_notify_queue(device, queue);
+        queue->notify_count++;
+    } else {
+        queue->notify_suppressed_count++;
+    }
+}
+
+__debug_optimize(3) bool
+virtio_queue_pop_used(struct virtio_queue *const queue,
+                      uint16_t *const id_out,
+                      uint32_t *const len_out)
+{
+    if (queue->is_packed) {
+        return virtio_packed_queue_pop_used(queue, id_out, len_out);
+    }
+
+    return virtio_split_queue_pop_used(queue, id_out, len_out);
+}
+
+__debug_optimize(3)
+bool virtio_queue_rearm_interrupts(struct virtio_queue *const queue) {
+    if (queue->is_packed) {
+        return virtio_packed_queue_rearm_interrupts(queue);
+    }
+
+    return virtio_split_queue_rearm_interrupts(queue);
+}
+
+void virtio_queue_destroy(struct virtio_queue *const queue) {
+    if (queue->is_packed) {
+        virtio_packed_queue_destroy(queue);
+    } else {
+        virtio_split_queue_destroy(queue);
+    }
+
+    if (queue->indirect_page != NULL) {
+        free_pages(queue->indirect_page, queue->indirect_order);
+    }
+
+    free_pages(queue->page, VIRTIO_QUEUE_ALLOC_PAGE_ORDER);
+
+    queue->page = NULL;
+    queue->indirect_page = NULL;
+    queue->indirect_table_list = NULL;
+    queue->indirect_table_phys = 0;
+    queue->indirect_table_length = 0;
+    queue->indirect_order = 0;
+    queue->desc_count = 0;
+    queue->free_count = 0;
+    queue->added_count = 0;
+}
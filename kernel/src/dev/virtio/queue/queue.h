@@ -0,0 +1,142 @@
+/*
+ * kernel/src/dev/virtio/queue/queue.h
+ * © suhas pai
+ */
+
+#pragma once
+
+#include "../device.h"
+
+#include "packed.h"
+#include "request.h"
+#include "split.h"
+
+// The ring layout and features negotiated for every queue of a device, picked
+// in order of preference when the device offers them.
+
+#define VIRTIO_QUEUE_FEATURES \
+    (__VIRTIO_DEVFEATURES_PACKED_RING \
+   | __VIRTIO_DEVFEATURE_EVENT_IDX \
+   | __VIRTIO_DEVFEATURE_INDR_DESC)
+
+// A queue's layout-specific functions don't do any locking of their own.
+// Callers must serialize every call after init on the same queue.
+
+struct virtio_queue {
+    struct page *page;
+    union {
+        struct virtio_split_queue split;
+        struct virtio_packed_queue packed;
+    };
+
+    // With indirect descs, a chain of more than one buffer is written to the
+    // indirect table of its id instead, and takes up a single desc in the
+    // ring.
+
+    struct page *indirect_page;
+    void *indirect_table_list;
+    uint64_t indirect_table_phys;
+
+    uint16_t indirect_table_length;
+    uint8_t indirect_order;
+
+    uint16_t desc_count;
+    uint16_t free_count;
+
+    // Number of chains added since the last commit.
+    uint16_t added_count;
+    uint16_t index;
+
+    // Offset of the queue's notification register within the device's
+    // notify-cfg. Only used for pci devices.
+
+    uint32_t notify_offset;
+
+    // Number of notifications sent to the device, and the number that were
+    // suppressed by the device.
+
+    uint64_t notify_count;
+    uint64_t notify_suppressed_count;
+
+    bool is_packed : 1;
+    bool event_idx : 1;
+    bool indirect : 1;
+};
+
+_Static_assert(sizeof(struct virtq_desc) == sizeof(struct virtq_packed_desc),
+               "virtio/queue: split and packed descs should be the same size");
+
+__debug_optimize(3) static inline bool
+virtio_queue_chain_is_indirect(const struct virtio_queue *const queue,
+                               const uint16_t count)
+{
+    return queue->indirect
+        && count > 1
+        && count <= queue->indirect_table_length;
+}
+
+__debug_optimize(3) static inline uint32_t
+virtio_queue_indirect_table_offset(const struct virtio_queue *const queue,
+                                   const uint16_t id)
+{
+    return (uint32_t)id
+         * queue->indirect_table_length
+         * sizeof(struct virtq_desc);
+}
+
+// Returns true if an event at `event_index` was crossed by moving from
+// `old_index` to `new_index`.
+
+__debug_optimize(3) static inline bool
+virtio_queue_need_event(const uint16_t event_index,
+                        const uint16_t new_index,
+                        const uint16_t old_index)
+{
+    return (uint16_t)(new_index - event_index - 1)
+         < (uint16_t)(new_index - old_index);
+}
+
+// Chains of up to `max_chain_length` buffers are put in indirect tables when
+// the device supports indirect descs.
+
+bool
+virtio_queue_init(struct virtio_device *device,
+                  struct virtio_queue *queue,
+                  uint16_t queue_index,
+                  uint16_t max_chain_length);
+
+// Add a chain of descriptors pointing to the buffers in req_list, without
+// notifying the device. `id` identifies the chain once the device is finished
+// with it, must be below the queue's desc-count, and must not be used by
+// another chain still in the queue. Returns false if the queue doesn't have
+// enough free descriptors for the chain.
+
+bool
+virtio_queue_add(struct virtio_queue *queue,
+                 const struct virtio_queue_request *req_list,
+                 uint16_t count,
+                 uint16_t id);
+
+// Make the chains added since the last commit visible to the device, and
+// notify it of them unless it asked not to be.
+
+void
+virtio_queue_commit(struct virtio_device *device, struct virtio_queue *queue);
+
+// Take the next chain the device has finished with off the queue, and free its
+// descriptors. Returns false if the device hasn't finished with any more
+// chains.
+
+bool
+virtio_queue_pop_used(struct virtio_queue *queue,
+                      uint16_t *id_out,
+                      uint32_t *len_out);
+
+// Ask the device to interrupt once it finishes with the next chain, after every
+// finished chain was popped. Returns true if the device finished with more
+// chains in the meantime, which the caller must pop before calling this again.
+
+bool virtio_queue_rearm_interrupts(struct virtio_queue *queue);
+
+// The device must have been reset before its queues are destroyed.
+void virtio_queue_destroy(struct virtio_queue *queue);
@@ -6,13 +6,17 @@
 #pragma once
 #include <stdint.h>
 
+// The kind of a request is from the device's point of view: the device reads
+// from the buffers of READ requests, and writes into the buffers of WRITE
+// requests.
+
 enum virtio_queue_request_kind {
     VIRTIO_QUEUE_REQUEST_READ,
     VIRTIO_QUEUE_REQUEST_WRITE,
 };
 
 struct virtio_queue_request {
-    void *data;
+    uint64_t phys;
     uint32_t size;
 
     enum virtio_queue_request_kind kind : 1;
@@ -7,61 +7,71 @@
 
 #include "dev/printk.h"
 #include "lib/align.h"
+#include "lib/util.h"
+#include "mm/kmalloc.h"
 #include "mm/page_alloc.h"
+#include "sys/mmio.h"
 
 #include "../transport.h"
-#include "split.h"
+#include "queue.h"
+
+// The avail ring ends with the used_event field, and the used ring with the
+// avail_event field. Both are always reserved, even if VIRTIO_F_EVENT_IDX
+// wasn't negotiated.
+
+#define VIRTIO_SPLIT_QUEUE_AVAIL_RING_SIZE(desc_count) \
+    (sizeof(struct virtq_avail) + (sizeof(le16_t) * ((desc_count) + 1)))
+#define VIRTIO_SPLIT_QUEUE_USED_RING_SIZE(desc_count) \
+    (sizeof(struct virtq_used) \
+   + (sizeof(struct virtq_used_elem) * (desc_count)) \
+   + sizeof(le16_t))
+
+_Static_assert(
+    // Desc Table
+    (sizeof(struct virtq_desc) * VIRTQ_MAX_DESC_COUNT)
+    // Avail ring, plus padding to align the used ring
+    + VIRTIO_SPLIT_QUEUE_AVAIL_RING_SIZE(VIRTQ_MAX_DESC_COUNT) + 3
+    // Used Ring
+    + VIRTIO_SPLIT_QUEUE_USED_RING_SIZE(VIRTQ_MAX_DESC_COUNT)
+        <= PAGE_SIZE,
+    "virtio/split-queue: queue's rings don't fit in one page");
+
+__debug_optimize(3) static inline le16_t *
+used_event_ptr(const struct virtio_queue *const queue) {
+    return &queue->split.avail_ring->ring[queue->desc_count];
+}
 
-#define VIRTIO_SPLIT_QUEUE_ALLOC_PAGE_ORDER 0
+__debug_optimize(3) static inline volatile le16_t *
+avail_event_ptr(const struct virtio_queue *const queue) {
+    return (volatile le16_t *)&queue->split.used_ring->ring[queue->desc_count];
+}
 
 bool
 virtio_split_queue_init(struct virtio_device *const device,
-                        struct virtio_split_queue *const queue,
-                        const uint16_t queue_index)
+                        struct virtio_queue *const queue)
 {
-    virtio_device_select_queue(device, queue_index);
-    const uint16_t desc_count =
-        min(virtio_device_selected_queue_max_size(device),
-            VIRTQ_MAX_DESC_COUNT);
-
-    _Static_assert(
-        // Desc Table
-        (sizeof(struct virtq_desc) * VIRTQ_MAX_DESC_COUNT)
-        // Avail ring
-        + (sizeof(struct virtq_avail) + (sizeof(le16_t) * VIRTQ_MAX_DESC_COUNT))
-        // Used Ring
-        + (sizeof(struct virtq_used)
-          + (sizeof(struct virtq_used_elem) * VIRTQ_MAX_DESC_COUNT))
-            <= (PAGE_SIZE << VIRTIO_SPLIT_QUEUE_ALLOC_PAGE_ORDER),
-        "virtio/split-queue: VIRTIO_SPLIT_QUEUE_ALLOC_PAGE_ORDER needs to be "
-        "increased");
-
-    struct page *const page =
-        alloc_pages(PAGE_STATE_USED,
-                    __ALLOC_ZERO,
-                    VIRTIO_SPLIT_QUEUE_ALLOC_PAGE_ORDER);
-
-    if (page == NULL) {
+    uint16_t *const id_list = kmalloc(sizeof(uint16_t) * queue->desc_count);
+    if (id_list == NULL) {
         printk(LOGLEVEL_WARN,
-               "virtio/split-queue: failed to allocate buffer for queue at "
+               "virtio/split-queue: failed to allocate id-list for queue at "
                "index %" PRIu16 "\n",
-               queue_index);
-
+               queue->index);
         return false;
     }
 
-    void *const page_ptr = page_to_virt(page);
+    const uint16_t desc_count = queue->desc_count;
+    void *const page_ptr = page_to_virt(queue->page);
 
     struct virtq_desc *const desc_table = page_ptr;
     struct virtq_avail *const avail_ring =
         (struct virtq_avail *)(desc_table + desc_count);
 
     const uint32_t avail_ring_size =
-        sizeof(struct virtq_avail) + (sizeof(le16_t) * desc_count);
-    struct virtq_used *const used_ring =
-        (void *)avail_ring + align_up_assert(avail_ring_size, /*boundary=*/4);
+        align_up_assert(VIRTIO_SPLIT_QUEUE_AVAIL_RING_SIZE(desc_count),
+                        /*boundary=*/4);
+    struct virtq_used *const used_ring = (void *)avail_ring + avail_ring_size;
 
-    const uint64_t page_phys = page_to_phys(page);
+    const uint64_t page_phys = page_to_phys(queue->page);
     const uint32_t desc_table_size = sizeof(struct virtq_desc) * desc_count;
 
     virtio_device_set_selected_queue_desc_phys(device, page_phys);
@@ -72,75 +82,121 @@ virtio_split_queue_init(struct virtio_device *const device,
                                                  desc_table_size +
                                                  avail_ring_size);
 
-    virtio_device_enable_selected_queue(device);
-
-    // Set the next-indices of each virtio-desc to point to the desc right after
-    // Outside the loop, set the next index for the last desc to 0.
-
-    struct virtq_desc *const begin = desc_table;
-    const struct virtq_desc *const back = begin + (desc_count - 1);
+    // Link every desc into the free list. The next index of the last desc is
+    // never followed, as the free-count runs out first.
 
-    struct virtq_desc *iter = begin;
-    uint16_t next_index = 1;
-
-    for (; iter != back; iter++, next_index++) {
-        iter->next = next_index;
-        iter->flags |= __VIRTQ_DESC_F_NEXT;
+    for (uint16_t index = 0; index != desc_count - 1; index++) {
+        desc_table[index].next = index + 1;
     }
 
-    iter->next = 0;
-
-    queue->page = page;
-    queue->desc_table = desc_table;
-    queue->avail_ring = avail_ring;
-
-    queue->desc_count = desc_count;
-    queue->used_ring = used_ring;
-    queue->free_index = 0;
-    queue->chain_count = 0;
-    queue->index = queue_index;
+    queue->split.desc_table = desc_table;
+    queue->split.avail_ring = avail_ring;
+    queue->split.used_ring = used_ring;
+    queue->split.id_list = id_list;
+    queue->split.free_index = 0;
+    queue->split.last_used_index = 0;
 
     return true;
 }
 
-void
-virtio_split_queue_add(struct virtio_split_queue *const queue,
-                       struct virtio_queue_request *const req,
-                       const uint32_t count)
+__debug_optimize(3) static void
+fill_indirect_table(struct virtio_queue *const queue,
+                    const struct virtio_queue_request *const req_list,
+                    const uint16_t count,
+                    const uint16_t id)
 {
-    assert_msg(count != 0, "virtio/split-queue: add() got count=0");
-
-    const uint16_t head_index = queue->free_index;
-    uint16_t free_index = head_index;
+    struct virtq_desc *const table =
+        queue->indirect_table_list
+      + virtio_queue_indirect_table_offset(queue, id);
 
-    for (uint32_t i = 0; i != count; i++) {
-        struct virtq_desc *const desc = &queue->desc_table[free_index];
+    for (uint16_t i = 0; i != count; i++) {
+        const struct virtio_queue_request *const req = &req_list[i];
+        struct virtq_desc *const desc = &table[i];
 
-        desc->phys_addr = (uint64_t)req->data;
-        desc->len = req->size;
+        desc->phys_addr = cpu_to_le(req->phys);
+        desc->len = cpu_to_le(req->size);
 
+        uint16_t flags = 0;
         if (i != count - 1) {
-            desc->flags = __VIRTQ_DESC_F_NEXT;
+            flags |= __VIRTQ_DESC_F_NEXT;
         }
 
         if (req->kind == VIRTIO_QUEUE_REQUEST_WRITE) {
-            desc->flags |= __VIRTQ_DESC_F_WRITE;
+            flags |= __VIRTQ_DESC_F_WRITE;
         }
 
+        desc->flags = cpu_to_le(flags);
+        desc->next = cpu_to_le((uint16_t)(i + 1));
+    }
+}
+
+__debug_optimize(3) bool
+virtio_split_queue_add(struct virtio_queue *const queue,
+                       const struct virtio_queue_request *const req_list,
+                       const uint16_t count,
+                       const uint16_t id)
+{
+    const bool indirect = virtio_queue_chain_is_indirect(queue, count);
+    const uint16_t desc_count = indirect ? 1 : count;
+
+    if (desc_count > queue->free_count) {
+        return false;
+    }
+
+    struct virtio_split_queue *const split = &queue->split;
+
+    const uint16_t head_index = split->free_index;
+    uint16_t free_index = head_index;
+
+    if (indirect) {
+        fill_indirect_table(queue, req_list, count, id);
+
+        struct virtq_desc *const desc = &split->desc_table[free_index];
+        desc->phys_addr =
+            cpu_to_le(queue->indirect_table_phys
+                      + virtio_queue_indirect_table_offset(queue, id));
+        desc->len = cpu_to_le((uint32_t)(sizeof(struct virtq_desc) * count));
+        desc->flags = cpu_to_le((uint16_t)__VIRTQ_DESC_F_INDIRECT);
+
         free_index = desc->next;
+    } else {
+        for (uint16_t i = 0; i != count; i++) {
+            const struct virtio_queue_request *const req = &req_list[i];
+            struct virtq_desc *const desc = &split->desc_table[free_index];
+
+            desc->phys_addr = cpu_to_le(req->phys);
+            desc->len = cpu_to_le(req->size);
+
+            uint16_t flags = 0;
+            if (i != count - 1) {
+                flags |= __VIRTQ_DESC_F_NEXT;
+            }
+
+            if (req->kind == VIRTIO_QUEUE_REQUEST_WRITE) {
+                flags |= __VIRTQ_DESC_F_WRITE;
+            }
+
+            desc->flags = cpu_to_le(flags);
+            free_index = desc->next;
+        }
     }
 
+    split->free_index = free_index;
+    split->id_list[head_index] = id;
+
+    queue->free_count -= desc_count;
+
     const uint16_t avail_index =
-        (queue->avail_ring->index + queue->chain_count) % queue->desc_count;
+        (split->avail_ring->index + queue->added_count) % queue->desc_count;
 
-    queue->avail_ring->ring[avail_index] = head_index;
-    queue->chain_count += 1;
+    split->avail_ring->ring[avail_index] = cpu_to_le(head_index);
+    return true;
 }
 
-void
-virtio_split_queue_commit(struct virtio_device *const device,
-                          struct virtio_split_queue *const queue)
-{
+__debug_optimize(3)
+bool virtio_split_queue_commit(struct virtio_queue *const queue) {
+    struct virtio_split_queue *const split = &queue->split;
+
     // 4. The driver performs a suitable memory barrier to ensure the device
     //    sees the updated descriptor table and available ring before the next
     //    step.
@@ -148,15 +204,127 @@ virtio_split_queue_commit(struct virtio_device *const device,
 
     // 5. The available idx is increased by the number of descriptor chain heads
     //    added to the available ring.
-    queue->avail_ring->index += queue->chain_count;
+    const uint16_t old_index = split->avail_ring->index;
+    const uint16_t new_index = old_index + queue->added_count;
+
+    split->avail_ring->index = new_index;
 
     // 6. The driver performs a suitable memory barrier to ensure that it
     //    updates the idx field before checking for notification suppression.
     atomic_thread_fence(memory_order_seq_cst);
 
     // 7. The driver sends an available buffer notification to the device if
-    //    such notifications are not suppressed
-    if ((queue->used_ring->flags & __VIRTQ_USED_F_NO_NOTIFY) == 0) {
-        virtio_device_notify_queue(device, queue->index);
+    //    such notifications are not suppressed. With VIRTIO_F_EVENT_IDX, the
+    //    device instead asks for a notification once the avail idx moves past
+    //    its avail_event.
+
+    if (queue->event_idx) {
+        const uint16_t avail_event =
+            le_to_cpu(mmio_read(avail_event_ptr(queue)));
+
+        return virtio_queue_need_event(avail_event, new_index, old_index);
+    }
+
+    return (queue->split.used_ring->flags & __VIRTQ_USED_F_NO_NOTIFY) == 0;
+}
+
+__debug_optimize(3) static inline bool
+has_used(const struct virtio_queue *const queue) {
+    return queue->split.last_used_index
+        != mmio_read(&queue->split.used_ring->index);
+}
+
+__debug_optimize(3) static void
+free_chain(struct virtio_queue *const queue, const uint16_t head_index) {
+    struct virtio_split_queue *const split = &queue->split;
+
+    // Find the end of the chain, and put the whole chain back at the front of
+    // the free list. An indirect chain only takes up its head desc.
+
+    uint16_t tail_index = head_index;
+    uint16_t count = 1;
+
+    while (le_to_cpu(split->desc_table[tail_index].flags)
+            & __VIRTQ_DESC_F_NEXT)
+    {
+        tail_index = split->desc_table[tail_index].next;
+        count++;
+    }
+
+    split->desc_table[tail_index].next = split->free_index;
+    split->free_index = head_index;
+
+    queue->free_count += count;
+}
+
+__debug_optimize(3) bool
+virtio_split_queue_pop_used(struct virtio_queue *const queue,
+                            uint16_t *const id_out,
+                            uint32_t *const len_out)
+{
+    if (!has_used(queue)) {
+        return false;
     }
-}
\ No newline at end of file
+
+    // Don't read the used-ring's entry before the device's update of the
+    // used-ring's index is visible.
+
+    atomic_thread_fence(memory_order_acquire);
+
+    struct virtio_split_queue *const split = &queue->split;
+
+    const uint16_t ring_index = split->last_used_index % queue->desc_count;
+    volatile struct virtq_used_elem *const elem =
+        &split->used_ring->ring[ring_index];
+
+    const uint32_t head_index = le_to_cpu(mmio_read(&elem->id));
+    const uint32_t len = le_to_cpu(mmio_read(&elem->len));
+
+    split->last_used_index++;
+    if (!index_in_bounds(head_index, queue->desc_count)) {
+        printk(LOGLEVEL_WARN,
+               "virtio/split-queue: device returned invalid head "
+               "%" PRIu32 " on queue %" PRIu16 "\n",
+               head_index,
+               queue->index);
+
+        *id_out = UINT16_MAX;
+        *len_out = 0;
+
+        return true;
+    }
+
+    free_chain(queue, (uint16_t)head_index);
+
+    *id_out = split->id_list[head_index];
+    *len_out = len;
+
+    return true;
+}
+
+__debug_optimize(3)
+bool virtio_split_queue_rearm_interrupts(struct virtio_queue *const queue) {
+    if (!queue->event_idx) {
+        return false;
+    }
+
+    // Ask for an interrupt once the device writes the used entry after the
+    // last one we consumed, then check that the device didn't write it before
+    // it could see our update.
+
+    *used_event_ptr(queue) = cpu_to_le(queue->split.last_used_index);
+    atomic_thread_fence(memory_order_seq_cst);
+
+    return has_used(queue);
+}
+
+void virtio_split_queue_destroy(struct virtio_queue *const queue) {
+    kfree(queue->split.id_list);
+
+    queue->split.desc_table = NULL;
+    queue->split.avail_ring = NULL;
+    queue->split.used_ring = NULL;
+    queue->split.id_list = NULL;
+    queue->split.free_index = 0;
+    queue->split.last_used_index = 0;
+}
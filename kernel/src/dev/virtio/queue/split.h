@@ -9,28 +9,44 @@
 #include "request.h"
 
 struct virtio_split_queue {
-    struct page *page;
-
     struct virtq_desc *desc_table;
     struct virtq_avail *avail_ring;
-    struct virtq_used *used_ring;
+    volatile struct virtq_used *used_ring;
+
+    // The used ring returns the head desc of each chain, which maps to the id
+    // the chain was added with.
+
+    uint16_t *id_list;
+
+    // Unused descriptors are kept in a list linked through their next fields,
+    // starting at free_index.
 
-    uint16_t desc_count;
     uint16_t free_index;
-    uint16_t chain_count;
-    uint16_t index;
+
+    // Index of the next entry to be consumed from the used ring.
+    uint16_t last_used_index;
 };
 
+struct virtio_queue;
 bool
 virtio_split_queue_init(struct virtio_device *device,
-                        struct virtio_split_queue *queue,
-                        uint16_t queue_index);
+                        struct virtio_queue *queue);
 
-void
-virtio_split_queue_add(struct virtio_split_queue *queue,
-                       struct virtio_queue_request *req,
-                       uint32_t count);
+bool
+virtio_split_queue_add(struct virtio_queue *queue,
+                       const struct virtio_queue_request *req_list,
+                       uint16_t count,
+                       uint16_t id);
+
+// Returns true if the device needs to be notified of the chains added since
+// the last commit.
+
+bool virtio_split_queue_commit(struct virtio_queue *queue);
+
+bool
+virtio_split_queue_pop_used(struct virtio_queue *queue,
+                            uint16_t *id_out,
+                            uint32_t *len_out);
 
-void
-virtio_split_queue_commit(struct virtio_device *device,
-                          struct virtio_split_queue *queue);
+bool virtio_split_queue_rearm_interrupts(struct virtio_queue *queue);
+void virtio_split_queue_destroy(struct virtio_queue *queue);
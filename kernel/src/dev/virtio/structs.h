@@ -113,6 +113,11 @@ struct virtio_pci_common_cfg {
     le16_t queue_reset;
 } __packed;
 
+// Written to a msix-vector field to stop the device from sending interrupts
+// for that source.
+
+#define VIRTIO_PCI_NO_MSIX_VECTOR 0xFFFF
+
 enum virtio_pci_legacy_common_cfg_offsets {
     // Read-only
     VIRTIO_PCI_LEGACY_DEV_FEATURES,
@@ -345,6 +350,11 @@ enum virtio_device_feature_bits {
 
 #define VIRTIO_MMIO_DEVICE_MAGIC 0x74726976
 
+enum virtio_mmio_interrupt_status {
+    __VIRTIO_MMIO_INTR_USED_BUFFER = 1 << 0,
+    __VIRTIO_MMIO_INTR_CONFIG_CHANGE = 1 << 1,
+};
+
 struct virtio_mmio_device {
     volatile const uint32_t magic;
     volatile const uint32_t version;
@@ -505,11 +515,10 @@ struct virtq_desc {
     le16_t next;
 };
 
-#define VIRTQ_MAX_DESC_COUNT 157
+// Queue sizes of split virtqueues must be a power of two, as the ring indices
+// are free-running 16-bit counters.
 
-struct virtio_indirect_desc_table {
-    struct virtq_desc desc[VIRTQ_MAX_DESC_COUNT];
-};
+#define VIRTQ_MAX_DESC_COUNT 128
 
 enum virtq_avail_flags {
     __VIRTQ_AVAIL_F_NO_INTERRUPT = 1 << 0
@@ -545,6 +554,47 @@ struct virtq_used {
     // le16_t avail_event; /* Only if VIRTIO_F_EVENT_IDX */
 };
 
+enum virtq_packed_desc_flags {
+    // This marks a buffer as continuing in the next desc of the ring.
+    __VIRTQ_PACKED_DESC_F_NEXT = 1 << 0,
+    // This marks a buffer as device write-only (otherwise device read-only).
+    __VIRTQ_PACKED_DESC_F_WRITE = 1 << 1,
+    // This means the buffer contains a list of buffer descriptors.
+    __VIRTQ_PACKED_DESC_F_INDIRECT = 1 << 2,
+
+    // A desc is available when its AVAIL bit matches the driver's wrap
+    // counter, and its USED bit doesn't. A desc is used when both bits match
+    // the device's wrap counter.
+
+    __VIRTQ_PACKED_DESC_F_AVAIL = 1 << 7,
+    __VIRTQ_PACKED_DESC_F_USED = 1 << 15,
+};
+
+struct virtq_packed_desc {
+    le64_t phys_addr;
+    le32_t len;
+    le16_t id;
+    le16_t flags;
+};
+
+enum virtq_packed_event_flags {
+    VIRTQ_PACKED_EVENT_FLAGS_ENABLE,
+    VIRTQ_PACKED_EVENT_FLAGS_DISABLE,
+
+    // Only valid if VIRTIO_F_EVENT_IDX was negotiated. The other side only
+    // sends an event once it reaches the desc at off_wrap.
+
+    VIRTQ_PACKED_EVENT_FLAGS_DESC,
+};
+
+#define VIRTQ_PACKED_EVENT_WRAP_SHIFT 15
+
+struct virtq_packed_event {
+    // Desc offset in the lower 15 bits, wrap counter in the top bit.
+    le16_t off_wrap;
+    le16_t flags;
+};
+
 enum virtio_block_feature_flags {
     __VIRTIO_BLOCK_HAS_MAX_SIZE = 1ull << 1,
     __VIRTIO_BLOCK_HAS_SEG_MAX = 1ull << 2,
@@ -6,7 +6,7 @@
 #include "dev/printk.h"
 #include "sys/mmio.h"
 
-#include "device.h"
+#include "queue/queue.h"
 
 uint8_t virtio_pci_read_device_status(struct virtio_device *const device) {
     return mmio_read(&device->pci.common_cfg->device_status);
@@ -117,17 +117,40 @@ virtio_pci_set_selected_queue_size(struct virtio_device *const device,
     mmio_write(&device->pci.common_cfg->queue_size, cpu_to_le(size));
 }
 
-void
+uint32_t
+virtio_pci_selected_queue_notify_offset(struct virtio_device *const device) {
+    const uint16_t notify_off =
+        le_to_cpu(mmio_read(&device->pci.common_cfg->queue_notify_off));
+
+    return (uint32_t)notify_off * device->pci.notify_off_multiplier;
+}
+
+bool
+virtio_pci_set_selected_queue_msix_vector(struct virtio_device *const device,
+                                          const uint16_t vector)
+{
+    mmio_write(&device->pci.common_cfg->queue_msix_vector, cpu_to_le(vector));
+    return le_to_cpu(mmio_read(&device->pci.common_cfg->queue_msix_vector))
+        == vector;
+}
+
+bool
+virtio_pci_set_config_msix_vector(struct virtio_device *const device,
+                                  const uint16_t vector)
+{
+    mmio_write(&device->pci.common_cfg->config_msix_vector, cpu_to_le(vector));
+    return le_to_cpu(mmio_read(&device->pci.common_cfg->config_msix_vector))
+        == vector;
+}
+
+__debug_optimize(3) void
 virtio_pci_notify_queue(struct virtio_device *const device,
-                        const uint16_t index)
+                        const struct virtio_queue *const queue)
 {
-    const uint32_t offset =
-        device->pci.common_cfg->queue_notify_off *
-        device->pci.notify_off_multiplier;
     volatile uint16_t *const ptr =
-        (void *)device->pci.notify_cfg_range.front + offset;
+        (void *)device->pci.notify_cfg_range.front + queue->notify_offset;
 
-    mmio_write(ptr, cpu_to_le(index));
+    mmio_write(ptr, cpu_to_le(queue->index));
 }
 
 void virtio_pci_enable_selected_queue(struct virtio_device *const device) {
@@ -160,7 +183,13 @@ uint8_t virtio_mmio_read_device_status(struct virtio_device *const device) {
 }
 
 uint64_t virtio_mmio_read_device_features(struct virtio_device *const device) {
-    return mmio_read(&device->mmio.header->device_features);
+    mmio_write(&device->mmio.header->device_features_select, 0);
+    const uint32_t lower = mmio_read(&device->mmio.header->device_features);
+
+    mmio_write(&device->mmio.header->device_features_select, 1);
+    const uint32_t upper = mmio_read(&device->mmio.header->device_features);
+
+    return ((uint64_t)upper << 32 | lower);
 }
 
 void
@@ -278,17 +307,27 @@ virtio_mmio_set_selected_queue_size(struct virtio_device *const device,
     mmio_write(&device->mmio.header->queue_num, size);
 }
 
-void
+__debug_optimize(3) void
 virtio_mmio_notify_queue(struct virtio_device *const device,
-                         const uint16_t index)
+                         const struct virtio_queue *const queue)
 {
-    mmio_write(&device->mmio.header->queue_notify, index);
+    mmio_write(&device->mmio.header->queue_notify, queue->index);
 }
 
 void virtio_mmio_enable_selected_queue(struct virtio_device *const device) {
     mmio_write(&device->mmio.header->queue_ready, 1);
 }
 
+__debug_optimize(3)
+uint32_t virtio_mmio_ack_interrupts(struct virtio_device *const device) {
+    const uint32_t status = mmio_read(&device->mmio.header->interrupt_status);
+    if (status != 0) {
+        mmio_write(&device->mmio.header->interrupt_ack, status);
+    }
+
+    return status;
+}
+
 void
 virtio_mmio_set_selected_queue_desc_phys(struct virtio_device *const device,
                                          const uint64_t phys)
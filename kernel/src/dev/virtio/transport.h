@@ -4,9 +4,11 @@
  */
 
 #pragma once
+#include <stdbool.h>
 #include <stdint.h>
 
 struct virtio_device;
+struct virtio_queue;
 
 uint8_t virtio_pci_read_device_status(struct virtio_device *device);
 uint64_t virtio_pci_read_device_features(struct virtio_device *device);
@@ -35,7 +37,25 @@ uint16_t virtio_pci_selected_queue_max_size(struct virtio_device *device);
 void
 virtio_pci_set_selected_queue_size(struct virtio_device *device, uint16_t size);
 
-void virtio_pci_notify_queue(struct virtio_device *device, uint16_t index);
+uint32_t
+virtio_pci_selected_queue_notify_offset(struct virtio_device *device);
+
+// Route the selected queue's, or the config-space's, interrupts to the msix
+// table entry at `vector`. Returns false if the device couldn't allocate the
+// resources to use the vector.
+
+bool
+virtio_pci_set_selected_queue_msix_vector(struct virtio_device *device,
+                                          uint16_t vector);
+
+bool
+virtio_pci_set_config_msix_vector(struct virtio_device *device,
+                                  uint16_t vector);
+
+void
+virtio_pci_notify_queue(struct virtio_device *device,
+                        const struct virtio_queue *queue);
+
 void virtio_pci_enable_selected_queue(struct virtio_device *device);
 
 void
@@ -78,9 +98,17 @@ void
 virtio_mmio_set_selected_queue_size(struct virtio_device *device,
                                     uint16_t size);
 
-void virtio_mmio_notify_queue(struct virtio_device *device, uint16_t index);
+void
+virtio_mmio_notify_queue(struct virtio_device *device,
+                         const struct virtio_queue *queue);
+
 void virtio_mmio_enable_selected_queue(struct virtio_device *device);
 
+// Acknowledge the device's pending interrupts, returning the
+// interrupt-status bits that were acknowledged.
+
+uint32_t virtio_mmio_ack_interrupts(struct virtio_device *device);
+
 void
 virtio_mmio_set_selected_queue_desc_phys(struct virtio_device *device,
                                          uint64_t phys);
@@ -150,10 +178,13 @@ virtio_mmio_set_selected_queue_device_phys(struct virtio_device *device,
     ((device)->transport_kind == VIRTIO_DEVICE_TRANSPORT_PCI ? \
         virtio_pci_set_selected_queue_size((device), (size)) : \
         virtio_mmio_set_selected_queue_size((device), (size)))
-#define virtio_device_notify_queue(device, index) \
+#define virtio_device_selected_queue_notify_offset(device) \
+    ((device)->transport_kind == VIRTIO_DEVICE_TRANSPORT_PCI ? \
+        virtio_pci_selected_queue_notify_offset((device)) : 0)
+#define virtio_device_notify_queue(device, queue) \
     ((device)->transport_kind == VIRTIO_DEVICE_TRANSPORT_PCI ? \
-        virtio_pci_notify_queue((device), (index)) : \
-        virtio_mmio_notify_queue((device), (index)))
+        virtio_pci_notify_queue((device), (queue)) : \
+        virtio_mmio_notify_queue((device), (queue)))
 #define virtio_device_enable_selected_queue(device) \
     ((device)->transport_kind == VIRTIO_DEVICE_TRANSPORT_PCI ? \
         virtio_pci_enable_selected_queue((device)) : \
@@ -15,15 +15,24 @@
 
 #include "dev/flanterm.h"
 #include "dev/init.h"
+#include "dev/irq_balance.h"
 #include "dev/printk.h"
+#include "dev/probe.h"
 
+#include "mm/bench.h"
 #include "mm/early.h"
+#include "mm/fault.h"
+#include "mm/numa.h"
 #include "mm/page_alloc.h"
+#include "mm/shootdown.h"
+#include "mm/thp.h"
 
+#include "sched/bench.h"
 #include "sched/scheduler.h"
 #include "sched/sleep.h"
 
 #include "sys/boot.h"
+#include "time/time.h"
 
 // Set the base revision to 1, this is recommended as this is the latest
 // base revision described by the Limine boot protocol specification.
@@ -56,6 +65,20 @@ static void test_alloc_largepage() {
     }
 }
 
+// Print how long the phase of boot that started at `begin` took, and return
+// the time the next phase begins at.
+
+static nsec_t print_phase_time(const char *const name, const nsec_t begin) {
+    const nsec_t end = nsec_since_boot();
+    printk(LOGLEVEL_INFO,
+           "kernel: %s took %" PRIu64 "us (%" PRIu64 "us since boot)\n",
+           name,
+           nano_to_micro(end - begin),
+           nano_to_micro(end));
+
+    return end;
+}
+
 void arch_init();
 void arch_early_init();
 void arch_post_mm_init();
@@ -83,24 +106,47 @@ void kmain(void) {
     printk(LOGLEVEL_INFO, "Console is working?\n");
 
     boot_post_early_init();
+    numa_init();
     mm_init();
 
     arch_init();
     arch_post_mm_init();
 
     smp_init();
+    numa_init_cpus();
     dtb_parse_main_tree();
 
     isr_init();
+    tlb_shootdown_init();
+    page_fault_init();
+
     enable_interrupts();
 
     dev_init();
     sched_init();
+    thp_init();
+    printk_init();
 
+    nsec_t phase_begin = nsec_since_boot();
     smp_boot_all_cpus();
+    phase_begin = print_phase_time("smp-boot", phase_begin);
+
+    mm_deferred_init_start();
     dev_init_drivers();
+    probe_wait_for_required();
+
+    print_phase_time("drivers", phase_begin);
+#if defined(IRQ_BALANCE)
+    irq_balance_init();
+#endif /* defined(IRQ_BALANCE) */
 
     test_alloc_largepage();
+#if defined(SCHED_BENCH)
+    sched_bench_thread_storm();
+#endif /* defined(SCHED_BENCH) */
+#if defined(MM_BENCH) && defined(__x86_64__)
+    mm_bench_page_faults();
+#endif /* defined(MM_BENCH) && defined(__x86_64__) */
 
     printk(LOGLEVEL_INFO, "kernel: finished initializing\n");
     sched_sleep_us(seconds_to_micro(5));
@@ -0,0 +1,117 @@
+/*
+ * kernel/src/mm/asid.c
+ * © suhas pai
+ */
+
+#include "asm/irqs.h"
+#include "cpu/info.h"
+#include "dev/printk.h"
+
+#if __has_include("mm/tlb.h")
+    #include "mm/tlb.h"
+#endif /* __has_include("mm/tlb.h") */
+
+#include "sched/process.h"
+
+#include "asid.h"
+#include "pagemap.h"
+
+void asid_cpu_state_init(struct asid_cpu_state *const state) {
+    for (uint8_t i = 0; i != ASID_SLOT_COUNT; i++) {
+        state->slot_list[i] = (struct asid_slot){
+            .pagemap = NULL,
+            .generation = 0,
+            .tlb_gen = 0,
+            .asid = ASID_KERNEL,
+        };
+    }
+
+    state->generation = 1;
+    state->rollover_count = 0;
+    state->next_asid = ASID_KERNEL + 1;
+    state->max_asid = 0;
+    state->next_victim = 0;
+}
+
+void asid_init_on_this_cpu(const uint16_t max_asid) {
+    assert(!are_interrupts_enabled());
+
+    struct asid_cpu_state *const state = &this_cpu_mut()->asid_state;
+    state->max_asid = max_asid;
+
+    if (max_asid != 0) {
+        printk(LOGLEVEL_INFO,
+               "asid: cpu %" PRIu32 " has %" PRIu16 " asids\n",
+               cpu_get_id(this_cpu()),
+               max_asid);
+    }
+}
+
+__debug_optimize(3) static void rollover(struct asid_cpu_state *const state) {
+    // Every asid handed out so far may still have tlb entries, so flush them
+    // all before handing any of them out again.
+
+    state->generation++;
+    state->rollover_count++;
+    state->next_asid = ASID_KERNEL + 1;
+
+#if __has_include("mm/tlb.h")
+    struct tlb_flush_batch batch = TLB_FLUSH_BATCH_INIT();
+
+    batch.full = true;
+    batch.global = true;
+
+    tlb_flush_local(&batch);
+#endif /* __has_include("mm/tlb.h") */
+}
+
+__debug_optimize(3)
+struct asid_result asid_get_for_pagemap(struct pagemap *const pagemap) {
+    assert(!are_interrupts_enabled());
+
+    struct asid_cpu_state *const state = &this_cpu_mut()->asid_state;
+    if (pagemap == &kernel_process.pagemap || state->max_asid == 0) {
+        return (struct asid_result){
+            .asid = ASID_KERNEL,
+            .need_flush = true
+        };
+    }
+
+    const uint64_t tlb_gen =
+        atomic_load_explicit(&pagemap->tlb_gen, memory_order_acquire);
+
+    for (uint8_t i = 0; i != ASID_SLOT_COUNT; i++) {
+        struct asid_slot *const slot = &state->slot_list[i];
+        if (slot->pagemap != pagemap || slot->generation != state->generation) {
+            continue;
+        }
+
+        // The pagemap was shot down while this cpu wasn't using it, so the
+        // asid's entries may be stale.
+
+        const bool need_flush = slot->tlb_gen != tlb_gen;
+        slot->tlb_gen = tlb_gen;
+
+        return (struct asid_result){
+            .asid = slot->asid,
+            .need_flush = need_flush
+        };
+    }
+
+    if (state->next_asid > state->max_asid) {
+        rollover(state);
+    }
+
+    struct asid_slot *const slot = &state->slot_list[state->next_victim];
+    state->next_victim = (state->next_victim + 1) % ASID_SLOT_COUNT;
+
+    *slot = (struct asid_slot){
+        .pagemap = pagemap,
+        .generation = state->generation,
+        .tlb_gen = tlb_gen,
+        .asid = (uint16_t)state->next_asid,
+    };
+
+    state->next_asid++;
+    return (struct asid_result){ .asid = slot->asid, .need_flush = false };
+}
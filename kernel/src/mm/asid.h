@@ -0,0 +1,86 @@
+/*
+ * kernel/src/mm/asid.h
+ * © suhas pai
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "lib/macros.h"
+
+// Number of pagemaps each cpu keeps an asid around for. A pagemap that's
+// switched back to while it still has its slot keeps its tlb entries.
+
+#define ASID_SLOT_COUNT 8
+
+// The kernel's pagemap always uses asid 0, which is never handed out to other
+// pagemaps.
+
+#define ASID_KERNEL 0
+
+struct pagemap;
+struct asid_slot {
+    struct pagemap *pagemap;
+
+    // The cpu's generation when the asid was handed out. The slot is stale
+    // once the cpu moves on to a new generation.
+
+    uint64_t generation;
+
+    // The pagemap's tlb-gen when the asid's tlb entries were last known to be
+    // up to date.
+
+    uint64_t tlb_gen;
+    uint16_t asid;
+};
+
+// Asids are handed out per-cpu, in order, so an asid is never reused within a
+// generation and needs no flush when handed out. Running out of asids starts
+// a new generation, which flushes every asid on the cpu.
+
+struct asid_cpu_state {
+    struct asid_slot slot_list[ASID_SLOT_COUNT];
+
+    uint64_t generation;
+    uint64_t rollover_count;
+
+    uint32_t next_asid;
+
+    // Zero if the cpu doesn't support asids, in which case every pagemap uses
+    // ASID_KERNEL and is flushed on every switch.
+
+    uint16_t max_asid;
+    uint8_t next_victim;
+};
+
+#define ASID_CPU_STATE_INIT() \
+    { \
+        .slot_list = {}, \
+        .generation = 1, \
+        .rollover_count = 0, \
+        .next_asid = ASID_KERNEL + 1, \
+        .max_asid = 0, \
+        .next_victim = 0 \
+    }
+
+struct asid_result {
+    uint16_t asid;
+
+    // Set if the asid may have stale tlb entries, and has to be flushed when
+    // the pagemap is loaded.
+
+    bool need_flush : 1;
+};
+
+void asid_cpu_state_init(struct asid_cpu_state *state);
+
+// Start handing out asids on this cpu, up to `max_asid`.
+void asid_init_on_this_cpu(uint16_t max_asid);
+
+// Find the asid to load `pagemap` with on this cpu, handing out a new one if
+// needed. Must be called with interrupts disabled and with the pagemap's
+// cpu-lock held.
+
+struct asid_result asid_get_for_pagemap(struct pagemap *pagemap);
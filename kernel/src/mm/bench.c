@@ -0,0 +1,67 @@
+/*
+ * kernel/src/mm/bench.c
+ * © suhas pai
+ */
+
+#include "dev/printk.h"
+#include "sched/process.h"
+#include "time/time.h"
+
+#include "bench.h"
+#include "fault.h"
+#include "vma.h"
+
+static volatile uint8_t *create_region() {
+    struct vm_area *const vma =
+        vma_create_anonymous(&kernel_process.pagemap,
+                             RANGE_INIT(gib(1), gib(64)),
+                             MM_BENCH_REGION_SIZE,
+                             /*align=*/0,
+                             PROT_READ | PROT_WRITE);
+
+    if (vma == NULL) {
+        return NULL;
+    }
+
+    return (volatile uint8_t *)vma->node.range.front;
+}
+
+static void print_pass(const char *const name, const nsec_t elapsed) {
+    const uint64_t page_count = PAGE_COUNT(MM_BENCH_REGION_SIZE);
+    printk(LOGLEVEL_INFO,
+           "mm: bench: %s: %" PRIu64 "ns per page\n",
+           name,
+           elapsed / page_count);
+}
+
+void mm_bench_page_faults() {
+    volatile uint8_t *const read_region = create_region();
+    volatile uint8_t *const write_region = create_region();
+
+    if (read_region == NULL || write_region == NULL) {
+        printk(LOGLEVEL_WARN, "mm: bench: failed to create vm_areas\n");
+        return;
+    }
+
+    nsec_t begin = nsec_since_boot();
+    for (uint64_t i = 0; i < MM_BENCH_REGION_SIZE; i += PAGE_SIZE) {
+        (void)read_region[i];
+    }
+
+    print_pass("read", nsec_since_boot() - begin);
+
+    begin = nsec_since_boot();
+    for (uint64_t i = 0; i < MM_BENCH_REGION_SIZE; i += PAGE_SIZE) {
+        read_region[i] = 1;
+    }
+
+    print_pass("write after read", nsec_since_boot() - begin);
+
+    begin = nsec_since_boot();
+    for (uint64_t i = 0; i < MM_BENCH_REGION_SIZE; i += PAGE_SIZE) {
+        write_region[i] = 1;
+    }
+
+    print_pass("write", nsec_since_boot() - begin);
+    page_fault_print_stats();
+}
@@ -0,0 +1,21 @@
+/*
+ * kernel/src/mm/bench.h
+ * © suhas pai
+ */
+
+#pragma once
+
+#include "lib/size.h"
+
+// Kept below THP_SIZE, so every fault is resolved with a single page.
+#define MM_BENCH_REGION_SIZE kib(512)
+
+// Fault in fresh anonymous vm_areas of the kernel's pagemap, first by reading
+// every page, then by writing to every page already read, and then by writing
+// to every page of another vm_area, and report the time taken per page.
+//
+// The vm_areas are placed in the lower-half of the kernel's pagemap, which is
+// otherwise unused, and are left in place as vm_areas can't be removed yet.
+// Requires an arch that resolves kernel page-faults with handle_page_fault().
+
+void mm_bench_page_faults();
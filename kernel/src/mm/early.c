@@ -9,7 +9,9 @@
 #include "lib/size.h"
 
 #include "sched/process.h"
+#include "sched/scheduler.h"
 #include "sys/boot.h"
+#include "time/time.h"
 
 #include "early.h"
 #include "kmalloc.h"
@@ -694,10 +696,11 @@ static void mark_crucial_pages(const struct page_section *const memmap) {
 
 __debug_optimize(3) static void
 set_section_for_pages(const struct page_section *const memmap,
+                      struct list *const freepage_list,
                       const page_section_t section)
 {
     struct freepage_list_info *iter = NULL;
-    list_foreach(iter, &g_freepage_list, list) {
+    list_foreach(iter, freepage_list, list) {
         uint64_t iter_phys = virt_to_phys(iter);
         uint64_t back_phys =
             iter_phys + (iter->avail_page_count << PAGE_SHIFT) - PAGE_SIZE;
@@ -726,85 +729,295 @@ set_section_for_pages(const struct page_section *const memmap,
     }
 }
 
+// Free pages into the buddy allocator while ensuring
+//  (1) The range of pages belong to the same zone.
+//  (2) The buddies of the first page for each order from 0...order are
+//      located after the first page.
+
+__debug_optimize(3) static void free_range(uint64_t phys, uint64_t avail) {
+    struct page *page = phys_to_page(phys);
+    struct page_section *section = page_to_section(page);
+
+    // iorder is log2() of the number of available pages.
+    int8_t iorder = MAX_ORDER - 1;
+
+    do {
+        for (; iorder >= 0; iorder--) {
+            if (avail >= 1ull << iorder) {
+                break;
+            }
+        }
+
+        // jorder is the order of pages that all fit in the same zone.
+        // jorder should be equal to iorder in most cases, except for when a
+        // section crosses the boundary of two zones.
+
+        int8_t jorder = iorder;
+        for (; jorder >= 0; jorder--) {
+            const struct page *const back_page = page + (1ull << jorder) - 1;
+            if (section == page_to_section(back_page)) {
+                break;
+            }
+        }
+
+        // Sections whose initialization was deferred are freed into while
+        // other cpus may be allocating from them.
+
+        const uint8_t highest_jorder = (uint8_t)jorder;
+        const int flag = spin_acquire_save_irq(&section->lock);
+
+        if (section->max_order <= highest_jorder) {
+            section->max_order = highest_jorder + 1;
+        }
+
+        early_free_pages_from_section(page, section, (uint8_t)jorder);
+        if (section->min_order > (uint8_t)jorder) {
+            section->min_order = (uint8_t)jorder;
+        }
+
+        spin_release_restore_irq(&section->lock, flag);
+
+        const uint64_t free_count = 1ull << jorder;
+        avail -= free_count;
+
+        if (avail == 0) {
+            break;
+        }
+
+        page += free_count;
+        phys += free_count << PAGE_SHIFT;
+        section = page_to_section(page);
+    } while (true);
+}
+
 __debug_optimize(3) static uint64_t free_all_pages() {
     struct freepage_list_info *iter = NULL;
     struct freepage_list_info *tmp = NULL;
 
-    /*
-     * Free pages into the buddy allocator while ensuring
-     *  (1) The range of pages belong to the same zone.
-     *  (2) The buddies of the first page for each order from 0...order are
-     *      located after the first page.
-     */
-
     uint64_t free_page_count = 0;
     list_foreach_reverse_mut(iter, tmp, &g_asc_freelist, asc_list) {
-        uint64_t phys = virt_to_phys(iter);
-        uint64_t avail = iter->avail_page_count;
+        const uint64_t avail = iter->avail_page_count;
 
-        struct page *page = phys_to_page(phys);
-        struct page_section *section = page_to_section(page);
+        free_range(virt_to_phys(iter), avail);
+        list_deinit(&iter->list);
 
-        // iorder is log2() of the number of available pages.
-        int8_t iorder = MAX_ORDER - 1;
+        free_page_count += avail;
+    }
 
-        do {
-            for (; iorder >= 0; iorder--) {
-                if (avail >= 1ull << iorder) {
-                    break;
-                }
-            }
+    return free_page_count;
+}
 
-            // jorder is the order of pages that all fit in the same zone.
-            // jorder should be equal to iorder in most cases, except for when a
-            // section crosses the boundary of two zones.
+static uint32_t g_deferred_section_count = 0;
+static uint64_t g_deferred_page_count = 0;
 
-            int8_t jorder = iorder;
-            for (; jorder >= 0; jorder--) {
-                const struct page *const back_page =
-                    page + (1ull << jorder) - 1;
+static _Atomic uint32_t g_deferred_remaining = 0;
+static _Atomic uint32_t g_deferred_worker_index = 0;
+static nsec_t g_deferred_begin = 0;
 
-                if (section == page_to_section(back_page)) {
-                    break;
-                }
-            }
+// Only the sections of the nodes' zones past the first MM_BOOT_INIT_SIZE bytes
+// of free memory are deferred, and only if none of their free ranges extend
+// past the section.
 
-            const uint8_t highest_jorder = (uint8_t)jorder;
-            if (section->max_order <= highest_jorder) {
-                section->max_order = highest_jorder + 1;
-            }
+__debug_optimize(3) static bool
+section_can_be_deferred(const struct page_section *const section) {
+    if (section->zone == page_zone_low4g()) {
+        return false;
+    }
 
-            const uint64_t free_count = 1ull << jorder;
-            early_free_pages_from_section(page, section, (uint8_t)jorder);
+    struct freepage_list_info *iter = NULL;
+    list_foreach(iter, &g_freepage_list, list) {
+        const struct range range =
+            RANGE_INIT(virt_to_phys(iter),
+                       iter->avail_page_count << PAGE_SHIFT);
+
+        if (range_overlaps(range, section->range)
+         && !range_has(section->range, range))
+        {
+            return false;
+        }
+    }
 
-            if (section->min_order > (uint8_t)jorder) {
-                section->min_order = (uint8_t)jorder;
-            }
+    return true;
+}
 
-            const struct range freed_range =
-                RANGE_INIT(phys, free_count << PAGE_SHIFT);
+// Move the free ranges of every section that's deferred off of the freelists,
+// so free_all_pages() skips them.
 
-            printk(LOGLEVEL_INFO,
-                   "mm: freed %" PRIu64 " pages at " RANGE_FMT " to zone %s\n",
-                   free_count,
-                   RANGE_FMT_ARGS(freed_range),
-                   section->zone->name);
+__debug_optimize(3) static void defer_sections() {
+    struct page_section *const begin = mm_get_page_section_list();
+    const struct page_section *const end = begin + mm_get_section_count();
 
-            avail -= free_count;
-            if (avail == 0) {
-                break;
+    uint64_t boot_size = 0;
+    for (__auto_type section = begin; section != end; section++) {
+        list_init(&section->deferred_list);
+        if (boot_size < MM_BOOT_INIT_SIZE || !section_can_be_deferred(section))
+        {
+            boot_size += section->range.size;
+            continue;
+        }
+
+        uint64_t page_count = 0;
+
+        struct freepage_list_info *iter = NULL;
+        struct freepage_list_info *tmp = NULL;
+
+        list_foreach_mut(iter, tmp, &g_freepage_list, list) {
+            if (!range_has_loc(section->range, virt_to_phys(iter))) {
+                continue;
             }
 
-            page += free_count;
-            phys += freed_range.size;
-            section = page_to_section(page);
-        } while (true);
+            list_remove(&iter->asc_list);
+            list_remove(&iter->list);
+
+            list_add(&section->deferred_list, &iter->list);
+            page_count += iter->avail_page_count;
+        }
+
+        if (page_count == 0) {
+            continue;
+        }
 
+        section->is_deferred = true;
+        g_deferred_section_count++;
+        g_deferred_page_count += page_count;
+    }
+
+    g_deferred_remaining = g_deferred_section_count;
+    if (g_deferred_section_count != 0) {
+        printk(LOGLEVEL_INFO,
+               "mm: deferring init of %" PRIu32 " section(s) with %" PRIu64 " "
+               "free pages\n",
+               g_deferred_section_count,
+               g_deferred_page_count);
+    }
+}
+
+// Initialize the struct pages of a deferred section and free its ranges into
+// the buddy allocator. Returns the number of pages freed.
+
+__debug_optimize(3) static uint64_t
+init_deferred_section(struct page_section *const section) {
+    const page_section_t number =
+        (page_section_t)(section - mm_get_page_section_list()) + 1;
+
+    set_section_for_pages(section, &section->deferred_list, number);
+
+    struct freepage_list_info *iter = NULL;
+    struct freepage_list_info *tmp = NULL;
+
+    uint64_t page_count = 0;
+    list_foreach_mut(iter, tmp, &section->deferred_list, list) {
+        const uint64_t avail = iter->avail_page_count;
         list_deinit(&iter->list);
-        free_page_count += iter->avail_page_count;
+
+        free_range(virt_to_phys(iter), avail);
+        page_count += avail;
     }
 
-    return free_page_count;
+    return page_count;
+}
+
+__debug_optimize(3) bool mm_deferred_init_pending() {
+    return atomic_load_explicit(&g_deferred_remaining, memory_order_acquire)
+        != 0;
+}
+
+__debug_optimize(3) uint64_t mm_deferred_init_one() {
+    if (atomic_load_explicit(&g_deferred_remaining, memory_order_relaxed) == 0)
+    {
+        return 0;
+    }
+
+    struct page_section *const begin = mm_get_page_section_list();
+    const struct page_section *const end = begin + mm_get_section_count();
+
+    for (__auto_type section = begin; section != end; section++) {
+        if (!atomic_exchange_explicit(&section->is_deferred,
+                                      false,
+                                      memory_order_acquire))
+        {
+            continue;
+        }
+
+        const uint64_t page_count = init_deferred_section(section);
+        const uint32_t remaining =
+            atomic_fetch_sub_explicit(&g_deferred_remaining,
+                                      1,
+                                      memory_order_release) - 1;
+
+        if (remaining == 0 && g_deferred_begin != 0) {
+            printk(LOGLEVEL_INFO,
+                   "mm: finished deferred init of %" PRIu64 " pages in "
+                   "%" PRIu64 "us\n",
+                   g_deferred_page_count,
+                   nano_to_micro(nsec_since_boot() - g_deferred_begin));
+        }
+
+        return page_count;
+    }
+
+    return 0;
+}
+
+__noreturn static void deferred_init_worker() {
+    const uint32_t index =
+        atomic_fetch_add_explicit(&g_deferred_worker_index,
+                                  1,
+                                  memory_order_relaxed);
+
+    const nsec_t begin = nsec_since_boot();
+
+    uint32_t section_count = 0;
+    uint64_t page_count = 0;
+
+    do {
+        const uint64_t count = mm_deferred_init_one();
+        if (count == 0) {
+            break;
+        }
+
+        section_count++;
+        page_count += count;
+    } while (true);
+
+    printk(LOGLEVEL_INFO,
+           "mm: deferred-init worker %" PRIu32 " initialized %" PRIu32 " "
+           "section(s) with %" PRIu64 " pages in %" PRIu64 "us\n",
+           index,
+           section_count,
+           page_count,
+           nano_to_micro(nsec_since_boot() - begin));
+
+    sched_dequeue_thread(current_thread());
+    sched_yield();
+
+    verify_not_reached();
+}
+
+void mm_deferred_init_start() {
+    if (g_deferred_section_count == 0) {
+        return;
+    }
+
+    const uint32_t cpu_count =
+        (uint32_t)list_count(cpus_get_list(), struct cpu_info, cpu_list);
+    const uint32_t worker_count = min(cpu_count, g_deferred_section_count);
+
+    g_deferred_begin = nsec_since_boot();
+
+    uint32_t created_count = 0;
+    for (; created_count != worker_count; created_count++) {
+        if (sched_create_kernel_thread(deferred_init_worker) == NULL) {
+            printk(LOGLEVEL_WARN,
+                   "mm: failed to create deferred-init worker, remaining "
+                   "sections will be initialized on demand\n");
+            break;
+        }
+    }
+
+    printk(LOGLEVEL_INFO,
+           "mm: started %" PRIu32 " deferred-init worker(s)\n",
+           created_count);
 }
 
 extern struct page_section *boot_add_section_at(struct page_section *section);
@@ -919,9 +1132,13 @@ void mm_post_arch_init() {
     // Start section-numbers at one so we can see if there's any pages missing
     // a section, which would have a section of 0.
 
+    defer_sections();
+
     uint64_t number = 1;
     for (__auto_type section = begin; section != end; section++, number++) {
-        set_section_for_pages(section, /*section=*/number);
+        if (!section->is_deferred) {
+            set_section_for_pages(section, &g_freepage_list, number);
+        }
     }
 
     printk(LOGLEVEL_INFO, "mm: finished setting up structpage table\n");
@@ -5,12 +5,37 @@
 
 #pragma once
 
+#include "lib/size.h"
 #include "mm_types.h"
 #include "section.h"
 
+// Only the first MM_BOOT_INIT_SIZE bytes of usable memory have their struct
+// pages initialized and freed into the buddy allocator on the boot cpu. The
+// rest of the default zone's sections are deferred, and are initialized by
+// worker threads on every cpu once mm_deferred_init_start() is called after
+// the APs are up. An allocation that fails before the workers finish
+// initializes a deferred section itself, see mm_deferred_init_one().
+
+#define MM_BOOT_INIT_SIZE gib(1)
+
 void mm_early_init();
 void mm_post_arch_init();
 
+// Initialize one deferred section, if any are left. Returns the number of pages
+// freed, or 0 if there were no deferred sections left.
+//
+// Every section is initialized in one go, which takes a while, and may be
+// done from alloc_pages() with interrupts disabled.
+
+uint64_t mm_deferred_init_one();
+
+// Returns whether any deferred section has yet to be freed into the buddy
+// allocator, including those that mm_deferred_init_one() already returned 0
+// for, as another cpu is still initializing them.
+
+bool mm_deferred_init_pending();
+void mm_deferred_init_start();
+
 void mm_init();
 void mm_early_refcount_alloced_map(uint64_t virt_addr, uint64_t length);
 
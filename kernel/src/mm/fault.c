@@ -0,0 +1,320 @@
+/*
+ * kernel/src/mm/fault.c
+ * © suhas pai
+ */
+
+#include <stdatomic.h>
+
+#include "asm/irqs.h"
+#include "cpu/info.h"
+#include "dev/printk.h"
+
+#include "lib/align.h"
+#include "lib/refcount.h"
+#include "lib/util.h"
+
+#if __has_include("mm/tlb.h")
+    #include "mm/tlb.h"
+#endif /* __has_include("mm/tlb.h") */
+
+#include "mm/page_alloc.h"
+#include "mm/pagemap.h"
+#include "mm/pgmap.h"
+#include "mm/shootdown.h"
+
+#include "time/time.h"
+
+#include "fault.h"
+#include "thp.h"
+
+static struct page *g_zero_page = NULL;
+static uint64_t g_zero_page_phys = INVALID_PHYS;
+
+static _Atomic uint64_t g_minor_count = 0;
+static _Atomic uint64_t g_zero_page_count = 0;
+static _Atomic uint64_t g_fault_around_count = 0;
+static _Atomic uint64_t g_spurious_count = 0;
+static _Atomic uint64_t g_failed_count = 0;
+
+static _Atomic nsec_t g_total_nsec = 0;
+static _Atomic nsec_t g_max_nsec = 0;
+
+__debug_optimize(3) static inline bool
+map_zero_page(struct pagemap *const pagemap,
+              const struct vm_area *const vma,
+              const uint64_t addr)
+{
+    // Every mapping of the zero-page holds a reference, which is dropped when
+    // the mapping is overwritten or unmapped. The zero-page's own reference
+    // keeps it from ever being freed.
+
+    ref_up(&g_zero_page->used.refcount);
+    const bool result =
+        arch_make_mapping(pagemap,
+                          RANGE_INIT(g_zero_page_phys, PAGE_SIZE),
+                          addr,
+                          rm_mask(vma->prot, PROT_WRITE),
+                          vma->cachekind,
+                          /*is_overwrite=*/false);
+
+    if (!result) {
+        ref_down(&g_zero_page->used.refcount);
+    }
+
+    return result;
+}
+
+// Map the zero-page into every unmapped page of the fault-around window of
+// `addr`, except for `addr` itself.
+
+__debug_optimize(3) static void
+fault_around(struct pagemap *const pagemap,
+             const struct vm_area *const vma,
+             const uint64_t addr)
+{
+    const uint64_t window_size = PAGE_FAULT_AROUND_PAGES * PAGE_SIZE;
+    const uint64_t vma_end = range_get_end_assert(vma->node.range);
+
+    const uint64_t front =
+        max(align_down(addr, window_size), vma->node.range.front);
+    const uint64_t end = min(front + window_size, vma_end);
+
+    uint64_t count = 0;
+    for (uint64_t page_addr = front; page_addr < end; page_addr += PAGE_SIZE) {
+        if (page_addr == addr
+         || pagemap_virt_get_phys(pagemap, page_addr) != INVALID_PHYS)
+        {
+            continue;
+        }
+
+        // Fault-around is only an optimization, so just stop on failure and
+        // let the rest of the window fault in normally.
+
+        if (!map_zero_page(pagemap, vma, page_addr)) {
+            break;
+        }
+
+        count++;
+    }
+
+    atomic_fetch_add_explicit(&g_fault_around_count,
+                              count,
+                              memory_order_relaxed);
+}
+
+// Another cpu may have resolved the fault before we took the vm_area's lock,
+// in which case this cpu may only have a stale entry left in its tlb.
+
+__debug_optimize(3) static void flush_spurious(const uint64_t addr) {
+#if __has_include("mm/tlb.h")
+    struct tlb_flush_batch batch = TLB_FLUSH_BATCH_INIT();
+    tlb_flush_batch_add(&batch, RANGE_INIT(addr, PAGE_SIZE));
+
+    tlb_flush_local(&batch);
+#else
+    (void)addr;
+#endif /* __has_include("mm/tlb.h") */
+
+    atomic_fetch_add_explicit(&g_spurious_count, 1, memory_order_relaxed);
+}
+
+__debug_optimize(3) static enum page_fault_result
+resolve_read_fault(struct pagemap *const pagemap,
+                   const struct vm_area *const vma,
+                   const uint64_t addr)
+{
+    if (pagemap_virt_get_phys(pagemap, addr) != INVALID_PHYS) {
+        flush_spurious(addr);
+        return E_PAGE_FAULT_OK;
+    }
+
+    if (!map_zero_page(pagemap, vma, addr)) {
+        return E_PAGE_FAULT_NO_MEM;
+    }
+
+    atomic_fetch_add_explicit(&g_zero_page_count, 1, memory_order_relaxed);
+    fault_around(pagemap, vma, addr);
+
+    return E_PAGE_FAULT_OK;
+}
+
+__debug_optimize(3) static enum page_fault_result
+resolve_write_fault(struct pagemap *const pagemap,
+                    struct vm_area *const vma,
+                    const uint64_t addr)
+{
+    const uint64_t phys = pagemap_virt_get_phys(pagemap, addr);
+    if (phys != INVALID_PHYS && phys != g_zero_page_phys) {
+        flush_spurious(addr);
+        return E_PAGE_FAULT_OK;
+    }
+
+    if (phys == INVALID_PHYS && thp_try_fault(pagemap, vma, addr)) {
+        return E_PAGE_FAULT_OK;
+    }
+
+    struct page *const page = alloc_page(PAGE_STATE_USED, __ALLOC_ZERO);
+    if (page == NULL) {
+        return E_PAGE_FAULT_NO_MEM;
+    }
+
+    const bool is_overwrite = phys == g_zero_page_phys;
+    const bool map_result =
+        arch_make_mapping(pagemap,
+                          RANGE_INIT(page_to_phys(page), PAGE_SIZE),
+                          addr,
+                          vma->prot,
+                          vma->cachekind,
+                          is_overwrite);
+
+    if (!map_result) {
+        free_page(page);
+        return E_PAGE_FAULT_NO_MEM;
+    }
+
+    // Faulting-around isn't done here, as mapping the zero-page around a write
+    // would have the likely writes to the following pages each overwrite it,
+    // which needs a tlb shootdown, rather than take a not-present fault.
+
+    atomic_fetch_add_explicit(&pagemap->anon_page_count,
+                              1,
+                              memory_order_relaxed);
+
+    return E_PAGE_FAULT_OK;
+}
+
+__debug_optimize(3) bool page_fault_is_zero_page(const uint64_t phys) {
+    return phys == g_zero_page_phys;
+}
+
+__debug_optimize(3) static bool
+access_allowed(const struct vm_area *const vma, const uint32_t flags) {
+    if ((flags & __PAGE_FAULT_USER) != 0 && (vma->prot & PROT_USER) == 0) {
+        return false;
+    }
+
+    if ((flags & __PAGE_FAULT_WRITE) != 0) {
+        return (vma->prot & PROT_WRITE) != 0;
+    }
+
+    if ((flags & __PAGE_FAULT_EXEC) != 0) {
+        return (vma->prot & PROT_EXEC) != 0;
+    }
+
+    return (vma->prot & PROT_READ) != 0;
+}
+
+__debug_optimize(3) static void record_latency(const nsec_t duration) {
+    atomic_fetch_add_explicit(&g_total_nsec, duration, memory_order_relaxed);
+    nsec_t max = atomic_load_explicit(&g_max_nsec, memory_order_relaxed);
+
+    while (duration > max) {
+        if (atomic_compare_exchange_weak_explicit(&g_max_nsec,
+                                                  &max,
+                                                  duration,
+                                                  memory_order_relaxed,
+                                                  memory_order_relaxed))
+        {
+            break;
+        }
+    }
+}
+
+enum page_fault_result
+handle_page_fault(struct pagemap *const pagemap,
+                  const uint64_t addr,
+                  const uint32_t flags)
+{
+    assert(!are_interrupts_enabled());
+    if (g_zero_page_phys == INVALID_PHYS) {
+        return E_PAGE_FAULT_NO_VMA;
+    }
+
+    const nsec_t start = nsec_since_boot();
+    const uint64_t page_addr = align_down(addr, PAGE_SIZE);
+
+    spin_acquire(&pagemap->addrspace_lock);
+    struct addrspace_node *const node =
+        addrspace_find_node_for_loc(&pagemap->addrspace, page_addr);
+
+    if (node == NULL) {
+        spin_release(&pagemap->addrspace_lock);
+        atomic_fetch_add_explicit(&g_failed_count, 1, memory_order_relaxed);
+
+        return E_PAGE_FAULT_NO_VMA;
+    }
+
+    struct vm_area *const vma = container_of(node, struct vm_area, node);
+    if (!vma->anonymous || !access_allowed(vma, flags)) {
+        spin_release(&pagemap->addrspace_lock);
+        atomic_fetch_add_explicit(&g_failed_count, 1, memory_order_relaxed);
+
+        return E_PAGE_FAULT_BAD_ACCESS;
+    }
+
+    // Hold the vm_area's lock before letting go of the addrspace-lock, so the
+    // vm_area can't be removed from under us.
+
+    spin_acquire(&vma->lock);
+    spin_release(&pagemap->addrspace_lock);
+
+    const enum page_fault_result result =
+        (flags & __PAGE_FAULT_WRITE) != 0
+            ? resolve_write_fault(pagemap, vma, page_addr)
+            : resolve_read_fault(pagemap, vma, page_addr);
+
+    spin_release(&vma->lock);
+    if (result != E_PAGE_FAULT_OK) {
+        atomic_fetch_add_explicit(&g_failed_count, 1, memory_order_relaxed);
+        return result;
+    }
+
+    atomic_fetch_add_explicit(&g_minor_count, 1, memory_order_relaxed);
+    record_latency(nsec_since_boot() - start);
+
+    return E_PAGE_FAULT_OK;
+}
+
+struct page_fault_stats page_fault_get_stats() {
+    return (struct page_fault_stats){
+        .minor_count =
+            atomic_load_explicit(&g_minor_count, memory_order_relaxed),
+        .zero_page_count =
+            atomic_load_explicit(&g_zero_page_count, memory_order_relaxed),
+        .fault_around_count =
+            atomic_load_explicit(&g_fault_around_count, memory_order_relaxed),
+        .spurious_count =
+            atomic_load_explicit(&g_spurious_count, memory_order_relaxed),
+        .failed_count =
+            atomic_load_explicit(&g_failed_count, memory_order_relaxed),
+        .total_nsec =
+            atomic_load_explicit(&g_total_nsec, memory_order_relaxed),
+        .max_nsec = atomic_load_explicit(&g_max_nsec, memory_order_relaxed),
+    };
+}
+
+void page_fault_print_stats() {
+    const struct page_fault_stats stats = page_fault_get_stats();
+    const nsec_t avg_nsec =
+        stats.minor_count != 0 ? stats.total_nsec / stats.minor_count : 0;
+
+    printk(LOGLEVEL_INFO,
+           "mm: page-faults: %" PRIu64 " minor (%" PRIu64 " zero-page, "
+           "%" PRIu64 " spurious), %" PRIu64 " pages faulted around, "
+           "%" PRIu64 " failed, avg %" PRIu64 "ns, max %" PRIu64 "ns\n",
+           stats.minor_count,
+           stats.zero_page_count,
+           stats.spurious_count,
+           stats.fault_around_count,
+           stats.failed_count,
+           avg_nsec,
+           stats.max_nsec);
+}
+
+void page_fault_init() {
+    struct page *const page = alloc_page(PAGE_STATE_USED, __ALLOC_ZERO);
+    assert_msg(page != NULL, "mm: failed to allocate zero-page");
+
+    g_zero_page = page;
+    g_zero_page_phys = page_to_phys(page);
+}
@@ -0,0 +1,64 @@
+/*
+ * kernel/src/mm/fault.h
+ * © suhas pai
+ */
+
+#pragma once
+#include "lib/time.h"
+
+// Pages of anonymous vm_areas are only allocated once they're first accessed.
+// A read fault maps in the shared zero-page read-only, and a write fault
+// allocates a zeroed page of its own, replacing the zero-page if it was mapped
+// in before.
+//
+// Read faults also map the zero-page into the unmapped pages around the
+// faulting page, within an aligned window of PAGE_FAULT_AROUND_PAGES pages, so
+// a sequential read of a region takes one fault per window instead of one per
+// page. Write faults don't, as the following writes would then each have to
+// replace the zero-page.
+//
+// Anonymous vm_areas large enough to hold a large-page try to get one on a
+// write fault first, see mm/thp.h.
+
+#define PAGE_FAULT_AROUND_PAGES 16u
+
+enum page_fault_flags {
+    __PAGE_FAULT_PRESENT = 1 << 0,
+    __PAGE_FAULT_WRITE = 1 << 1,
+    __PAGE_FAULT_EXEC = 1 << 2,
+    __PAGE_FAULT_USER = 1 << 3,
+};
+
+enum page_fault_result {
+    E_PAGE_FAULT_OK,
+    E_PAGE_FAULT_NO_VMA,
+    E_PAGE_FAULT_BAD_ACCESS,
+    E_PAGE_FAULT_NO_MEM
+};
+
+struct page_fault_stats {
+    uint64_t minor_count;
+    uint64_t zero_page_count;
+    uint64_t fault_around_count;
+    uint64_t spurious_count;
+    uint64_t failed_count;
+
+    nsec_t total_nsec;
+    nsec_t max_nsec;
+};
+
+struct pagemap;
+
+// Resolve a fault at `addr` in `pagemap`. Must be called with interrupts
+// disabled, and without holding the pagemap's addrspace-lock or the lock of
+// any of its vm_areas.
+
+enum page_fault_result
+handle_page_fault(struct pagemap *pagemap, uint64_t addr, uint32_t flags);
+
+bool page_fault_is_zero_page(uint64_t phys);
+
+struct page_fault_stats page_fault_get_stats();
+void page_fault_print_stats();
+
+void page_fault_init();
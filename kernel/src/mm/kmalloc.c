@@ -6,11 +6,43 @@
 #include "dev/printk.h"
 
 #include "kmalloc.h"
+#include "size_class.h"
 #include "slab.h"
 
 static struct slab_allocator kmalloc_slabs[19] = {0};
 static bool kmalloc_is_initialized = false;
 
+static const uint8_t kmalloc_small_classes[SIZE_CLASS_SMALL_TABLE_LEN] = {
+    [0 ... 1] = 0,
+    [2] = 1,
+    [3 ... 4] = 2,
+    [5 ... 6] = 3,
+    [7 ... 8] = 4,
+    [9 ... 12] = 5,
+    [13 ... 16] = 6,
+    [17 ... 24] = 7,
+    [25 ... 32] = 8,
+    [33 ... 48] = 9,
+    [49 ... 64] = 10,
+};
+
+static const uint8_t
+kmalloc_large_classes[SIZE_CLASS_LARGE_TABLE_LEN(KMALLOC_MAX)] = {
+    [0 ... 3] = 11,
+    [4] = 12,
+    [5 ... 8] = 13,
+    [9 ... 12] = 14,
+    [13 ... 16] = 15,
+    [17 ... 24] = 16,
+};
+
+__debug_optimize(3)
+static inline uint8_t kmalloc_class_for(const uint32_t size) {
+    return size_class_lookup(kmalloc_small_classes,
+                             kmalloc_large_classes,
+                             size);
+}
+
 __debug_optimize(3) bool kmalloc_initialized() {
     return kmalloc_is_initialized;
 }
@@ -20,6 +52,18 @@ __debug_optimize(3) bool kmalloc_initialized() {
         slab_allocator_init(&kmalloc_slabs[index], size, alloc_flags, flags)); \
     index++;
 
+static void verify_size_classes() {
+#if defined(CHECK_SLABS)
+    for (uint32_t size = 1; size <= KMALLOC_MAX; size++) {
+        const uint8_t index = kmalloc_class_for(size);
+
+        assert(index == KMALLOC_SIZE_CLASS(size));
+        assert(kmalloc_slabs[index].object_size >= size);
+        assert(index == 0 || kmalloc_slabs[index - 1].object_size < size);
+    }
+#endif /* defined(CHECK_SLABS) */
+}
+
 void kmalloc_check_slabs() {
 #if defined(CHECK_SLABS)
     carr_foreach(kmalloc_slabs, alloc) {
@@ -31,31 +75,41 @@ void kmalloc_check_slabs() {
 void kmalloc_init() {
     uint8_t index = 0;
 
-    SLAB_ALLOC_INIT(16, /*alloc_flags=*/0, /*flags=*/0);
-    SLAB_ALLOC_INIT(32, /*alloc_flags=*/0, /*flags=*/0);
-    SLAB_ALLOC_INIT(64, /*alloc_flags=*/0, /*flags=*/0);
-    SLAB_ALLOC_INIT(96, /*alloc_flags=*/0, /*flags=*/0);
-    SLAB_ALLOC_INIT(128, /*alloc_flags=*/0, /*flags=*/0);
-    SLAB_ALLOC_INIT(192, /*alloc_flags=*/0, /*flags=*/0);
-    SLAB_ALLOC_INIT(256, /*alloc_flags=*/0, /*flags=*/0);
-    SLAB_ALLOC_INIT(384, /*alloc_flags=*/0, /*flags=*/0);
-    SLAB_ALLOC_INIT(512, /*alloc_flags=*/0, /*flags=*/0);
-    SLAB_ALLOC_INIT(768, /*alloc_flags=*/0, /*flags=*/0);
-    SLAB_ALLOC_INIT(1024, /*alloc_flags=*/0, /*flags=*/0);
-    SLAB_ALLOC_INIT(1536, /*alloc_flags=*/0, /*flags=*/0);
-    SLAB_ALLOC_INIT(2048, /*alloc_flags=*/0, /*flags=*/0);
-    SLAB_ALLOC_INIT(4096, /*alloc_flags=*/0, /*flags=*/0);
-    SLAB_ALLOC_INIT(6102, /*alloc_flags=*/0, /*flags=*/0);
-    SLAB_ALLOC_INIT(8192, /*alloc_flags=*/0, /*flags=*/0);
-    SLAB_ALLOC_INIT(12288, /*alloc_flags=*/0, /*flags=*/0);
-    SLAB_ALLOC_INIT(16384, /*alloc_flags=*/0, /*flags=*/0);
-    SLAB_ALLOC_INIT(32748, /*alloc_flags=*/0, /*flags=*/0);
-
+    SLAB_ALLOC_INIT(16, /*alloc_flags=*/0, __SLAB_ALLOC_CPU_CACHE);
+    SLAB_ALLOC_INIT(32, /*alloc_flags=*/0, __SLAB_ALLOC_CPU_CACHE);
+    SLAB_ALLOC_INIT(64, /*alloc_flags=*/0, __SLAB_ALLOC_CPU_CACHE);
+    SLAB_ALLOC_INIT(96, /*alloc_flags=*/0, __SLAB_ALLOC_CPU_CACHE);
+    SLAB_ALLOC_INIT(128, /*alloc_flags=*/0, __SLAB_ALLOC_CPU_CACHE);
+    SLAB_ALLOC_INIT(192, /*alloc_flags=*/0, __SLAB_ALLOC_CPU_CACHE);
+    SLAB_ALLOC_INIT(256, /*alloc_flags=*/0, __SLAB_ALLOC_CPU_CACHE);
+    SLAB_ALLOC_INIT(384, /*alloc_flags=*/0, __SLAB_ALLOC_CPU_CACHE);
+    SLAB_ALLOC_INIT(512, /*alloc_flags=*/0, __SLAB_ALLOC_CPU_CACHE);
+    SLAB_ALLOC_INIT(768, /*alloc_flags=*/0, __SLAB_ALLOC_CPU_CACHE);
+    SLAB_ALLOC_INIT(1024, /*alloc_flags=*/0, __SLAB_ALLOC_CPU_CACHE);
+    SLAB_ALLOC_INIT(1536, /*alloc_flags=*/0, __SLAB_ALLOC_CPU_CACHE);
+    SLAB_ALLOC_INIT(2048, /*alloc_flags=*/0, __SLAB_ALLOC_CPU_CACHE);
+    SLAB_ALLOC_INIT(4096, /*alloc_flags=*/0, __SLAB_ALLOC_CPU_CACHE);
+    SLAB_ALLOC_INIT(6144, /*alloc_flags=*/0, __SLAB_ALLOC_CPU_CACHE);
+    SLAB_ALLOC_INIT(8192, /*alloc_flags=*/0, __SLAB_ALLOC_CPU_CACHE);
+    SLAB_ALLOC_INIT(12288, /*alloc_flags=*/0, __SLAB_ALLOC_CPU_CACHE);
+    SLAB_ALLOC_INIT(16384, /*alloc_flags=*/0, __SLAB_ALLOC_CPU_CACHE);
+    SLAB_ALLOC_INIT(32768, /*alloc_flags=*/0, __SLAB_ALLOC_CPU_CACHE);
+
+    verify_size_classes();
     kmalloc_is_initialized = true;
 }
 
+__debug_optimize(3) __malloclike __malloc_dealloc(kfree, 1)
+void *kmalloc_from_class(const uint8_t class_index) {
+    assert_msg(kmalloc_initialized(),
+               "mm: kmalloc() called before kmalloc_init()");
+
+    kmalloc_check_slabs();
+    return slab_alloc(&kmalloc_slabs[class_index]);
+}
+
 __debug_optimize(3) __malloclike __malloc_dealloc(kfree, 1) __alloc_size(1)
-void *kmalloc(const uint32_t size) {
+void *__kmalloc(const uint32_t size) {
     assert_msg(kmalloc_initialized(),
                "mm: kmalloc() called before kmalloc_init()");
 
@@ -74,12 +128,7 @@ void *kmalloc(const uint32_t size) {
         return NULL;
     }
 
-    struct slab_allocator *allocator = &kmalloc_slabs[0];
-    while (allocator->object_size < size) {
-        allocator++;
-    }
-
-    return slab_alloc(allocator);
+    return slab_alloc(&kmalloc_slabs[kmalloc_class_for(size)]);
 }
 
 __debug_optimize(3) __malloclike __malloc_dealloc(kfree, 1)
@@ -102,10 +151,8 @@ void *kmalloc_size(const uint32_t size, uint32_t *const size_out) {
         return NULL;
     }
 
-    struct slab_allocator *allocator = &kmalloc_slabs[0];
-    while (allocator->object_size < size) {
-        allocator++;
-    }
+    struct slab_allocator *const allocator =
+        &kmalloc_slabs[kmalloc_class_for(size)];
 
     void *const result = slab_alloc(allocator);
     kmalloc_check_slabs();
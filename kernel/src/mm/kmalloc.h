@@ -18,7 +18,45 @@ bool kmalloc_initialized();
 void kfree(void *buffer);
 
 __malloclike __malloc_dealloc(kfree, 1) __alloc_size(1)
-void *kmalloc(uint32_t size);
+void *__kmalloc(uint32_t size);
+
+// Allocate from the size-class with the provided index, as returned by
+// KMALLOC_SIZE_CLASS().
+
+__malloclike __malloc_dealloc(kfree, 1)
+void *kmalloc_from_class(uint8_t class_index);
+
+// Index of the size-class for a size known at compile-time. Must match the
+// order of the slab-allocators setup in kmalloc_init().
+
+#define KMALLOC_SIZE_CLASS(size) \
+    ((size) <= 16 ? 0 : \
+     (size) <= 32 ? 1 : \
+     (size) <= 64 ? 2 : \
+     (size) <= 96 ? 3 : \
+     (size) <= 128 ? 4 : \
+     (size) <= 192 ? 5 : \
+     (size) <= 256 ? 6 : \
+     (size) <= 384 ? 7 : \
+     (size) <= 512 ? 8 : \
+     (size) <= 768 ? 9 : \
+     (size) <= 1024 ? 10 : \
+     (size) <= 1536 ? 11 : \
+     (size) <= 2048 ? 12 : \
+     (size) <= 4096 ? 13 : \
+     (size) <= 6144 ? 14 : \
+     (size) <= 8192 ? 15 : 16)
+
+// When size is a compile-time constant, skip both the checks on size and the
+// size-class lookup.
+//
+// This is a macro rather than an inline function, as gcc ignores the
+// __malloc_dealloc() attribute on inline functions, so both branches call a
+// function that has it.
+
+#define kmalloc(size) \
+    (__builtin_constant_p(size) && (size) != 0 && (size) <= KMALLOC_MAX ? \
+        kmalloc_from_class(KMALLOC_SIZE_CLASS(size)) : __kmalloc(size))
 
 __malloclike __malloc_dealloc(kfree, 1)
 void *kmalloc_size(uint32_t size, uint32_t *size_out);
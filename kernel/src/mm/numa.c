@@ -0,0 +1,321 @@
+/*
+ * kernel/src/mm/numa.c
+ * © suhas pai
+ */
+
+#include "acpi/api.h"
+#include "acpi/slit.h"
+#include "acpi/srat.h"
+
+#include "cpu/info.h"
+#include "dev/dtb/numa.h"
+#include "dev/printk.h"
+
+#include "sched/thread.h"
+#include "sys/boot.h"
+
+#include "numa.h"
+
+struct numa_mem_range {
+    struct range range;
+    numa_node_t node;
+};
+
+struct numa_cpu {
+    enum numa_cpu_id_kind kind;
+    numa_node_t node;
+    uint64_t id;
+};
+
+static uint32_t g_domain_list[NUMA_MAX_NODES] = {};
+static uint8_t g_node_count = 0;
+
+static struct numa_mem_range g_mem_range_list[NUMA_MAX_MEM_RANGES] = {};
+static uint8_t g_mem_range_count = 0;
+
+static struct numa_cpu g_cpu_list[NUMA_MAX_CPUS] = {};
+static uint16_t g_cpu_count = 0;
+
+static uint8_t g_distance_list[NUMA_MAX_NODES][NUMA_MAX_NODES] = {};
+static struct numa_fallback_list g_fallback_list[NUMA_MAX_NODES] = {};
+
+__debug_optimize(3) numa_node_t numa_node_for_domain(const uint32_t domain) {
+    for (numa_node_t node = 0; node != g_node_count; node++) {
+        if (g_domain_list[node] == domain) {
+            return node;
+        }
+    }
+
+    return NUMA_NO_NODE;
+}
+
+numa_node_t numa_add_domain(const uint32_t domain) {
+    const numa_node_t node = numa_node_for_domain(domain);
+    if (node != NUMA_NO_NODE) {
+        return node;
+    }
+
+    if (g_node_count == NUMA_MAX_NODES) {
+        printk(LOGLEVEL_WARN,
+               "numa: too many nodes, ignoring proximity-domain %" PRIu32 "\n",
+               domain);
+        return NUMA_NO_NODE;
+    }
+
+    g_domain_list[g_node_count] = domain;
+    return g_node_count++;
+}
+
+void numa_add_mem_range(const numa_node_t node, const struct range range) {
+    if (node >= g_node_count || range_empty(range)) {
+        return;
+    }
+
+    if (g_mem_range_count == NUMA_MAX_MEM_RANGES) {
+        printk(LOGLEVEL_WARN,
+               "numa: too many memory ranges, ignoring range " RANGE_FMT "\n",
+               RANGE_FMT_ARGS(range));
+        return;
+    }
+
+    g_mem_range_list[g_mem_range_count] = (struct numa_mem_range){
+        .range = range,
+        .node = node,
+    };
+
+    g_mem_range_count++;
+}
+
+void
+numa_add_cpu(const enum numa_cpu_id_kind kind,
+             const uint64_t id,
+             const numa_node_t node)
+{
+    if (node >= g_node_count) {
+        return;
+    }
+
+    if (g_cpu_count == NUMA_MAX_CPUS) {
+        printk(LOGLEVEL_WARN,
+               "numa: too many cpus, ignoring cpu with id %" PRIu64 "\n",
+               id);
+        return;
+    }
+
+    g_cpu_list[g_cpu_count] = (struct numa_cpu){
+        .kind = kind,
+        .node = node,
+        .id = id,
+    };
+
+    g_cpu_count++;
+}
+
+void
+numa_set_distance(const numa_node_t from,
+                  const numa_node_t to,
+                  const uint8_t distance)
+{
+    if (from >= NUMA_MAX_NODES || to >= NUMA_MAX_NODES) {
+        return;
+    }
+
+    g_distance_list[from][to] = distance;
+}
+
+__debug_optimize(3) uint8_t numa_get_node_count() {
+    return g_node_count;
+}
+
+__debug_optimize(3)
+uint8_t numa_get_distance(const numa_node_t from, const numa_node_t to) {
+    assert(from < g_node_count && to < g_node_count);
+    return g_distance_list[from][to];
+}
+
+__debug_optimize(3) numa_node_t numa_phys_to_node(const uint64_t phys) {
+    for (uint8_t i = 0; i != g_mem_range_count; i++) {
+        const struct numa_mem_range *const mem_range = &g_mem_range_list[i];
+        if (range_has_loc(mem_range->range, phys)) {
+            return mem_range->node;
+        }
+    }
+
+    // Memory the firmware didn't describe is given to the first node.
+    return 0;
+}
+
+__debug_optimize(3)
+bool numa_node_has_mem_in(const numa_node_t node, const struct range range) {
+    if (g_mem_range_count == 0) {
+        return node == 0;
+    }
+
+    for (uint8_t i = 0; i != g_mem_range_count; i++) {
+        const struct numa_mem_range *const mem_range = &g_mem_range_list[i];
+        if (mem_range->node == node && range_overlaps(mem_range->range, range))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+__debug_optimize(3) numa_node_t numa_local_node() {
+    numa_node_t node = 0;
+    with_preempt_disabled({
+        node = this_cpu()->numa_node;
+    });
+
+    return node;
+}
+
+__debug_optimize(3) const struct numa_fallback_list *
+numa_get_fallback_list(const numa_node_t node) {
+    assert(node < g_node_count);
+    return &g_fallback_list[node];
+}
+
+// Order every node by its distance from `node`, breaking ties by node id so
+// that every node with the same distances falls back in the same order.
+
+static void build_fallback_list(const numa_node_t node) {
+    struct numa_fallback_list *const list = &g_fallback_list[node];
+    const uint8_t *const distance_list = g_distance_list[node];
+
+    list->count = 0;
+    for (numa_node_t other = 0; other != g_node_count; other++) {
+        uint8_t index = list->count;
+        for (; index != 0; index--) {
+            const numa_node_t prev = list->nodes[index - 1];
+            if (distance_list[prev] <= distance_list[other]) {
+                break;
+            }
+
+            list->nodes[index] = prev;
+        }
+
+        list->nodes[index] = other;
+        list->count++;
+    }
+
+    // A node is always closest to itself, even if the firmware says
+    // otherwise.
+
+    for (uint8_t i = 0; i != list->count; i++) {
+        if (list->nodes[i] == node) {
+            for (; i != 0; i--) {
+                list->nodes[i] = list->nodes[i - 1];
+            }
+
+            list->nodes[0] = node;
+            break;
+        }
+    }
+}
+
+static void print_nodes() {
+    for (numa_node_t node = 0; node != g_node_count; node++) {
+        printk(LOGLEVEL_INFO,
+               "numa: node %" PRIu8 " (proximity-domain %" PRIu32 ")\n",
+               node,
+               g_domain_list[node]);
+
+        for (uint8_t i = 0; i != g_mem_range_count; i++) {
+            const struct numa_mem_range *const mem_range = &g_mem_range_list[i];
+            if (mem_range->node == node) {
+                printk(LOGLEVEL_INFO,
+                       "\tmemory at " RANGE_FMT "\n",
+                       RANGE_FMT_ARGS(mem_range->range));
+            }
+        }
+
+        for (numa_node_t other = 0; other != g_node_count; other++) {
+            printk(LOGLEVEL_INFO,
+                   "\tdistance to node %" PRIu8 ": %" PRIu8 "\n",
+                   other,
+                   g_distance_list[node][other]);
+        }
+    }
+}
+
+void numa_init() {
+    for (numa_node_t from = 0; from != NUMA_MAX_NODES; from++) {
+        for (numa_node_t to = 0; to != NUMA_MAX_NODES; to++) {
+            g_distance_list[from][to] =
+                from == to ? NUMA_LOCAL_DISTANCE : NUMA_REMOTE_DISTANCE;
+        }
+    }
+
+    const struct acpi_info *const acpi_info = get_acpi_info();
+    if (acpi_info->srat != NULL) {
+        srat_init(acpi_info->srat);
+        if (acpi_info->slit != NULL) {
+            slit_init(acpi_info->slit);
+        }
+    } else {
+        const void *const dtb = boot_get_dtb();
+        if (dtb != NULL) {
+            dtb_numa_init(dtb);
+        }
+    }
+
+    if (g_node_count == 0) {
+        g_node_count = 1;
+        g_domain_list[0] = 0;
+    }
+
+    for (numa_node_t node = 0; node != g_node_count; node++) {
+        build_fallback_list(node);
+    }
+
+    print_nodes();
+}
+
+static numa_node_t find_node_for_cpu(const struct cpu_info *const cpu) {
+    for (uint16_t i = 0; i != g_cpu_count; i++) {
+        const struct numa_cpu *const numa_cpu = &g_cpu_list[i];
+        switch (numa_cpu->kind) {
+            case NUMA_CPU_ID_APIC:
+            #if defined(__x86_64__)
+                if (numa_cpu->id == cpu->lapic_id) {
+                    return numa_cpu->node;
+                }
+            #endif /* defined(__x86_64__) */
+
+                continue;
+            case NUMA_CPU_ID_ACPI_UID: {
+                uint32_t acpi_id = 0;
+                if (cpu_get_acpi_processor_id(cpu, &acpi_id)
+                 && numa_cpu->id == acpi_id)
+                {
+                    return numa_cpu->node;
+                }
+
+                continue;
+            }
+            case NUMA_CPU_ID_DTB_REG:
+                if (numa_cpu->id == cpu_get_dtb_reg(cpu)) {
+                    return numa_cpu->node;
+                }
+
+                continue;
+        }
+
+        verify_not_reached();
+    }
+
+    return 0;
+}
+
+void numa_init_cpus() {
+    struct cpu_info *cpu = NULL;
+    list_foreach(cpu, cpus_get_list(), cpu_list) {
+        cpu->numa_node = find_node_for_cpu(cpu);
+        printk(LOGLEVEL_INFO,
+               "numa: cpu %" PRIu32 " is on node %" PRIu8 "\n",
+               cpu_get_id(cpu),
+               cpu->numa_node);
+    }
+}
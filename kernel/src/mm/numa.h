@@ -0,0 +1,65 @@
+/*
+ * kernel/src/mm/numa.h
+ * © suhas pai
+ */
+
+#pragma once
+#include "lib/adt/range.h"
+
+// Memory and cpus are split into nodes, found at boot by numa_init() from the
+// acpi srat and slit, or from the devicetree's numa-node-id props. Firmware
+// proximity-domains are given dense node ids in the order they're first seen.
+//
+// Systems without either are treated as a single node, node 0.
+
+typedef uint8_t numa_node_t;
+
+#define NUMA_MAX_NODES 8
+#define NUMA_NO_NODE UINT8_MAX
+
+#define NUMA_MAX_MEM_RANGES 32
+#define NUMA_MAX_CPUS 256
+
+// Distances follow the slit, where a node's distance to itself is 10.
+#define NUMA_LOCAL_DISTANCE 10
+#define NUMA_REMOTE_DISTANCE 20
+
+enum numa_cpu_id_kind {
+    NUMA_CPU_ID_APIC,
+    NUMA_CPU_ID_ACPI_UID,
+    NUMA_CPU_ID_DTB_REG,
+};
+
+struct numa_fallback_list {
+    numa_node_t nodes[NUMA_MAX_NODES];
+    uint8_t count;
+};
+
+// Returns the node of `domain`, giving it a new node if it doesn't have one.
+// Returns NUMA_NO_NODE if there are already NUMA_MAX_NODES nodes.
+
+numa_node_t numa_add_domain(uint32_t domain);
+
+// Returns NUMA_NO_NODE if `domain` wasn't added.
+numa_node_t numa_node_for_domain(uint32_t domain);
+
+void numa_add_mem_range(numa_node_t node, struct range range);
+void numa_add_cpu(enum numa_cpu_id_kind kind, uint64_t id, numa_node_t node);
+void numa_set_distance(numa_node_t from, numa_node_t to, uint8_t distance);
+
+uint8_t numa_get_node_count();
+uint8_t numa_get_distance(numa_node_t from, numa_node_t to);
+
+numa_node_t numa_phys_to_node(uint64_t phys);
+
+// Returns whether any memory of `node` is within `range`. Memory the firmware
+// didn't describe is treated as node 0's, as in numa_phys_to_node().
+
+bool numa_node_has_mem_in(numa_node_t node, struct range range);
+numa_node_t numa_local_node();
+
+// Every node, ordered by distance from `node`, starting with `node` itself.
+const struct numa_fallback_list *numa_get_fallback_list(numa_node_t node);
+
+void numa_init();
+void numa_init_cpus();
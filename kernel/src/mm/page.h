@@ -18,6 +18,12 @@ enum page_state {
     PAGE_STATE_FREE_LIST_HEAD,
     PAGE_STATE_FREE_LIST_TAIL,
 
+    // In a cpu's pcp-list, see mm/pcp.h.
+    PAGE_STATE_PCP_LIST,
+
+    // In a zone's zero-pool, see mm/zero_pool.h.
+    PAGE_STATE_ZERO_POOL,
+
     PAGE_STATE_SYSTEM_CRUCIAL,
 
     PAGE_STATE_LRU_CACHE,
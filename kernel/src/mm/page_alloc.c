@@ -4,6 +4,9 @@
  */
 
 #include <stdatomic.h>
+
+#include "asm/irqs.h"
+#include "cpu/info.h"
 #include "dev/printk.h"
 
 #include "lib/align.h"
@@ -11,11 +14,17 @@
 
 #include "sys/boot.h"
 #include "sched/process.h"
+#include "sched/scheduler.h"
 
+#include "early.h"
 #include "page.h"
 #include "section.h"
+#include "zero_pool.h"
 #include "zone.h"
 
+// Internal flag for pages known to already be zeroed.
+#define __ALLOC_PREZEROED (1ull << 63)
+
 // Caller is required to set section->min_order
 __debug_optimize(3) static void
 add_to_freelist_order(struct page_section *const section,
@@ -312,8 +321,22 @@ setup_pages_off_freelist(struct page *const page,
         case PAGE_STATE_IN_FREE_LIST:
         case PAGE_STATE_FREE_LIST_HEAD:
         case PAGE_STATE_FREE_LIST_TAIL:
-        case PAGE_STATE_LRU_CACHE:
+        case PAGE_STATE_PCP_LIST:
+        case PAGE_STATE_ZERO_POOL:
             verify_not_reached();
+        case PAGE_STATE_LRU_CACHE: {
+            page_set_state(page, PAGE_STATE_LRU_CACHE);
+
+            const struct page *const end = page + (1ull << order);
+            for (struct page *iter = page + 1; iter != end; iter++) {
+                page_set_state(iter, PAGE_STATE_LRU_CACHE);
+
+                iter->dirty_lru.head = page;
+                iter->dirty_lru.amount = 0;
+            }
+
+            return;
+        }
         case PAGE_STATE_SLAB_HEAD: {
             page_set_state(page, PAGE_STATE_SLAB_HEAD);
 
@@ -609,6 +632,19 @@ done:
     return page;
 }
 
+__debug_optimize(3) static inline void
+zero_alloced_pages(struct page *const page,
+                   const uint64_t page_count,
+                   const uint64_t alloc_flags)
+{
+    if (alloc_flags & __ALLOC_PREZEROED) {
+        return;
+    }
+
+    zero_multiple_pages(page_to_virt(page), page_count);
+    zero_pool_count_inline(page_count);
+}
+
 __debug_optimize(3) struct page *
 setup_alloced_page(struct page *const page,
                    const enum page_state state,
@@ -629,7 +665,7 @@ setup_alloced_page(struct page *const page,
             }
 
             if (alloc_flags & __ALLOC_ZERO) {
-                zero_multiple_pages(page_to_virt(page), page_count);
+                zero_alloced_pages(page, page_count, alloc_flags);
             }
 
             return page;
@@ -637,27 +673,37 @@ setup_alloced_page(struct page *const page,
         case PAGE_STATE_IN_FREE_LIST:
         case PAGE_STATE_FREE_LIST_HEAD:
         case PAGE_STATE_FREE_LIST_TAIL:
-        case PAGE_STATE_LRU_CACHE:
+        case PAGE_STATE_PCP_LIST:
+        case PAGE_STATE_ZERO_POOL:
             verify_not_reached();
+        case PAGE_STATE_LRU_CACHE:
+            list_init(&page->dirty_lru.lru);
+            page->dirty_lru.amount = 1ull << order;
+
+            if (alloc_flags & __ALLOC_ZERO) {
+                zero_alloced_pages(page, 1ull << order, alloc_flags);
+            }
+
+            return page;
         case PAGE_STATE_KERNEL_STACK:
-            zero_multiple_pages(page_to_virt(page), 1ull << order);
+            zero_alloced_pages(page, 1ull << order, alloc_flags);
             list_init(&page->kernel_stack.list);
 
             return page;
         case PAGE_STATE_USER_STACK:
-            zero_multiple_pages(page_to_virt(page), 1ull << order);
+            zero_alloced_pages(page, 1ull << order, alloc_flags);
             list_init(&page->user_stack.list);
 
             return page;
         case PAGE_STATE_SLAB_HEAD:
-            zero_multiple_pages(page_to_virt(page), 1ull << order);
+            zero_alloced_pages(page, 1ull << order, alloc_flags);
             list_init(&page->slab.head.slab_list);
 
             return page;
         case PAGE_STATE_SLAB_TAIL:
             verify_not_reached();
         case PAGE_STATE_TABLE:
-            zero_page(page_to_virt(page));
+            zero_alloced_pages(page, /*page_count=*/1, alloc_flags);
             list_init(&page->table.delayed_free_list);
 
             page->table.refcount = REFCOUNT_EMPTY();
@@ -670,7 +716,7 @@ setup_alloced_page(struct page *const page,
             page->largehead.level = largeinfo->level;
 
             if (alloc_flags & __ALLOC_ZERO) {
-                zero_multiple_pages(page_to_virt(page), 1ull << order);
+                zero_alloced_pages(page, 1ull << order, alloc_flags);
             }
 
             return page;
@@ -681,6 +727,312 @@ setup_alloced_page(struct page *const page,
     verify_not_reached();
 }
 
+__debug_optimize(3) static inline void
+add_to_page_list(struct list *const list,
+                 struct page *const page,
+                 const uint8_t order,
+                 const enum page_state state,
+                 const bool hot)
+{
+    // Mark both the first and last page so find_nearby_free_pages() doesn't
+    // merge a neighboring range with pages in a pcp-list or zero-pool.
+
+    page_set_state(page, state);
+    page->freelist_head.order = order;
+
+    if (order != 0) {
+        page_set_state(page + (1ull << order) - 1, state);
+    }
+
+    if (hot) {
+        list_add(list, &page->freelist_head.freelist);
+    } else {
+        list_radd(list, &page->freelist_head.freelist);
+    }
+}
+
+__debug_optimize(3) static inline void
+add_to_pcp_list(struct page_pcp_list *const pcp_list,
+                struct page *const page,
+                const uint8_t order,
+                const bool hot)
+{
+    add_to_page_list(&pcp_list->page_list,
+                     page,
+                     order,
+                     PAGE_STATE_PCP_LIST,
+                     hot);
+
+    pcp_list->count++;
+}
+
+// Take a batch of pages off the freelists of the zone's sections, holding each
+// section's lock once for as many pages as it can provide.
+
+uint32_t
+take_free_pages_from_zone(struct page_zone *const zone,
+                          const uint8_t order,
+                          const uint32_t count,
+                          const enum page_state state,
+                          struct list *const list)
+{
+    if (__builtin_expect(atomic_load(&zone->total_free) < 1ull << order, 0)) {
+        return 0;
+    }
+
+    uint32_t taken = 0;
+    struct page_section *iter = NULL;
+
+    list_foreach(iter, &zone->section_list, zone_list) {
+        int flag = 0;
+        if (!spin_try_acquire_save_irq(&iter->lock, &flag)) {
+            continue;
+        }
+
+        while (taken != count) {
+            struct page *page = NULL;
+
+            uint8_t alloced_order = max(order, iter->min_order);
+            const uint8_t max_order = iter->max_order;
+
+            for (; alloced_order < max_order; alloced_order++) {
+                page = get_from_freelist_order(iter, alloced_order, order);
+                if (page != NULL) {
+                    break;
+                }
+            }
+
+            if (page == NULL) {
+                break;
+            }
+
+            free_extra_pages_if_from_higher_order(page,
+                                                  iter,
+                                                  alloced_order,
+                                                  order);
+
+            add_to_page_list(list, page, order, state, /*hot=*/false);
+            taken++;
+        }
+
+        spin_release_restore_irq(&iter->lock, flag);
+        if (taken == count) {
+            break;
+        }
+    }
+
+    return taken;
+}
+
+// Give back a list of pages taken off of pcp-lists to the freelists. Caller
+// must not hold any pcp lock.
+
+static void spill_pages_to_freelist(struct list *const list) {
+    struct page *page = NULL;
+    struct page *tmp = NULL;
+
+    list_foreach_mut(page, tmp, list, freelist_head.freelist) {
+        list_deinit(&page->freelist_head.freelist);
+        free_pages_to_freelist(page, page->freelist_head.order);
+    }
+}
+
+static struct page *alloc_pages_from_pcp(const uint8_t order) {
+    const bool irqs_enabled = disable_irqs_if_enabled();
+    struct page_pcp *const pcp = &this_cpu_mut()->page_pcp;
+
+    spin_acquire(&pcp->lock);
+    struct page_pcp_list *const pcp_list = &pcp->list_list[order];
+
+    if (pcp_list->count == 0) {
+        // Only refill from the zones local to this cpu's node, so that every
+        // page on a pcp-list is local to its cpu.
+
+        const numa_node_t node = this_cpu()->numa_node;
+        const struct page_zone_list *const zone_list =
+            page_zone_list_for_node(node);
+
+        uint32_t taken = 0;
+        for (uint8_t i = 0; i != zone_list->count; i++) {
+            struct page_zone *const zone = zone_list->zones[i];
+            if (!page_zone_is_local(zone, node)) {
+                continue;
+            }
+
+            taken =
+                take_free_pages_from_zone(zone,
+                                          order,
+                                          PCP_BATCH(order),
+                                          PAGE_STATE_PCP_LIST,
+                                          &pcp_list->page_list);
+
+            if (taken != 0) {
+                pcp_list->count += taken;
+                break;
+            }
+        }
+
+        if (taken == 0) {
+            spin_release(&pcp->lock);
+            enable_irqs_if_flag(irqs_enabled);
+
+            return NULL;
+        }
+
+        pcp->refill_count++;
+    } else {
+        pcp->hit_count++;
+    }
+
+    struct page *const page =
+        list_head(&pcp_list->page_list, struct page, freelist_head.freelist);
+
+    list_deinit(&page->freelist_head.freelist);
+    pcp_list->count--;
+
+    spin_release(&pcp->lock);
+    enable_irqs_if_flag(irqs_enabled);
+
+    return page;
+}
+
+static void free_pages_to_pcp(struct page *const page, const uint8_t order) {
+    struct list spill_list = LIST_INIT(spill_list);
+
+    const bool irqs_enabled = disable_irqs_if_enabled();
+    struct cpu_info *const cpu = this_cpu_mut();
+
+    // Pages of another node go straight back to their freelists, to be
+    // allocated again by the cpus of that node.
+
+    if (!page_zone_is_local(page_to_zone(page), cpu->numa_node)) {
+        enable_irqs_if_flag(irqs_enabled);
+        free_pages_to_freelist(page, order);
+
+        return;
+    }
+
+    struct page_pcp *const pcp = &cpu->page_pcp;
+
+    spin_acquire(&pcp->lock);
+    struct page_pcp_list *const pcp_list = &pcp->list_list[order];
+
+    add_to_pcp_list(pcp_list, page, order, /*hot=*/true);
+    if (pcp_list->count > PCP_HIGH(order)) {
+        // Spill the coldest pages, at the back of the list.
+        do {
+            struct page *const back =
+                list_tail(&pcp_list->page_list,
+                          struct page,
+                          freelist_head.freelist);
+
+            list_remove(&back->freelist_head.freelist);
+            list_add(&spill_list, &back->freelist_head.freelist);
+
+            pcp_list->count--;
+        } while (pcp_list->count > PCP_LOW(order));
+
+        pcp->spill_count++;
+    }
+
+    spin_release(&pcp->lock);
+    enable_irqs_if_flag(irqs_enabled);
+
+    spill_pages_to_freelist(&spill_list);
+}
+
+void page_pcp_init(struct page_pcp *const pcp) {
+    pcp->lock = SPINLOCK_INIT();
+    carr_foreach_mut(pcp->list_list, pcp_list) {
+        list_init(&pcp_list->page_list);
+        pcp_list->count = 0;
+    }
+
+    pcp->hit_count = 0;
+    pcp->refill_count = 0;
+    pcp->spill_count = 0;
+}
+
+uint64_t page_alloc_drain_pcp() {
+    uint64_t count = 0;
+    struct cpu_info *cpu = NULL;
+
+    list_foreach(cpu, cpus_get_list(), cpu_list) {
+        struct page_pcp *const pcp = &cpu->page_pcp;
+        struct list spill_list = LIST_INIT(spill_list);
+
+        const int flag = spin_acquire_save_irq(&pcp->lock);
+        carr_foreach_mut(pcp->list_list, pcp_list) {
+            while (!list_empty(&pcp_list->page_list)) {
+                struct page *const page =
+                    list_head(&pcp_list->page_list,
+                              struct page,
+                              freelist_head.freelist);
+
+                list_remove(&page->freelist_head.freelist);
+                list_add(&spill_list, &page->freelist_head.freelist);
+
+                count += 1ull << page->freelist_head.order;
+            }
+
+            pcp_list->count = 0;
+        }
+
+        spin_release_restore_irq(&pcp->lock, flag);
+        spill_pages_to_freelist(&spill_list);
+    }
+
+    return count;
+}
+
+__debug_optimize(3) static inline bool
+alloc_needs_zeroing(const enum page_state state, const uint64_t alloc_flags) {
+    switch (state) {
+        case PAGE_STATE_KERNEL_STACK:
+        case PAGE_STATE_USER_STACK:
+        case PAGE_STATE_SLAB_HEAD:
+        case PAGE_STATE_TABLE:
+            return true;
+        case PAGE_STATE_USED:
+        case PAGE_STATE_LRU_CACHE:
+        case PAGE_STATE_LARGE_HEAD:
+            return alloc_flags & __ALLOC_ZERO;
+        case PAGE_STATE_IN_FREE_LIST:
+        case PAGE_STATE_FREE_LIST_HEAD:
+        case PAGE_STATE_FREE_LIST_TAIL:
+        case PAGE_STATE_PCP_LIST:
+        case PAGE_STATE_ZERO_POOL:
+        case PAGE_STATE_SYSTEM_CRUCIAL:
+        case PAGE_STATE_SLAB_TAIL:
+        case PAGE_STATE_LARGE_TAIL:
+            return false;
+    }
+
+    verify_not_reached();
+}
+
+static struct page *
+alloc_pages_from_zone_list(const struct page_zone_list *const zone_list,
+                           const enum page_state state,
+                           const uint64_t alloc_flags,
+                           const uint8_t order)
+{
+    for (uint8_t i = 0; i != zone_list->count; i++) {
+        struct page *const page =
+            try_alloc_pages_from_zone(zone_list->zones[i], order, state);
+
+        if (page != NULL) {
+            return setup_alloced_page(page,
+                                      state,
+                                      alloc_flags,
+                                      order,
+                                      /*largeinfo=*/NULL);
+        }
+    }
+
+    return NULL;
+}
+
 struct page *
 alloc_pages(const enum page_state state,
             const uint64_t alloc_flags,
@@ -691,25 +1043,122 @@ alloc_pages(const enum page_state state,
         return NULL;
     }
 
-    struct page_zone *zone = page_zone_default();
-    struct page *page = NULL;
+    if (order == 0 && alloc_needs_zeroing(state, alloc_flags)) {
+        struct page *const page = zero_pool_take();
+        if (page != NULL) {
+            setup_pages_off_freelist(page, order, state);
+            return setup_alloced_page(page,
+                                      state,
+                                      alloc_flags | __ALLOC_PREZEROED,
+                                      order,
+                                      /*largeinfo=*/NULL);
+        }
+    }
 
-    while (zone != NULL) {
-        page = try_alloc_pages_from_zone(zone, order, state);
+    if (order < PCP_ORDER_COUNT) {
+        struct page *const page = alloc_pages_from_pcp(order);
         if (page != NULL) {
+            setup_pages_off_freelist(page, order, state);
             return setup_alloced_page(page,
                                       state,
                                       alloc_flags,
                                       order,
                                       /*largeinfo=*/NULL);
         }
+    }
 
-        zone = zone->fallback_zone;
+    const struct page_zone_list *const zone_list = page_zone_list_local();
+    struct page *page =
+        alloc_pages_from_zone_list(zone_list, state, alloc_flags, order);
+
+    if (page != NULL) {
+        return page;
+    }
+
+    // Free pages may be sitting in the pcp-lists of other cpus or in the
+    // zero-pools, so drain them and try again.
+
+    const uint64_t drained = page_alloc_drain_pcp() + zero_pool_drain();
+    if (drained != 0) {
+        page = alloc_pages_from_zone_list(zone_list, state, alloc_flags, order);
+        if (page != NULL) {
+            return page;
+        }
+    }
+
+    // Sections whose init was deferred may still be waiting on a worker, so
+    // initialize them here until the allocation succeeds. This may initialize
+    // a whole section with interrupts disabled, but only when memory would
+    // otherwise have run out.
+    //
+    // Once every section is claimed, the ones other cpus are still freeing are
+    // waited on, but only by callers that can yield, as the cpu freeing one may
+    // be this one, in a thread that this caller interrupted.
+
+    bool waited_on_deferred = false;
+    while (mm_deferred_init_pending()) {
+        waited_on_deferred = true;
+        if (mm_deferred_init_one() != 0) {
+            page =
+                alloc_pages_from_zone_list(zone_list,
+                                           state,
+                                           alloc_flags,
+                                           order);
+
+            if (page != NULL) {
+                return page;
+            }
+
+            continue;
+        }
+
+        if (!preemption_enabled() || !are_interrupts_enabled()) {
+            break;
+        }
+
+        sched_yield();
+    }
+
+    // Sections may have been freed since the last try.
+    if (waited_on_deferred) {
+        return alloc_pages_from_zone_list(zone_list,
+                                          state,
+                                          alloc_flags,
+                                          order);
     }
 
     return NULL;
 }
 
+struct page *
+alloc_pages_on_node(const numa_node_t node,
+                    const enum page_state state,
+                    const uint64_t alloc_flags,
+                    const uint8_t order)
+{
+    if (__builtin_expect(order >= MAX_ORDER, 0)) {
+        printk(LOGLEVEL_WARN,
+               "mm: alloc_pages_on_node() got order >= MAX_ORDER\n");
+        return NULL;
+    }
+
+    if (node == numa_local_node()) {
+        return alloc_pages(state, alloc_flags, order);
+    }
+
+    struct page *const page =
+        alloc_pages_from_zone_list(page_zone_list_for_node(node),
+                                   state,
+                                   alloc_flags,
+                                   order);
+
+    if (page != NULL) {
+        return page;
+    }
+
+    return alloc_pages(state, alloc_flags, order);
+}
+
 struct page *
 alloc_pages_from_zone(struct page_zone *zone,
                       const enum page_state state,
@@ -763,11 +1212,14 @@ alloc_pages_at_align(const enum page_state state,
         return NULL;
     }
 
-    struct page_zone *zone = page_zone_default();
-    struct page *page = NULL;
+    const struct page_zone_list *const zone_list = page_zone_list_local();
+    for (uint8_t i = 0; i != zone_list->count; i++) {
+        struct page *const page =
+            try_alloc_pages_from_zone_at_align(zone_list->zones[i],
+                                               order,
+                                               align,
+                                               state);
 
-    while (zone != NULL) {
-        page = try_alloc_pages_from_zone_at_align(zone, order, align, state);
         if (page != NULL) {
             return setup_alloced_page(page,
                                       state,
@@ -775,8 +1227,6 @@ alloc_pages_at_align(const enum page_state state,
                                       order,
                                       /*largeinfo=*/NULL);
         }
-
-        zone = zone->fallback_zone;
     }
 
     return NULL;
@@ -865,7 +1315,6 @@ try_alloc_large_page_from_zone(struct page_zone *const zone,
 
 struct page *
 alloc_large_page(const pgt_level_t level, const uint64_t alloc_flags) {
-    struct page_zone *zone = page_zone_iterstart();
     const struct largepage_level_info *const info =
         &largepage_level_info_list[level - 1];
 
@@ -884,9 +1333,11 @@ alloc_large_page(const pgt_level_t level, const uint64_t alloc_flags) {
         return NULL;
     }
 
-    struct page *page = NULL;
-    while (zone != NULL) {
-        page = try_alloc_large_page_from_zone(zone, info);
+    const struct page_zone_list *const zone_list = page_zone_list_local();
+    for (uint8_t i = 0; i != zone_list->count; i++) {
+        struct page *const page =
+            try_alloc_large_page_from_zone(zone_list->zones[i], info);
+
         if (page != NULL) {
             return setup_alloced_page(page,
                                       PAGE_STATE_LARGE_HEAD,
@@ -894,8 +1345,6 @@ alloc_large_page(const pgt_level_t level, const uint64_t alloc_flags) {
                                       order,
                                       info);
         }
-
-        zone = zone->fallback_zone;
     }
 
     return NULL;
@@ -1102,7 +1551,21 @@ void free_large_page(struct page *const head) {
     });
 }
 
-void free_pages(struct page *page, const uint8_t order) {
+void free_pages_to_freelist(struct page *page, const uint8_t order) {
+    struct page_section *const section = page_to_section(page);
+    const int flag = spin_acquire_save_irq(&section->lock);
+
+    uint64_t amount = 1ull << order;
+    if (find_nearby_free_pages(page, amount, &page, &amount)) {
+        free_range_of_pages(page, section, amount, MAX_ORDER);
+    } else {
+        add_to_freelist_order(section, order, page);
+    }
+
+    spin_release_restore_irq(&section->lock, flag);
+}
+
+void free_pages(struct page *const page, const uint8_t order) {
     if (__builtin_expect(order >= MAX_ORDER, 0)) {
         printk(LOGLEVEL_WARN, "mm: free_pages() got order >= MAX_ORDER\n");
         return;
@@ -1120,12 +1583,18 @@ void free_pages(struct page *page, const uint8_t order) {
         return;
     }
 
-    uint64_t amount = 1ull << order;
-    if (find_nearby_free_pages(page, amount, &page, &amount)) {
-        free_range_of_pages(page, page_to_section(page), amount, MAX_ORDER);
-    } else {
-        add_to_freelist_order(page_to_section(page), order, page);
+#if defined(ZERO_FREED_PAGES)
+    if (order == 0 && zero_pool_add_dirty(page)) {
+        return;
     }
+#endif /* defined(ZERO_FREED_PAGES) */
+
+    if (order < PCP_ORDER_COUNT) {
+        free_pages_to_pcp(page, order);
+        return;
+    }
+
+    free_pages_to_freelist(page, order);
 }
 
 __debug_optimize(3)
@@ -5,6 +5,7 @@
 
 #pragma once
 
+#include "numa.h"
 #include "page.h"
 #include "pageop.h"
 
@@ -15,8 +16,9 @@ enum page_alloc_flags {
     __ALLOC_ZERO = 1 << 0,
 };
 
-// free_pages will call zero-out the page. Call page_to_zone() and
-// free_pages_to_zone() directly to avoid this.
+// free_pages() doesn't zero pages. When built with ZERO_FREED_PAGES, order-0
+// pages are instead handed to the zone's zero-pool to be zeroed in the
+// background, see mm/zero_pool.h.
 
 void free_pages(struct page *page, uint8_t order);
 void free_large_page(struct page *page);
@@ -38,6 +40,15 @@ alloc_pages_at_align(enum page_state state,
                      uint8_t align,
                      uint8_t order);
 
+// Allocate from the zones of `node`, falling back to the zones closest to it,
+// and then to alloc_pages().
+
+struct page *
+alloc_pages_on_node(numa_node_t node,
+                    enum page_state state,
+                    uint64_t alloc_flags,
+                    uint8_t order);
+
 struct page_zone;
 
 struct page *
@@ -62,6 +73,18 @@ alloc_large_page_in_zone(struct page_zone *zone,
                          pgt_level_t level,
                          bool allow_fallback);
 
+// Used by mm/zero_pool.c to move pages between a zone's freelists and its
+// pool. Pages taken are given `state` and linked through freelist_head.
+
+uint32_t
+take_free_pages_from_zone(struct page_zone *zone,
+                          uint8_t order,
+                          uint32_t count,
+                          enum page_state state,
+                          struct list *list);
+
+void free_pages_to_freelist(struct page *page, uint8_t order);
+
 struct page *alloc_table();
 struct page *alloc_user_stack(struct process *proc, uint8_t order);
 
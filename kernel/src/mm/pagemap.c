@@ -4,7 +4,7 @@
  */
 
 #if defined(__x86_64__)
-    #include "asm/regs.h"
+    #include "asm/cr.h"
 #elif defined(__aarch64__)
     #if defined(AARCH64_USE_16K_PAGES)
         #include "asm/tcr.h"
@@ -16,7 +16,13 @@
     #include "asm/csr.h"
 #endif /* defined(__x86_64__) */
 
+#include "asm/irqs.h"
 #include "cpu/info.h"
+
+#if __has_include("mm/tlb.h")
+    #include "mm/tlb.h"
+#endif /* __has_include("mm/tlb.h") */
+
 #include "mm/walker.h"
 #include "sched/process.h"
 
@@ -36,6 +42,9 @@ __debug_optimize(3) struct pagemap pagemap_empty() {
 
         .cpu_list = LIST_INIT(kernel_process.pagemap.cpu_list),
         .cpu_lock = SPINLOCK_INIT(),
+        .tlb_gen = 0,
+        .anon_page_count = 0,
+        .anon_large_page_count = 0,
     };
 
     refcount_init(&result.refcount);
@@ -53,6 +62,9 @@ __debug_optimize(3) struct pagemap pagemap_empty() {
 
             .cpu_list = LIST_INIT(kernel_process.pagemap.cpu_list),
             .cpu_lock = SPINLOCK_INIT(),
+            .tlb_gen = 0,
+            .anon_page_count = 0,
+            .anon_large_page_count = 0,
 
             .addrspace_lock = SPINLOCK_INIT(),
         };
@@ -68,6 +80,9 @@ __debug_optimize(3) struct pagemap pagemap_empty() {
 
             .cpu_list = LIST_INIT(kernel_process.pagemap.cpu_list),
             .cpu_lock = SPINLOCK_INIT(),
+            .tlb_gen = 0,
+            .anon_page_count = 0,
+            .anon_large_page_count = 0,
 
             .addrspace_lock = SPINLOCK_INIT(),
         };
@@ -97,7 +112,7 @@ pagemap_find_space_and_add_vma(struct pagemap *const pagemap,
         return false;
     }
 
-    if (vma->prot == PROT_NONE) {
+    if (vma->prot == PROT_NONE || vma->anonymous) {
         spin_release_restore_irq(&pagemap->addrspace_lock, flag);
         return true;
     }
@@ -128,7 +143,7 @@ pagemap_add_vma(struct pagemap *const pagemap,
         return false;
     }
 
-    if (vma->prot == PROT_NONE) {
+    if (vma->prot == PROT_NONE || vma->anonymous) {
         spin_release_restore_irq(&pagemap->addrspace_lock, flag);
         return true;
     }
@@ -148,6 +163,54 @@ pagemap_add_vma(struct pagemap *const pagemap,
     return map_result;
 }
 
+__debug_optimize(3) static void
+load_pagemap(struct pagemap *const pagemap, const struct asid_result asid) {
+#if defined(__x86_64__)
+    // Without the no-flush bit, loading cr3 flushes the pcid's tlb entries.
+    uint64_t value = virt_to_phys(pagemap->root);
+    if (get_cpu_capabilities()->supports_pcid) {
+        value |= asid.asid;
+        if (!asid.need_flush) {
+            value |= __CR3_BIT_NOFLUSH;
+        }
+    }
+
+    write_cr3(value);
+#elif defined(__aarch64__)
+    if (asid.need_flush) {
+        tlb_flush_asid(asid.asid);
+    }
+
+    write_ttbr0_el1(virt_to_phys(pagemap->lower_root)
+                  | (uint64_t)asid.asid << TTBR_ASID_SHIFT);
+    write_ttbr1_el1(virt_to_phys(pagemap->higher_root));
+
+    #if defined(AARCH64_USE_16K_PAGES)
+        write_tcr_el1(rm_mask(read_tcr_el1(), __TCR_TG1)
+                    | TCR_TG1_16KIB << TCR_TG1_SHIFT);
+    #endif /* defined(AARCH64_USE_16K_PAGES) */
+
+    asm volatile ("dsb sy; isb" ::: "memory");
+#elif defined(__riscv64)
+    const uint64_t value =
+        (SATP_MODE_39_BIT_PAGING + PAGING_MODE) << SATP_PHYS_MODE_SHIFT
+      | (uint64_t)asid.asid << SATP_PHYS_ASID_SHIFT
+      | (virt_to_phys(pagemap->root) >> PML1_SHIFT);
+
+    csr_write(satp, value);
+    if (asid.need_flush) {
+        tlb_flush_asid(asid.asid);
+    }
+#elif defined(__loongarch64)
+    (void)asid;
+
+    csr_write(pgdl, virt_to_phys(pagemap->lower_root));
+    csr_write(pgdh, virt_to_phys(pagemap->higher_root));
+#else
+    verify_not_reached();
+#endif /* defined(__x86_64__) */
+}
+
 void switch_to_pagemap(struct pagemap *const pagemap) {
 #if PAGEMAP_HAS_SPLIT_ROOT
     assert(pagemap->lower_root != NULL);
@@ -156,36 +219,65 @@ void switch_to_pagemap(struct pagemap *const pagemap) {
     assert(pagemap->root != NULL);
 #endif /* PAGEMAP_HAS_SPLIT_ROOT */
 
-    with_spinlock_irq_disabled(&pagemap->cpu_lock, {
-    #if defined(__x86_64__)
-        write_cr3(virt_to_phys(pagemap->root));
-    #elif defined(__aarch64__)
-        write_ttbr0_el1(virt_to_phys(pagemap->lower_root));
-        write_ttbr1_el1(virt_to_phys(pagemap->higher_root));
-
-        #if defined(AARCH64_USE_16K_PAGES)
-            write_tcr_el1(rm_mask(read_tcr_el1(), __TCR_TG1)
-                        | TCR_TG1_16KIB << TCR_TG1_SHIFT);
-        #endif /* defined(AARCH64_USE_16K_PAGES) */
-
-        asm volatile ("dsb sy; isb" ::: "memory");
-    #elif defined(__riscv64)
-        const uint64_t value =
-            (SATP_MODE_39_BIT_PAGING + PAGING_MODE) << SATP_PHYS_MODE_SHIFT
-          | (virt_to_phys(pagemap->root) >> PML1_SHIFT);
-
-        csr_write(satp, value);
-        asm volatile ("sfence.vma" ::: "memory");
-    #elif defined(__loongarch64)
-        csr_write(pgdl, virt_to_phys(pagemap->lower_root));
-        csr_write(pgdh, virt_to_phys(pagemap->higher_root));
-    #else
-        verify_not_reached();
-    #endif /* defined(__x86_64__) */
+    const bool flag = disable_irqs_if_enabled();
+
+    struct cpu_info *const cpu = this_cpu_mut();
+    struct tlb_cpu_state *const state = &cpu->tlb_state;
+    struct pagemap *const prev = state->pagemap;
+
+    if (prev != NULL) {
+        // Kernel threads only use kernel mappings, which every pagemap has, so
+        // we keep the previous pagemap loaded in lazy mode instead of switching
+        // away from it.
+
+        if (pagemap == prev) {
+            bool flush_needed = false;
+            with_spinlock_acquired(&prev->cpu_lock, {
+                flush_needed = state->lazy_flush_needed;
+
+                state->lazy = false;
+                state->lazy_flush_needed = false;
+            });
+
+            // Shootdowns skipped us while we were lazy.
+            if (flush_needed) {
+                tlb_flush_this_cpu();
+            }
+
+            enable_irqs_if_flag(flag);
+            return;
+        }
 
-        list_remove(&this_cpu_mut()->pagemap_node);
-        list_add(&pagemap->cpu_list, &this_cpu_mut()->pagemap_node);
+        if (pagemap == &kernel_process.pagemap) {
+            with_spinlock_acquired(&prev->cpu_lock, {
+                state->lazy = true;
+            });
+
+            enable_irqs_if_flag(flag);
+            return;
+        }
+
+        with_spinlock_acquired(&prev->cpu_lock, {
+            list_remove(&cpu->pagemap_node);
+
+            state->lazy = false;
+            state->lazy_flush_needed = false;
+        });
+    }
+
+    // The previous pagemap's translations either stay behind under its own
+    // asid, which is flushed before it's used again if the pagemap is shot
+    // down in the meantime, or are flushed by loading the new root. Either
+    // way, shootdowns of the previous pagemap can skip us from here on.
+
+    with_spinlock_acquired(&pagemap->cpu_lock, {
+        load_pagemap(pagemap, asid_get_for_pagemap(pagemap));
+
+        list_add(&pagemap->cpu_list, &cpu->pagemap_node);
+        state->pagemap = pagemap;
     });
+
+    enable_irqs_if_flag(flag);
 }
 
 __debug_optimize(3) uint64_t
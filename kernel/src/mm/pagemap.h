@@ -5,6 +5,8 @@
 
 #pragma once
 
+#include <stdatomic.h>
+
 #include "lib/refcount.h"
 #include "vma.h"
 
@@ -28,6 +30,17 @@ struct pagemap {
     struct list cpu_list;
     struct spinlock cpu_lock;
 
+    // Incremented on every shootdown of the pagemap, so cpus that weren't
+    // using the pagemap during a shootdown know to flush its asid.
+
+    _Atomic uint64_t tlb_gen;
+
+    // Number of pages and large-pages allocated for the pagemap's anonymous
+    // vm_areas, used to report how much of them is covered by large-pages.
+
+    _Atomic uint64_t anon_page_count;
+    _Atomic uint64_t anon_large_page_count;
+
     struct refcount refcount;
 };
 
@@ -4,13 +4,6 @@
  */
 
 #include "asm/irqs.h"
-#include "cpu/info.h"
-
-#if __has_include("mm/tlb.h")
-    #include "mm/tlb.h"
-#endif /* __has_include("mm/tlb.h") */
-
-#include "sched/thread.h"
 
 #include "pagemap.h"
 #include "page_alloc.h"
@@ -24,6 +17,7 @@ pageop_init(struct pageop *const pageop,
 {
     pageop->pagemap = pagemap;
     pageop->flush_range = range;
+    pageop->batch = TLB_FLUSH_BATCH_INIT();
 
     list_init(&pageop->delayed_free);
 }
@@ -37,7 +31,16 @@ pageop_flush_pte_in_current_range(struct pageop *const pageop,
     const uint64_t pte_phys = pte_to_phys(pte, level);
     struct page *const pte_page = phys_to_page(pte_phys);
 
-    if (page_get_state(pte_page) != PAGE_STATE_TABLE) {
+    // A large page allocated by alloc_large_page() holds one reference for
+    // the large mapping, separate from the references of its pages.
+
+    const enum page_state state = page_get_state(pte_page);
+    if (state == PAGE_STATE_LARGE_HEAD) {
+        deref_large_page(pte_page, pageop, level);
+        return;
+    }
+
+    if (state != PAGE_STATE_TABLE) {
         deref_page(pte_page, pageop);
         return;
     }
@@ -102,7 +105,7 @@ pageop_setup_for_address(struct pageop *const pageop, const uint64_t virt) {
         }
     }
 
-    pageop_finish(pageop);
+    tlb_flush_batch_add(&pageop->batch, pageop->flush_range);
     pageop->flush_range = RANGE_INIT(virt, PAGE_SIZE);
 }
 
@@ -128,32 +131,34 @@ pageop_setup_for_range(struct pageop *const pageop, const struct range virt) {
         }
     }
 
-    pageop_finish(pageop);
+    tlb_flush_batch_add(&pageop->batch, pageop->flush_range);
     pageop->flush_range = virt;
 }
 
 __debug_optimize(3) static void free_all_pages(struct pageop *const pageop) {
-    struct page *iter = NULL;
-    list_foreach(iter, &pageop->delayed_free, table.delayed_free_list) {
-        free_page(iter);
+    struct page *page = NULL;
+    struct page *tmp = NULL;
+
+    list_foreach_mut(page, tmp, &pageop->delayed_free, table.delayed_free_list)
+    {
+        list_deinit(&page->table.delayed_free_list);
+        free_page(page);
     }
+
+    list_init(&pageop->delayed_free);
 }
 
 __debug_optimize(3) void pageop_finish(struct pageop *const pageop) {
-    if (range_empty(pageop->flush_range)) {
-        free_all_pages(pageop);
-        return;
-    }
-
     assert(!are_interrupts_enabled());
-    if (&current_thread()->process->pagemap == pageop->pagemap) {
-    #if defined(__x86_64__)
-        tlb_flush_pageop(pageop);
-    #elif defined(__riscv64)
-        asm volatile ("fence.i" ::: "memory");
-    #endif /* defined(__x86_64__) */
-    }
+
+    // The pages can only be freed once no cpu can reach them through a stale
+    // translation.
+
+    tlb_flush_batch_add(&pageop->batch, pageop->flush_range);
+    tlb_shootdown(pageop->pagemap, &pageop->batch);
 
     free_all_pages(pageop);
+
     pageop->flush_range = RANGE_EMPTY();
-}
\ No newline at end of file
+    pageop->batch = TLB_FLUSH_BATCH_INIT();
+}
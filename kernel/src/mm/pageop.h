@@ -9,11 +9,17 @@
 #include "lib/list.h"
 
 #include "mm_types.h"
+#include "shootdown.h"
 
 struct pagemap;
 struct pageop {
     struct pagemap *pagemap;
     struct range flush_range;
+
+    // Ranges that were flushed out of flush_range before it moved elsewhere,
+    // which are all shot down together on finish.
+
+    struct tlb_flush_batch batch;
     struct list delayed_free;
 };
 
@@ -21,6 +27,7 @@ struct pageop {
     ((struct pageop){ \
         .pagemap = (pagemap_), \
         .flush_range = RANGE_EMPTY(), \
+        .batch = TLB_FLUSH_BATCH_INIT(), \
         .delayed_free = LIST_INIT(name.delayed_free) \
     })
 
@@ -0,0 +1,73 @@
+/*
+ * kernel/src/mm/pcp.h
+ * © suhas pai
+ */
+
+#pragma once
+
+#include "cpu/spinlock.h"
+#include "lib/list.h"
+
+// Every cpu keeps lists of free pages of the lowest orders so that
+// alloc_pages() and free_pages() don't need to take a section's lock for
+// every call.
+//
+// Pages are refilled from and spilled back to the buddy freelists in batches.
+// Recently freed pages are added to the front of a list, and are the first to
+// be allocated again while they're likely still in the cache, while pages
+// spilled back to the freelists are taken from the back.
+
+#define PCP_ORDER_COUNT 4
+
+// Number of pages moved between a pcp-list and the freelists at once.
+#define PCP_BATCH(order) (32u >> (order))
+
+// A pcp-list holding more than its high watermark of pages is spilled back to
+// the freelists until it's at its low watermark.
+
+#define PCP_HIGH(order) (PCP_BATCH(order) * 4)
+#define PCP_LOW(order) (PCP_BATCH(order) * 2)
+
+struct page_pcp_list {
+    struct list page_list;
+    uint32_t count;
+};
+
+struct page_pcp {
+    // Only contended when another cpu drains this cpu's lists.
+    struct spinlock lock;
+    struct page_pcp_list list_list[PCP_ORDER_COUNT];
+
+    // Allocations served from a pcp-list without a refill.
+    uint64_t hit_count;
+
+    // Times a pcp-list was refilled from or spilled to the freelists.
+    uint64_t refill_count;
+    uint64_t spill_count;
+};
+
+#define PAGE_PCP_LIST_INIT(name) \
+    { .page_list = LIST_INIT(name.page_list), .count = 0 }
+
+_Static_assert(PCP_ORDER_COUNT == 4, "PAGE_PCP_INIT() needs to be updated");
+
+#define PAGE_PCP_INIT(name) \
+    { \
+        .lock = SPINLOCK_INIT(), \
+        .list_list = { \
+            PAGE_PCP_LIST_INIT(name.list_list[0]), \
+            PAGE_PCP_LIST_INIT(name.list_list[1]), \
+            PAGE_PCP_LIST_INIT(name.list_list[2]), \
+            PAGE_PCP_LIST_INIT(name.list_list[3]), \
+        }, \
+        .hit_count = 0, \
+        .refill_count = 0, \
+        .spill_count = 0, \
+    }
+
+void page_pcp_init(struct page_pcp *pcp);
+
+// Give back the free pages of every cpu's pcp-lists to the freelists. Returns
+// the number of pages freed.
+
+uint64_t page_alloc_drain_pcp();
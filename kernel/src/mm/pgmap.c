@@ -68,6 +68,20 @@ split_large_page(struct pt_walker *const walker,
     curr_split->is_active = true;
 }
 
+// The pages of a split large page that are mapped again as smaller pages need
+// a reference of their own, as the large page's reference is dropped once the
+// split is finished.
+
+__debug_optimize(3)
+static void ref_up_split_pages(const struct range phys_range) {
+    struct page *page = phys_to_page(phys_range.front);
+    const struct page *const end = page + PAGE_COUNT(phys_range.size);
+
+    for (; page != end; page++) {
+        ref_up(&page->largetail.refcount);
+    }
+}
+
 static bool
 pgmap_with_ptwalker(struct pt_walker *const walker,
                     struct current_split_info *const curr_split,
@@ -99,19 +113,15 @@ finish_split_info(struct pt_walker *const walker,
         return;
     }
 
-    struct page *const begin = phys_to_page(curr_split->phys_range.front);
-    const struct page *const end =
-        begin + PAGE_COUNT(curr_split->phys_range.size);
-
-    struct page *page = begin + PAGE_COUNT(virt_end - walker_virt_addr);
-    for (; page != end; page++) {
-        ref_up(&page->largetail.refcount);
-    }
+    // Map back the rest of the large page, past the part that was just
+    // mapped over.
 
-    const uint64_t offset = virt_end - walker_virt_addr;
+    const uint64_t offset = walker_virt_addr - curr_split->virt_addr;
     const struct range phys_range =
         range_from_index(curr_split->phys_range, offset);
 
+    ref_up_split_pages(phys_range);
+
     struct current_split_info new_curr_split = CURRENT_SPLIT_INFO_INIT();
     pgmap_with_ptwalker(walker,
                         &new_curr_split,
@@ -709,6 +719,8 @@ pgmap_at(struct pagemap *const pagemap,
 
                 const struct range largepage_phys_range =
                     RANGE_INIT(curr_split.phys_range.front, offset);
+
+                ref_up_split_pages(largepage_phys_range);
                 const bool result =
                     pgmap_with_ptwalker(&walker,
                                         /*curr_split=*/NULL,
@@ -1020,6 +1032,15 @@ split_initial_large_page_if_necessary(
         return true;
     }
 
+    // The large page's pte is cleared by the split, so its physical address
+    // has to be read out first.
+
+    uint64_t phys_front = INVALID_PHYS;
+    if (calculate_phys) {
+        phys_front = ptwalker_get_phys_addr(walker);
+        assert(phys_front != INVALID_PHYS);
+    }
+
     const uint64_t offset = virt_range.front - walker_virt_addr;
     split_large_page(walker,
                      pageop,
@@ -1027,13 +1048,13 @@ split_initial_large_page_if_necessary(
                      walker->level,
                      options);
 
-    uint64_t phys_front = curr_split->phys_range.front;
-    if (calculate_phys) {
-        phys_front = ptwalker_get_phys_addr(walker);
-        assert(phys_front != INVALID_PHYS);
+    if (!calculate_phys) {
+        phys_front = curr_split->phys_range.front;
     }
 
     const struct range largepage_phys_range = RANGE_INIT(phys_front, offset);
+    ref_up_split_pages(largepage_phys_range);
+
     const bool result =
         pgmap_with_ptwalker(walker,
                             /*curr_split=*/NULL,
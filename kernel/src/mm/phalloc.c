@@ -5,6 +5,7 @@
 
 #include "dev/printk.h"
 #include "mm/mm_types.h"
+#include "mm/size_class.h"
 #include "mm/slab.h"
 
 #include "phalloc.h"
@@ -12,6 +13,45 @@
 static struct slab_allocator phalloc_slabs[14] = {0};
 static bool phalloc_is_initialized = false;
 
+static const uint8_t phalloc_small_classes[SIZE_CLASS_SMALL_TABLE_LEN] = {
+    [0 ... 16] = 0,
+    [17 ... 24] = 1,
+    [25 ... 32] = 2,
+    [33 ... 48] = 3,
+    [49 ... 64] = 4,
+};
+
+static const uint8_t
+phalloc_large_classes[SIZE_CLASS_LARGE_TABLE_LEN(PHALLOC_MAX)] = {
+    [0 ... 3] = 5,
+    [4] = 6,
+    [5 ... 6] = 7,
+    [7 ... 8] = 8,
+    [9 ... 12] = 9,
+    [13 ... 16] = 10,
+    [17 ... 32] = 11,
+    [33 ... 64] = 12,
+    [65 ... 128] = 13,
+};
+
+__debug_optimize(3)
+static inline uint8_t phalloc_class_for(const uint32_t size) {
+    return size_class_lookup(phalloc_small_classes,
+                             phalloc_large_classes,
+                             size);
+}
+
+static void verify_size_classes() {
+#if defined(CHECK_SLABS)
+    for (uint32_t size = 1; size <= PHALLOC_MAX; size++) {
+        const uint8_t index = phalloc_class_for(size);
+
+        assert(phalloc_slabs[index].object_size >= size);
+        assert(index == 0 || phalloc_slabs[index - 1].object_size < size);
+    }
+#endif /* defined(CHECK_SLABS) */
+}
+
 __debug_optimize(3) bool phalloc_initialized() {
     return phalloc_is_initialized;
 }
@@ -24,21 +64,22 @@ __debug_optimize(3) bool phalloc_initialized() {
 void phalloc_init() {
     uint8_t index = 0;
 
-    SLAB_ALLOC_INIT(256, /*alloc_flags=*/0, /*flags=*/0);
-    SLAB_ALLOC_INIT(384, /*alloc_flags=*/0, /*flags=*/0);
-    SLAB_ALLOC_INIT(512, /*alloc_flags=*/0, /*flags=*/0);
-    SLAB_ALLOC_INIT(768, /*alloc_flags=*/0, /*flags=*/0);
-    SLAB_ALLOC_INIT(1024, /*alloc_flags=*/0, /*flags=*/0);
-    SLAB_ALLOC_INIT(1536, /*alloc_flags=*/0, /*flags=*/0);
-    SLAB_ALLOC_INIT(2048, /*alloc_flags=*/0, /*flags=*/0);
-    SLAB_ALLOC_INIT(3072, /*alloc_flags=*/0, /*flags=*/0);
-    SLAB_ALLOC_INIT(4096, /*alloc_flags=*/0, /*flags=*/0);
-    SLAB_ALLOC_INIT(6102, /*alloc_flags=*/0, /*flags=*/0);
-    SLAB_ALLOC_INIT(8192, /*alloc_flags=*/0, /*flags=*/0);
-    SLAB_ALLOC_INIT(16384, /*alloc_flags=*/0, /*flags=*/0);
-    SLAB_ALLOC_INIT(32768, /*alloc_flags=*/0, /*flags=*/0);
-    SLAB_ALLOC_INIT(65536, /*alloc_flags=*/0, /*flags=*/0);
-
+    SLAB_ALLOC_INIT(256, /*alloc_flags=*/0, __SLAB_ALLOC_CPU_CACHE);
+    SLAB_ALLOC_INIT(384, /*alloc_flags=*/0, __SLAB_ALLOC_CPU_CACHE);
+    SLAB_ALLOC_INIT(512, /*alloc_flags=*/0, __SLAB_ALLOC_CPU_CACHE);
+    SLAB_ALLOC_INIT(768, /*alloc_flags=*/0, __SLAB_ALLOC_CPU_CACHE);
+    SLAB_ALLOC_INIT(1024, /*alloc_flags=*/0, __SLAB_ALLOC_CPU_CACHE);
+    SLAB_ALLOC_INIT(1536, /*alloc_flags=*/0, __SLAB_ALLOC_CPU_CACHE);
+    SLAB_ALLOC_INIT(2048, /*alloc_flags=*/0, __SLAB_ALLOC_CPU_CACHE);
+    SLAB_ALLOC_INIT(3072, /*alloc_flags=*/0, __SLAB_ALLOC_CPU_CACHE);
+    SLAB_ALLOC_INIT(4096, /*alloc_flags=*/0, __SLAB_ALLOC_CPU_CACHE);
+    SLAB_ALLOC_INIT(6144, /*alloc_flags=*/0, __SLAB_ALLOC_CPU_CACHE);
+    SLAB_ALLOC_INIT(8192, /*alloc_flags=*/0, __SLAB_ALLOC_CPU_CACHE);
+    SLAB_ALLOC_INIT(16384, /*alloc_flags=*/0, __SLAB_ALLOC_CPU_CACHE);
+    SLAB_ALLOC_INIT(32768, /*alloc_flags=*/0, __SLAB_ALLOC_CPU_CACHE);
+    SLAB_ALLOC_INIT(65536, /*alloc_flags=*/0, __SLAB_ALLOC_CPU_CACHE);
+
+    verify_size_classes();
     phalloc_is_initialized = true;
 }
 
@@ -60,10 +101,8 @@ __debug_optimize(3) uint64_t phalloc(const uint32_t size) {
         return INVALID_PHYS;
     }
 
-    struct slab_allocator *allocator = &phalloc_slabs[0];
-    while (allocator->object_size < size) {
-        allocator++;
-    }
+    struct slab_allocator *const allocator =
+        &phalloc_slabs[phalloc_class_for(size)];
 
     uint64_t offset = 0;
     struct page *const page = slab_alloc2(allocator, &offset);
@@ -94,10 +133,8 @@ uint64_t phalloc_size(const uint32_t size, uint32_t *const size_out) {
         return INVALID_PHYS;
     }
 
-    struct slab_allocator *allocator = &phalloc_slabs[0];
-    while (allocator->object_size < size) {
-        allocator++;
-    }
+    struct slab_allocator *const allocator =
+        &phalloc_slabs[phalloc_class_for(size)];
 
     uint64_t offset = 0;
     struct page *const page = slab_alloc2(allocator, &offset);
@@ -19,6 +19,7 @@ page_section_init(struct page_section *const section,
     section->zone = zone;
     section->lock = SPINLOCK_INIT();
     section->pfn = pfn;
+    section->is_deferred = false;
     section->range = range;
     section->min_order = MAX_ORDER;
     section->max_order = 0;
@@ -30,6 +31,7 @@ page_section_init(struct page_section *const section,
     }
 
     list_init(&section->zone_list);
+    list_init(&section->deferred_list);
 }
 
 __debug_optimize(3) struct page_section *phys_to_section(const uint64_t phys) {
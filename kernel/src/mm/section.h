@@ -25,6 +25,12 @@ struct page_section {
 
     uint64_t pfn;
 
+    // Free ranges of a section whose struct pages are initialized after the
+    // APs are up, instead of at boot. See mm_deferred_init_start().
+
+    struct list deferred_list;
+    _Atomic bool is_deferred;
+
     // Lock covers all fields directly after it.
     struct spinlock lock;
     struct page_freelist freelist_list[MAX_ORDER];
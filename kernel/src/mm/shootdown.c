@@ -0,0 +1,462 @@
+/*
+ * kernel/src/mm/shootdown.c
+ * © suhas pai
+ */
+
+#include "asm/irqs.h"
+#include "asm/pause.h"
+#include "cpu/info.h"
+
+#if __has_include("mm/tlb.h")
+    #include "mm/tlb.h"
+#endif /* __has_include("mm/tlb.h") */
+
+#if defined(__riscv64)
+    #include "asm/sbi.h"
+#endif /* defined(__riscv64) */
+
+#include "sched/process.h"
+#include "sched/thread.h"
+
+#include "pagemap.h"
+#include "shootdown.h"
+
+// Maximum number of cpus a shootdown posts to before waiting on them.
+#define TLB_SHOOTDOWN_WAIT_MAX 32
+
+// Number of cpus waiting on a shootdown, so cpus spinning on a lock only check
+// for pending flushes when there can be any.
+
+static _Atomic uint32_t g_waiter_count = 0;
+
+__debug_optimize(3) static inline bool
+ranges_touch(const struct range range, const struct range other) {
+    return range_overlaps(range, other)
+        || range_get_end_assert(range) == other.front
+        || range_get_end_assert(other) == range.front;
+}
+
+__debug_optimize(3) void
+tlb_flush_batch_add(struct tlb_flush_batch *const batch,
+                    const struct range range)
+{
+    if (batch->full || range_empty(range)) {
+        return;
+    }
+
+    batch->page_count += range.size / PAGE_SIZE;
+    if (batch->page_count > TLB_FLUSH_FULL_THRESHOLD_PAGES) {
+        batch->full = true;
+        batch->range_count = 0;
+
+        return;
+    }
+
+    for (uint8_t i = 0; i != batch->range_count; i++) {
+        struct range *const iter = &batch->range_list[i];
+        if (!ranges_touch(*iter, range)) {
+            continue;
+        }
+
+        const uint64_t front = min(iter->front, range.front);
+        const uint64_t end =
+            max(range_get_end_assert(*iter), range_get_end_assert(range));
+
+        *iter = RANGE_INIT(front, end - front);
+        return;
+    }
+
+    if (batch->range_count == TLB_FLUSH_BATCH_MAX_RANGES) {
+        batch->full = true;
+        batch->range_count = 0;
+
+        return;
+    }
+
+    batch->range_list[batch->range_count] = range;
+    batch->range_count++;
+}
+
+__debug_optimize(3) void
+tlb_flush_batch_merge(struct tlb_flush_batch *const batch,
+                      const struct tlb_flush_batch *const other)
+{
+    batch->global = batch->global || other->global;
+    batch->frees_tables = batch->frees_tables || other->frees_tables;
+    if (other->full) {
+        batch->full = true;
+        batch->range_count = 0;
+
+        return;
+    }
+
+    for (uint8_t i = 0; i != other->range_count; i++) {
+        tlb_flush_batch_add(batch, other->range_list[i]);
+    }
+}
+
+void tlb_cpu_state_init(struct tlb_cpu_state *const state) {
+    state->lock = SPINLOCK_INIT();
+    state->pending = TLB_FLUSH_BATCH_INIT();
+
+    atomic_init(&state->request_gen, 0);
+    atomic_init(&state->done_gen, 0);
+
+    state->ipi_pending = false;
+    atomic_init(&state->online, false);
+
+    state->pagemap = NULL;
+    state->lazy = false;
+    state->lazy_flush_needed = false;
+}
+
+__debug_optimize(3) void tlb_flush_this_cpu() {
+#if __has_include("mm/tlb.h")
+    struct tlb_flush_batch batch = TLB_FLUSH_BATCH_INIT();
+    batch.full = true;
+
+    tlb_flush_local(&batch);
+#endif /* __has_include("mm/tlb.h") */
+}
+
+void tlb_shootdown_init_on_cpu() {
+    assert(!are_interrupts_enabled());
+
+    // Shootdowns skip this cpu until it's online, so flush out anything it may
+    // have missed.
+
+    atomic_store_explicit(&this_cpu_mut()->tlb_state.online,
+                          true,
+                          memory_order_seq_cst);
+
+#if __has_include("mm/tlb.h")
+    // Asids are only handed out from here on, so the flush also clears out
+    // any entries tagged with an asid before.
+
+    asid_init_on_this_cpu(tlb_get_max_asid());
+    struct tlb_flush_batch batch = TLB_FLUSH_BATCH_INIT();
+
+    batch.full = true;
+    batch.global = true;
+
+    tlb_flush_local(&batch);
+#endif /* __has_include("mm/tlb.h") */
+}
+
+void tlb_shootdown_init() {
+#if defined(__x86_64__)
+    tlb_init_shootdown_ipi();
+#endif /* defined(__x86_64__) */
+
+    with_interrupts_disabled({
+        tlb_shootdown_init_on_cpu();
+    });
+}
+
+#if defined(__x86_64__)
+    // The state-lock is taken while spinning in spin_acquire(), so it can't be
+    // taken through spin_acquire() itself.
+
+    __debug_optimize(3)
+    static inline void state_lock(struct tlb_cpu_state *const state) {
+        while (!spin_try_acquire(&state->lock)) {
+            cpu_pause();
+        }
+    }
+
+    __debug_optimize(3)
+    static void handle_pending(struct tlb_cpu_state *const state) {
+        const uint64_t request_gen =
+            atomic_load_explicit(&state->request_gen, memory_order_acquire);
+
+        if (request_gen
+                == atomic_load_explicit(&state->done_gen, memory_order_relaxed))
+        {
+            return;
+        }
+
+        state_lock(state);
+
+        const struct tlb_flush_batch batch = state->pending;
+        const uint64_t gen =
+            atomic_load_explicit(&state->request_gen, memory_order_relaxed);
+
+        state->pending = TLB_FLUSH_BATCH_INIT();
+        state->ipi_pending = false;
+
+        spin_release(&state->lock);
+
+        tlb_flush_local(&batch);
+        atomic_store_explicit(&state->done_gen, gen, memory_order_release);
+    }
+
+    __debug_optimize(3) static uint64_t
+    post_to_cpu(struct cpu_info *const cpu,
+                const struct tlb_flush_batch *const batch)
+    {
+        struct tlb_cpu_state *const state = &cpu->tlb_state;
+
+        state_lock(state);
+        tlb_flush_batch_merge(&state->pending, batch);
+
+        const uint64_t gen =
+            atomic_load_explicit(&state->request_gen, memory_order_relaxed) + 1;
+
+        atomic_store_explicit(&state->request_gen, gen, memory_order_release);
+
+        // If an ipi is still outstanding, the cpu picks up our flush along with
+        // the ones already pending.
+
+        const bool send_ipi = !state->ipi_pending;
+        state->ipi_pending = true;
+
+        spin_release(&state->lock);
+        if (send_ipi) {
+            tlb_send_shootdown_ipi(cpu);
+        }
+
+        return gen;
+    }
+
+    __debug_optimize(3) static void
+    wait_for_cpus(struct cpu_info *const *const target_list,
+                  const uint64_t *const gen_list,
+                  const uint32_t count)
+    {
+        // Keep handling flushes posted to us while waiting, in case the cpus
+        // we're waiting on are waiting on us.
+
+        struct tlb_cpu_state *const self = &this_cpu_mut()->tlb_state;
+        for (uint32_t i = 0; i != count; i++) {
+            const struct tlb_cpu_state *const state =
+                &target_list[i]->tlb_state;
+            while (atomic_load_explicit(&state->done_gen, memory_order_acquire)
+                    < gen_list[i])
+            {
+                handle_pending(self);
+                cpu_pause();
+            }
+        }
+    }
+
+    __debug_optimize(3) static void
+    shootdown_online_cpus(const struct tlb_flush_batch *const batch) {
+        struct cpu_info *target_list[TLB_SHOOTDOWN_WAIT_MAX];
+        uint64_t gen_list[TLB_SHOOTDOWN_WAIT_MAX];
+        uint32_t count = 0;
+
+        const struct cpu_info *const self = this_cpu();
+        struct cpu_info *iter = NULL;
+
+        list_foreach(iter, cpus_get_list(), cpu_list) {
+            if (iter == self
+             || !atomic_load_explicit(&iter->tlb_state.online,
+                                      memory_order_acquire))
+            {
+                continue;
+            }
+
+            target_list[count] = iter;
+            gen_list[count] = post_to_cpu(iter, batch);
+
+            count++;
+            if (count == TLB_SHOOTDOWN_WAIT_MAX) {
+                wait_for_cpus(target_list, gen_list, count);
+                count = 0;
+            }
+        }
+
+        wait_for_cpus(target_list, gen_list, count);
+    }
+
+    __debug_optimize(3) static void
+    shootdown_pagemap_cpus(struct pagemap *const pagemap,
+                           const struct tlb_flush_batch *const batch)
+    {
+        struct cpu_info *target_list[TLB_SHOOTDOWN_WAIT_MAX];
+        uint64_t gen_list[TLB_SHOOTDOWN_WAIT_MAX];
+
+        uint32_t count = 0;
+        bool overflow = false;
+
+        const struct cpu_info *const self = this_cpu();
+        struct cpu_info *iter = NULL;
+
+        // Only post while holding the cpu-lock, as waiting on cpus under it
+        // would deadlock cpus trying to switch pagemaps.
+
+        spin_acquire(&pagemap->cpu_lock);
+        list_foreach(iter, &pagemap->cpu_list, pagemap_node) {
+            if (iter == self) {
+                continue;
+            }
+
+            // Lazy cpus are only skipped if no page-tables are freed, see
+            // tlb_flush_batch.frees_tables.
+
+            if (iter->tlb_state.lazy && !batch->frees_tables) {
+                iter->tlb_state.lazy_flush_needed = true;
+                continue;
+            }
+
+            if (count == TLB_SHOOTDOWN_WAIT_MAX) {
+                overflow = true;
+                break;
+            }
+
+            target_list[count] = iter;
+            gen_list[count] = post_to_cpu(iter, batch);
+
+            count++;
+        }
+
+        spin_release(&pagemap->cpu_lock);
+        wait_for_cpus(target_list, gen_list, count);
+
+        // Flushing cpus that aren't using the pagemap is harmless, so fall
+        // back to flushing every cpu when too many are using it.
+
+        if (overflow) {
+            shootdown_online_cpus(batch);
+        }
+    }
+#elif defined(__riscv64)
+    __debug_optimize(3) static void
+    shootdown_pagemap_cpus(struct pagemap *const pagemap,
+                           const struct tlb_flush_batch *const batch)
+    {
+        const struct cpu_info *const self = this_cpu();
+        struct cpu_info *iter = NULL;
+
+        // The sbi takes harts in windows of 64, so flush each window as we
+        // come across a hart outside of it.
+
+        uint64_t hart_mask = 0;
+        uint64_t hart_mask_base = 0;
+
+        spin_acquire(&pagemap->cpu_lock);
+        list_foreach(iter, &pagemap->cpu_list, pagemap_node) {
+            if (iter == self) {
+                continue;
+            }
+
+            // Lazy cpus are only skipped if no page-tables are freed, see
+            // tlb_flush_batch.frees_tables.
+
+            if (iter->tlb_state.lazy && !batch->frees_tables) {
+                iter->tlb_state.lazy_flush_needed = true;
+                continue;
+            }
+
+            const uint64_t hart_id = iter->hart_id;
+            const uint64_t base = hart_id - (hart_id % 64);
+
+            if (hart_mask != 0 && base != hart_mask_base) {
+                tlb_flush_remote_harts(hart_mask, hart_mask_base, batch);
+                hart_mask = 0;
+            }
+
+            hart_mask_base = base;
+            hart_mask |= 1ull << (hart_id - base);
+        }
+
+        if (hart_mask != 0) {
+            tlb_flush_remote_harts(hart_mask, hart_mask_base, batch);
+        }
+
+        spin_release(&pagemap->cpu_lock);
+    }
+#endif /* defined(__x86_64__) */
+
+__debug_optimize(3) void tlb_shootdown_handle_pending() {
+#if defined(__x86_64__)
+    handle_pending(&this_cpu_mut()->tlb_state);
+#endif /* defined(__x86_64__) */
+}
+
+__debug_optimize(3) void tlb_shootdown_poll() {
+#if defined(__x86_64__)
+    if (atomic_load_explicit(&g_waiter_count, memory_order_relaxed) == 0) {
+        return;
+    }
+
+    // Cpus that haven't setup their current thread yet can't be online, and so
+    // can't have any flushes posted to them.
+
+    const struct thread *const thread = current_thread();
+    if (thread == NULL) {
+        return;
+    }
+
+    const bool flag = disable_irqs_if_enabled();
+
+    handle_pending(&this_cpu_mut()->tlb_state);
+    enable_irqs_if_flag(flag);
+#endif /* defined(__x86_64__) */
+}
+
+__debug_optimize(3) void
+tlb_shootdown(struct pagemap *const pagemap,
+              const struct tlb_flush_batch *const batch)
+{
+    assert(!are_interrupts_enabled());
+    if (tlb_flush_batch_empty(batch)) {
+        return;
+    }
+
+    // Kernel mappings are shared by every pagemap, so they're flushed on every
+    // online cpu.
+
+    const bool is_kernel = pagemap == &kernel_process.pagemap;
+
+#if !defined(__aarch64__)
+    // Cpus that aren't using the pagemap are skipped, but may still have its
+    // entries under the asid they last used it with. Broadcast tlbi flushes
+    // every asid on aarch64, so it doesn't need this.
+
+    if (!is_kernel) {
+        atomic_fetch_add_explicit(&pagemap->tlb_gen, 1, memory_order_acq_rel);
+    }
+#endif /* !defined(__aarch64__) */
+
+#if __has_include("mm/tlb.h")
+    const struct tlb_cpu_state *const state = &this_cpu()->tlb_state;
+
+    struct tlb_flush_batch flush = *batch;
+    flush.global = is_kernel;
+
+    #if defined(__aarch64__)
+        if (atomic_load_explicit(&state->online, memory_order_relaxed)) {
+            tlb_flush_broadcast(&flush);
+            return;
+        }
+    #endif /* defined(__aarch64__) */
+
+    if (is_kernel || state->pagemap == pagemap) {
+        tlb_flush_local(&flush);
+    }
+
+    if (!atomic_load_explicit(&state->online, memory_order_relaxed)) {
+        return;
+    }
+
+    #if defined(__x86_64__)
+        atomic_fetch_add_explicit(&g_waiter_count, 1, memory_order_acq_rel);
+        if (is_kernel) {
+            shootdown_online_cpus(&flush);
+        } else {
+            shootdown_pagemap_cpus(pagemap, &flush);
+        }
+
+        atomic_fetch_sub_explicit(&g_waiter_count, 1, memory_order_acq_rel);
+    #elif defined(__riscv64)
+        if (is_kernel) {
+            tlb_flush_remote_harts(/*hart_mask=*/0,
+                                   SBI_HART_MASK_BASE_ALL,
+                                   &flush);
+        } else {
+            shootdown_pagemap_cpus(pagemap, &flush);
+        }
+    #endif /* defined(__x86_64__) */
+#endif /* __has_include("mm/tlb.h") */
+}
@@ -0,0 +1,128 @@
+/*
+ * kernel/src/mm/shootdown.h
+ * © suhas pai
+ */
+
+#pragma once
+#include <stdatomic.h>
+
+#include "cpu/spinlock.h"
+#include "lib/adt/range.h"
+#include "lib/macros.h"
+
+// Batches covering more pages than this are flushed by flushing the entire
+// tlb, instead of one page at a time.
+
+#define TLB_FLUSH_FULL_THRESHOLD_PAGES 32
+#define TLB_FLUSH_BATCH_MAX_RANGES 8
+
+struct tlb_flush_batch {
+    struct range range_list[TLB_FLUSH_BATCH_MAX_RANGES];
+
+    uint64_t page_count;
+    uint8_t range_count;
+
+    // Set once the batch has too many pages or ranges, at which point the
+    // range-list is no longer used.
+
+    bool full : 1;
+
+    // Set when the batch has kernel mappings, which are global on x86_64 and
+    // survive a non-global full flush.
+
+    bool global : 1;
+
+    // Set when page-tables are freed once the batch is flushed. Cpus in lazy
+    // mode still have the pagemap loaded, and may walk into those tables until
+    // they flush, so they have to be flushed right away too.
+
+    bool frees_tables : 1;
+};
+
+#define TLB_FLUSH_BATCH_INIT() \
+    ((struct tlb_flush_batch){ \
+        .range_list = {}, \
+        .page_count = 0, \
+        .range_count = 0, \
+        .full = false, \
+        .global = false, \
+        .frees_tables = false \
+    })
+
+__debug_optimize(3) static inline bool
+tlb_flush_batch_empty(const struct tlb_flush_batch *const batch) {
+    return !batch->full && batch->range_count == 0;
+}
+
+void tlb_flush_batch_add(struct tlb_flush_batch *batch, struct range range);
+
+void
+tlb_flush_batch_merge(struct tlb_flush_batch *batch,
+                      const struct tlb_flush_batch *other);
+
+struct pagemap;
+struct tlb_cpu_state {
+    // Flushes posted to this cpu by other cpus, which are merged into a
+    // single batch until the cpu gets around to them. Only one ipi is
+    // outstanding at a time.
+
+    struct spinlock lock;
+    struct tlb_flush_batch pending;
+
+    _Atomic uint64_t request_gen;
+    _Atomic uint64_t done_gen;
+
+    bool ipi_pending;
+
+    // Set once the cpu can take part in shootdowns. A cpu that isn't online
+    // yet flushes its entire tlb when it comes online instead.
+
+    _Atomic bool online;
+
+    // The pagemap loaded on this cpu. A cpu that switches to a kernel thread
+    // keeps its previous pagemap loaded and is marked lazy. Shootdowns that
+    // don't free page-tables skip lazy cpus, which flush their entire tlb when
+    // leaving lazy mode instead.
+    // These fields are protected by the loaded pagemap's cpu-lock.
+
+    struct pagemap *pagemap;
+
+    bool lazy;
+    bool lazy_flush_needed;
+};
+
+#define TLB_CPU_STATE_INIT() \
+    { \
+        .lock = SPINLOCK_INIT(), \
+        .pending = TLB_FLUSH_BATCH_INIT(), \
+        .request_gen = 0, \
+        .done_gen = 0, \
+        .ipi_pending = false, \
+        .online = false, \
+        .pagemap = NULL, \
+        .lazy = false, \
+        .lazy_flush_needed = false \
+    }
+
+void tlb_cpu_state_init(struct tlb_cpu_state *state);
+
+void tlb_shootdown_init();
+void tlb_shootdown_init_on_cpu();
+
+// Flush the batch's ranges out of the tlb of every cpu that may have
+// translations of `pagemap` cached, and wait for them to finish. Must be called
+// with interrupts disabled.
+
+void
+tlb_shootdown(struct pagemap *pagemap, const struct tlb_flush_batch *batch);
+
+// Handle the flushes posted to this cpu, for use by the shootdown ipi handler.
+void tlb_shootdown_handle_pending();
+
+// Called while spinning with interrupts disabled, so a cpu waiting on a lock
+// held by a cpu that's waiting on a shootdown still handles the shootdown.
+
+void tlb_shootdown_poll();
+
+// Flush the entire tlb of this cpu, except for global mappings.
+void tlb_flush_this_cpu();
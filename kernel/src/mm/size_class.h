@@ -0,0 +1,41 @@
+/*
+ * kernel/src/mm/size_class.h
+ * © suhas pai
+ */
+
+#pragma once
+#include <stdint.h>
+
+#include "lib/macros.h"
+
+// Size-classes of kmalloc() and phalloc() are looked up with two tables
+// instead of walking the list of slab-allocators.
+//
+// Sizes up to SIZE_CLASS_SMALL_MAX are looked up in 16-byte steps, while
+// larger sizes are looked up in 512-byte steps. Every size-class larger than
+// SIZE_CLASS_SMALL_MAX must therefore be a multiple of 512 bytes.
+
+#define SIZE_CLASS_SMALL_MAX 1024
+#define SIZE_CLASS_SMALL_SHIFT 4
+#define SIZE_CLASS_LARGE_SHIFT 9
+
+#define SIZE_CLASS_SMALL_INDEX(size) \
+    (((size) + (1ull << SIZE_CLASS_SMALL_SHIFT) - 1) >> SIZE_CLASS_SMALL_SHIFT)
+#define SIZE_CLASS_LARGE_INDEX(size) \
+    (((size) + (1ull << SIZE_CLASS_LARGE_SHIFT) - 1) >> SIZE_CLASS_LARGE_SHIFT)
+
+#define SIZE_CLASS_SMALL_TABLE_LEN \
+    (SIZE_CLASS_SMALL_INDEX(SIZE_CLASS_SMALL_MAX) + 1)
+#define SIZE_CLASS_LARGE_TABLE_LEN(max) (SIZE_CLASS_LARGE_INDEX(max) + 1)
+
+__debug_optimize(3) static inline uint8_t
+size_class_lookup(const uint8_t *const small_table,
+                  const uint8_t *const large_table,
+                  const uint32_t size)
+{
+    if (size <= SIZE_CLASS_SMALL_MAX) {
+        return small_table[SIZE_CLASS_SMALL_INDEX(size)];
+    }
+
+    return large_table[SIZE_CLASS_LARGE_INDEX(size)];
+}
@@ -3,6 +3,10 @@
  * © suhas pai
  */
 
+#include "asm/irqs.h"
+#include "cpu/info.h"
+#include "dev/printk.h"
+
 #include "lib/align.h"
 #include "lib/overflow.h"
 #include "lib/string.h"
@@ -53,6 +57,23 @@ _Static_assert(sizeof(struct free_slab_object) <= SLAB_ALIGNMENT,
 
 #define MIN_OBJ_PER_SLAB 1
 
+// Limit how many bytes of objects a single magazine can hold, so allocators
+// for large objects don't hoard memory on every cpu.
+
+#define SLAB_MAGAZINE_MAX_BYTES (PAGE_SIZE * 16)
+
+// Maximum number of full and empty magazines each depot keeps around. Full
+// magazines past this limit are flushed back to the slabs so slab pages can
+// still be freed.
+
+#define SLAB_DEPOT_MAX_FULL 8
+#define SLAB_DEPOT_MAX_EMPTY 8
+
+static struct slab_allocator g_magazine_alloc = {0};
+static bool g_magazine_alloc_initialized = false;
+
+static uint8_t g_cpu_cache_count = 0;
+
 __debug_optimize(3) static uint64_t
 get_free_obj_byte_index(struct slab_allocator *const alloc,
                         const uint32_t index)
@@ -139,19 +160,58 @@ slab_allocator_init(struct slab_allocator *const slab_alloc,
     }
 
     list_init(&slab_alloc->free_slab_head_list);
+    list_init(&slab_alloc->depot.full_list);
+    list_init(&slab_alloc->depot.empty_list);
 
     slab_alloc->lock = SPINLOCK_INIT();
+    slab_alloc->depot.lock = SPINLOCK_INIT();
+    slab_alloc->depot.full_count = 0;
+    slab_alloc->depot.empty_count = 0;
+
     slab_alloc->object_size = object_size;
     slab_alloc->free_obj_count = 0;
     slab_alloc->alloc_flags = alloc_flags;
     slab_alloc->flags = flags;
 
+    slab_alloc->cpu_cache_index = SLAB_NO_CPU_CACHE;
+    slab_alloc->magazine_capacity = 0;
+
     uint8_t order = 0;
     for (; (PAGE_SIZE << order) < min_size_for_slab; order++) {}
 
     slab_alloc->slab_order = order;
     slab_alloc->object_count_per_slab = (PAGE_SIZE << order) / object_size;
 
+    if (flags & __SLAB_ALLOC_CPU_CACHE) {
+        if (!g_magazine_alloc_initialized) {
+            if (!slab_allocator_init(&g_magazine_alloc,
+                                     sizeof(struct slab_magazine),
+                                     /*alloc_flags=*/0,
+                                     /*flags=*/0))
+            {
+                return false;
+            }
+
+            g_magazine_alloc_initialized = true;
+        }
+
+        if (g_cpu_cache_count == SLAB_CPU_CACHE_MAX) {
+            return false;
+        }
+
+        uint64_t capacity = SLAB_MAGAZINE_MAX_BYTES / object_size;
+        if (capacity == 0) {
+            capacity = 1;
+        } else if (capacity > SLAB_MAGAZINE_SIZE) {
+            capacity = SLAB_MAGAZINE_SIZE;
+        }
+
+        slab_alloc->cpu_cache_index = g_cpu_cache_count;
+        slab_alloc->magazine_capacity = (uint8_t)capacity;
+
+        g_cpu_cache_count++;
+    }
+
     return true;
 }
 
@@ -198,23 +258,12 @@ static struct page *alloc_slab_page(struct slab_allocator *const alloc) {
     return head;
 }
 
-void *slab_alloc(struct slab_allocator *const alloc) {
-    slab_verify(alloc);
-    int flag = 0;
-
-    const bool needs_lock = (alloc->flags & __SLAB_ALLOC_NO_LOCK) == 0;
-    if (needs_lock) {
-        flag = spin_acquire_save_irq(&alloc->lock);
-    }
-
+// Caller must hold the allocator's lock.
+static void *alloc_from_slabs(struct slab_allocator *const alloc) {
     struct page *head = NULL;
     if (list_empty(&alloc->free_slab_head_list)) {
         head = alloc_slab_page(alloc);
         if (head == NULL) {
-            if (needs_lock) {
-                spin_release_restore_irq(&alloc->lock, flag);
-            }
-
             return NULL;
         }
     } else {
@@ -234,61 +283,10 @@ void *slab_alloc(struct slab_allocator *const alloc) {
     struct free_slab_object *const result = get_free_object(head, alloc);
     head->slab.head.first_free_index = result->next;
 
-    if (needs_lock) {
-        spin_release_restore_irq(&alloc->lock, flag);
-    }
-
     zero_free_object(result);
     return result;
 }
 
-struct page *
-slab_alloc2(struct slab_allocator *const alloc, uint64_t *const offset) {
-    slab_verify(alloc);
-    int flag = 0;
-
-    const bool needs_lock = (alloc->flags & __SLAB_ALLOC_NO_LOCK) == 0;
-    if (needs_lock) {
-        flag = spin_acquire_save_irq(&alloc->lock);
-    }
-
-    struct page *head = NULL;
-    if (list_empty(&alloc->free_slab_head_list)) {
-        head = alloc_slab_page(alloc);
-        if (head == NULL) {
-            if (needs_lock) {
-                spin_release_restore_irq(&alloc->lock, flag);
-            }
-
-            return NULL;
-        }
-    } else {
-        head =
-            list_head(&alloc->free_slab_head_list,
-                      struct page,
-                      slab.head.slab_list);
-    }
-
-    alloc->free_obj_count--;
-    head->slab.head.free_obj_count--;
-
-    if (head->slab.head.free_obj_count == 0) {
-        list_deinit(&head->slab.head.slab_list);
-    }
-
-    *offset = get_free_obj_byte_index(alloc, head->slab.head.first_free_index);
-
-    struct free_slab_object *const result = page_to_virt(head) + *offset;
-    head->slab.head.first_free_index = result->next;
-
-    if (needs_lock) {
-        spin_release_restore_irq(&alloc->lock, flag);
-    }
-
-    zero_free_object(result);
-    return head;
-}
-
 __debug_optimize(3)
 static inline struct page *slab_head_of(const void *const mem) {
     struct page *const page = virt_to_page(mem);
@@ -307,20 +305,12 @@ index_of_free_object(struct page *const head,
     return distance(page_to_virt(head), free_object) / alloc->object_size;
 }
 
-void slab_free(void *const mem) {
-    struct page *const head = slab_head_of(mem);
-    struct slab_allocator *const alloc = head->slab.allocator;
-
-    bzero(mem, alloc->object_size);
-    slab_verify(alloc);
-
-    int flag = 0;
-    const bool needs_lock = (alloc->flags & __SLAB_ALLOC_NO_LOCK) == 0;
-
-    if (needs_lock) {
-        flag = spin_acquire_save_irq(&alloc->lock);
-    }
-
+// Caller must hold the allocator's lock.
+static void
+free_to_slabs(struct slab_allocator *const alloc,
+              struct page *const head,
+              void *const mem)
+{
     alloc->free_obj_count += 1;
     head->slab.head.free_obj_count += 1;
 
@@ -332,10 +322,6 @@ void slab_free(void *const mem) {
             list_deinit(&head->slab.head.slab_list);
             free_pages(head, alloc->slab_order);
 
-            if (needs_lock) {
-                spin_release_restore_irq(&alloc->lock, flag);
-            }
-
             return;
         }
     } else {
@@ -350,7 +336,289 @@ void slab_free(void *const mem) {
 
     head->slab.head.first_free_index =
         index_of_free_object(head, alloc, free_obj);
+}
+
+__debug_optimize(3) static inline struct slab_cpu_cache *
+cpu_cache_of(const struct slab_allocator *const alloc) {
+    return &this_cpu_mut()->slab_cache_list[alloc->cpu_cache_index];
+}
+
+static struct slab_magazine *alloc_magazine() {
+    struct slab_magazine *const magazine = slab_alloc(&g_magazine_alloc);
+    if (magazine == NULL) {
+        return NULL;
+    }
+
+    list_init(&magazine->list);
+    magazine->count = 0;
+
+    return magazine;
+}
+
+// Allocate a batch of objects from the slabs into the provided magazine with a
+// single acquisition of the allocator's lock.
+
+static uint32_t
+fill_magazine_from_slabs(struct slab_allocator *const alloc,
+                         struct slab_magazine *const magazine)
+{
+    const int flag = spin_acquire_save_irq(&alloc->lock);
+    while (magazine->count != alloc->magazine_capacity) {
+        void *const object = alloc_from_slabs(alloc);
+        if (object == NULL) {
+            break;
+        }
+
+        magazine->objects[magazine->count] = object;
+        magazine->count++;
+    }
 
+    spin_release_restore_irq(&alloc->lock, flag);
+    return magazine->count;
+}
+
+static void
+flush_magazine_to_slabs(struct slab_allocator *const alloc,
+                        struct slab_magazine *const magazine)
+{
+    const int flag = spin_acquire_save_irq(&alloc->lock);
+    for (uint32_t i = 0; i != magazine->count; i++) {
+        void *const object = magazine->objects[i];
+        free_to_slabs(alloc, slab_head_of(object), object);
+    }
+
+    spin_release_restore_irq(&alloc->lock, flag);
+    magazine->count = 0;
+}
+
+// Exchange the cpu's empty loaded magazine for a full one from the depot.
+static bool
+cpu_cache_take_full(struct slab_allocator *const alloc,
+                    struct slab_cpu_cache *const cache)
+{
+    struct slab_depot *const depot = &alloc->depot;
+    struct slab_magazine *empty = cache->loaded;
+
+    spin_acquire(&depot->lock);
+    if (list_empty(&depot->full_list)) {
+        spin_release(&depot->lock);
+        return false;
+    }
+
+    struct slab_magazine *const full =
+        list_head(&depot->full_list, struct slab_magazine, list);
+
+    list_remove(&full->list);
+    depot->full_count--;
+
+    if (empty != NULL && depot->empty_count != SLAB_DEPOT_MAX_EMPTY) {
+        list_add(&depot->empty_list, &empty->list);
+        depot->empty_count++;
+
+        empty = NULL;
+    }
+
+    spin_release(&depot->lock);
+    if (empty != NULL) {
+        slab_free(empty);
+    }
+
+    cache->loaded = full;
+    cache->refill_count++;
+
+    return true;
+}
+
+// Load an empty magazine so the cpu can keep freeing into its cache. The
+// previous magazine, which is full, is given to the depot, or flushed back to
+// the slabs if the depot is already at its limit.
+
+static bool
+cpu_cache_take_empty(struct slab_allocator *const alloc,
+                     struct slab_cpu_cache *const cache)
+{
+    struct slab_depot *const depot = &alloc->depot;
+    struct slab_magazine *const previous = cache->previous;
+    struct slab_magazine *empty = NULL;
+
+    spin_acquire(&depot->lock);
+
+    const bool flush_previous =
+        previous != NULL && depot->full_count == SLAB_DEPOT_MAX_FULL;
+
+    if (!flush_previous) {
+        if (previous != NULL) {
+            list_add(&depot->full_list, &previous->list);
+            depot->full_count++;
+        }
+
+        if (!list_empty(&depot->empty_list)) {
+            empty = list_head(&depot->empty_list, struct slab_magazine, list);
+            list_remove(&empty->list);
+
+            depot->empty_count--;
+        }
+    }
+
+    spin_release(&depot->lock);
+    if (flush_previous) {
+        flush_magazine_to_slabs(alloc, previous);
+        empty = previous;
+    } else if (empty == NULL) {
+        empty = alloc_magazine();
+        if (empty == NULL) {
+            cache->previous = NULL;
+            return false;
+        }
+    }
+
+    if (previous != NULL) {
+        cache->flush_count++;
+    }
+
+    cache->previous = cache->loaded;
+    cache->loaded = empty;
+
+    return true;
+}
+
+// Nothing is cached for this allocator anywhere, so fill the cpu's loaded
+// magazine with a batch of objects from the slabs.
+
+static bool
+cpu_cache_fill(struct slab_allocator *const alloc,
+               struct slab_cpu_cache *const cache)
+{
+    if (cache->loaded == NULL) {
+        if (cache->previous != NULL) {
+            swap(cache->loaded, cache->previous);
+        } else {
+            cache->loaded = alloc_magazine();
+            if (cache->loaded == NULL) {
+                return false;
+            }
+        }
+    }
+
+    if (fill_magazine_from_slabs(alloc, cache->loaded) == 0) {
+        return false;
+    }
+
+    cache->refill_count++;
+    return true;
+}
+
+static void *cpu_cache_alloc(struct slab_allocator *const alloc) {
+    const bool irqs_enabled = disable_irqs_if_enabled();
+    struct slab_cpu_cache *const cache = cpu_cache_of(alloc);
+
+    if (cache->loaded == NULL || cache->loaded->count == 0) {
+        if (cache->previous != NULL && cache->previous->count != 0) {
+            swap(cache->loaded, cache->previous);
+            cache->hit_count++;
+        } else if (cpu_cache_take_full(alloc, cache)) {
+            cache->hit_count++;
+        } else {
+            cache->miss_count++;
+            if (!cpu_cache_fill(alloc, cache)) {
+                enable_irqs_if_flag(irqs_enabled);
+                return NULL;
+            }
+        }
+    } else {
+        cache->hit_count++;
+    }
+
+    struct slab_magazine *const loaded = cache->loaded;
+    loaded->count--;
+
+    void *const result = loaded->objects[loaded->count];
+    enable_irqs_if_flag(irqs_enabled);
+
+    return result;
+}
+
+static bool cpu_cache_free(struct slab_allocator *const alloc, void *const mem) {
+    const bool irqs_enabled = disable_irqs_if_enabled();
+    struct slab_cpu_cache *const cache = cpu_cache_of(alloc);
+
+    const uint32_t capacity = alloc->magazine_capacity;
+    if (cache->loaded == NULL || cache->loaded->count == capacity) {
+        if (cache->previous != NULL && cache->previous->count != capacity) {
+            swap(cache->loaded, cache->previous);
+        } else if (!cpu_cache_take_empty(alloc, cache)) {
+            enable_irqs_if_flag(irqs_enabled);
+            return false;
+        }
+    }
+
+    struct slab_magazine *const loaded = cache->loaded;
+
+    loaded->objects[loaded->count] = mem;
+    loaded->count++;
+
+    enable_irqs_if_flag(irqs_enabled);
+    return true;
+}
+
+void *slab_alloc(struct slab_allocator *const alloc) {
+    slab_verify(alloc);
+    if (alloc->cpu_cache_index != SLAB_NO_CPU_CACHE) {
+        void *const result = cpu_cache_alloc(alloc);
+        if (__builtin_expect(result != NULL, 1)) {
+            return result;
+        }
+    }
+
+    int flag = 0;
+
+    const bool needs_lock = (alloc->flags & __SLAB_ALLOC_NO_LOCK) == 0;
+    if (needs_lock) {
+        flag = spin_acquire_save_irq(&alloc->lock);
+    }
+
+    void *const result = alloc_from_slabs(alloc);
+    if (needs_lock) {
+        spin_release_restore_irq(&alloc->lock, flag);
+    }
+
+    return result;
+}
+
+struct page *
+slab_alloc2(struct slab_allocator *const alloc, uint64_t *const offset) {
+    void *const result = slab_alloc(alloc);
+    if (result == NULL) {
+        return NULL;
+    }
+
+    struct page *const head = slab_head_of(result);
+    *offset = distance(page_to_virt(head), result);
+
+    return head;
+}
+
+void slab_free(void *const mem) {
+    struct page *const head = slab_head_of(mem);
+    struct slab_allocator *const alloc = head->slab.allocator;
+
+    bzero(mem, alloc->object_size);
+    slab_verify(alloc);
+
+    if (alloc->cpu_cache_index != SLAB_NO_CPU_CACHE) {
+        if (__builtin_expect(cpu_cache_free(alloc, mem), 1)) {
+            return;
+        }
+    }
+
+    int flag = 0;
+    const bool needs_lock = (alloc->flags & __SLAB_ALLOC_NO_LOCK) == 0;
+
+    if (needs_lock) {
+        flag = spin_acquire_save_irq(&alloc->lock);
+    }
+
+    free_to_slabs(alloc, head, mem);
     if (needs_lock) {
         spin_release_restore_irq(&alloc->lock, flag);
     }
@@ -368,4 +636,38 @@ __debug_optimize(3) uint32_t slab_object_size(void *const mem) {
 
     struct slab_allocator *const allocator = page->slab.allocator;
     return allocator->object_size;
-}
\ No newline at end of file
+}
+
+__debug_optimize(3) const struct slab_cpu_cache *
+slab_get_cpu_cache(const struct slab_allocator *const alloc,
+                   const struct cpu_info *const cpu)
+{
+    if (alloc->cpu_cache_index == SLAB_NO_CPU_CACHE) {
+        return NULL;
+    }
+
+    return &cpu->slab_cache_list[alloc->cpu_cache_index];
+}
+
+void slab_print_cpu_cache_stats(const struct slab_allocator *const alloc) {
+    if (alloc->cpu_cache_index == SLAB_NO_CPU_CACHE) {
+        return;
+    }
+
+    const struct cpu_info *cpu = NULL;
+    list_foreach(cpu, cpus_get_list(), cpu_list) {
+        const struct slab_cpu_cache *const cache =
+            &cpu->slab_cache_list[alloc->cpu_cache_index];
+
+        printk(LOGLEVEL_INFO,
+               "slab: object-size %" PRIu32 " on cpu %" PRIu32 ": "
+               "%" PRIu64 " hits, %" PRIu64 " misses, %" PRIu64 " refills, "
+               "%" PRIu64 " flushes\n",
+               alloc->object_size,
+               cpu_get_id(cpu),
+               cache->hit_count,
+               cache->miss_count,
+               cache->refill_count,
+               cache->flush_count);
+    }
+}
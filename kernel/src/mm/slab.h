@@ -8,12 +8,66 @@
 #include "cpu/spinlock.h"
 #include "lib/list.h"
 
+// Maximum number of objects a magazine can hold. The actual capacity used by
+// an allocator is scaled down for larger objects, see
+// slab_allocator::magazine_capacity.
+
+#define SLAB_MAGAZINE_SIZE 30
+
+// Maximum number of slab-allocators that can have per-cpu caches.
+#define SLAB_CPU_CACHE_MAX 40
+#define SLAB_NO_CPU_CACHE UINT8_MAX
+
+// A magazine is a stack of free objects that a cpu can allocate from and free
+// into without taking any shared lock.
+
+struct slab_magazine {
+    struct list list;
+    uint32_t count;
+
+    void *objects[SLAB_MAGAZINE_SIZE];
+};
+
+// Per-cpu state for a slab-allocator. Every cpu holds a loaded magazine and
+// the previously loaded one, and swaps between the two before having to go
+// to the depot or the slabs.
+
+struct slab_cpu_cache {
+    struct slab_magazine *loaded;
+    struct slab_magazine *previous;
+
+    // Allocations served from a magazine.
+    uint64_t hit_count;
+
+    // Allocations that had to take the slab lock.
+    uint64_t miss_count;
+
+    // Times a magazine was taken from the depot or filled from the slabs.
+    uint64_t refill_count;
+
+    // Times a full magazine was given back to the depot or the slabs.
+    uint64_t flush_count;
+};
+
+// The depot holds magazines not currently loaded on any cpu.
+struct slab_depot {
+    struct list full_list;
+    struct list empty_list;
+
+    struct spinlock lock;
+
+    uint32_t full_count;
+    uint32_t empty_count;
+};
+
 // Structure to represent a slab allocator.
 struct slab_allocator {
     // List of struct page used as slabs.
     struct list free_slab_head_list;
     struct spinlock lock;
 
+    struct slab_depot depot;
+
     // Statistics about this allocator. These are constant and can be read w/o
     // holding the lock.
     uint32_t object_size;
@@ -22,12 +76,19 @@ struct slab_allocator {
     uint8_t slab_order;
     uint16_t flags;
 
+    // Index into cpu_info_base::slab_cache_list, or SLAB_NO_CPU_CACHE.
+    uint8_t cpu_cache_index;
+    uint8_t magazine_capacity;
+
     uint32_t free_obj_count;
     uint32_t slab_count;
 };
 
 enum slab_allocator_flags {
-    __SLAB_ALLOC_NO_LOCK = 1ull << 0
+    __SLAB_ALLOC_NO_LOCK = 1ull << 0,
+
+    // Keep per-cpu magazines of free objects in front of the slabs.
+    __SLAB_ALLOC_CPU_CACHE = 1ull << 1,
 };
 
 void slab_verify(struct slab_allocator *allocator);
@@ -45,3 +106,11 @@ void *slab_alloc(struct slab_allocator *allocator);
 
 struct page *slab_alloc2(struct slab_allocator *allocator, uint64_t *offset);
 uint32_t slab_object_size(void *mem);
+
+struct cpu_info;
+
+const struct slab_cpu_cache *
+slab_get_cpu_cache(const struct slab_allocator *allocator,
+                   const struct cpu_info *cpu);
+
+void slab_print_cpu_cache_stats(const struct slab_allocator *allocator);
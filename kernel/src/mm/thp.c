@@ -0,0 +1,391 @@
+/*
+ * kernel/src/mm/thp.c
+ * © suhas pai
+ */
+
+#include <stdatomic.h>
+
+#include "asm/irqs.h"
+#include "dev/printk.h"
+
+#include "lib/align.h"
+#include "lib/string.h"
+#include "lib/util.h"
+
+#include "sched/scheduler.h"
+#include "sched/sleep.h"
+
+#include "fault.h"
+#include "kmalloc.h"
+#include "page_alloc.h"
+#include "pgmap.h"
+#include "thp.h"
+#include "walker.h"
+
+static struct list g_vma_list = LIST_INIT(g_vma_list);
+static struct spinlock g_vma_list_lock = SPINLOCK_INIT();
+
+static _Atomic uint64_t g_fault_count = 0;
+static _Atomic uint64_t g_fault_fallback_count = 0;
+
+static _Atomic uint64_t g_collapse_count = 0;
+static _Atomic uint64_t g_collapse_fail_count = 0;
+
+void thp_register_vma(struct vm_area *const vma) {
+    const int flag = spin_acquire_save_irq(&g_vma_list_lock);
+    list_add(&g_vma_list, &vma->thp_list);
+    spin_release_restore_irq(&g_vma_list_lock, flag);
+}
+
+__debug_optimize(3) static inline bool
+window_is_unmapped(struct pagemap *const pagemap, const uint64_t window) {
+    struct pt_walker walker;
+    ptwalker_create_for_pagemap(&walker,
+                                pagemap,
+                                window,
+                                /*alloc_pgtable=*/NULL,
+                                /*free_pgtable=*/NULL);
+
+    // The walker stops at the lowest level that has a table. If that's above
+    // the large-page's level, then nothing in the window can be mapped.
+
+    if (walker.level != THP_LEVEL) {
+        return walker.level > THP_LEVEL;
+    }
+
+    const pte_t *const pte =
+        &walker.tables[THP_LEVEL - 1][walker.indices[THP_LEVEL - 1]];
+
+    return !pte_is_present(pte_read(pte));
+}
+
+bool
+thp_try_fault(struct pagemap *const pagemap,
+              struct vm_area *const vma,
+              const uint64_t addr)
+{
+    if (!largepage_level_info_list[THP_LEVEL - 1].is_supported) {
+        return false;
+    }
+
+    const struct range window_range =
+        RANGE_INIT(align_down(addr, THP_SIZE), THP_SIZE);
+
+    if (!range_has(vma->node.range, window_range)
+     || !window_is_unmapped(pagemap, window_range.front))
+    {
+        return false;
+    }
+
+    struct page *const page = alloc_large_page(THP_LEVEL, __ALLOC_ZERO);
+    if (page == NULL) {
+        atomic_fetch_add_explicit(&g_fault_fallback_count,
+                                  1,
+                                  memory_order_relaxed);
+        return false;
+    }
+
+    const bool map_result =
+        arch_make_mapping(pagemap,
+                          RANGE_INIT(page_to_phys(page), THP_SIZE),
+                          window_range.front,
+                          vma->prot,
+                          vma->cachekind,
+                          /*is_overwrite=*/false);
+
+    if (!map_result) {
+        free_page(page);
+        atomic_fetch_add_explicit(&g_fault_fallback_count,
+                                  1,
+                                  memory_order_relaxed);
+        return false;
+    }
+
+    atomic_fetch_add_explicit(&pagemap->anon_large_page_count,
+                              1,
+                              memory_order_relaxed);
+    atomic_fetch_add_explicit(&g_fault_count, 1, memory_order_relaxed);
+
+    return true;
+}
+
+enum collapse_result {
+    COLLAPSE_OK,
+    COLLAPSE_SKIPPED,
+    COLLAPSE_FAILED
+};
+
+// Fill `phys_list` with the page backing every page of the window, if every
+// page is mapped to a page of its own.
+
+__debug_optimize(3) static bool
+window_is_populated(struct pagemap *const pagemap,
+                    const uint64_t window,
+                    uint64_t *const phys_list)
+{
+    struct pt_walker walker;
+    ptwalker_create_for_pagemap(&walker,
+                                pagemap,
+                                window,
+                                /*alloc_pgtable=*/NULL,
+                                /*free_pgtable=*/NULL);
+
+    if (walker.level != 1) {
+        return false;
+    }
+
+    const pte_t *const table = walker.tables[0];
+    for (uint64_t i = 0; i != PAGE_COUNT(THP_SIZE); i++) {
+        const pte_t entry = pte_read(&table[i]);
+        if (!pte_is_present(entry)) {
+            return false;
+        }
+
+        const uint64_t phys = pte_to_phys(entry, /*level=*/1);
+        if (page_fault_is_zero_page(phys)) {
+            return false;
+        }
+
+        phys_list[i] = phys;
+    }
+
+    return true;
+}
+
+// Put the pages in `phys_list` back in the window, after a collapse that failed
+// after unmapping them.
+
+static void
+remap_window(struct pagemap *const pagemap,
+             const struct vm_area *const vma,
+             const uint64_t window,
+             const uint64_t *const phys_list)
+{
+    for (uint64_t i = 0; i != PAGE_COUNT(THP_SIZE); i++) {
+        const bool map_result =
+            arch_make_mapping(pagemap,
+                              RANGE_INIT(phys_list[i], PAGE_SIZE),
+                              window + (i << PAGE_SHIFT),
+                              vma->prot,
+                              vma->cachekind,
+                              /*is_overwrite=*/false);
+
+        assert_msg(map_result,
+                   "mm: thp: failed to map back page of window at %p",
+                   (void *)window);
+    }
+}
+
+static enum collapse_result
+collapse_window(struct pagemap *const pagemap,
+                struct vm_area *const vma,
+                const uint64_t window,
+                uint64_t *const phys_list)
+{
+    if (!window_is_populated(pagemap, window, phys_list)) {
+        return COLLAPSE_SKIPPED;
+    }
+
+    struct page *const large_page = alloc_large_page(THP_LEVEL, /*flags=*/0);
+    if (large_page == NULL) {
+        return COLLAPSE_FAILED;
+    }
+
+    // Unmap the window first, so no cpu can write to the pages while they're
+    // copied. Faults on the window wait on the vm_area's lock until the
+    // large-page is mapped in.
+
+    const struct range window_range = RANGE_INIT(window, THP_SIZE);
+    const struct pgunmap_options unmap_options = {
+        .free_pages = false,
+        .dont_split_large_pages = true
+    };
+
+    if (!arch_unmap_mapping(pagemap,
+                            window_range,
+                            /*map_options=*/NULL,
+                            &unmap_options))
+    {
+        free_page(large_page);
+        return COLLAPSE_FAILED;
+    }
+
+    uint8_t *const dst = page_to_virt(large_page);
+    for (uint64_t i = 0; i != PAGE_COUNT(THP_SIZE); i++) {
+        memcpy(dst + (i << PAGE_SHIFT), phys_to_virt(phys_list[i]), PAGE_SIZE);
+    }
+
+    const bool map_result =
+        arch_make_mapping(pagemap,
+                          RANGE_INIT(page_to_phys(large_page), THP_SIZE),
+                          window,
+                          vma->prot,
+                          vma->cachekind,
+                          /*is_overwrite=*/false);
+
+    if (!map_result) {
+        remap_window(pagemap, vma, window, phys_list);
+        free_page(large_page);
+
+        return COLLAPSE_FAILED;
+    }
+
+    for (uint64_t i = 0; i != PAGE_COUNT(THP_SIZE); i++) {
+        free_page(phys_to_page(phys_list[i]));
+    }
+
+    atomic_fetch_sub_explicit(&pagemap->anon_page_count,
+                              PAGE_COUNT(THP_SIZE),
+                              memory_order_relaxed);
+    atomic_fetch_add_explicit(&pagemap->anon_large_page_count,
+                              1,
+                              memory_order_relaxed);
+
+    return COLLAPSE_OK;
+}
+
+static uint32_t
+collapse_vma(struct vm_area *const vma,
+             uint64_t *const phys_list,
+             const uint32_t limit)
+{
+    struct pagemap *const pagemap = vma_pagemap(vma);
+    const struct range range = vma->node.range;
+
+    uint64_t window = 0;
+    if (!align_up(range.front, THP_SIZE, &window)) {
+        return 0;
+    }
+
+    uint32_t count = 0;
+    for (; count != limit; window += THP_SIZE) {
+        if (!range_has(range, RANGE_INIT(window, THP_SIZE))) {
+            break;
+        }
+
+        // The window is unmapped before its pages are copied, so only the
+        // vm_area's lock has to be held, and irqs can stay enabled across the
+        // copy. Preemption is disabled so faults on the window don't spin on
+        // a lock held by a thread that isn't running.
+
+        spin_acquire_preempt_disable(&vma->lock);
+        const enum collapse_result result =
+            collapse_window(pagemap, vma, window, phys_list);
+
+        spin_release_preempt_enable(&vma->lock);
+        switch (result) {
+            case COLLAPSE_OK:
+                atomic_fetch_add_explicit(&g_collapse_count,
+                                          1,
+                                          memory_order_relaxed);
+                count++;
+                break;
+            case COLLAPSE_SKIPPED:
+                break;
+            case COLLAPSE_FAILED:
+                atomic_fetch_add_explicit(&g_collapse_fail_count,
+                                          1,
+                                          memory_order_relaxed);
+                return count;
+        }
+    }
+
+    return count;
+}
+
+// Returns the vm_area after `vma` in the list, or the first one if `vma` is
+// NULL. vm_areas are never taken off the list, so the collapse thread can keep
+// using one after the list's lock is dropped.
+
+static struct vm_area *next_vma(struct vm_area *const vma) {
+    struct vm_area *result = NULL;
+    with_spinlock_irq_disabled(&g_vma_list_lock, {
+        const struct list *const next =
+            vma != NULL ? vma->thp_list.next : g_vma_list.next;
+
+        if (next != &g_vma_list) {
+            result = container_of(next, struct vm_area, thp_list);
+        }
+    });
+
+    return result;
+}
+
+__noreturn static void thp_collapse_worker() {
+    uint64_t *const phys_list =
+        kmalloc(sizeof(uint64_t) * PAGE_COUNT(THP_SIZE));
+
+    assert_msg(phys_list != NULL, "mm: thp: failed to allocate phys-list");
+    while (true) {
+        uint32_t count = 0;
+        for (struct vm_area *vma = next_vma(/*vma=*/NULL);
+             vma != NULL;
+             vma = next_vma(vma))
+        {
+            count +=
+                collapse_vma(vma,
+                             phys_list,
+                             THP_COLLAPSE_MAX_PER_PASS - count);
+
+            if (count == THP_COLLAPSE_MAX_PER_PASS) {
+                break;
+            }
+        }
+
+        sched_sleep_us(THP_COLLAPSE_INTERVAL_US);
+    }
+}
+
+uint64_t thp_coverage_permille(const struct pagemap *const pagemap) {
+    const uint64_t page_count =
+        atomic_load_explicit(&pagemap->anon_page_count, memory_order_relaxed);
+    const uint64_t large_page_count =
+        atomic_load_explicit(&pagemap->anon_large_page_count,
+                             memory_order_relaxed);
+
+    const uint64_t large_size = large_page_count * THP_SIZE;
+    const uint64_t total_size = large_size + (page_count << PAGE_SHIFT);
+
+    if (total_size == 0) {
+        return 0;
+    }
+
+    return large_size * 1000 / total_size;
+}
+
+struct thp_stats thp_get_stats() {
+    return (struct thp_stats){
+        .fault_count =
+            atomic_load_explicit(&g_fault_count, memory_order_relaxed),
+        .fault_fallback_count =
+            atomic_load_explicit(&g_fault_fallback_count, memory_order_relaxed),
+        .collapse_count =
+            atomic_load_explicit(&g_collapse_count, memory_order_relaxed),
+        .collapse_fail_count =
+            atomic_load_explicit(&g_collapse_fail_count, memory_order_relaxed),
+    };
+}
+
+void thp_print_stats(const struct pagemap *const pagemap) {
+    const struct thp_stats stats = thp_get_stats();
+    const uint64_t coverage = thp_coverage_permille(pagemap);
+
+    printk(LOGLEVEL_INFO,
+           "mm: thp: %" PRIu64 " large-page faults (%" PRIu64 " fell back), "
+           "%" PRIu64 " collapses (%" PRIu64 " failed), %" PRIu64 ".%" PRIu64
+           "%% of anonymous memory in large-pages\n",
+           stats.fault_count,
+           stats.fault_fallback_count,
+           stats.collapse_count,
+           stats.collapse_fail_count,
+           coverage / 10,
+           coverage % 10);
+}
+
+void thp_init() {
+    struct thread *const thread =
+        sched_create_kernel_thread(thp_collapse_worker);
+
+    assert_msg(thread != NULL, "mm: thp: failed to create collapse thread");
+    printk(LOGLEVEL_INFO, "mm: started thp collapse thread\n");
+}
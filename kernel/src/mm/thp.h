@@ -0,0 +1,51 @@
+/*
+ * kernel/src/mm/thp.h
+ * © suhas pai
+ */
+
+#pragma once
+#include "lib/time.h"
+#include "mm_types.h"
+
+// Anonymous vm_areas at least as large as a large-page are placed at a
+// large-page aligned address, so their memory can be backed by large-pages
+// instead of individual pages.
+//
+// A write fault in an aligned window that has nothing mapped in it allocates a
+// large-page for the entire window. Windows that were faulted in page by page
+// are collapsed into a large-page later by a background kernel thread, once
+// every page in the window was written to.
+
+#define THP_LEVEL LARGEPAGE_LEVELS[0]
+#define THP_SIZE LARGEPAGE_SIZE(0)
+
+#define THP_COLLAPSE_INTERVAL_US milli_to_micro(500)
+#define THP_COLLAPSE_MAX_PER_PASS 16u
+
+struct thp_stats {
+    uint64_t fault_count;
+    uint64_t fault_fallback_count;
+
+    uint64_t collapse_count;
+    uint64_t collapse_fail_count;
+};
+
+struct pagemap;
+struct vm_area;
+
+void thp_register_vma(struct vm_area *vma);
+
+// Map a large-page into the window around `addr`, if the window fits in `vma`
+// and nothing is mapped in it yet. Must be called with the vm_area's lock held.
+
+bool thp_try_fault(struct pagemap *pagemap, struct vm_area *vma, uint64_t addr);
+
+// Returns the fraction of the pagemap's anonymous memory that's backed by
+// large-pages, in units of 1/1000.
+
+uint64_t thp_coverage_permille(const struct pagemap *pagemap);
+
+struct thp_stats thp_get_stats();
+void thp_print_stats(const struct pagemap *pagemap);
+
+void thp_init();
@@ -3,8 +3,11 @@
  * © suhas pai
  */
 
+#include "lib/align.h"
+
 #include "kmalloc.h"
 #include "pagemap.h"
+#include "thp.h"
 
 __debug_optimize(3) struct vm_area *vma_prev(struct vm_area *const vma) {
     struct addrspace_node *const node = addrspace_node_prev(&vma->node);
@@ -37,8 +40,12 @@ vma_alloc(struct pagemap *const pagemap,
 
     vma->node = ADDRSPACE_NODE_INIT(vma->node, &pagemap->addrspace);
     vma->node.range = range;
+    vma->lock = SPINLOCK_INIT();
     vma->cachekind = cachekind;
     vma->prot = prot;
+    vma->anonymous = false;
+
+    list_init(&vma->thp_list);
 
     return vma;
 }
@@ -91,6 +98,46 @@ vma_create_at(struct pagemap *const pagemap,
     return vma;
 }
 
+struct vm_area *
+vma_create_anonymous(struct pagemap *const pagemap,
+                     const struct range in_range,
+                     const uint64_t size,
+                     const uint64_t align,
+                     const prot_t prot)
+{
+    assert(has_align(size, PAGE_SIZE));
+    struct vm_area *const vma =
+        vma_alloc(pagemap, RANGE_INIT(0, size), prot, VMA_CACHEKIND_DEFAULT);
+
+    if (vma == NULL) {
+        return NULL;
+    }
+
+    // Place vm_areas that can hold a large-page at a large-page aligned
+    // address, so their windows line up with large-pages.
+
+    const bool use_thp = size >= THP_SIZE;
+    const uint64_t thp_align = (uint64_t)(LARGEPAGE_SHIFTS[0] - PAGE_SHIFT);
+    const uint64_t vma_align = use_thp ? max(align, thp_align) : align;
+
+    vma->anonymous = true;
+    if (!pagemap_find_space_and_add_vma(pagemap,
+                                        vma,
+                                        in_range,
+                                        /*phys_addr=*/0,
+                                        vma_align))
+    {
+        kfree(vma);
+        return NULL;
+    }
+
+    if (use_thp) {
+        thp_register_vma(vma);
+    }
+
+    return vma;
+}
+
 __debug_optimize(3) struct pagemap *vma_pagemap(struct vm_area *const vma) {
     return container_of(vma->node.addrspace, struct pagemap, addrspace);
 }
\ No newline at end of file
@@ -18,6 +18,17 @@ struct vm_area {
     prot_t prot;
 
     enum vma_cachekind cachekind;
+
+    // Anonymous vm_areas aren't backed by any physical range when created.
+    // Their pages are instead allocated on first access by the page-fault
+    // handler, see mm/fault.h.
+
+    bool anonymous : 1;
+
+    // Anonymous vm_areas that can hold a large-page are kept in a list
+    // scanned by the thp collapse thread.
+
+    struct list thp_list;
 };
 
 #define vma_of(obj) container_of((obj), struct vm_area, node.avlnode)
@@ -49,4 +60,14 @@ vma_create_at(struct pagemap *pagemap,
               prot_t prot,
               enum vma_cachekind cachekind);
 
+// Reserve a range of `size` bytes in `pagemap` without mapping anything in it.
+// Pages are mapped in lazily as they're faulted on.
+
+struct vm_area *
+vma_create_anonymous(struct pagemap *pagemap,
+                     struct range in_range,
+                     uint64_t size,
+                     uint64_t align,
+                     prot_t prot);
+
 struct pagemap *vma_pagemap(struct vm_area *vma);
@@ -37,7 +37,9 @@ ptwalker_free_pgtable_cb(struct pt_walker *const walker,
     (void)walker;
 
     struct pageop *const pageop = (struct pageop *)cb_info;
+
     list_add(&pageop->delayed_free, &page->table.delayed_free_list);
+    pageop->batch.frees_tables = true;
 }
 
 __debug_optimize(3) uint64_t
@@ -0,0 +1,235 @@
+/*
+ * kernel/src/mm/zero_pool.c
+ * © suhas pai
+ */
+
+#include <stdatomic.h>
+
+#include "dev/printk.h"
+#include "lib/util.h"
+
+#include "sched/thread.h"
+
+#include "zero_pool.h"
+#include "zone.h"
+
+static _Atomic uint64_t g_hit_count = 0;
+static _Atomic uint64_t g_miss_count = 0;
+
+static _Atomic uint64_t g_background_zeroed_bytes = 0;
+static _Atomic uint64_t g_inline_zeroed_bytes = 0;
+
+__debug_optimize(3) static struct page *
+take_from_list(struct list *const list, uint32_t *const count) {
+    struct page *const page =
+        list_head(list, struct page, freelist_head.freelist);
+
+    list_remove(&page->freelist_head.freelist);
+    (*count)--;
+
+    return page;
+}
+
+struct page *zero_pool_take() {
+    const struct page_zone_list *const zone_list = page_zone_list_local();
+    for (uint8_t i = 0; i != zone_list->count; i++) {
+        struct page_zero_pool *const pool = &zone_list->zones[i]->zero_pool;
+        const int flag = spin_acquire_save_irq(&pool->lock);
+
+        if (pool->zeroed_count != 0) {
+            struct page *const page =
+                take_from_list(&pool->zeroed_list, &pool->zeroed_count);
+
+            spin_release_restore_irq(&pool->lock, flag);
+            atomic_fetch_add_explicit(&g_hit_count, 1, memory_order_relaxed);
+
+            return page;
+        }
+
+        spin_release_restore_irq(&pool->lock, flag);
+    }
+
+    atomic_fetch_add_explicit(&g_miss_count, 1, memory_order_relaxed);
+    return NULL;
+}
+
+bool zero_pool_add_dirty(struct page *const page) {
+    struct page_zero_pool *const pool = &page_to_zone(page)->zero_pool;
+    const int flag = spin_acquire_save_irq(&pool->lock);
+
+    if (pool->zeroed_count + pool->dirty_count >= ZERO_POOL_TARGET_COUNT) {
+        spin_release_restore_irq(&pool->lock, flag);
+        return false;
+    }
+
+    page_set_state(page, PAGE_STATE_ZERO_POOL);
+    page->freelist_head.order = 0;
+
+    list_radd(&pool->dirty_list, &page->freelist_head.freelist);
+    pool->dirty_count++;
+
+    spin_release_restore_irq(&pool->lock, flag);
+    return true;
+}
+
+__debug_optimize(3) void zero_pool_count_inline(const uint64_t page_count) {
+    atomic_fetch_add_explicit(&g_inline_zeroed_bytes,
+                              page_count * PAGE_SIZE,
+                              memory_order_relaxed);
+}
+
+static void
+move_to_zeroed_list(struct page_zero_pool *const pool,
+                    struct list *const list,
+                    const uint32_t count)
+{
+    struct page *page = NULL;
+    struct page *tmp = NULL;
+
+    with_spinlock_irq_disabled(&pool->lock, {
+        list_foreach_mut(page, tmp, list, freelist_head.freelist) {
+            list_remove(&page->freelist_head.freelist);
+            list_add(&pool->zeroed_list, &page->freelist_head.freelist);
+        }
+
+        pool->zeroed_count += count;
+    });
+
+    atomic_fetch_add_explicit(&g_background_zeroed_bytes,
+                              count * PAGE_SIZE,
+                              memory_order_relaxed);
+}
+
+// Take a batch of pages to zero, preferring the pool's dirty pages over pages
+// off the zone's freelists. Returns the number of pages taken.
+
+static uint32_t
+take_batch_to_zero(struct page_zone *const zone, struct list *const list) {
+    struct page_zero_pool *const pool = &zone->zero_pool;
+
+    uint32_t count = 0;
+    uint32_t needed = 0;
+
+    with_spinlock_irq_disabled(&pool->lock, {
+        while (pool->dirty_count != 0 && count != ZERO_POOL_BATCH) {
+            struct page *const page =
+                take_from_list(&pool->dirty_list, &pool->dirty_count);
+
+            list_radd(list, &page->freelist_head.freelist);
+            count++;
+        }
+
+        if (pool->zeroed_count < ZERO_POOL_TARGET_COUNT) {
+            needed = ZERO_POOL_TARGET_COUNT - pool->zeroed_count;
+        }
+    });
+
+    if (count != 0 || needed == 0) {
+        return count;
+    }
+
+    return take_free_pages_from_zone(zone,
+                                     /*order=*/0,
+                                     min(needed, ZERO_POOL_BATCH),
+                                     PAGE_STATE_ZERO_POOL,
+                                     list);
+}
+
+// The idle-thread's context is never saved, so the batch is zeroed with
+// preemption disabled so it can't be abandoned halfway with the pages off of
+// every list.
+
+static bool refill_zero_pool_batch(struct page_zone *const zone) {
+    bool result = false;
+    with_preempt_disabled({
+        struct list list = LIST_INIT(list);
+        const uint32_t count = take_batch_to_zero(zone, &list);
+
+        if (count != 0) {
+            struct page *page = NULL;
+            list_foreach(page, &list, freelist_head.freelist) {
+                zero_page(page_to_virt(page));
+            }
+
+            move_to_zeroed_list(&zone->zero_pool, &list, count);
+            result = true;
+        }
+    });
+
+    return result;
+}
+
+bool zero_pool_refill_on_idle() {
+    const numa_node_t node = numa_local_node();
+    const struct page_zone_list *const zone_list = page_zone_list_local();
+
+    for (uint8_t i = 0; i != zone_list->count; i++) {
+        struct page_zone *const zone = zone_list->zones[i];
+        if (page_zone_is_local(zone, node) && refill_zero_pool_batch(zone)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+uint64_t zero_pool_drain() {
+    uint64_t count = 0;
+    for_each_page_zone(zone) {
+        struct page_zero_pool *const pool = &zone->zero_pool;
+        struct list list = LIST_INIT(list);
+
+        with_spinlock_irq_disabled(&pool->lock, {
+            while (pool->zeroed_count != 0) {
+                struct page *const page =
+                    take_from_list(&pool->zeroed_list, &pool->zeroed_count);
+
+                list_add(&list, &page->freelist_head.freelist);
+                count++;
+            }
+
+            while (pool->dirty_count != 0) {
+                struct page *const page =
+                    take_from_list(&pool->dirty_list, &pool->dirty_count);
+
+                list_add(&list, &page->freelist_head.freelist);
+                count++;
+            }
+        });
+
+        struct page *page = NULL;
+        struct page *tmp = NULL;
+
+        list_foreach_mut(page, tmp, &list, freelist_head.freelist) {
+            list_deinit(&page->freelist_head.freelist);
+            free_pages_to_freelist(page, /*order=*/0);
+        }
+    }
+
+    return count;
+}
+
+struct zero_pool_stats zero_pool_get_stats() {
+    return (struct zero_pool_stats){
+        .hit_count = atomic_load_explicit(&g_hit_count, memory_order_relaxed),
+        .miss_count =
+            atomic_load_explicit(&g_miss_count, memory_order_relaxed),
+        .background_zeroed_bytes =
+            atomic_load_explicit(&g_background_zeroed_bytes,
+                                 memory_order_relaxed),
+        .inline_zeroed_bytes =
+            atomic_load_explicit(&g_inline_zeroed_bytes, memory_order_relaxed),
+    };
+}
+
+void zero_pool_print_stats() {
+    const struct zero_pool_stats stats = zero_pool_get_stats();
+    printk(LOGLEVEL_INFO,
+           "mm: zero-pool: %" PRIu64 " hits, %" PRIu64 " misses, "
+           "%" PRIu64 " bytes zeroed in background, %" PRIu64 " bytes zeroed "
+           "inline\n",
+           stats.hit_count,
+           stats.miss_count,
+           stats.background_zeroed_bytes,
+           stats.inline_zeroed_bytes);
+}
@@ -0,0 +1,43 @@
+/*
+ * kernel/src/mm/zero_pool.h
+ * © suhas pai
+ */
+
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+
+// Every zone keeps a pool of order-0 pages that were zeroed ahead of time by
+// idle cpus, so alloc_pages() can serve allocations that need zeroed memory
+// without zeroing a page inline.
+//
+// When built with ZERO_FREED_PAGES, free_pages() hands order-0 pages to the
+// zone's pool as dirty pages instead of returning them to the freelists, and
+// idle cpus zero them later.
+
+#define ZERO_POOL_TARGET_COUNT 256u
+#define ZERO_POOL_BATCH 32u
+
+struct zero_pool_stats {
+    uint64_t hit_count;
+    uint64_t miss_count;
+
+    uint64_t background_zeroed_bytes;
+    uint64_t inline_zeroed_bytes;
+};
+
+struct page;
+
+struct page *zero_pool_take();
+bool zero_pool_add_dirty(struct page *page);
+
+void zero_pool_count_inline(uint64_t page_count);
+uint64_t zero_pool_drain();
+
+struct zero_pool_stats zero_pool_get_stats();
+void zero_pool_print_stats();
+
+// Called by every cpu's idle-thread. Zeroes one batch of pages for the pools
+// of the zones on the current cpu's node, and returns false if none needed any.
+
+bool zero_pool_refill_on_idle();
@@ -3,9 +3,138 @@
  * © suhas pai
  */
 
+#include "lib/size.h"
 #include "zone.h"
 
+static struct page_zone zone_low4g = {
+    .lock = SPINLOCK_INIT(),
+    .name = "low4g",
+
+    .section_list = LIST_INIT(zone_low4g.section_list),
+    .fallback_zone = NULL,
+    .node = 0,
+
+    .zero_pool = PAGE_ZERO_POOL_INIT(zone_low4g.zero_pool),
+};
+
+#define NODE_ZONE_INIT(index) \
+    [index] = { \
+        .lock = SPINLOCK_INIT(), \
+        .name = "node" #index, \
+        .section_list = LIST_INIT(node_zone_list[index].section_list), \
+        .fallback_zone = &zone_low4g, \
+        .node = index, \
+        .zero_pool = PAGE_ZERO_POOL_INIT(node_zone_list[index].zero_pool), \
+    }
+
+static struct page_zone node_zone_list[NUMA_MAX_NODES] = {
+    NODE_ZONE_INIT(0),
+    NODE_ZONE_INIT(1),
+    NODE_ZONE_INIT(2),
+    NODE_ZONE_INIT(3),
+    NODE_ZONE_INIT(4),
+    NODE_ZONE_INIT(5),
+    NODE_ZONE_INIT(6),
+    NODE_ZONE_INIT(7),
+};
+
+_Static_assert(NUMA_MAX_NODES == 8, "node_zone_list must have a zone per node");
+
+static struct page_zone_list g_zone_list_list[NUMA_MAX_NODES] = {};
+
 __debug_optimize(3)
 struct page_zone *page_to_zone(const struct page *const page) {
     return page_to_section(page)->zone;
-}
\ No newline at end of file
+}
+
+__debug_optimize(3) struct page_zone *phys_to_zone(const uint64_t phys) {
+    if (phys < gib(4)) {
+        return &zone_low4g;
+    }
+
+    return &node_zone_list[numa_phys_to_node(phys)];
+}
+
+__debug_optimize(3) struct page_zone *page_zone_iterstart() {
+    return &node_zone_list[0];
+}
+
+__debug_optimize(3)
+struct page_zone *page_zone_iternext(struct page_zone *const zone) {
+    if (zone == &zone_low4g) {
+        return NULL;
+    }
+
+    if (zone->node + 1 < numa_get_node_count()) {
+        return &node_zone_list[zone->node + 1];
+    }
+
+    return &zone_low4g;
+}
+
+__debug_optimize(3) struct page_zone *page_zone_default() {
+    return page_zone_for_node(numa_local_node());
+}
+
+__debug_optimize(3) struct page_zone *page_zone_low4g() {
+    return &zone_low4g;
+}
+
+__debug_optimize(3)
+struct page_zone *page_zone_for_node(const numa_node_t node) {
+    assert(node < numa_get_node_count());
+    return &node_zone_list[node];
+}
+
+__debug_optimize(3) bool
+page_zone_is_local(const struct page_zone *const zone, const numa_node_t node)
+{
+    return zone->node == node || zone == &zone_low4g;
+}
+
+__debug_optimize(3) const struct page_zone_list *
+page_zone_list_for_node(const numa_node_t node) {
+    assert(node < numa_get_node_count());
+    return &g_zone_list_list[node];
+}
+
+__debug_optimize(3) const struct page_zone_list *page_zone_list_local() {
+    return page_zone_list_for_node(numa_local_node());
+}
+
+void pagezones_init() {
+    for (numa_node_t node = 0; node != numa_get_node_count(); node++) {
+        const struct numa_fallback_list *const fallback_list =
+            numa_get_fallback_list(node);
+
+        // Low4g goes right after the zone of the closest node that has memory
+        // below 4gib, so a node that has little memory above 4gib uses its own
+        // memory below 4gib before that of a remote node.
+
+        struct page_zone_list *const list = &g_zone_list_list[node];
+        const struct range low4g_range = RANGE_INIT(0, gib(4));
+
+        bool added_low4g = false;
+        list->count = 0;
+
+        for (uint8_t i = 0; i != fallback_list->count; i++) {
+            const numa_node_t fallback_node = fallback_list->nodes[i];
+            list->zones[list->count] = &node_zone_list[fallback_node];
+            list->count++;
+
+            if (!added_low4g
+             && numa_node_has_mem_in(fallback_node, low4g_range))
+            {
+                list->zones[list->count] = &zone_low4g;
+                list->count++;
+
+                added_low4g = true;
+            }
+        }
+
+        if (!added_low4g) {
+            list->zones[list->count] = &zone_low4g;
+            list->count++;
+        }
+    }
+}
@@ -4,8 +4,39 @@
  */
 
 #pragma once
+
+#include "numa.h"
 #include "page_alloc.h"
 
+// Pool of order-0 pages that have already been zeroed, so __ALLOC_ZERO
+// allocations don't have to zero pages inline. See mm/zero_pool.h.
+
+struct page_zero_pool {
+    struct spinlock lock;
+
+    struct list zeroed_list;
+    struct list dirty_list;
+
+    uint32_t zeroed_count;
+    uint32_t dirty_count;
+};
+
+#define PAGE_ZERO_POOL_INIT(name) \
+    { \
+        .lock = SPINLOCK_INIT(), \
+        .zeroed_list = LIST_INIT(name.zeroed_list), \
+        .dirty_list = LIST_INIT(name.dirty_list), \
+        .zeroed_count = 0, \
+        .dirty_count = 0, \
+    }
+
+// Every numa node has its own zone, holding the node's memory above 4gib.
+// Memory below 4gib is kept in the low4g zone, which is treated as part of node
+// 0, so allocations that need it aren't competing with every other one.
+//
+// Low4g may hold most of the memory of small machines however, so pcp-lists
+// and zero-pools treat it as local to every node, see page_zone_is_local().
+
 struct page_zone {
     struct spinlock lock;
     const char *const name;
@@ -13,7 +44,21 @@ struct page_zone {
     struct list section_list;
     struct page_zone *const fallback_zone;
 
+    const numa_node_t node;
+
     _Atomic uint64_t total_free;
+    struct page_zero_pool zero_pool;
+};
+
+#define PAGE_ZONE_LIST_MAX (NUMA_MAX_NODES + 1)
+
+// Zones in the order they're allocated from, the zone of the list's node first,
+// followed by the zones of every other node by distance. Low4g comes right
+// after the zone of the closest node with memory below 4gib.
+
+struct page_zone_list {
+    struct page_zone *zones[PAGE_ZONE_LIST_MAX];
+    uint8_t count;
 };
 
 struct page_zone *page_zone_iterstart();
@@ -22,8 +67,17 @@ struct page_zone *page_zone_iternext(struct page_zone *prev);
 struct page_zone *page_to_zone(const struct page *page);
 struct page_zone *phys_to_zone(uint64_t phys);
 
+// Returns the zone of the current cpu's node.
 struct page_zone *page_zone_default();
+
 struct page_zone *page_zone_low4g();
+struct page_zone *page_zone_for_node(numa_node_t node);
+
+bool
+page_zone_is_local(const struct page_zone *zone, numa_node_t node);
+
+const struct page_zone_list *page_zone_list_for_node(numa_node_t node);
+const struct page_zone_list *page_zone_list_local();
 
 #define for_each_page_zone(zone) \
     for (__auto_type zone = page_zone_iterstart(); \
@@ -5,48 +5,308 @@
 
 #include <stdatomic.h>
 
+#include "asm/irqs.h"
 #include "mm/kmalloc.h"
+
 #include "sched/scheduler.h"
+#include "sched/timer.h"
+#include "time/time.h"
 
 #include "alarm.h"
 
-struct alarm *alarm_create(const usec_t time) {
+__debug_optimize(3) static inline usec_t usec_since_boot() {
+    return nano_to_micro(nsec_since_boot());
+}
+
+__debug_optimize(3)
+void alarm_init(struct alarm *const alarm, const usec_t timeout) {
+    list_init(&alarm->list);
+
+    alarm->listener = NULL;
+    alarm->cpu = NULL;
+
+    alarm->active = false;
+    alarm->in_wheel = false;
+
+    alarm->level = 0;
+    alarm->slot = 0;
+
+    alarm->timeout = timeout;
+    alarm->deadline = 0;
+}
+
+struct alarm *alarm_create(const usec_t timeout) {
     struct alarm *const alarm = kmalloc(sizeof(*alarm));
     if (alarm == NULL) {
         return NULL;
     }
 
-    alarm->remaining = time;
+    alarm_init(alarm, timeout);
     return alarm;
 }
 
+void alarm_wheel_init(struct alarm_wheel *const wheel) {
+    wheel->lock = SPINLOCK_INIT();
+    wheel->tick = 0;
+
+    carr_foreach_mut(wheel->occupied_list, iter) {
+        *iter = 0;
+    }
+}
+
+__debug_optimize(3) static inline uint8_t
+slot_for_tick(const uint64_t tick, const uint8_t level) {
+    return (tick >> (level * ALARM_WHEEL_LEVEL_SHIFT))
+         & (ALARM_WHEEL_SLOT_COUNT - 1);
+}
+
+// Caller must hold the wheel's lock.
+
+__debug_optimize(3) static void
+wheel_insert(struct alarm_wheel *const wheel, struct alarm *const alarm) {
+    // The current tick has already been processed.
+    uint64_t expires = max(alarm->deadline, wheel->tick + 1);
+    if (expires - wheel->tick >= ALARM_WHEEL_SPAN) {
+        expires = wheel->tick + ALARM_WHEEL_SPAN - 1;
+    }
+
+    const uint64_t delta = expires - wheel->tick;
+    uint8_t level = 0;
+
+    while ((delta >> ((level + 1) * ALARM_WHEEL_LEVEL_SHIFT)) != 0) {
+        level++;
+    }
+
+    const uint8_t slot = slot_for_tick(expires, level);
+    struct list *const slot_list = &wheel->slot_list[level][slot];
+
+    if ((wheel->occupied_list[level] & (1ull << slot)) == 0) {
+        wheel->occupied_list[level] |= 1ull << slot;
+        list_init(slot_list);
+    }
+
+    list_radd(slot_list, &alarm->list);
+
+    alarm->level = level;
+    alarm->slot = slot;
+    alarm->in_wheel = true;
+}
+
+// Caller must hold the wheel's lock.
+
+__debug_optimize(3) static void
+wheel_remove(struct alarm_wheel *const wheel, struct alarm *const alarm) {
+    struct list *const slot_list =
+        &wheel->slot_list[alarm->level][alarm->slot];
+
+    list_remove(&alarm->list);
+    if (list_empty(slot_list)) {
+        wheel->occupied_list[alarm->level] &= ~(1ull << alarm->slot);
+    }
+
+    alarm->in_wheel = false;
+}
+
+// Returns the tick at which the wheel next has a slot to process, or
+// UINT64_MAX if the wheel is empty.
+
 __debug_optimize(3)
-static int compare(struct list *const theirs, struct list *const ours) {
-    struct alarm *const their_alarm = container_of(theirs, struct alarm, list);
-    struct alarm *const our_alarm = container_of(ours, struct alarm, list);
+static uint64_t wheel_next_event(const struct alarm_wheel *const wheel) {
+    uint64_t result = UINT64_MAX;
+    for (uint8_t level = 0; level != ALARM_WHEEL_LEVEL_COUNT; level++) {
+        const uint64_t occupied = wheel->occupied_list[level];
+        if (occupied == 0) {
+            continue;
+        }
 
-    return twovar_cmp(their_alarm->remaining, our_alarm->remaining);
+        // Rotate the bitmap so bit N is the slot N slots after the current
+        // one. The current slot has already been processed, so any alarms in
+        // it are for the next rotation.
+
+        const uint8_t shift = level * ALARM_WHEEL_LEVEL_SHIFT;
+        const uint8_t current = slot_for_tick(wheel->tick, level);
+        const uint64_t rotated =
+            current != 0 ?
+                (occupied >> current)
+              | (occupied << (ALARM_WHEEL_SLOT_COUNT - current))
+            : occupied;
+
+        const uint64_t distance =
+            (rotated & ~1ull) != 0 ?
+                (uint64_t)__builtin_ctzll(rotated & ~1ull)
+              : ALARM_WHEEL_SLOT_COUNT;
+
+        result = min(result, ((wheel->tick >> shift) + distance) << shift);
+    }
+
+    return result;
+}
+
+// Caller must hold the wheel's lock. Takes the alarms of a slot off of the
+// wheel and either moves them to a lower level, or fires them if they expired.
+
+static void
+wheel_process_slot(struct alarm_wheel *const wheel,
+                   const uint8_t level,
+                   const uint8_t slot)
+{
+    if ((wheel->occupied_list[level] & (1ull << slot)) == 0) {
+        return;
+    }
+
+    struct list list = LIST_INIT(list);
+    struct list *const slot_list = &wheel->slot_list[level][slot];
+
+    // Move the slot's alarms to a local list as we may be re-inserting them
+    // into the same slot.
+
+    struct alarm *alarm = NULL;
+    struct alarm *tmp = NULL;
+
+    list_foreach_mut(alarm, tmp, slot_list, list) {
+        list_remove(&alarm->list);
+        list_radd(&list, &alarm->list);
+    }
+
+    wheel->occupied_list[level] &= ~(1ull << slot);
+    list_foreach_mut(alarm, tmp, &list, list) {
+        list_remove(&alarm->list);
+        if (alarm->deadline > wheel->tick) {
+            wheel_insert(wheel, alarm);
+            continue;
+        }
+
+        alarm->in_wheel = false;
+        struct thread *const listener = alarm->listener;
+
+        atomic_store_explicit(&alarm->active, false, memory_order_release);
+        sched_enqueue_thread(listener);
+    }
+}
+
+// Caller must hold the wheel's lock. Processes every slot up to and including
+// tick `now`, skipping straight over empty slots.
+
+static void wheel_advance(struct alarm_wheel *const wheel, const uint64_t now) {
+    while (true) {
+        const uint64_t event = wheel_next_event(wheel);
+        if (event > now) {
+            wheel->tick = max(wheel->tick, now);
+            return;
+        }
+
+        wheel->tick = event;
+
+        // Higher levels are processed first so their alarms can be moved into
+        // slots of lower levels being processed at this same tick.
+
+        uint8_t level = ALARM_WHEEL_LEVEL_COUNT - 1;
+        for (; level != 0; level--) {
+            const uint8_t shift = level * ALARM_WHEEL_LEVEL_SHIFT;
+            if ((event & ((1ull << shift) - 1)) == 0) {
+                wheel_process_slot(wheel, level, slot_for_tick(event, level));
+            }
+        }
+
+        wheel_process_slot(wheel, /*level=*/0, slot_for_tick(event, 0));
+    }
 }
 
 __debug_optimize(3)
 void alarm_post(struct alarm *const alarm, const bool await) {
-    with_preempt_disabled({
-        alarm->listener = current_thread();
-        list_add_inorder(&this_cpu_mut()->alarm_list, &alarm->list, compare);
-    });
+    const bool irqs_enabled = disable_irqs_if_enabled();
+
+    struct cpu_info *const cpu = this_cpu_mut();
+    struct alarm_wheel *const wheel = &cpu->alarm_wheel;
+
+    const usec_t now = usec_since_boot();
+
+    alarm->listener = current_thread();
+    alarm->cpu = cpu;
+    alarm->deadline = now + alarm->timeout;
+
+    spin_acquire(&wheel->lock);
+
+    wheel_advance(wheel, now);
+    wheel_insert(wheel, alarm);
 
     atomic_store_explicit(&alarm->active, true, memory_order_relaxed);
+    spin_release(&wheel->lock);
+
+    // Interrupts stay disabled until we've dequeued ourselves, so the alarm
+    // can't fire before, and have its wakeup be lost.
+
     if (await) {
         sched_dequeue_thread(current_thread());
+        enable_irqs_if_flag(irqs_enabled);
+
         sched_yield();
+        return;
+    }
+
+    // Fire sooner than the timer's current one-shot if needed.
+    const usec_t remaining = sched_timer_remaining();
+    if (remaining == 0 || remaining > alarm->timeout) {
+        sched_timer_oneshot(max(alarm->timeout, (usec_t)1));
     }
+
+    enable_irqs_if_flag(irqs_enabled);
 }
 
 __debug_optimize(3) void alarm_clear(struct alarm *const alarm) {
-    list_remove(&alarm->list);
-    atomic_store_explicit(&alarm->active, false, memory_order_relaxed);
+    struct cpu_info *const cpu = alarm->cpu;
+    if (cpu == NULL) {
+        return;
+    }
+
+    struct alarm_wheel *const wheel = &cpu->alarm_wheel;
+    with_spinlock_irq_disabled(&wheel->lock, {
+        if (alarm->in_wheel) {
+            wheel_remove(wheel, alarm);
+        }
+
+        atomic_store_explicit(&alarm->active, false, memory_order_relaxed);
+    });
 }
 
 __debug_optimize(3) bool alarm_cleared(const struct alarm *const alarm) {
-    return !atomic_load_explicit(&alarm->active, memory_order_relaxed);
-}
\ No newline at end of file
+    return !atomic_load_explicit(&alarm->active, memory_order_acquire);
+}
+
+void alarm_expire() {
+    struct alarm_wheel *const wheel = &this_cpu_mut()->alarm_wheel;
+    const usec_t now = usec_since_boot();
+
+    spin_acquire(&wheel->lock);
+    wheel_advance(wheel, now);
+    spin_release(&wheel->lock);
+}
+
+void
+alarm_arm_timer(struct cpu_info *const cpu, const struct thread *const thread) {
+    struct alarm_wheel *const wheel = &cpu->alarm_wheel;
+
+    spin_acquire(&wheel->lock);
+    const uint64_t event = wheel_next_event(wheel);
+    spin_release(&wheel->lock);
+
+    const bool is_idle = thread == cpu->idle_thread;
+    if (event == UINT64_MAX) {
+        if (is_idle) {
+            sched_timer_stop();
+        } else {
+            sched_timer_oneshot(thread->sched_info.timeslice);
+        }
+
+        return;
+    }
+
+    const usec_t now = usec_since_boot();
+    usec_t timeout = event > now ? event - now : 1;
+
+    if (!is_idle) {
+        timeout = min(timeout, (usec_t)thread->sched_info.timeslice);
+    }
+
+    sched_timer_oneshot(timeout);
+}
@@ -13,13 +13,37 @@ struct alarm {
     struct list list;
     struct thread *listener;
 
+    // The cpu whose wheel the alarm is in while it's active.
+    struct cpu_info *cpu;
+
     _Atomic bool active;
-    usec_t remaining;
+    bool in_wheel : 1;
+
+    uint8_t level;
+    uint8_t slot;
+
+    usec_t timeout;
+
+    // Microseconds since boot at which the alarm fires.
+    usec_t deadline;
 };
 
-struct alarm *alarm_create(usec_t time);
+void alarm_init(struct alarm *alarm, usec_t timeout);
+struct alarm *alarm_create(usec_t timeout);
 
 void alarm_post(struct alarm *alarm, bool await);
 void alarm_clear(struct alarm *alarm);
 
 bool alarm_cleared(const struct alarm *alarm);
+
+// Called by the scheduler on every tick to fire the current cpu's expired
+// alarms. Alarms are never freed here, their owners are responsible for them.
+
+void alarm_expire();
+
+// Program the current cpu's one-shot timer for the thread about to run, for
+// at most its timeslice, or sooner if an alarm is due first. The idle thread
+// has no timeslice, so the timer is only programmed for the next alarm, or
+// stopped if there are none.
+
+void alarm_arm_timer(struct cpu_info *cpu, const struct thread *thread);
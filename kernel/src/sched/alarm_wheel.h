@@ -0,0 +1,46 @@
+/*
+ * kernel/src/sched/alarm_wheel.h
+ * © suhas pai
+ */
+
+#pragma once
+
+#include "cpu/spinlock.h"
+#include "lib/list.h"
+
+// Every cpu keeps its alarms in a hierarchical timing wheel, whose ticks are
+// microseconds since boot.
+//
+// Level 0 has a slot for each of the next 64 ticks, and every level after
+// has slots spanning 64 times as many ticks as a slot of the level before.
+// Alarms are placed in the lowest level that reaches their deadline, and an
+// alarm in a higher level is moved down once its slot is reached, so every
+// alarm is moved at most ALARM_WHEEL_LEVEL_COUNT times.
+
+#define ALARM_WHEEL_LEVEL_SHIFT 6
+#define ALARM_WHEEL_SLOT_COUNT (1u << ALARM_WHEEL_LEVEL_SHIFT)
+#define ALARM_WHEEL_LEVEL_COUNT 6
+
+// The wheel spans 2^36 microseconds, or about 19 hours. Alarms further out
+// are placed at the end of the wheel, and placed again once reached.
+
+#define ALARM_WHEEL_SPAN \
+    (1ull << (ALARM_WHEEL_LEVEL_SHIFT * ALARM_WHEEL_LEVEL_COUNT))
+
+struct alarm_wheel {
+    struct spinlock lock;
+
+    // Every tick up to and including this one has been processed.
+    uint64_t tick;
+
+    // Bitmap of slots that have alarms for every level. A slot's list is only
+    // valid while its bit is set.
+
+    uint64_t occupied_list[ALARM_WHEEL_LEVEL_COUNT];
+    struct list slot_list[ALARM_WHEEL_LEVEL_COUNT][ALARM_WHEEL_SLOT_COUNT];
+};
+
+#define ALARM_WHEEL_INIT() \
+    { .lock = SPINLOCK_INIT(), .tick = 0, .occupied_list = {} }
+
+void alarm_wheel_init(struct alarm_wheel *wheel);
@@ -30,12 +30,18 @@ void sched_thread_algo_info_init(struct thread *const thread) {
     list_init(&thread->sched_info.list);
 }
 
+void sched_percpu_info_init(struct sched_percpu_info *const info) {
+    info->idle = true;
+    info->switch_count = 0;
+}
+
 void sched_algo_init() {
 
 }
 
 __debug_optimize(3) void sched_algo_post_init() {
     kernel_main_thread.sched_info.runnable = true;
+    g_base_cpu_info.sched_info.idle = false;
 }
 
 __debug_optimize(3) bool thread_runnable(const struct thread *const thread) {
@@ -81,7 +87,32 @@ static void sched_dequeue_thread_for_use(struct thread *const thread) {
     list_remove(&thread->sched_info.list);
 }
 
+__debug_optimize(3) static void wakeup_idle_cpu() {
+    const struct cpu_info *const self = this_cpu();
+
+    // Our own cpu may be idle with its timer stopped, for example when a
+    // thread is enqueued from an irq handler, so it has to be woken up the
+    // same as any other cpu.
+
+    if (atomic_load_explicit(&self->sched_info.idle, memory_order_relaxed)) {
+        sched_send_ipi(self);
+        return;
+    }
+
+    const struct cpu_info *cpu = NULL;
+
+    list_foreach(cpu, cpus_get_list(), cpu_list) {
+        if (cpu != self
+         && atomic_load_explicit(&cpu->sched_info.idle, memory_order_relaxed))
+        {
+            sched_send_ipi(cpu);
+            return;
+        }
+    }
+}
+
 __debug_optimize(3) void sched_enqueue_thread(struct thread *const thread) {
+    bool queued = false;
     with_spinlock_irq_disabled(&g_run_queue_lock, {
         // sched_enqueue_thread() might be called from a dequeued but running
         // thread so only enqueue-for-use for threads that are not running and
@@ -89,12 +120,17 @@ __debug_optimize(3) void sched_enqueue_thread(struct thread *const thread) {
 
         if (!thread_running_nolock(thread) && !thread_enqueued_nolock(thread)) {
             sched_enqueue_thread_for_use(thread);
+            queued = true;
         }
 
         atomic_store_explicit(&thread->sched_info.runnable,
                               true,
                               memory_order_relaxed);
     });
+
+    if (queued) {
+        with_interrupts_disabled(wakeup_idle_cpu());
+    }
 }
 
 __debug_optimize(3) void sched_dequeue_thread(struct thread *const thread) {
@@ -139,32 +175,6 @@ static struct thread *get_next_thread(struct thread *const prev) {
     return result;
 }
 
-__debug_optimize(3)
-static void update_alarm_list(struct thread *const current_thread) {
-    struct list *const alarm_list = &this_cpu_mut()->alarm_list;
-
-    struct alarm *iter = NULL;
-    struct alarm *tmp = NULL;
-
-    list_foreach_mut(iter, tmp, alarm_list, list) {
-        const usec_t time_spent =
-            current_thread->sched_info.timeslice
-          - current_thread->sched_info.remaining;
-
-        if (iter->remaining > time_spent) {
-            iter->remaining -= time_spent;
-            continue;
-        }
-
-        atomic_store_explicit(&iter->active, false, memory_order_relaxed);
-
-        sched_enqueue_thread(iter->listener);
-        list_remove(&iter->list);
-
-        kfree(iter);
-    }
-}
-
 void sched_set_current_thread(struct thread *thread);
 extern __noreturn void thread_spinup(const struct thread_context *context);
 
@@ -174,9 +184,12 @@ void sched_next(const irq_number_t irq, struct thread_context *const context) {
     struct thread *const curr_thread = current_thread();
     thread_context_verify(curr_thread->process, context);
 
+    struct cpu_info *const cpu = curr_thread->cpu;
+    alarm_expire();
+
     if (curr_thread->preemption_disabled > 0) {
         sched_irq_eoi(irq);
-        sched_timer_oneshot(curr_thread->sched_info.timeslice);
+        alarm_arm_timer(cpu, curr_thread);
 
         return;
     }
@@ -184,20 +197,21 @@ void sched_next(const irq_number_t irq, struct thread_context *const context) {
     curr_thread->sched_info.awaiting = false;
     curr_thread->sched_info.remaining = 0;
 
-    update_alarm_list(curr_thread);
     struct thread *const next_thread = get_next_thread(curr_thread);
+    atomic_store_explicit(&cpu->sched_info.idle,
+                          next_thread == cpu->idle_thread,
+                          memory_order_relaxed);
 
     // Only possible if we were idle and will still be idle, or if our current
     // thread is still runnable and no other thread is.
 
     if (curr_thread == next_thread) {
         sched_irq_eoi(irq);
-        sched_timer_oneshot(curr_thread->sched_info.timeslice);
+        alarm_arm_timer(cpu, curr_thread);
 
         return;
     }
 
-    struct cpu_info *const cpu = curr_thread->cpu;
     const struct thread *const idle_thread = cpu->idle_thread;
 
     next_thread->cpu = cpu;
@@ -205,6 +219,8 @@ void sched_next(const irq_number_t irq, struct thread_context *const context) {
         curr_thread->cpu = NULL;
     }
 
+    cpu->sched_info.switch_count++;
+
     sched_set_current_thread(next_thread);
     sched_save_restore_context(/*prev=*/curr_thread, next_thread, context);
 
@@ -213,12 +229,17 @@ void sched_next(const irq_number_t irq, struct thread_context *const context) {
     }
 
     sched_irq_eoi(irq);
-    sched_timer_oneshot(next_thread->sched_info.timeslice);
+    alarm_arm_timer(cpu, next_thread);
 
     thread_spinup(&next_thread->context);
     verify_not_reached();
 }
 
+__debug_optimize(3)
+uint64_t sched_get_switch_count(const struct cpu_info *const cpu) {
+    return cpu->sched_info.switch_count;
+}
+
 void sched_yield() {
     disable_interrupts();
     assert(preemption_enabled());
@@ -25,7 +25,9 @@ struct sched_thread_info {
 };
 
 struct sched_percpu_info {
-
+    // Idle cpus have no tick, so they're sent an ipi when a thread is queued.
+    _Atomic bool idle;
+    uint64_t switch_count;
 };
 
-#define SCHED_PERCPU_INFO_INIT() (struct sched_percpu_info){}
+#define SCHED_PERCPU_INFO_INIT(name) { .idle = true, .switch_count = 0 }
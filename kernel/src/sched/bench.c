@@ -0,0 +1,115 @@
+/*
+ * kernel/src/sched/bench.c
+ * © suhas pai
+ */
+
+#include <stdatomic.h>
+
+#include "dev/printk.h"
+#include "mm/kmalloc.h"
+#include "time/time.h"
+
+#include "bench.h"
+#include "scheduler.h"
+#include "sleep.h"
+
+static _Atomic bool g_storm_running = false;
+static _Atomic uint32_t g_storm_done_count = 0;
+
+__noreturn static void storm_thread() {
+    while (atomic_load_explicit(&g_storm_running, memory_order_relaxed)) {
+        sched_yield();
+    }
+
+    atomic_fetch_add_explicit(&g_storm_done_count, 1, memory_order_relaxed);
+
+    sched_dequeue_thread(current_thread());
+    sched_yield();
+
+    verify_not_reached();
+}
+
+static void
+read_switch_counts(uint64_t *const count_list, const uint32_t cpu_count) {
+    const struct cpu_info *cpu = NULL;
+    uint32_t index = 0;
+
+    list_foreach(cpu, cpus_get_list(), cpu_list) {
+        if (index == cpu_count) {
+            break;
+        }
+
+        count_list[index] = sched_get_switch_count(cpu);
+        index++;
+    }
+}
+
+void sched_bench_thread_storm() {
+    const uint32_t cpu_count =
+        (uint32_t)list_count(cpus_get_list(), struct cpu_info, cpu_list);
+
+    uint64_t *const begin_list = kmalloc(sizeof(uint64_t) * cpu_count);
+    uint64_t *const end_list = kmalloc(sizeof(uint64_t) * cpu_count);
+
+    if (begin_list == NULL || end_list == NULL) {
+        printk(LOGLEVEL_WARN, "sched: bench: failed to alloc count lists\n");
+
+        kfree(begin_list);
+        kfree(end_list);
+
+        return;
+    }
+
+    const uint32_t thread_count = cpu_count * SCHED_BENCH_THREADS_PER_CPU;
+
+    atomic_store_explicit(&g_storm_done_count, 0, memory_order_relaxed);
+    atomic_store_explicit(&g_storm_running, true, memory_order_relaxed);
+
+    uint32_t created_count = 0;
+    for (; created_count != thread_count; created_count++) {
+        if (sched_create_kernel_thread(storm_thread) == NULL) {
+            printk(LOGLEVEL_WARN, "sched: bench: failed to create thread\n");
+            break;
+        }
+    }
+
+    read_switch_counts(begin_list, cpu_count);
+    const nsec_t begin = nsec_since_boot();
+
+    sched_sleep_us(SCHED_BENCH_DURATION_US);
+
+    read_switch_counts(end_list, cpu_count);
+    const nsec_t elapsed = nsec_since_boot() - begin;
+
+    atomic_store_explicit(&g_storm_running, false, memory_order_relaxed);
+    printk(LOGLEVEL_INFO,
+           "sched: bench: %" PRIu32 " threads on %" PRIu32 " cpus for "
+           "%" PRIu64 "ns\n",
+           created_count,
+           cpu_count,
+           elapsed);
+
+    uint64_t total = 0;
+    for (uint32_t i = 0; i != cpu_count; i++) {
+        const uint64_t switches = end_list[i] - begin_list[i];
+        total += switches;
+
+        printk(LOGLEVEL_INFO,
+               "sched: bench: cpu %" PRIu32 ": %" PRIu64 " switches/sec\n",
+               i,
+               switches * NANO_IN_SECONDS / elapsed);
+    }
+
+    printk(LOGLEVEL_INFO,
+           "sched: bench: average of %" PRIu64 " switches/sec per cpu\n",
+           total * NANO_IN_SECONDS / elapsed / cpu_count);
+
+    while (atomic_load_explicit(&g_storm_done_count, memory_order_relaxed)
+            != created_count)
+    {
+        sched_yield();
+    }
+
+    kfree(begin_list);
+    kfree(end_list);
+}
@@ -0,0 +1,15 @@
+/*
+ * kernel/src/sched/bench.h
+ * © suhas pai
+ */
+
+#pragma once
+#include "lib/time.h"
+
+#define SCHED_BENCH_THREADS_PER_CPU 8
+#define SCHED_BENCH_DURATION_US seconds_to_micro(2)
+
+// Start a storm of threads that do nothing but yield, and report the context
+// switches per second done by every cpu.
+
+void sched_bench_thread_storm();
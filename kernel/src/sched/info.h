@@ -7,12 +7,18 @@
 
 #if defined(SCHED_BASIC)
     #include "basic/sched.h"
+#elif defined(SCHED_PERCPU)
+    #include "percpu/sched.h"
 #else
     #error "scheduler not set"
 #endif /* defined(SCHED_BASIC) */
 
 struct process;
 struct thread;
+struct cpu_info;
 
 void sched_process_algo_info_init(struct process *process);
 void sched_thread_algo_info_init(struct thread *thread);
+void sched_percpu_info_init(struct sched_percpu_info *info);
+
+uint64_t sched_get_switch_count(const struct cpu_info *cpu);
@@ -6,6 +6,7 @@
 #include "asm/irqs.h"
 #include "cpu/util.h"
 #include "mm/kmalloc.h"
+#include "mm/zero_pool.h"
 
 #include "irq.h"
 #include "scheduler.h"
@@ -31,12 +32,41 @@ void sched_init() {
     });
 }
 
+// Every cpu's idle-thread enters here whenever there's nothing else to run, as
+// its context is never saved. Background work is done a batch at a time,
+// yielding in between so a thread that became runnable isn't kept waiting.
+
+__noreturn static void idle_thread_entry() {
+    while (zero_pool_refill_on_idle()) {
+        sched_yield();
+    }
+
+    cpu_idle();
+}
+
 void sched_init_on_cpu(struct cpu_info *const cpu) {
     struct thread *const idle_thread = kmalloc(sizeof(struct thread));
     assert(idle_thread != NULL);
 
     with_interrupts_disabled({
-        sched_thread_init(idle_thread, &kernel_process, cpu, cpu_idle);
+        sched_thread_init(idle_thread,
+                          &kernel_process,
+                          cpu,
+                          idle_thread_entry);
         cpu->idle_thread = idle_thread;
     });
-}
\ No newline at end of file
+}
+
+struct thread *sched_create_kernel_thread(const void *const entry) {
+    struct thread *const thread = kmalloc(sizeof(struct thread));
+    if (thread == NULL) {
+        return NULL;
+    }
+
+    with_interrupts_disabled({
+        sched_thread_init(thread, &kernel_process, /*cpu=*/NULL, entry);
+    });
+
+    sched_enqueue_thread(thread);
+    return thread;
+}
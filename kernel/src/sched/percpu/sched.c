@@ -0,0 +1,527 @@
+/*
+ * kernel/src/sched/percpu/sched.c
+ * © suhas pai
+ */
+
+#include <stdatomic.h>
+
+#include "asm/irqs.h"
+#include "asm/pause.h"
+
+#include "mm/kmalloc.h"
+
+#include "sched/alarm.h"
+#include "sched/irq.h"
+#include "sched/scheduler.h"
+#include "sched/timer.h"
+
+// Every cpu has its own run-queue, so picking the next thread only takes the
+// cpu's own lock and takes the thread at the front of its queue.
+//
+// A cpu with an empty run-queue steals a thread from the busiest cpu instead
+// of going idle, preferring cpus that share its last-level cache. Threads are
+// woken up on the cpu they last ran on while it's not much busier than the
+// waking cpu, and threads created with a cpu are bound to that cpu.
+//
+// Lock order is a thread's lock, then a run-queue's lock.
+
+void sched_process_algo_info_init(struct process *const process) {
+    (void)process;
+}
+
+void sched_thread_algo_info_init(struct thread *const thread) {
+    thread->sched_info.lock = SPINLOCK_INIT();
+    list_init(&thread->sched_info.list);
+
+    thread->sched_info.queue_cpu = NULL;
+    thread->sched_info.timeslice = SCHED_PERCPU_DEF_TIMESLICE_US;
+    thread->sched_info.remaining = 0;
+
+    thread->sched_info.state = SCHED_THREAD_STATE_STOPPED;
+    thread->sched_info.awaiting = false;
+    thread->sched_info.runnable = false;
+    thread->sched_info.on_cpu = false;
+
+    // sched_thread_init() sets the thread's cpu before calling us.
+    thread->sched_info.bound = thread->cpu != NULL;
+}
+
+void sched_percpu_info_init(struct sched_percpu_info *const info) {
+    info->lock = SPINLOCK_INIT();
+    list_init(&info->run_queue);
+
+    info->queued_count = 0;
+    info->idle = false;
+    info->switched_out = NULL;
+
+    info->switch_count = 0;
+    info->steal_count = 0;
+}
+
+void sched_algo_init() {
+
+}
+
+__debug_optimize(3) void sched_algo_post_init() {
+    kernel_main_thread.sched_info.runnable = true;
+    kernel_main_thread.sched_info.on_cpu = true;
+    kernel_main_thread.sched_info.state = SCHED_THREAD_STATE_RUNNING;
+}
+
+__debug_optimize(3) static inline enum sched_thread_state
+thread_get_state(const struct thread *const thread) {
+    return atomic_load_explicit(&thread->sched_info.state,
+                                memory_order_relaxed);
+}
+
+__debug_optimize(3) static inline void
+thread_set_state(struct thread *const thread,
+                 const enum sched_thread_state state)
+{
+    atomic_store_explicit(&thread->sched_info.state,
+                          state,
+                          memory_order_relaxed);
+}
+
+__debug_optimize(3) bool thread_runnable(const struct thread *const thread) {
+    return atomic_load_explicit(&thread->sched_info.runnable,
+                                memory_order_relaxed);
+}
+
+__debug_optimize(3) bool thread_enqueued(const struct thread *const thread) {
+    return thread_get_state(thread) == SCHED_THREAD_STATE_QUEUED;
+}
+
+__debug_optimize(3) bool thread_running(const struct thread *const thread) {
+    return thread_get_state(thread) == SCHED_THREAD_STATE_RUNNING;
+}
+
+__debug_optimize(3)
+static inline bool thread_on_cpu(const struct thread *const thread) {
+    return atomic_load_explicit(&thread->sched_info.on_cpu,
+                                memory_order_acquire);
+}
+
+// Caller must hold the thread's lock.
+
+__debug_optimize(3) static void
+add_to_run_queue(struct cpu_info *const cpu, struct thread *const thread) {
+    struct sched_percpu_info *const info = &cpu->sched_info;
+    spin_acquire(&info->lock);
+
+    list_radd(&info->run_queue, &thread->sched_info.list);
+    atomic_fetch_add_explicit(&info->queued_count, 1, memory_order_relaxed);
+
+    thread->sched_info.queue_cpu = cpu;
+    thread_set_state(thread, SCHED_THREAD_STATE_QUEUED);
+
+    spin_release(&info->lock);
+}
+
+// Caller must hold the run-queue's lock.
+
+__debug_optimize(3) static void
+remove_from_run_queue(struct sched_percpu_info *const info,
+                      struct thread *const thread,
+                      const enum sched_thread_state state)
+{
+    list_remove(&thread->sched_info.list);
+    atomic_fetch_sub_explicit(&info->queued_count, 1, memory_order_relaxed);
+
+    thread_set_state(thread, state);
+}
+
+__debug_optimize(3) static inline uint32_t
+queued_count(const struct cpu_info *const cpu) {
+    return atomic_load_explicit(&cpu->sched_info.queued_count,
+                                memory_order_relaxed);
+}
+
+__debug_optimize(3)
+static inline bool cpu_is_idle(const struct cpu_info *const cpu) {
+    return atomic_load_explicit(&cpu->sched_info.idle, memory_order_relaxed);
+}
+
+// Idle cpus have no tick, so count them to quickly know if there are any to
+// hand work to.
+
+static _Atomic uint32_t g_idle_cpu_count = 0;
+
+__debug_optimize(3)
+static void set_cpu_idle(struct cpu_info *const cpu, const bool idle) {
+    if (cpu_is_idle(cpu) == idle) {
+        return;
+    }
+
+    atomic_store_explicit(&cpu->sched_info.idle, idle, memory_order_relaxed);
+    if (idle) {
+        atomic_fetch_add_explicit(&g_idle_cpu_count, 1, memory_order_relaxed);
+    } else {
+        atomic_fetch_sub_explicit(&g_idle_cpu_count, 1, memory_order_relaxed);
+    }
+}
+
+// Find an idle cpu other than `self`, preferring one that shares its
+// last-level cache with `near`, where a thread moved over may still find its
+// data cached.
+
+static struct cpu_info *
+find_idle_cpu(const struct cpu_info *const self,
+              const struct cpu_info *const near)
+{
+    if (atomic_load_explicit(&g_idle_cpu_count, memory_order_relaxed) == 0) {
+        return NULL;
+    }
+
+    struct cpu_info *result = NULL;
+    struct cpu_info *cpu = NULL;
+
+    list_foreach(cpu, cpus_get_list(), cpu_list) {
+        if (cpu == self || !cpu_is_idle(cpu)) {
+            continue;
+        }
+
+        if (cpu_shares_topology_level(cpu, near, CPU_TOPOLOGY_LEVEL_LLC)) {
+            return cpu;
+        }
+
+        if (result == NULL) {
+            result = cpu;
+        }
+    }
+
+    return result;
+}
+
+static struct cpu_info *
+queue_cpu_for_thread(const struct thread *const thread) {
+    struct cpu_info *const last_cpu = thread->cpu;
+    if (thread->sched_info.bound) {
+        return last_cpu;
+    }
+
+    // The cpu the thread last ran on may still be on the thread's stack.
+    if (thread_on_cpu(thread)) {
+        return last_cpu;
+    }
+
+    struct cpu_info *const cpu = this_cpu_mut();
+
+    // Prefer the cpu the thread last ran on while its caches may still be
+    // warm, unless it's noticeably busier than our cpu.
+
+    struct cpu_info *result = last_cpu;
+    if (last_cpu == NULL || queued_count(last_cpu) > queued_count(cpu) + 1) {
+        result = cpu;
+    }
+
+    // Rather than wait behind another thread, run on an idle cpu.
+    if (!cpu_is_idle(result)) {
+        struct cpu_info *const idle_cpu =
+            find_idle_cpu(/*self=*/NULL, /*near=*/result);
+
+        if (idle_cpu != NULL) {
+            return idle_cpu;
+        }
+    }
+
+    return result;
+}
+
+__debug_optimize(3) void sched_enqueue_thread(struct thread *const thread) {
+    struct cpu_info *wakeup_cpu = NULL;
+
+    const int flag = spin_acquire_save_irq(&thread->sched_info.lock);
+    atomic_store_explicit(&thread->sched_info.runnable,
+                          true,
+                          memory_order_relaxed);
+
+    // sched_enqueue_thread() might be called from a dequeued but running
+    // thread, which will be added back to a run-queue by its cpu once it's
+    // switched away from.
+
+    if (thread_get_state(thread) == SCHED_THREAD_STATE_STOPPED) {
+        struct cpu_info *const cpu = queue_cpu_for_thread(thread);
+        add_to_run_queue(cpu, thread);
+
+        if (cpu_is_idle(cpu)) {
+            wakeup_cpu = cpu;
+        }
+    }
+
+    spin_release_restore_irq(&thread->sched_info.lock, flag);
+
+    // Don't have an idle cpu wait until its next tick to run the thread. An
+    // idle cpu may not have a next tick at all, as its timer is stopped when
+    // it has no alarms, so this includes our own cpu, for example when a
+    // thread is enqueued from an irq handler.
+    if (wakeup_cpu != NULL) {
+        sched_send_ipi(wakeup_cpu);
+    }
+}
+
+__debug_optimize(3) void sched_dequeue_thread(struct thread *const thread) {
+    const int flag = spin_acquire_save_irq(&thread->sched_info.lock);
+    atomic_store_explicit(&thread->sched_info.runnable,
+                          false,
+                          memory_order_relaxed);
+
+    // A running thread is marked stopped by its cpu once it's switched away
+    // from.
+
+    if (thread_get_state(thread) == SCHED_THREAD_STATE_QUEUED) {
+        struct sched_percpu_info *const info =
+            &thread->sched_info.queue_cpu->sched_info;
+
+        spin_acquire(&info->lock);
+
+        // The thread may have been taken off of the run-queue by its cpu
+        // before we acquired the lock.
+
+        if (thread_get_state(thread) == SCHED_THREAD_STATE_QUEUED) {
+            remove_from_run_queue(info, thread, SCHED_THREAD_STATE_STOPPED);
+        }
+
+        spin_release(&info->lock);
+    }
+
+    spin_release_restore_irq(&thread->sched_info.lock, flag);
+}
+
+__debug_optimize(3)
+static struct thread *take_from_run_queue(struct cpu_info *const cpu) {
+    struct sched_percpu_info *const info = &cpu->sched_info;
+    if (queued_count(cpu) == 0) {
+        return NULL;
+    }
+
+    spin_acquire(&info->lock);
+    if (list_empty(&info->run_queue)) {
+        spin_release(&info->lock);
+        return NULL;
+    }
+
+    struct thread *const thread =
+        list_head(&info->run_queue, struct thread, sched_info.list);
+
+    remove_from_run_queue(info, thread, SCHED_THREAD_STATE_RUNNING);
+    spin_release(&info->lock);
+
+    return thread;
+}
+
+static struct thread *steal_thread(struct cpu_info *const cpu) {
+    struct cpu_info *victim = NULL;
+    uint32_t victim_count = 0;
+
+    struct cpu_info *llc_victim = NULL;
+    uint32_t llc_victim_count = 0;
+
+    struct cpu_info *iter = NULL;
+    list_foreach(iter, cpus_get_list(), cpu_list) {
+        if (iter == cpu) {
+            continue;
+        }
+
+        const uint32_t count = queued_count(iter);
+        if (count > victim_count) {
+            victim = iter;
+            victim_count = count;
+        }
+
+        if (count > llc_victim_count
+         && cpu_shares_topology_level(cpu, iter, CPU_TOPOLOGY_LEVEL_LLC))
+        {
+            llc_victim = iter;
+            llc_victim_count = count;
+        }
+    }
+
+    // A thread stolen from a cpu sharing our last-level cache keeps its data
+    // cached, so only steal from further away when those cpus have nothing
+    // queued.
+
+    if (llc_victim != NULL) {
+        victim = llc_victim;
+    }
+
+    if (victim == NULL) {
+        return NULL;
+    }
+
+    struct sched_percpu_info *const info = &victim->sched_info;
+    if (!spin_try_acquire(&info->lock)) {
+        return NULL;
+    }
+
+    // Steal from the back of the queue, as those threads would be the last to
+    // run on the victim cpu anyways.
+
+    struct thread *thread = NULL;
+    uint32_t scanned = 0;
+
+    list_foreach_reverse(thread, &info->run_queue, sched_info.list) {
+        if (!thread->sched_info.bound && !thread_on_cpu(thread)) {
+            remove_from_run_queue(info, thread, SCHED_THREAD_STATE_RUNNING);
+            spin_release(&info->lock);
+
+            cpu->sched_info.steal_count++;
+            return thread;
+        }
+
+        scanned++;
+        if (scanned == SCHED_PERCPU_STEAL_SCAN_MAX) {
+            break;
+        }
+    }
+
+    spin_release(&info->lock);
+    return NULL;
+}
+
+__debug_optimize(3) static struct thread *
+get_next_thread(struct thread *const prev, struct cpu_info *const cpu) {
+    struct thread *next = take_from_run_queue(cpu);
+    if (next != NULL) {
+        return next;
+    }
+
+    if (prev != cpu->idle_thread && thread_runnable(prev)) {
+        return prev;
+    }
+
+    next = steal_thread(cpu);
+    if (next != NULL) {
+        return next;
+    }
+
+    return cpu->idle_thread;
+}
+
+// Called once the context of prev has been saved.
+
+__debug_optimize(3) static void
+put_prev_thread(struct thread *const prev, struct cpu_info *const cpu) {
+    if (prev == cpu->idle_thread) {
+        return;
+    }
+
+    spin_acquire(&prev->sched_info.lock);
+    if (thread_runnable(prev)) {
+        add_to_run_queue(cpu, prev);
+    } else {
+        thread_set_state(prev, SCHED_THREAD_STATE_STOPPED);
+    }
+
+    spin_release(&prev->sched_info.lock);
+    cpu->sched_info.switched_out = prev;
+}
+
+// We're no longer running on the stack of the thread we last switched away
+// from, so let other cpus run it. Any idle cpu is then sent an ipi to steal
+// from our run-queue if we have threads waiting.
+
+__debug_optimize(3)
+static inline void finish_switch(struct cpu_info *const cpu) {
+    struct thread *const prev = cpu->sched_info.switched_out;
+    if (prev != NULL) {
+        atomic_store_explicit(&prev->sched_info.on_cpu,
+                              false,
+                              memory_order_release);
+
+        cpu->sched_info.switched_out = NULL;
+    }
+
+    if (queued_count(cpu) != 0) {
+        struct cpu_info *const idle_cpu = find_idle_cpu(cpu, /*near=*/cpu);
+        if (idle_cpu != NULL) {
+            sched_send_ipi(idle_cpu);
+        }
+    }
+}
+
+void sched_set_current_thread(struct thread *thread);
+extern __noreturn void thread_spinup(const struct thread_context *context);
+
+void sched_next(const irq_number_t irq, struct thread_context *const context) {
+    kmalloc_check_slabs();
+
+    struct thread *const curr_thread = current_thread();
+    thread_context_verify(curr_thread->process, context);
+
+    struct cpu_info *const cpu = curr_thread->cpu;
+
+    finish_switch(cpu);
+    alarm_expire();
+
+    if (curr_thread->preemption_disabled > 0) {
+        sched_irq_eoi(irq);
+        alarm_arm_timer(cpu, curr_thread);
+
+        return;
+    }
+
+    curr_thread->sched_info.awaiting = false;
+    curr_thread->sched_info.remaining = 0;
+
+    struct thread *const next_thread = get_next_thread(curr_thread, cpu);
+    set_cpu_idle(cpu, next_thread == cpu->idle_thread);
+
+    // Only possible if we were idle and will still be idle, or if our current
+    // thread is still runnable and no other thread is.
+
+    if (curr_thread == next_thread) {
+        sched_irq_eoi(irq);
+        alarm_arm_timer(cpu, curr_thread);
+
+        return;
+    }
+
+    next_thread->cpu = cpu;
+    atomic_store_explicit(&next_thread->sched_info.on_cpu,
+                          true,
+                          memory_order_relaxed);
+
+    cpu->sched_info.switch_count++;
+
+    sched_set_current_thread(next_thread);
+    sched_save_restore_context(/*prev=*/curr_thread, next_thread, context);
+
+    put_prev_thread(curr_thread, cpu);
+    if (curr_thread->process != next_thread->process) {
+        switch_to_pagemap(&next_thread->process->pagemap);
+    }
+
+    sched_irq_eoi(irq);
+    alarm_arm_timer(cpu, next_thread);
+
+    thread_spinup(&next_thread->context);
+    verify_not_reached();
+}
+
+__debug_optimize(3)
+uint64_t sched_get_switch_count(const struct cpu_info *const cpu) {
+    return cpu->sched_info.switch_count;
+}
+
+void sched_yield() {
+    disable_interrupts();
+    assert(preemption_enabled());
+
+    struct thread *const curr_thread = current_thread();
+    atomic_store_explicit(&curr_thread->sched_info.awaiting,
+                          true,
+                          memory_order_relaxed);
+
+    curr_thread->sched_info.remaining = sched_timer_remaining();
+
+    sched_timer_stop();
+    sched_send_ipi(this_cpu());
+
+    enable_interrupts();
+    do {
+        cpu_pause();
+    } while (
+        atomic_load_explicit(&curr_thread->sched_info.awaiting,
+                             memory_order_relaxed));
+}
@@ -0,0 +1,83 @@
+/*
+ * kernel/src/sched/percpu/sched.h
+ * © suhas pai
+ */
+
+#pragma once
+
+#include "cpu/spinlock.h"
+#include "lib/list.h"
+#include "lib/time.h"
+
+#define SCHED_PERCPU_DEF_TIMESLICE_US (usec_t)5000
+
+// Maximum amount of threads looked at from the back of a run-queue when
+// looking for a thread that isn't bound to its cpu.
+
+#define SCHED_PERCPU_STEAL_SCAN_MAX 4
+
+struct sched_process_info {
+
+};
+
+enum sched_thread_state {
+    SCHED_THREAD_STATE_STOPPED,
+    SCHED_THREAD_STATE_QUEUED,
+    SCHED_THREAD_STATE_RUNNING,
+};
+
+struct sched_thread_info {
+    // Protects the thread's state and which run-queue it's in. Taken before
+    // any run-queue's lock.
+
+    struct spinlock lock;
+    struct list list;
+
+    // The cpu whose run-queue the thread is in, if queued.
+    struct cpu_info *queue_cpu;
+
+    usec_t timeslice : 32;
+    usec_t remaining : 32;
+
+    _Atomic uint8_t state;
+
+    _Atomic bool awaiting;
+    _Atomic bool runnable;
+
+    // Set from when a thread is switched to until its cpu next enters the
+    // scheduler, as the cpu may still be running on the thread's stack after
+    // switching away from it. Other cpus won't run the thread until it's
+    // cleared.
+
+    _Atomic bool on_cpu;
+
+    // Threads created with a cpu (see sched_thread_init()) only ever run on
+    // that cpu, and are never stolen.
+
+    bool bound : 1;
+};
+
+struct sched_percpu_info {
+    struct spinlock lock;
+    struct list run_queue;
+
+    _Atomic uint32_t queued_count;
+    _Atomic bool idle;
+
+    // Thread this cpu last switched away from, whose on_cpu is to be cleared.
+    struct thread *switched_out;
+
+    uint64_t switch_count;
+    uint64_t steal_count;
+};
+
+#define SCHED_PERCPU_INFO_INIT(name) \
+    { \
+        .lock = SPINLOCK_INIT(), \
+        .run_queue = LIST_INIT(name.run_queue), \
+        .queued_count = 0, \
+        .idle = false, \
+        .switched_out = NULL, \
+        .switch_count = 0, \
+        .steal_count = 0, \
+    }
@@ -16,6 +16,9 @@ __hidden struct process kernel_process = {
 
         .cpu_list = LIST_INIT(kernel_process.pagemap.cpu_list),
         .cpu_lock = SPINLOCK_INIT(),
+        .tlb_gen = 0,
+        .anon_page_count = 0,
+        .anon_large_page_count = 0,
         .addrspace = ADDRSPACE_INIT(kernel_process.pagemap.addrspace),
         .addrspace_lock = SPINLOCK_INIT(),
         .refcount = REFCOUNT_CREATE_MAX(),
@@ -11,6 +11,11 @@
 void sched_init();
 void sched_init_on_cpu(struct cpu_info *cpu);
 
+// Create a thread in the kernel process that starts running at `entry`. The
+// entry function must never return.
+
+struct thread *sched_create_kernel_thread(const void *entry);
+
 void sched_algo_init();
 void sched_algo_post_init();
 
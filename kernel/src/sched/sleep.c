@@ -3,12 +3,13 @@
  * © suhas pai
  */
 
-#include "mm/kmalloc.h"
 #include "sched/alarm.h"
 
 #include "sleep.h"
 
 __debug_optimize(3) void sched_sleep_us(const usec_t usecs) {
-    struct alarm *const alarm = alarm_create(usecs);
-    alarm_post(alarm, /*await=*/true);
+    struct alarm alarm;
+    alarm_init(&alarm, usecs);
+
+    alarm_post(&alarm, /*await=*/true);
 }
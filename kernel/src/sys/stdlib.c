@@ -6,8 +6,11 @@
 #include <stdbool.h>
 #include <stdint.h>
 
-#if defined(__riscv64)
+#if defined(__riscv64) || defined(__x86_64__)
     #include "cpu/info.h"
+#endif /* defined(__riscv64) || defined(__x86_64__) */
+
+#if defined(__riscv64)
     #include "lib/align.h"
     #include "sched/thread.h"
 #endif /* defined(__riscv64) */
@@ -301,12 +304,19 @@ __debug_optimize(3) int memcmp(const void *left, const void *right, size_t len)
 
 #if defined(__x86_64__)
     #define REP_MOVSB_MIN 16
+
+// With fast-short-rep-movsb, a forward rep movsb is the fastest way to copy at
+// any size, so the threshold is patched out at boot.
+
+__debug_optimize(3) static inline bool use_rep_movsb(const unsigned long n) {
+    return static_key_enabled(&g_cpu_fsrm_key) || n >= REP_MOVSB_MIN;
+}
 #endif /* defined(__x86_64__) */
 
 __debug_optimize(3) void *memcpy(void *dst, const void *src, unsigned long n) {
     void *ret = dst;
 #if defined(__x86_64__)
-    if (n >= REP_MOVSB_MIN) {
+    if (use_rep_movsb(n)) {
         asm volatile ("rep movsb"
                       : "+D"(dst), "+S"(src), "+c"(n)
                       :: "memory");
@@ -421,7 +431,7 @@ __debug_optimize(3) void *memmove(void *dst, const void *src, unsigned long n) {
     void *ret = dst;
     if (src > dst) {
     #if defined(__x86_64__)
-        if (n >= REP_MOVSB_MIN) {
+        if (use_rep_movsb(n)) {
             asm volatile ("cld\n"
                           "rep movsb\n"
                           : "+D"(dst), "+S"(src), "+c"(n)
@@ -5,11 +5,23 @@
 
 #include "cpu/spinlock.h"
 
-#include "lib/math.h"
 #include "lib/overflow.h"
 
 #include "clock.h"
 
+// Factor between two resolutions, indexed by the difference between them.
+static const uint64_t g_res_factor_list[] = {
+    1,
+    1000,
+    1000000,
+    1000000000,
+    1000000000000,
+    1000000000000000,
+};
+
+_Static_assert(countof(g_res_factor_list) == CLOCK_RES_FEMTO + 1,
+               "clock: g_res_factor_list is missing resolutions");
+
 static struct list g_clock_list = LIST_INIT(g_clock_list);
 static struct spinlock g_lock = SPINLOCK_INIT();
 
@@ -31,13 +43,13 @@ clock_read_res(const struct clock *const clock,
 
     if (resolution > clock->resolution) {
         const uint64_t diff = resolution - clock->resolution;
-        *result_out = clock->read(clock) / math_pow_assert(1000, diff);
+        *result_out = clock->read(clock) / g_res_factor_list[diff];
 
         return true;
     }
 
     const uint64_t diff = clock->resolution - resolution;
     return check_mul(clock->read(clock),
-                     math_pow_assert(1000, diff),
+                     g_res_factor_list[diff],
                      result_out);
 }
\ No newline at end of file
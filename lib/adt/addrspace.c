@@ -331,6 +331,28 @@ void addrspace_remove_node(struct addrspace_node *const node) {
     list_deinit(&node->list);
 }
 
+__debug_optimize(3) struct addrspace_node *
+addrspace_find_node_for_loc(const struct address_space *const addrspace,
+                            const uint64_t loc)
+{
+    struct avlnode *avlnode = addrspace->avltree.root;
+    while (avlnode != NULL) {
+        struct addrspace_node *const node = addrspace_node_of(avlnode);
+        if (loc < node->range.front) {
+            avlnode = avlnode->left;
+            continue;
+        }
+
+        if (range_has_loc(node->range, loc)) {
+            return node;
+        }
+
+        avlnode = avlnode->right;
+    }
+
+    return NULL;
+}
+
 #if defined(BUILD_KERNEL)
 __debug_optimize(3)
 void avlnode_print_node_cb(struct avlnode *const avlnode, void *const cb_info) {
@@ -65,4 +65,12 @@ addrspace_add_node(struct address_space *addrspace,
                    struct addrspace_node *node);
 
 void addrspace_remove_node(struct addrspace_node *node);
+
+// Returns the node whose range contains `loc`, or NULL if `loc` isn't in any
+// node.
+
+struct addrspace_node *
+addrspace_find_node_for_loc(const struct address_space *addrspace,
+                            uint64_t loc);
+
 void addrspace_print(struct address_space *addrspace);
@@ -48,7 +48,9 @@
                 continue; \
             } \
             \
-            h_var(result) = (uint64_t)((h_var(index) + 1) * h_var(bit_index)); \
+            h_var(result) = \
+                (uint64_t)h_var(index) * sizeof_bits(uint64_t) \
+              + h_var(bit_index); \
             if (h_var(result) == BITSET_INVALID) { \
                 break; \
             } \
@@ -87,7 +89,9 @@
                 continue; \
             } \
             \
-            h_var(result) = (uint64_t)((h_var(index) + 1) * h_var(bit_index)); \
+            h_var(result) = \
+                (uint64_t)h_var(index) * sizeof_bits(uint64_t) \
+              + h_var(bit_index); \
             if (h_var(result) == BITSET_INVALID) { \
                 break; \
             } \
@@ -0,0 +1,21 @@
+/*
+ * tests/bitset.c
+ * © suhas pai
+ */
+
+#include "lib/adt/bitset.h"
+#include "lib/assert.h"
+
+void test_bitset() {
+    bitset_decl(bitset, 256);
+    for (uint64_t i = 0; i != 256; i++) {
+        assert(bitset_find_unset(bitset, 256, /*invert=*/true) == i);
+        assert(bitset_has(bitset, i));
+    }
+
+    assert(bitset_find_unset(bitset, 256, /*invert=*/true) == BITSET_INVALID);
+
+    bitset_unset(bitset, 130);
+    assert(bitset_find_unset(bitset, 256, /*invert=*/false) == 130);
+    assert(!bitset_has(bitset, 130));
+}
@@ -8,6 +8,7 @@ extern void test_format();
 extern void test_time();
 extern void test_avltree();
 extern void test_bitmap();
+extern void test_bitset();
 extern void test_hashmap();
 
 int main() {
@@ -16,6 +17,7 @@ int main() {
     test_time();
     test_avltree();
     test_bitmap();
+    test_bitset();
     test_hashmap();
 
     return 0;